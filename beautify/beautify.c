@@ -18,13 +18,21 @@
  *   ./beautify --json data.json
  *   ./beautify --html page.html
  *   ./beautify --extract-field explanation response.json
+ *   ./beautify --extract-field site.notice --extract-field 'projects[0].title' data.json
  *   ./beautify --css styles.css
  *
+ * JSON, HTML and CSS are formatted as a stream: input is read in
+ * STREAM_CHUNK pieces and each formatter keeps its state between them,
+ * so memory stays constant for any input size and output for piped
+ * input (such as a streaming AI response) appears as it arrives.
+ *
  * Flags:
  *   --json              Format as indented JSON
  *   --html              Format HTML with indentation
  *   --css               Format CSS with indentation
- *   --extract-field KEY Extract a top-level string field from JSON
+ *   --extract-field PATH
+ *                       Print the JSON value at PATH (key, a.b, list[0].c);
+ *                       may be repeated, one value per line
  *   --indent N          Set indent width (default: 2)
  *   --compact           Minify instead of beautify
  *   --help              Show usage
@@ -34,8 +42,123 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../lib/json.h"
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <windows.h>
+  #define read_fd(fd, buf, n) _read(fd, buf, (unsigned)(n))
+  #define file_no(f) _fileno(f)
+  static double now_seconds(void) {
+      LARGE_INTEGER freq, t;
+      QueryPerformanceFrequency(&freq);
+      QueryPerformanceCounter(&t);
+      return (double)t.QuadPart / (double)freq.QuadPart;
+  }
+#else
+  #include <unistd.h>
+  #include <time.h>
+  #define read_fd(fd, buf, n) read(fd, buf, n)
+  #define file_no(f) fileno(f)
+  static double now_seconds(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+  }
+#endif
+
+/* Bytes read per step in streaming mode */
+#ifndef STREAM_CHUNK
+  #define STREAM_CHUNK 65536
+#endif
+
 static int indent_width = 2;
 
+/* ---- Buffered Output ---- */
+
+/*
+ * Formatters append to one large buffer instead of calling putchar per
+ * byte. It is written out when full and after every input chunk, so
+ * streaming output still appears as input arrives. In --bench mode the
+ * bytes are counted and dropped.
+ */
+
+#define OUT_BUF_SIZE (256 * 1024)
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len = 0;
+static int out_discard = 0;
+static long long out_total = 0;
+
+static void out_drain(void) {
+    if (out_len && !out_discard) fwrite(out_buf, 1, out_len, stdout);
+    out_total += (long long)out_len;
+    out_len = 0;
+}
+
+static void out_flush(void) {
+    out_drain();
+    if (!out_discard) fflush(stdout);
+}
+
+static void out_char(char c) {
+    if (out_len == OUT_BUF_SIZE) out_drain();
+    out_buf[out_len++] = c;
+}
+
+static void out_write(const char *p, size_t n) {
+    if (n > OUT_BUF_SIZE - out_len) {
+        out_drain();
+        if (n >= OUT_BUF_SIZE) {
+            if (!out_discard) fwrite(p, 1, n, stdout);
+            out_total += (long long)n;
+            return;
+        }
+    }
+    memcpy(out_buf + out_len, p, n);
+    out_len += n;
+}
+
+/* ---- Vectorized Scanning ---- */
+
+/*
+ * String bodies (long base64 values especially) are copied in bulk up to
+ * the next quote or backslash with json_scan2() from lib/json.h, which
+ * compares 16 bytes at a time with SSE2 or NEON. HTML text needs four
+ * stop bytes, so it has its own scanner built on the same detection
+ * macros.
+ */
+
+/* Find the first of four bytes (HTML text: < > and line breaks), or n */
+static long scan_for4(const char *p, long n, char a, char b, char c, char d) {
+    long i = 0;
+#if defined(JSON_SIMD_SSE2)
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    __m128i vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return i + json_ctz32((unsigned)mask);
+    }
+#elif defined(JSON_SIMD_NEON)
+    uint8x16_t va = vdupq_n_u8((uint8_t)a), vb = vdupq_n_u8((uint8_t)b);
+    uint8x16_t vc = vdupq_n_u8((uint8_t)c), vd = vdupq_n_u8((uint8_t)d);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(p + i));
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb)),
+                                vorrq_u8(vceqq_u8(v, vc), vceqq_u8(v, vd)));
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (bits) return i + (json_ctz64(bits) >> 2);
+    }
+#endif
+    for (; i < n; i++) {
+        if (p[i] == a || p[i] == b || p[i] == c || p[i] == d) return i;
+    }
+    return n;
+}
+
 /* ---- Read all input into a buffer ---- */
 
 static char *read_all(FILE *f, long *out_len) {
@@ -59,6 +182,28 @@ static char *read_all(FILE *f, long *out_len) {
     return buf;
 }
 
+/*
+ * Feed the input to a formatter one chunk at a time. read() returns as soon
+ * as anything is available, so text piped in from a slow producer is
+ * formatted and flushed as it comes instead of after EOF.
+ */
+typedef void (*feed_fn)(void *state, const char *src, long len);
+
+static int stream_input(FILE *f, feed_fn feed, void *state) {
+    char *buf = (char *)malloc(STREAM_CHUNK);
+    if (!buf) return -1;
+    int fd = file_no(f);
+    for (;;) {
+        long n = (long)read_fd(fd, buf, STREAM_CHUNK);
+        if (n < 0) { free(buf); return -1; }
+        if (n == 0) break;
+        feed(state, buf, n);
+        out_flush();
+    }
+    free(buf);
+    return 0;
+}
+
 static FILE *open_input(const char *path) {
     if (!path || strcmp(path, "-") == 0) {
         return stdin;
@@ -74,275 +219,599 @@ static FILE *open_input(const char *path) {
 /* ---- JSON Beautifier ---- */
 
 static void print_indent(int depth) {
-    for (int i = 0; i < depth * indent_width; i++) {
-        putchar(' ');
+    static const char spaces[64] =
+        "                                                                ";
+    long n = (long)depth * indent_width;
+    while (n > 0) {
+        long k = n < (long)sizeof(spaces) ? n : (long)sizeof(spaces);
+        out_write(spaces, (size_t)k);
+        n -= k;
     }
 }
 
-static void beautify_json(const char *src, long len) {
-    int depth = 0;
-    int in_string = 0;
-    int escaped = 0;
+typedef struct {
+    int depth;
+    int in_string;
+    int escaped;
+    char open;      /* '{' or '[' just printed, waiting to see if it is empty */
+} json_state;
 
-    for (long i = 0; i < len; i++) {
-        char c = src[i];
+/* The bracket in s->open turned out to have contents: open a new level */
+static void json_open_level(json_state *s) {
+    s->open = 0;
+    s->depth++;
+    out_char('\n');
+    print_indent(s->depth);
+}
 
-        if (escaped) {
-            putchar(c);
-            escaped = 0;
-            continue;
+static void beautify_json_feed(void *state, const char *src, long len) {
+    json_state *s = (json_state *)state;
+
+    for (long i = 0; i < len; i++) {
+        if (s->in_string && !s->escaped) {
+            long run = json_scan2(src + i, len - i, '"', '\\');
+            out_write(src + i, (size_t)run);
+            i += run;
+            if (i == len) break;
         }
+        char c = src[i];
 
-        if (c == '\\' && in_string) {
-            putchar(c);
-            escaped = 1;
+        if (s->escaped) {
+            out_char(c);
+            s->escaped = 0;
             continue;
         }
 
-        if (c == '"') {
-            putchar(c);
-            in_string = !in_string;
+        if (c == '\\' && s->in_string) {
+            out_char(c);
+            s->escaped = 1;
             continue;
         }
 
-        if (in_string) {
-            putchar(c);
+        if (s->in_string) {
+            out_char(c);
+            if (c == '"') s->in_string = 0;
             continue;
         }
 
         /* Skip whitespace outside strings */
-        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        if (json_is_space(c)) {
             continue;
         }
 
-        if (c == '{' || c == '[') {
-            putchar(c);
-            /* Check if empty */
-            long j = i + 1;
-            while (j < len && (src[j] == ' ' || src[j] == '\t' ||
-                   src[j] == '\n' || src[j] == '\r')) j++;
-            if (j < len && ((c == '{' && src[j] == '}') ||
-                            (c == '[' && src[j] == ']'))) {
-                putchar(c == '{' ? '}' : ']');
-                i = j;
+        /* Empty {} or [] stays on one line */
+        if (s->open) {
+            if ((s->open == '{' && c == '}') || (s->open == '[' && c == ']')) {
+                out_char(c);
+                s->open = 0;
                 continue;
             }
-            depth++;
-            putchar('\n');
-            print_indent(depth);
+            json_open_level(s);
+        }
+
+        if (c == '"') {
+            out_char(c);
+            s->in_string = 1;
+        } else if (c == '{' || c == '[') {
+            out_char(c);
+            s->open = c;
         } else if (c == '}' || c == ']') {
-            depth--;
-            putchar('\n');
-            print_indent(depth);
-            putchar(c);
+            s->depth--;
+            out_char('\n');
+            print_indent(s->depth);
+            out_char(c);
         } else if (c == ',') {
-            putchar(',');
-            putchar('\n');
-            print_indent(depth);
+            out_char(',');
+            out_char('\n');
+            print_indent(s->depth);
         } else if (c == ':') {
-            putchar(':');
-            putchar(' ');
+            out_char(':');
+            out_char(' ');
         } else {
-            putchar(c);
+            out_char(c);
         }
     }
-    putchar('\n');
 }
 
-static void compact_json(const char *src, long len) {
-    int in_string = 0;
-    int escaped = 0;
+static void beautify_json_end(json_state *s) {
+    if (s->open) json_open_level(s);
+    out_char('\n');
+}
+
+static void compact_json_feed(void *state, const char *src, long len) {
+    json_state *s = (json_state *)state;
 
     for (long i = 0; i < len; i++) {
+        if (s->in_string && !s->escaped) {
+            long run = json_scan2(src + i, len - i, '"', '\\');
+            out_write(src + i, (size_t)run);
+            i += run;
+            if (i == len) break;
+        }
         char c = src[i];
 
-        if (escaped) {
-            putchar(c);
-            escaped = 0;
+        if (s->escaped) {
+            out_char(c);
+            s->escaped = 0;
             continue;
         }
 
-        if (c == '\\' && in_string) {
-            putchar(c);
-            escaped = 1;
+        if (c == '\\' && s->in_string) {
+            out_char(c);
+            s->escaped = 1;
             continue;
         }
 
         if (c == '"') {
-            putchar(c);
-            in_string = !in_string;
+            out_char(c);
+            s->in_string = !s->in_string;
             continue;
         }
 
-        if (in_string) {
-            putchar(c);
+        if (s->in_string) {
+            out_char(c);
             continue;
         }
 
-        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
-            putchar(c);
+        if (!json_is_space(c)) {
+            out_char(c);
         }
     }
-    putchar('\n');
 }
 
-/* ---- Extract a top-level string field from JSON ---- */
+/* ---- JSON Path Queries ---- */
+
+/*
+ * --extract-field takes a path such as "explanation", "site.notice" or
+ * "projects[2].title" and may be given several times. The input is parsed
+ * once, front to back, while it is being read: subtrees that no path
+ * descends into are skipped without being examined, and reading stops as
+ * soon as every path has been matched. A key that appears more than once
+ * matches the first time. Values are printed one per line in the order
+ * the paths were given; strings are unescaped, anything else is printed
+ * as it appears in the input.
+ */
+
+#define QUERY_MAX 64
+#define PATH_MAX_SEGS 32
 
-static void extract_field(const char *src, long len, const char *field) {
-    /* Simple extraction: find "field": "value" */
-    char needle[512];
-    int nlen = snprintf(needle, sizeof(needle), "\"%s\"", field);
-    (void)nlen;
+typedef struct {
+    const char *key;    /* NULL for an array index */
+    long key_len;
+    long index;
+} path_seg;
 
-    const char *pos = strstr(src, needle);
-    if (!pos) {
-        fprintf(stderr, "Field '%s' not found.\n", field);
-        exit(1);
+typedef struct {
+    const char *text;
+    path_seg seg[PATH_MAX_SEGS];
+    int nseg;
+    int found;
+    long start, end;    /* value span in the reader buffer */
+} json_query;
+
+typedef struct {
+    int fd;
+    char *buf;
+    long len, cap, pos;
+    int eof;
+    json_query *q;
+    int nq;
+    int remaining;
+} json_reader;
+
+/* Split "a.b[3].c" into segments; keys point into text */
+static int parse_path(const char *text, json_query *q) {
+    const char *p = text;
+    q->text = text;
+    q->nseg = 0;
+    q->found = 0;
+    if (!*p) return -1;
+    while (*p) {
+        if (q->nseg == PATH_MAX_SEGS) return -1;
+        path_seg *sg = &q->seg[q->nseg++];
+        if (*p == '[') {
+            char *e;
+            sg->key = NULL;
+            sg->index = strtol(p + 1, &e, 10);
+            if (e == p + 1 || *e != ']' || sg->index < 0) return -1;
+            p = e + 1;
+        } else {
+            sg->key = p;
+            while (*p && *p != '.' && *p != '[') p++;
+            sg->key_len = (long)(p - sg->key);
+            if (sg->key_len == 0) return -1;
+        }
+        if (*p == '.') {
+            p++;
+            if (!*p) return -1;
+        } else if (*p && *p != '[') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Read more input, growing the buffer; returns -1 at EOF */
+static int rd_fill(json_reader *r) {
+    if (r->eof) return -1;
+    if (r->cap - r->len < STREAM_CHUNK) {
+        long cap = r->cap ? r->cap * 2 : 2 * STREAM_CHUNK;
+        char *tmp = (char *)realloc(r->buf, cap);
+        if (!tmp) { r->eof = 1; return -1; }
+        r->buf = tmp;
+        r->cap = cap;
     }
+    long n = (long)read_fd(r->fd, r->buf + r->len, STREAM_CHUNK);
+    if (n <= 0) { r->eof = 1; return -1; }
+    r->len += n;
+    return 0;
+}
 
-    /* Skip past the key and colon */
-    pos += strlen(needle);
-    while (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r') pos++;
-    if (*pos != ':') {
-        fprintf(stderr, "Malformed JSON near field '%s'.\n", field);
-        exit(1);
+static int rd_peek(json_reader *r) {
+    while (r->pos >= r->len) {
+        if (rd_fill(r) != 0) return -1;
     }
-    pos++;
-    while (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r') pos++;
+    return (unsigned char)r->buf[r->pos];
+}
 
-    if (*pos != '"') {
-        fprintf(stderr, "Field '%s' is not a string value.\n", field);
-        exit(1);
+static int rd_skip_space(json_reader *r) {
+    int c;
+    while ((c = rd_peek(r)) >= 0 && json_is_space((char)c)) r->pos++;
+    return c;
+}
+
+/* Skip the rest of a string whose opening quote has been consumed */
+static int rd_skip_string(json_reader *r) {
+    for (;;) {
+        r->pos += json_scan2(r->buf + r->pos, r->len - r->pos, '"', '\\');
+        if (rd_peek(r) < 0) return -1;
+        if (r->buf[r->pos++] == '"') return 0;
+        if (rd_peek(r) < 0) return -1;
+        r->pos++;
     }
+}
 
-    pos++; /* skip opening quote */
-    int escaped = 0;
-    while (*pos) {
-        if (escaped) {
-            if (*pos == 'n') putchar('\n');
-            else if (*pos == 't') putchar('\t');
-            else if (*pos == '"') putchar('"');
-            else if (*pos == '\\') putchar('\\');
-            else if (*pos == '/') putchar('/');
-            else { putchar('\\'); putchar(*pos); }
-            escaped = 0;
-            pos++;
-            continue;
+static int is_json_delim(int c) {
+    return c == ',' || c == ']' || c == '}' || json_is_space((char)c);
+}
+
+/* Skip one value without looking inside it */
+static int rd_skip_value(json_reader *r) {
+    int c = rd_skip_space(r);
+    if (c < 0) return -1;
+    if (c == '"') {
+        r->pos++;
+        return rd_skip_string(r);
+    }
+    if (c == '{' || c == '[') {
+        int level = 0;
+        do {
+            c = rd_peek(r);
+            if (c < 0) return -1;
+            r->pos++;
+            if (c == '"') {
+                if (rd_skip_string(r) != 0) return -1;
+            } else if (c == '{' || c == '[') {
+                level++;
+            } else if (c == '}' || c == ']') {
+                level--;
+            }
+        } while (level > 0);
+        return 0;
+    }
+    while ((c = rd_peek(r)) >= 0 && !is_json_delim(c)) r->pos++;
+    return 0;
+}
+
+/*
+ * Walk one value at the given depth. mask holds the queries whose first
+ * depth segments match the path to here. Returns 0 to continue, 1 once
+ * every query has matched, -1 on malformed input.
+ */
+static int rd_walk(json_reader *r, unsigned long long mask, int depth) {
+    int c = rd_skip_space(r);
+    if (c < 0) return -1;
+
+    unsigned long long here = 0, below = 0;
+    for (int i = 0; i < r->nq; i++) {
+        if (!(mask >> i & 1) || r->q[i].found) continue;
+        if (r->q[i].nseg == depth) here |= 1ULL << i;
+        else below |= 1ULL << i;
+    }
+    long start = r->pos;
+
+    if (!below || (c != '{' && c != '[')) {
+        if (rd_skip_value(r) != 0) return -1;
+    } else if (c == '{') {
+        r->pos++;
+        if (rd_skip_space(r) == '}') {
+            r->pos++;
+        } else for (;;) {
+            if (rd_skip_space(r) != '"') return -1;
+            long key = ++r->pos;
+            if (rd_skip_string(r) != 0) return -1;
+            long key_len = r->pos - 1 - key;
+            if (rd_skip_space(r) != ':') return -1;
+            r->pos++;
+
+            /* Keys are compared as they appear in the input, escapes included */
+            unsigned long long child = 0;
+            for (int i = 0; i < r->nq; i++) {
+                const path_seg *sg = &r->q[i].seg[depth];
+                if ((below >> i & 1) && sg->key && sg->key_len == key_len &&
+                    memcmp(sg->key, r->buf + key, (size_t)key_len) == 0) {
+                    child |= 1ULL << i;
+                }
+            }
+            int rc = child ? rd_walk(r, child, depth + 1) : rd_skip_value(r);
+            if (rc != 0) return rc;
+            c = rd_skip_space(r);
+            r->pos++;
+            if (c == '}') break;
+            if (c != ',') return -1;
+        }
+    } else {
+        r->pos++;
+        if (rd_skip_space(r) == ']') {
+            r->pos++;
+        } else for (long index = 0;; index++) {
+            unsigned long long child = 0;
+            for (int i = 0; i < r->nq; i++) {
+                const path_seg *sg = &r->q[i].seg[depth];
+                if ((below >> i & 1) && !sg->key && sg->index == index) {
+                    child |= 1ULL << i;
+                }
+            }
+            int rc = child ? rd_walk(r, child, depth + 1) : rd_skip_value(r);
+            if (rc != 0) return rc;
+            c = rd_skip_space(r);
+            r->pos++;
+            if (c == ']') break;
+            if (c != ',') return -1;
         }
-        if (*pos == '\\') {
-            escaped = 1;
-            pos++;
+    }
+
+    for (int i = 0; i < r->nq; i++) {
+        if (!(here >> i & 1)) continue;
+        r->q[i].found = 1;
+        r->q[i].start = start;
+        r->q[i].end = r->pos;
+        r->remaining--;
+    }
+    return r->remaining == 0 ? 1 : 0;
+}
+
+/*
+ * Print the contents of a quoted JSON string with escapes decoded. The
+ * reader only skips strings, so the string is checked first; one with a
+ * bad escape or a raw control character is printed as it appears.
+ */
+static void print_unescaped(const char *p, const char *end) {
+    json_lexer lx;
+    json_token tok;
+    json_lexer_init(&lx, p, (size_t)(end - p));
+    if (json_next(&lx, &tok) != JSON_TOK_STRING) {
+        out_write(p + 1, (size_t)(end - p - 2));
+        return;
+    }
+    char *text = (char *)malloc(tok.len + 1);
+    if (!text) {
+        out_write(tok.text, tok.len);
+        return;
+    }
+    out_write(text, json_unescape(tok.text, tok.len, text));
+    free(text);
+}
+
+static int extract_fields(FILE *f, const char **paths, int npaths) {
+    json_query q[QUERY_MAX];
+    for (int i = 0; i < npaths; i++) {
+        if (parse_path(paths[i], &q[i]) != 0) {
+            fprintf(stderr, "Error: invalid path '%s'.\n", paths[i]);
+            return 1;
+        }
+    }
+
+    json_reader r;
+    memset(&r, 0, sizeof(r));
+    r.fd = file_no(f);
+    r.q = q;
+    r.nq = npaths;
+    r.remaining = npaths;
+    int rc = rd_walk(&r, npaths == QUERY_MAX ? ~0ULL : (1ULL << npaths) - 1, 0);
+    if (rc < 0 && r.remaining > 0) {
+        fprintf(stderr, "Malformed JSON near byte %ld.\n", r.pos);
+    }
+
+    int missing = 0;
+    for (int i = 0; i < npaths; i++) {
+        if (!q[i].found) {
+            fprintf(stderr, "Field '%s' not found.\n", q[i].text);
+            missing = 1;
             continue;
         }
-        if (*pos == '"') break;
-        putchar(*pos);
-        pos++;
+        const char *v = r.buf + q[i].start;
+        const char *end = r.buf + q[i].end;
+        if (*v == '"') print_unescaped(v, end);
+        else out_write(v, (size_t)(end - v));
+        out_char('\n');
     }
-    putchar('\n');
+    free(r.buf);
+    return missing;
 }
 
 /* ---- HTML Beautifier ---- */
 
-static void beautify_html(const char *src, long len) {
-    int depth = 0;
-    int in_tag = 0;
-    int is_closing = 0;
-    int at_line_start = 1;
+/*
+ * Deciding how to indent a tag needs the characters after its '<': a '/'
+ * for a closing tag, otherwise the tag name to spot void elements. Those
+ * characters are held in ahead[] until the decision can be made (or the
+ * input ends), then replayed through the normal path.
+ */
+#define HTML_TAG_MAX 63
+
+typedef struct {
+    int depth;
+    int in_tag;
+    int at_line_start;
+    int pending;                  /* a '<' is waiting on lookahead */
+    char ahead[HTML_TAG_MAX + 1];
+    int ahead_len;
+} html_state;
+
+static int html_name_end(char c) {
+    return c == ' ' || c == '>' || c == '/' || c == '\n';
+}
+
+static void html_char(html_state *s, char c);
+
+/* Print the pending '<' and adjust depth now that the lookahead is known */
+static void html_open_tag(html_state *s) {
     /* Void elements that do not get indented children */
-    const char *voids[] = {
+    static const char *const voids[] = {
         "br", "hr", "img", "input", "meta", "link", "area",
         "base", "col", "embed", "source", "track", "wbr", NULL
     };
+    int is_closing = s->ahead_len > 0 && s->ahead[0] == '/';
 
-    for (long i = 0; i < len; i++) {
-        char c = src[i];
-
-        if (c == '<') {
-            /* Determine if closing tag */
-            is_closing = (i + 1 < len && src[i + 1] == '/');
+    if (is_closing && s->depth > 0) s->depth--;
 
-            if (is_closing && depth > 0) depth--;
+    if (!s->at_line_start) {
+        out_char('\n');
+    }
+    print_indent(s->depth);
+    out_char('<');
+    s->in_tag = 1;
+    s->at_line_start = 0;
 
-            if (!at_line_start) {
-                putchar('\n');
-            }
-            print_indent(depth);
-            putchar(c);
-            in_tag = 1;
-            at_line_start = 0;
-
-            /* Check if this is a void element */
-            int is_void = 0;
-            if (!is_closing) {
-                /* Extract tag name */
-                char tagname[64] = {0};
-                int ti = 0;
-                long j = i + 1;
-                while (j < len && src[j] != ' ' && src[j] != '>' &&
-                       src[j] != '/' && src[j] != '\n' && ti < 63) {
-                    tagname[ti++] = src[j];
-                    j++;
-                }
-                tagname[ti] = '\0';
-                for (int v = 0; voids[v]; v++) {
-                    if (strcmp(tagname, voids[v]) == 0) {
-                        is_void = 1;
-                        break;
-                    }
-                }
-                if (!is_void && !is_closing) {
-                    depth++;
-                }
-            }
-        } else if (c == '>') {
-            putchar(c);
-            in_tag = 0;
-            at_line_start = 0;
-        } else if (c == '\n' || c == '\r') {
-            if (in_tag) {
-                /* skip newlines inside tags */
-            } else {
-                at_line_start = 1;
+    /* Check if this is a void element */
+    if (!is_closing) {
+        char tagname[HTML_TAG_MAX + 1];
+        int ti = 0;
+        while (ti < s->ahead_len && !html_name_end(s->ahead[ti])) {
+            tagname[ti] = s->ahead[ti];
+            ti++;
+        }
+        tagname[ti] = '\0';
+        int is_void = 0;
+        for (int v = 0; voids[v]; v++) {
+            if (strcmp(tagname, voids[v]) == 0) {
+                is_void = 1;
+                break;
             }
+        }
+        if (!is_void) {
+            s->depth++;
+        }
+    }
+
+    /* Replay the lookahead; it may itself start another tag */
+    char replay[HTML_TAG_MAX + 1];
+    int n = s->ahead_len;
+    memcpy(replay, s->ahead, (size_t)n);
+    s->pending = 0;
+    s->ahead_len = 0;
+    for (int i = 0; i < n; i++) html_char(s, replay[i]);
+}
+
+static void html_char(html_state *s, char c) {
+    if (s->pending) {
+        s->ahead[s->ahead_len++] = c;
+        if ((s->ahead_len == 1 && c == '/') || html_name_end(c) ||
+            s->ahead_len == HTML_TAG_MAX) {
+            html_open_tag(s);
+        }
+        return;
+    }
+
+    if (c == '<') {
+        s->pending = 1;
+        s->ahead_len = 0;
+    } else if (c == '>') {
+        out_char(c);
+        s->in_tag = 0;
+        s->at_line_start = 0;
+    } else if (c == '\n' || c == '\r') {
+        if (s->in_tag) {
+            /* skip newlines inside tags */
         } else {
-            if (at_line_start && !in_tag && (c == ' ' || c == '\t')) {
-                continue; /* skip leading whitespace */
-            }
-            if (at_line_start && !in_tag) {
-                putchar('\n');
-                print_indent(depth);
-                at_line_start = 0;
-            }
-            putchar(c);
+            s->at_line_start = 1;
+        }
+    } else {
+        if (s->at_line_start && !s->in_tag && (c == ' ' || c == '\t')) {
+            return; /* skip leading whitespace */
+        }
+        if (s->at_line_start && !s->in_tag) {
+            out_char('\n');
+            print_indent(s->depth);
+            s->at_line_start = 0;
         }
+        out_char(c);
     }
-    putchar('\n');
+}
+
+static void beautify_html_feed(void *state, const char *src, long len) {
+    html_state *s = (html_state *)state;
+    for (long i = 0; i < len; i++) {
+        /* Mid-line text and tag bodies copy through until the next < > or break */
+        if (!s->pending && !s->at_line_start) {
+            long run = scan_for4(src + i, len - i, '<', '>', '\n', '\r');
+            out_write(src + i, (size_t)run);
+            i += run;
+            if (i == len) break;
+        }
+        html_char(s, src[i]);
+    }
+}
+
+static void beautify_html_end(html_state *s) {
+    while (s->pending) html_open_tag(s);  /* a replay can leave another tag pending */
+    out_char('\n');
 }
 
 /* ---- CSS Beautifier ---- */
 
-static void beautify_css(const char *src, long len) {
-    int depth = 0;
-    int in_string = 0;
-    char string_char = 0;
+typedef struct {
+    int depth;
+    int in_string;
+    int escaped;
+    char string_char;
+    int prev;       /* previous input character (-1 at the start), for collapsing */
+} css_state;
+
+static void beautify_css_feed(void *state, const char *src, long len) {
+    css_state *s = (css_state *)state;
 
     for (long i = 0; i < len; i++) {
+        if (s->in_string && !s->escaped) {
+            long run = json_scan2(src + i, len - i, s->string_char, '\\');
+            if (run > 0) {
+                out_write(src + i, (size_t)run);
+                i += run;
+                s->prev = (unsigned char)src[i - 1];
+                if (i == len) break;
+            }
+        }
         char c = src[i];
+        int prev = s->prev;
+        s->prev = (unsigned char)c;
 
         /* Handle strings */
-        if (in_string) {
-            putchar(c);
-            if (c == '\\' && i + 1 < len) {
-                putchar(src[++i]);
-                continue;
+        if (s->in_string) {
+            out_char(c);
+            if (s->escaped) {
+                s->escaped = 0;
+            } else if (c == '\\') {
+                s->escaped = 1;
+            } else if (c == s->string_char) {
+                s->in_string = 0;
             }
-            if (c == string_char) in_string = 0;
             continue;
         }
         if (c == '"' || c == '\'') {
-            in_string = 1;
-            string_char = c;
-            putchar(c);
+            s->in_string = 1;
+            s->string_char = c;
+            out_char(c);
             continue;
         }
 
@@ -350,35 +819,124 @@ static void beautify_css(const char *src, long len) {
         if (c == '\n' || c == '\r') continue;
 
         if (c == '{') {
-            putchar(' ');
-            putchar('{');
-            putchar('\n');
-            depth++;
-            print_indent(depth);
+            out_char(' ');
+            out_char('{');
+            out_char('\n');
+            s->depth++;
+            print_indent(s->depth);
         } else if (c == '}') {
-            putchar('\n');
-            depth--;
-            if (depth < 0) depth = 0;
-            print_indent(depth);
-            putchar('}');
-            putchar('\n');
-            if (depth == 0) putchar('\n');
+            out_char('\n');
+            s->depth--;
+            if (s->depth < 0) s->depth = 0;
+            print_indent(s->depth);
+            out_char('}');
+            out_char('\n');
+            if (s->depth == 0) out_char('\n');
         } else if (c == ';') {
-            putchar(';');
-            putchar('\n');
-            print_indent(depth);
+            out_char(';');
+            out_char('\n');
+            print_indent(s->depth);
         } else if (c == ' ' || c == '\t') {
             /* Collapse whitespace */
-            if (i > 0 && src[i - 1] != ' ' && src[i - 1] != '\t' &&
-                src[i - 1] != '\n' && src[i - 1] != '{' &&
-                src[i - 1] != ';') {
-                putchar(' ');
+            if (prev >= 0 && prev != ' ' && prev != '\t' &&
+                prev != '\n' && prev != '{' &&
+                prev != ';') {
+                out_char(' ');
             }
         } else {
-            putchar(c);
+            out_char(c);
         }
     }
-    putchar('\n');
+}
+
+static void beautify_css_end(css_state *s) {
+    (void)s;
+    out_char('\n');
+}
+
+/* ---- Benchmark ---- */
+
+/*
+ * --bench FILE: load FILE once, then run every formatter over it in
+ * STREAM_CHUNK slices (the same path as stream_input) for about a second
+ * each with output discarded, and report input throughput in MB/s.
+ */
+
+typedef struct {
+    const char *name;
+    feed_fn feed;
+    void (*end)(void *);
+    size_t state_size;
+} bench_mode;
+
+static void end_compact_json(void *state) { (void)state; out_char('\n'); }
+static void end_json(void *state) { beautify_json_end((json_state *)state); }
+static void end_html(void *state) { beautify_html_end((html_state *)state); }
+static void end_css(void *state) { beautify_css_end((css_state *)state); }
+
+static void bench_reset(const char *name, void *state) {
+    if (strcmp(name, "html") == 0) {
+        html_state *hs = (html_state *)state;
+        memset(hs, 0, sizeof(*hs));
+        hs->at_line_start = 1;
+    } else if (strcmp(name, "css") == 0) {
+        css_state cs = { 0, 0, 0, 0, -1 };
+        memcpy(state, &cs, sizeof(cs));
+    } else {
+        memset(state, 0, sizeof(json_state));
+    }
+}
+
+static int run_bench(const char *path, double seconds) {
+    static const bench_mode modes[] = {
+        { "json",    beautify_json_feed, end_json,         sizeof(json_state) },
+        { "compact", compact_json_feed,  end_compact_json, sizeof(json_state) },
+        { "html",    beautify_html_feed, end_html,         sizeof(html_state) },
+        { "css",     beautify_css_feed,  end_css,          sizeof(css_state) },
+    };
+    FILE *f = open_input(path);
+    long len = 0;
+    char *src = read_all(f, &len);
+    if (f != stdin) fclose(f);
+    if (!src || len == 0) {
+        fprintf(stderr, "Error: failed to read benchmark input.\n");
+        free(src);
+        return 1;
+    }
+
+    out_discard = 1;
+    printf("Input: %s (%ld bytes), %s scanner\n", path, len,
+#if defined(JSON_SIMD_SSE2)
+           "SSE2"
+#elif defined(JSON_SIMD_NEON)
+           "NEON"
+#else
+           "scalar"
+#endif
+    );
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        union { json_state j; html_state h; css_state c; } state;
+        long long passes = 0;
+        double start = now_seconds(), elapsed;
+        out_total = 0;
+        do {
+            bench_reset(modes[m].name, &state);
+            for (long off = 0; off < len; off += STREAM_CHUNK) {
+                long n = len - off < STREAM_CHUNK ? len - off : STREAM_CHUNK;
+                modes[m].feed(&state, src + off, n);
+                out_drain();
+            }
+            modes[m].end(&state);
+            out_drain();
+            passes++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < seconds);
+        fprintf(stdout, "  %-8s %9.1f MB/s  (%lld passes, %lld bytes out per pass)\n",
+                modes[m].name, (double)len * (double)passes / elapsed / 1e6,
+                passes, out_total / passes);
+    }
+    free(src);
+    return 0;
 }
 
 /* ---- Usage ---- */
@@ -390,15 +948,20 @@ static void print_usage(void) {
     printf("  --json              Format as indented JSON\n");
     printf("  --html              Format HTML with indentation\n");
     printf("  --css               Format CSS with indentation\n");
-    printf("  --extract-field KEY Extract a top-level string field from JSON\n");
+    printf("  --extract-field PATH\n");
+    printf("                      Print the JSON value at PATH (key, a.b, list[0].c);\n");
+    printf("                      may be repeated, one value per line\n");
     printf("  --indent N          Set indent width (default: 2)\n");
     printf("  --compact           Minify instead of beautify\n");
+    printf("  --bench FILE        Report MB/s for each mode on FILE\n");
     printf("  --help              Show this message\n\n");
     printf("Examples:\n");
     printf("  echo '{\"a\":1}' | beautify --json\n");
     printf("  beautify --json data.json\n");
     printf("  beautify --extract-field explanation response.json\n");
+    printf("  beautify --extract-field site.notice --extract-field projects[0].title data.json\n");
     printf("  beautify --css styles.css\n");
+    printf("  beautify --bench crissy-data.json\n");
 }
 
 /* ---- Main ---- */
@@ -407,7 +970,8 @@ int main(int argc, char *argv[]) {
     enum { MODE_JSON, MODE_HTML, MODE_CSS, MODE_EXTRACT } mode = MODE_JSON;
     int compact = 0;
     const char *input_path = NULL;
-    const char *extract_key = NULL;
+    const char *extract_paths[QUERY_MAX];
+    int npaths = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--json") == 0) {
@@ -418,12 +982,15 @@ int main(int argc, char *argv[]) {
             mode = MODE_CSS;
         } else if (strcmp(argv[i], "--extract-field") == 0) {
             mode = MODE_EXTRACT;
-            if (i + 1 < argc) {
-                extract_key = argv[++i];
-            } else {
-                fprintf(stderr, "Error: --extract-field requires a key name.\n");
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --extract-field requires a path.\n");
                 return 1;
             }
+            if (npaths == QUERY_MAX) {
+                fprintf(stderr, "Error: at most %d --extract-field paths.\n", QUERY_MAX);
+                return 1;
+            }
+            extract_paths[npaths++] = argv[++i];
         } else if (strcmp(argv[i], "--indent") == 0) {
             if (i + 1 < argc) {
                 indent_width = atoi(argv[++i]);
@@ -432,6 +999,12 @@ int main(int argc, char *argv[]) {
             }
         } else if (strcmp(argv[i], "--compact") == 0) {
             compact = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            if (i + 1 < argc) {
+                return run_bench(argv[++i], 1.0);
+            }
+            fprintf(stderr, "Error: --bench requires a file.\n");
+            return 1;
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             print_usage();
             return 0;
@@ -444,31 +1017,46 @@ int main(int argc, char *argv[]) {
     }
 
     FILE *f = open_input(input_path);
-    long len = 0;
-    char *src = read_all(f, &len);
-    if (f != stdin) fclose(f);
+    int rc = 0;
 
-    if (!src) {
-        fprintf(stderr, "Error: failed to read input.\n");
-        return 1;
+    if (mode == MODE_EXTRACT) {
+        rc = extract_fields(f, extract_paths, npaths);
+        out_flush();
+        if (f != stdin) fclose(f);
+        return rc;
     }
 
     switch (mode) {
-        case MODE_JSON:
-            if (compact) compact_json(src, len);
-            else beautify_json(src, len);
+        case MODE_JSON: {
+            json_state js = { 0, 0, 0, 0 };
+            rc = stream_input(f, compact ? compact_json_feed : beautify_json_feed, &js);
+            if (compact) out_char('\n');
+            else beautify_json_end(&js);
             break;
-        case MODE_HTML:
-            beautify_html(src, len);
+        }
+        case MODE_HTML: {
+            html_state hs;
+            memset(&hs, 0, sizeof(hs));
+            hs.at_line_start = 1;
+            rc = stream_input(f, beautify_html_feed, &hs);
+            beautify_html_end(&hs);
             break;
-        case MODE_CSS:
-            beautify_css(src, len);
+        }
+        case MODE_CSS: {
+            css_state cs = { 0, 0, 0, 0, -1 };
+            rc = stream_input(f, beautify_css_feed, &cs);
+            beautify_css_end(&cs);
             break;
-        case MODE_EXTRACT:
-            extract_field(src, len, extract_key);
+        }
+        default:
             break;
     }
+    out_flush();
+    if (f != stdin) fclose(f);
 
-    free(src);
+    if (rc != 0) {
+        fprintf(stderr, "Error: failed to read input.\n");
+        return 1;
+    }
     return 0;
 }
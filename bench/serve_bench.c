@@ -0,0 +1,627 @@
+/*
+ * serve_bench.c - HTTP load generator and latency benchmark for serve.c
+ *
+ * Opens N concurrent connections to a running portfolio server and sends
+ * GET requests for a fixed duration, cycling through a list of paths
+ * (by default the portfolio page, the 1.8 MB data file, a small API
+ * endpoint and a 404). Reports requests per second, latency percentiles,
+ * throughput and the server's resident memory, per path and in total.
+ *
+ * Build
+ *   gcc -O2 -pthread -o serve_bench serve_bench.c         (macOS / Linux)
+ *   cl serve_bench.c /Fe:serve_bench.exe                  (Windows MSVC)
+ *   gcc -O2 -o serve_bench.exe serve_bench.c -lws2_32 -lpsapi   (MinGW)
+ *
+ * Usage
+ *   ./serve_bench [--port 9090] [-c 32] [-d 10] [--no-keepalive]
+ *                 [--path /index.html ...] [--pid PID] [--gzip] [--json]
+ *
+ * Compiles on Windows (MSVC, MinGW), macOS, and Linux with no external
+ * libraries.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ---- Platform ---- */
+
+#ifdef _WIN32
+  #ifndef _CRT_SECURE_NO_WARNINGS
+    #define _CRT_SECURE_NO_WARNINGS
+  #endif
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  #include <windows.h>
+  #include <process.h>
+  #include <psapi.h>
+  #pragma comment(lib, "ws2_32.lib")
+  #pragma comment(lib, "psapi.lib")
+  typedef SOCKET sock_t;
+  #define CLOSESOCKET closesocket
+  #define INVALID_SOCK INVALID_SOCKET
+  typedef HANDLE thread_t;
+  #define THREAD_FUNC unsigned __stdcall
+  #define THREAD_RETURN return 0
+  static int thread_start(thread_t *t, unsigned (__stdcall *fn)(void *), void *arg) {
+      *t = (HANDLE)_beginthreadex(NULL, 0, fn, arg, 0, NULL);
+      return *t ? 0 : -1;
+  }
+  static void thread_join(thread_t t) {
+      WaitForSingleObject(t, INFINITE);
+      CloseHandle(t);
+  }
+  static void sleep_ms(int ms) { Sleep(ms); }
+  static double now_seconds(void) {
+      static LARGE_INTEGER freq;
+      LARGE_INTEGER t;
+      if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+      QueryPerformanceCounter(&t);
+      return (double)t.QuadPart / (double)freq.QuadPart;
+  }
+#else
+  #include <unistd.h>
+  #include <strings.h>
+  #include <errno.h>
+  #include <pthread.h>
+  #include <signal.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  #include <arpa/inet.h>
+  typedef int sock_t;
+  #define CLOSESOCKET close
+  #define INVALID_SOCK (-1)
+  typedef pthread_t thread_t;
+  #define THREAD_FUNC void *
+  #define THREAD_RETURN return NULL
+  static int thread_start(thread_t *t, void *(*fn)(void *), void *arg) {
+      return pthread_create(t, NULL, fn, arg) == 0 ? 0 : -1;
+  }
+  static void thread_join(thread_t t) { pthread_join(t, NULL); }
+  static void sleep_ms(int ms) { usleep((useconds_t)ms * 1000); }
+  static double now_seconds(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+  }
+#endif
+
+/* ---- Constants ---- */
+
+#define MAX_PATHS        16
+#define MAX_CONNECTIONS  1024
+#define RECV_BUF_SIZE    65536
+#define DEFAULT_PORT     9090
+#define DEFAULT_CONNS    32
+#define DEFAULT_SECONDS  10
+
+static const char *const default_paths[] = {
+    "/index.html", "/crissy-data.json", "/api/deploy-config", "/bench-missing-page.html"
+};
+
+/* ---- Options ---- */
+
+static char opt_host[256] = "127.0.0.1";
+static int opt_port = DEFAULT_PORT;
+static int opt_conns = DEFAULT_CONNS;
+static double opt_seconds = DEFAULT_SECONDS;
+static int opt_keepalive = 1;
+static int opt_gzip = 0;
+static int opt_json = 0;
+static long opt_pid = 0;
+static const char *opt_paths[MAX_PATHS];
+static int opt_npaths = 0;
+
+/* ---- Results ---- */
+
+/* One latency sample list per path per connection; merged at the end */
+typedef struct {
+    double *lat;      /* seconds */
+    long count;
+    long cap;
+    long errors;
+    double bytes;     /* response bytes, headers included */
+} path_stats;
+
+typedef struct {
+    int index;
+    path_stats paths[MAX_PATHS];
+    long status_2xx, status_3xx, status_4xx, status_5xx;
+    long connects;
+} worker_t;
+
+static volatile int bench_running = 1;
+static double bench_deadline = 0;
+
+static void record(path_stats *ps, double latency, double bytes) {
+    if (ps->count == ps->cap) {
+        long cap = ps->cap ? ps->cap * 2 : 4096;
+        double *tmp = (double *)realloc(ps->lat, cap * sizeof(double));
+        if (!tmp) return;
+        ps->lat = tmp;
+        ps->cap = cap;
+    }
+    ps->lat[ps->count++] = latency;
+    ps->bytes += bytes;
+}
+
+/* ---- HTTP Client ---- */
+
+typedef struct {
+    sock_t sock;
+    char buf[RECV_BUF_SIZE];
+    int len;     /* bytes in buf */
+    int pos;     /* next unread byte */
+} client_t;
+
+static sock_t connect_server(void) {
+    sock_t s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCK) return INVALID_SOCK;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)opt_port);
+    if (inet_pton(AF_INET, opt_host, &addr.sin_addr) != 1) {
+        CLOSESOCKET(s);
+        return INVALID_SOCK;
+    }
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        CLOSESOCKET(s);
+        return INVALID_SOCK;
+    }
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+    return s;
+}
+
+static int client_fill(client_t *c) {
+    if (c->pos == c->len) c->pos = c->len = 0;
+    if (c->len == RECV_BUF_SIZE) {
+        memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+        c->len -= c->pos;
+        c->pos = 0;
+    }
+    int n = recv(c->sock, c->buf + c->len, RECV_BUF_SIZE - c->len, 0);
+    if (n <= 0) return -1;
+    c->len += n;
+    return n;
+}
+
+/* Read a CRLF-terminated line (chunk sizes); returns its length or -1 */
+static int client_line(client_t *c, char *out, int out_len, double *bytes) {
+    int n = 0;
+    for (;;) {
+        if (c->pos == c->len && client_fill(c) < 0) return -1;
+        char ch = c->buf[c->pos++];
+        *bytes += 1;
+        if (ch == '\n') break;
+        if (ch != '\r' && n < out_len - 1) out[n++] = ch;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/* Discard n body bytes */
+static int client_skip(client_t *c, long n, double *bytes) {
+    while (n > 0) {
+        if (c->pos == c->len && client_fill(c) < 0) return -1;
+        long take = c->len - c->pos;
+        if (take > n) take = n;
+        c->pos += (int)take;
+        n -= take;
+        *bytes += (double)take;
+    }
+    return 0;
+}
+
+static int header_value(const char *head, const char *name, char *out, int out_len) {
+    size_t nlen = strlen(name);
+    const char *p = strchr(head, '\n');
+    while (p) {
+        p++;
+        #ifdef _WIN32
+        if (_strnicmp(p, name, nlen) == 0 && p[nlen] == ':') {
+        #else
+        if (strncasecmp(p, name, nlen) == 0 && p[nlen] == ':') {
+        #endif
+            p += nlen + 1;
+            while (*p == ' ') p++;
+            int i = 0;
+            while (*p && *p != '\r' && *p != '\n' && i < out_len - 1) out[i++] = *p++;
+            out[i] = '\0';
+            return 1;
+        }
+        p = strchr(p, '\n');
+    }
+    return 0;
+}
+
+/*
+ * Send one GET and read the whole response. Returns the status code, or
+ * -1 on a transport error. *reuse is cleared when the server will close.
+ */
+static int do_request(client_t *c, const char *path, double *bytes, int *reuse) {
+    char req[1024];
+    int rlen = snprintf(req, sizeof(req),
+        "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: serve_bench\r\n%sConnection: %s\r\n\r\n",
+        path, opt_host, opt_port, opt_gzip ? "Accept-Encoding: gzip\r\n" : "",
+        opt_keepalive ? "keep-alive" : "close");
+    if (send(c->sock, req, rlen, 0) != rlen) return -1;
+
+    /* Headers */
+    char head[8192];
+    int hlen = 0;
+    for (;;) {
+        if (c->pos == c->len && client_fill(c) < 0) return -1;
+        head[hlen++] = c->buf[c->pos++];
+        if (hlen >= 4 && memcmp(head + hlen - 4, "\r\n\r\n", 4) == 0) break;
+        if (hlen == (int)sizeof(head) - 1) return -1;
+    }
+    head[hlen] = '\0';
+    *bytes += hlen;
+
+    int status = 0;
+    if (sscanf(head, "HTTP/%*d.%*d %d", &status) != 1) return -1;
+
+    char value[256];
+    *reuse = opt_keepalive;
+    if (header_value(head, "Connection", value, sizeof(value)) && strstr(value, "close")) *reuse = 0;
+
+    if (status == 304 || status == 204 || (status >= 100 && status < 200)) return status;
+    if (header_value(head, "Transfer-Encoding", value, sizeof(value)) && strstr(value, "chunked")) {
+        char line[128];
+        for (;;) {
+            if (client_line(c, line, sizeof(line), bytes) < 0) return -1;
+            long size = strtol(line, NULL, 16);
+            if (size == 0) {
+                do {
+                    if (client_line(c, line, sizeof(line), bytes) < 0) return -1;
+                } while (line[0]);
+                break;
+            }
+            if (client_skip(c, size, bytes) != 0) return -1;
+            if (client_line(c, line, sizeof(line), bytes) < 0) return -1;
+        }
+    } else if (header_value(head, "Content-Length", value, sizeof(value))) {
+        if (client_skip(c, atol(value), bytes) != 0) return -1;
+    } else {
+        /* Delimited by close */
+        *reuse = 0;
+        while (client_fill(c) > 0) {
+            *bytes += c->len - c->pos;
+            c->pos = c->len;
+        }
+    }
+    return status;
+}
+
+static THREAD_FUNC worker_main(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    client_t *c = (client_t *)malloc(sizeof(client_t));
+    if (!c) THREAD_RETURN;
+    c->sock = INVALID_SOCK;
+    int next = w->index % opt_npaths;
+
+    while (bench_running && now_seconds() < bench_deadline) {
+        int pi = next;
+        next = (next + 1) % opt_npaths;
+        double start = now_seconds();
+        if (c->sock == INVALID_SOCK) {
+            c->sock = connect_server();
+            c->len = c->pos = 0;
+            w->connects++;
+            if (c->sock == INVALID_SOCK) {
+                w->paths[pi].errors++;
+                sleep_ms(10);
+                continue;
+            }
+        }
+        double bytes = 0;
+        int reuse = 0;
+        int status = do_request(c, opt_paths[pi], &bytes, &reuse);
+        double latency = now_seconds() - start;
+        if (status < 0) {
+            w->paths[pi].errors++;
+        } else {
+            record(&w->paths[pi], latency, bytes);
+            if (status < 300) w->status_2xx++;
+            else if (status < 400) w->status_3xx++;
+            else if (status < 500) w->status_4xx++;
+            else w->status_5xx++;
+        }
+        if (status < 0 || !reuse) {
+            CLOSESOCKET(c->sock);
+            c->sock = INVALID_SOCK;
+        }
+    }
+    if (c->sock != INVALID_SOCK) CLOSESOCKET(c->sock);
+    free(c);
+    THREAD_RETURN;
+}
+
+/* ---- Server Memory ---- */
+
+/* Resident set size of opt_pid in bytes, or -1 if unavailable */
+static long server_rss(void) {
+    if (opt_pid <= 0) return -1;
+    #ifdef _WIN32
+    HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, FALSE, (DWORD)opt_pid);
+    if (!h) return -1;
+    PROCESS_MEMORY_COUNTERS pmc;
+    long rss = -1;
+    if (GetProcessMemoryInfo(h, &pmc, sizeof(pmc))) rss = (long)pmc.WorkingSetSize;
+    CloseHandle(h);
+    return rss;
+    #elif defined(__linux__)
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/status", opt_pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            kb = atol(line + 6);
+            break;
+        }
+    }
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+    #else
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "ps -o rss= -p %ld", opt_pid);
+    FILE *p = popen(cmd, "r");
+    if (!p) return -1;
+    long kb = -1;
+    if (fscanf(p, "%ld", &kb) != 1) kb = -1;
+    pclose(p);
+    return kb < 0 ? -1 : kb * 1024;
+    #endif
+}
+
+/* ---- Report ---- */
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, long n, double p) {
+    if (n == 0) return 0;
+    long i = (long)(p * (double)(n - 1) + 0.5);
+    return sorted[i];
+}
+
+typedef struct {
+    long count;
+    long errors;
+    double bytes;
+    double p50, p99, p999, max;
+} summary_t;
+
+static summary_t summarize(double *lat, long n, long errors, double bytes) {
+    summary_t s;
+    qsort(lat, n, sizeof(double), compare_double);
+    s.count = n;
+    s.errors = errors;
+    s.bytes = bytes;
+    s.p50 = percentile(lat, n, 0.50);
+    s.p99 = percentile(lat, n, 0.99);
+    s.p999 = percentile(lat, n, 0.999);
+    s.max = n ? lat[n - 1] : 0;
+    return s;
+}
+
+static void print_row(const char *name, const summary_t *s, double elapsed) {
+    printf("%-28s %9ld %7ld %10.1f %8.3f %8.3f %8.3f %9.2f\n",
+           name, s->count, s->errors, s->count / elapsed,
+           s->p50 * 1000.0, s->p99 * 1000.0, s->p999 * 1000.0,
+           s->bytes / elapsed / (1024.0 * 1024.0));
+}
+
+static void print_json_summary(const char *name, const summary_t *s, double elapsed) {
+    printf("{\"path\":\"%s\",\"requests\":%ld,\"errors\":%ld,\"rps\":%.1f,"
+           "\"p50Ms\":%.3f,\"p99Ms\":%.3f,\"p999Ms\":%.3f,\"maxMs\":%.3f,\"bytesPerSec\":%.0f}",
+           name, s->count, s->errors, s->count / elapsed, s->p50 * 1000.0,
+           s->p99 * 1000.0, s->p999 * 1000.0, s->max * 1000.0, s->bytes / elapsed);
+}
+
+/* ---- Usage ---- */
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "Usage: serve_bench [options]\n"
+        "\n"
+        "Options:\n"
+        "  --host ADDR      Server IPv4 address (default 127.0.0.1)\n"
+        "  --port N         Server port (default %d)\n"
+        "  -c N             Concurrent connections (default %d, max %d)\n"
+        "  -d SECONDS       Test duration (default %d)\n"
+        "  --no-keepalive   Open a new connection for every request\n"
+        "  --path P         Request path; repeat to cycle through several\n"
+        "                   (default: /index.html /crissy-data.json\n"
+        "                   /api/deploy-config and a 404 path)\n"
+        "  --gzip           Send Accept-Encoding: gzip\n"
+        "  --pid PID        Sample the server's resident memory during the run\n"
+        "  --json           Print the results as one JSON object\n"
+        "\n"
+        "Example:\n"
+        "  ./serve 9090 &\n"
+        "  ./bench/serve_bench -c 64 -d 10 --pid $!\n",
+        DEFAULT_PORT, DEFAULT_CONNS, MAX_CONNECTIONS, DEFAULT_SECONDS);
+}
+
+/* ---- Main ---- */
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+            snprintf(opt_host, sizeof(opt_host), "%s", argv[++i]);
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            opt_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            opt_conns = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            opt_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--no-keepalive") == 0) {
+            opt_keepalive = 0;
+        } else if (strcmp(argv[i], "--path") == 0 && i + 1 < argc) {
+            if (opt_npaths < MAX_PATHS) opt_paths[opt_npaths++] = argv[++i];
+            else i++;
+        } else if (strcmp(argv[i], "--gzip") == 0) {
+            opt_gzip = 1;
+        } else if (strcmp(argv[i], "--pid") == 0 && i + 1 < argc) {
+            opt_pid = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            opt_json = 1;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage();
+            return 0;
+        } else {
+            fprintf(stderr, "serve_bench: unknown option %s\n", argv[i]);
+            print_usage();
+            return 2;
+        }
+    }
+    if (opt_conns < 1) opt_conns = 1;
+    if (opt_conns > MAX_CONNECTIONS) opt_conns = MAX_CONNECTIONS;
+    if (opt_seconds <= 0) opt_seconds = DEFAULT_SECONDS;
+    if (opt_port <= 0 || opt_port > 65535) {
+        fprintf(stderr, "serve_bench: invalid port\n");
+        return 2;
+    }
+    if (opt_npaths == 0) {
+        for (size_t i = 0; i < sizeof(default_paths) / sizeof(default_paths[0]); i++) {
+            opt_paths[opt_npaths++] = default_paths[i];
+        }
+    }
+
+    #ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "serve_bench: failed to initialize networking\n");
+        return 1;
+    }
+    #else
+    signal(SIGPIPE, SIG_IGN);
+    #endif
+
+    /* Fail fast if nothing is listening */
+    sock_t probe = connect_server();
+    if (probe == INVALID_SOCK) {
+        fprintf(stderr, "serve_bench: cannot connect to %s:%d\n", opt_host, opt_port);
+        return 1;
+    }
+    CLOSESOCKET(probe);
+
+    worker_t *workers = (worker_t *)calloc(opt_conns, sizeof(worker_t));
+    thread_t *threads = (thread_t *)calloc(opt_conns, sizeof(thread_t));
+    if (!workers || !threads) {
+        fprintf(stderr, "serve_bench: out of memory\n");
+        return 1;
+    }
+
+    long rss_start = server_rss();
+    long rss_peak = rss_start;
+    double start = now_seconds();
+    bench_deadline = start + opt_seconds;
+
+    int started = 0;
+    for (int i = 0; i < opt_conns; i++) {
+        workers[i].index = i;
+        if (thread_start(&threads[i], worker_main, &workers[i]) != 0) break;
+        started++;
+    }
+
+    /* Sample server memory while the load runs */
+    while (now_seconds() < bench_deadline) {
+        sleep_ms(100);
+        long rss = server_rss();
+        if (rss > rss_peak) rss_peak = rss;
+    }
+    for (int i = 0; i < started; i++) thread_join(threads[i]);
+    double elapsed = now_seconds() - start;
+    long rss_end = server_rss();
+    if (rss_end > rss_peak) rss_peak = rss_end;
+
+    /* Merge per-connection samples */
+    long total_n = 0;
+    for (int i = 0; i < started; i++) {
+        for (int p = 0; p < opt_npaths; p++) total_n += workers[i].paths[p].count;
+    }
+    double *all = (double *)malloc((total_n ? total_n : 1) * sizeof(double));
+    summary_t per_path[MAX_PATHS];
+    long all_n = 0, all_errors = 0, connects = 0;
+    long s2 = 0, s3 = 0, s4 = 0, s5 = 0;
+    double all_bytes = 0;
+    for (int p = 0; p < opt_npaths; p++) {
+        long n = 0, errors = 0;
+        double bytes = 0;
+        for (int i = 0; i < started; i++) n += workers[i].paths[p].count;
+        double *lat = (double *)malloc((n ? n : 1) * sizeof(double));
+        long k = 0;
+        for (int i = 0; i < started; i++) {
+            path_stats *ps = &workers[i].paths[p];
+            if (lat && ps->count) memcpy(lat + k, ps->lat, ps->count * sizeof(double));
+            if (all && ps->count) memcpy(all + all_n, ps->lat, ps->count * sizeof(double));
+            k += ps->count;
+            all_n += ps->count;
+            errors += ps->errors;
+            bytes += ps->bytes;
+        }
+        per_path[p] = summarize(lat, lat ? n : 0, errors, bytes);
+        all_errors += errors;
+        all_bytes += bytes;
+        free(lat);
+    }
+    for (int i = 0; i < started; i++) {
+        s2 += workers[i].status_2xx;
+        s3 += workers[i].status_3xx;
+        s4 += workers[i].status_4xx;
+        s5 += workers[i].status_5xx;
+        connects += workers[i].connects;
+        for (int p = 0; p < opt_npaths; p++) free(workers[i].paths[p].lat);
+    }
+    summary_t total = summarize(all, all ? all_n : 0, all_errors, all_bytes);
+
+    if (opt_json) {
+        printf("{\"connections\":%d,\"seconds\":%.2f,\"keepAlive\":%s,\"gzip\":%s,"
+               "\"connects\":%ld,\"status\":{\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld},"
+               "\"serverRss\":{\"start\":%ld,\"peak\":%ld,\"end\":%ld},\"total\":",
+               started, elapsed, opt_keepalive ? "true" : "false", opt_gzip ? "true" : "false",
+               connects, s2, s3, s4, s5, rss_start, rss_peak, rss_end);
+        print_json_summary("*", &total, elapsed);
+        printf(",\"paths\":[");
+        for (int p = 0; p < opt_npaths; p++) {
+            if (p) printf(",");
+            print_json_summary(opt_paths[p], &per_path[p], elapsed);
+        }
+        printf("]}\n");
+    } else {
+        printf("serve_bench: %d connections, %.1f s, %s, http://%s:%d\n\n",
+               started, elapsed, opt_keepalive ? "keep-alive" : "new connection per request",
+               opt_host, opt_port);
+        printf("%-28s %9s %7s %10s %8s %8s %8s %9s\n",
+               "path", "requests", "errors", "req/s", "p50 ms", "p99 ms", "p999 ms", "MB/s");
+        for (int p = 0; p < opt_npaths; p++) print_row(opt_paths[p], &per_path[p], elapsed);
+        print_row("total", &total, elapsed);
+        printf("\nstatus: 2xx=%ld 3xx=%ld 4xx=%ld 5xx=%ld   connections opened: %ld\n",
+               s2, s3, s4, s5, connects);
+        if (rss_start >= 0) {
+            printf("server RSS: start %.1f MB, peak %.1f MB, end %.1f MB\n",
+                   rss_start / 1048576.0, rss_peak / 1048576.0, rss_end / 1048576.0);
+        } else {
+            printf("server RSS: n/a (pass --pid PID)\n");
+        }
+    }
+
+    free(all);
+    free(workers);
+    free(threads);
+    #ifdef _WIN32
+    WSACleanup();
+    #endif
+    return all_errors > 0 && total.count == 0 ? 1 : 0;
+}
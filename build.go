@@ -1,20 +1,119 @@
 package main
 
 import (
+	"bytes"
+	"crypto/sha256"
+	"encoding/base64"
+	"encoding/hex"
+	"encoding/json"
+	"flag"
 	"fmt"
 	"os"
 	"path/filepath"
+	"sort"
 	"strings"
 )
 
 // build.go - CLI build tool for Crissy Portfolio
 // Inlines styles.css, scripts.js, and crissy-data.json into a single HTML file
 // then copies that HTML to all configured output filenames.
+//
+// Base64 data: URLs in the JSON (the images written by img_convert) are
+// moved out into content-addressed files under build/assets/ so the pages
+// stay small and the images can be cached on their own. Pass -inline to
+// keep the old fully self-contained output.
+
+// assetsDirName is the folder inside build/ that holds extracted data: URLs.
+// The server sends files in it with a long-lived immutable Cache-Control.
+const assetsDirName = "assets"
+
+// assetExtensions maps the data: URL media types we extract to a file
+// extension the server knows the MIME type for. Anything else stays inline.
+var assetExtensions = map[string]string{
+	"image/png":                ".png",
+	"image/jpeg":               ".jpg",
+	"image/jpg":                ".jpg",
+	"image/gif":                ".gif",
+	"image/webp":               ".webp",
+	"image/avif":               ".avif",
+	"image/svg+xml":            ".svg",
+	"image/x-icon":             ".ico",
+	"image/vnd.microsoft.icon": ".ico",
+}
+
+// defaultOutputFiles is used when crissy-data.json has no site.outputFiles.
+var defaultOutputFiles = []string{
+	"index.html",
+	"projects.html",
+	"links.html",
+	"about.html",
+}
+
+// The first output file is always written in full. The rest are produced
+// according to the output mode:
+//
+//	copy      a full copy of the page (the original behavior)
+//	hardlink  a hard link to the first file, falling back to a copy
+//	symlink   a relative symlink to the first file, falling back to a copy
+//	redirect  a small stub page that forwards to the first file
+const defaultOutputMode = "hardlink"
+
+var validOutputModes = map[string]bool{
+	"copy":     true,
+	"hardlink": true,
+	"symlink":  true,
+	"redirect": true,
+}
+
+// outputSettings holds the site fields that control where the page is written.
+type outputSettings struct {
+	OutputFiles []string `json:"outputFiles"`
+	OutputMode  string   `json:"outputMode"`
+}
+
+// manifestName is the file, next to the sources, where each build records
+// what it read and wrote. It lets the next build skip work that would
+// produce the same bytes. Bump manifestVersion when the output format
+// changes so old manifests are ignored.
+const manifestName = ".build-manifest.json"
+const manifestVersion = 1
+
+// dataPlaceholder marks where the JSON goes in the page template. The NUL
+// bytes keep it from ever matching text in the source files.
+const dataPlaceholder = "\x00__CRISSY_DATA__\x00"
+
+// buildManifest is the saved state of one build.
+type buildManifest struct {
+	Version  int               `json:"version"`
+	Options  string            `json:"options"`
+	Inputs   map[string]string `json:"inputs"`
+	Template string            `json:"template"`
+	Outputs  []manifestOutput  `json:"outputs"`
+}
+
+// manifestOutput is one file the build wrote (or left alone because it
+// was already correct). Path is relative to build/ with forward slashes.
+type manifestOutput struct {
+	Path    string `json:"path"`
+	Hash    string `json:"sha256"`
+	Size    int64  `json:"size"`
+	ModTime int64  `json:"mtime"`
+}
 
 func main() {
+	minify := flag.Bool("minify", true, "strip comments and whitespace from the HTML, CSS, JS, and JSON (use -minify=false to keep them)")
+	inline := flag.Bool("inline", false, "keep data: URLs inline instead of writing build/assets/")
+	force := flag.Bool("force", false, "rebuild everything, ignoring the build manifest")
+	pagesFlag := flag.String("pages", "", "how to write the extra output files: copy, hardlink, symlink, or redirect (overrides site.outputMode)")
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: %s [-force] [-inline] [-minify=false] [-pages mode] [dir]\n", filepath.Base(os.Args[0]))
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+
 	dir := "."
-	if len(os.Args) > 1 {
-		dir = os.Args[1]
+	if flag.NArg() > 0 {
+		dir = flag.Arg(0)
 	}
 
 	htmlPath := filepath.Join(dir, "index.html")
@@ -43,46 +142,204 @@ func main() {
 		os.Exit(1)
 	}
 
-	html := string(htmlBytes)
-	css := string(cssBytes)
-	js := string(jsBytes)
+	buildDir := filepath.Join(dir, "build")
+	err = os.MkdirAll(buildDir, 0755)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error creating build directory: %v\n", err)
+		os.Exit(1)
+	}
+
+	// Output files: the pages that should all be identical
+	settings := readOutputSettings(jsonBytes)
+	mode := settings.OutputMode
+	if *pagesFlag != "" {
+		mode = *pagesFlag
+	}
+	if mode == "" {
+		mode = defaultOutputMode
+	}
+	if !validOutputModes[mode] {
+		fmt.Fprintf(os.Stderr, "Error: unknown output mode %q (use copy, hardlink, symlink, or redirect)\n", mode)
+		os.Exit(1)
+	}
+	outputFiles, err := cleanOutputFiles(settings.OutputFiles)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error in site.outputFiles: %v\n", err)
+		os.Exit(1)
+	}
+
+	// Compare against the previous build
+	manifestPath := filepath.Join(dir, manifestName)
+	next := &buildManifest{
+		Version: manifestVersion,
+		Options: fmt.Sprintf("inline=%v minify=%v pages=%s", *inline, *minify, mode),
+		Inputs: map[string]string{
+			"index.html":       hashHex(htmlBytes),
+			"styles.css":       hashHex(cssBytes),
+			"scripts.js":       hashHex(jsBytes),
+			"crissy-data.json": hashHex(jsonBytes),
+		},
+	}
+	var prev *buildManifest
+	if !*force {
+		prev = loadManifest(manifestPath)
+	}
+	if prev.upToDate(next, buildDir) {
+		fmt.Println("Build up to date (no inputs changed).")
+		return
+	}
+
+	// The page template depends only on the HTML, CSS, and JS. Reuse the
+	// one from the last build when those are unchanged.
+	if prev.templateValid(next) {
+		next.Template = prev.Template
+		fmt.Println("Reusing inlined CSS and JS from the previous build.")
+	} else {
+		next.Template = buildTemplate(string(htmlBytes), string(cssBytes), string(jsBytes), *minify)
+	}
+
+	// Move data: URLs out of the JSON into build/assets/
 	jsonData := string(jsonBytes)
+	assetsDir := filepath.Join(buildDir, assetsDirName)
+	if *inline {
+		os.RemoveAll(assetsDir)
+	} else {
+		var assets map[string][]byte
+		jsonData, assets = extractAssets(jsonData)
+		err = writeAssets(assetsDir, assets, next)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Error writing assets: %v\n", err)
+			os.Exit(1)
+		}
+	}
+
+	if *minify {
+		before := len(jsonData)
+		jsonData = minifyJSON(jsonData)
+		reportMinify("crissy-data.json", before, len(jsonData))
+	}
+
+	html := strings.Replace(next.Template, dataPlaceholder, jsonData, 1)
+	err = writePages(buildDir, outputFiles, html, mode, next)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error: %v\n", err)
+		os.Exit(1)
+	}
+
+	err = next.save(manifestPath)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Warning: could not write %s: %v\n", manifestName, err)
+	}
+
+	fmt.Println("Build complete.")
+}
+
+// buildTemplate inlines the CSS and the patched JS into the HTML and leaves
+// dataPlaceholder where the JSON goes. With minify set, each part is
+// minified first and the finished page has its markup whitespace collapsed.
+func buildTemplate(html, css, js string, minify bool) string {
+	js = patchJSForInline(js)
+	if minify {
+		before := len(css)
+		css = minifyCSS(css)
+		reportMinify("styles.css", before, len(css))
+		before = len(js)
+		js = minifyJS(js)
+		reportMinify("scripts.js", before, len(js))
+	}
 
 	// Replace the external CSS link with inline style
 	inlineCSS := "<style>\n" + css + "\n</style>"
 	html = replaceLinkTag(html, inlineCSS)
 
 	// Replace the external JS script with inline script that embeds JSON data
-	inlineJS := "<script>\nvar __CRISSY_DATA__ = " + jsonData + ";\n</script>\n"
-	inlineJS += "<script>\n" + patchJSForInline(js) + "\n</script>"
+	inlineJS := "<script>\nvar __CRISSY_DATA__ = " + dataPlaceholder + ";\n</script>\n"
+	inlineJS += "<script>\n" + js + "\n</script>"
 	html = replaceScriptTag(html, inlineJS)
 
-	// Output files: the 4 pages that should all be identical
-	outputFiles := []string{
-		"index.html",
-		"projects.html",
-		"links.html",
-		"about.html",
+	if minify {
+		before := len(html)
+		html = minifyHTML(html)
+		reportMinify("page markup", before, len(html))
 	}
+	return html
+}
 
-	buildDir := filepath.Join(dir, "build")
-	err = os.MkdirAll(buildDir, 0755)
+func hashHex(data []byte) string {
+	sum := sha256.Sum256(data)
+	return hex.EncodeToString(sum[:])
+}
+
+// loadManifest reads the previous build's manifest. A missing, unreadable,
+// or outdated manifest returns nil, which means build everything.
+func loadManifest(path string) *buildManifest {
+	data, err := os.ReadFile(path)
 	if err != nil {
-		fmt.Fprintf(os.Stderr, "Error creating build directory: %v\n", err)
-		os.Exit(1)
+		return nil
+	}
+	var m buildManifest
+	if json.Unmarshal(data, &m) != nil || m.Version != manifestVersion {
+		return nil
 	}
+	return &m
+}
 
-	for _, name := range outputFiles {
-		outPath := filepath.Join(buildDir, name)
-		err = os.WriteFile(outPath, []byte(html), 0644)
-		if err != nil {
-			fmt.Fprintf(os.Stderr, "Error writing %s: %v\n", name, err)
-			os.Exit(1)
+func (m *buildManifest) save(path string) error {
+	data, err := json.MarshalIndent(m, "", "  ")
+	if err != nil {
+		return err
+	}
+	return writeFileAtomic(path, append(data, '\n'))
+}
+
+// templateValid reports whether m's page template was built from the same
+// HTML, CSS, and JS as next.
+func (m *buildManifest) templateValid(next *buildManifest) bool {
+	if m == nil || m.Template == "" {
+		return false
+	}
+	for _, name := range []string{"index.html", "styles.css", "scripts.js"} {
+		if m.Inputs[name] != next.Inputs[name] {
+			return false
 		}
-		fmt.Printf("Built: %s\n", outPath)
 	}
+	return true
+}
 
-	fmt.Println("Build complete.")
+// upToDate reports whether the last build read the same inputs with the
+// same options, and every file it wrote is still there with the size and
+// mtime it had then.
+func (m *buildManifest) upToDate(next *buildManifest, buildDir string) bool {
+	if m == nil || m.Options != next.Options || len(m.Outputs) == 0 || len(m.Inputs) != len(next.Inputs) {
+		return false
+	}
+	for name, hash := range next.Inputs {
+		if m.Inputs[name] != hash {
+			return false
+		}
+	}
+	for _, out := range m.Outputs {
+		info, err := os.Lstat(filepath.Join(buildDir, filepath.FromSlash(out.Path)))
+		if err != nil || info.Size() != out.Size || info.ModTime().UnixNano() != out.ModTime {
+			return false
+		}
+	}
+	return true
+}
+
+// record adds a file the build produced, as it is now on disk, to m.
+func (m *buildManifest) record(buildDir, rel string, data []byte) error {
+	info, err := os.Lstat(filepath.Join(buildDir, filepath.FromSlash(rel)))
+	if err != nil {
+		return err
+	}
+	m.Outputs = append(m.Outputs, manifestOutput{
+		Path:    rel,
+		Hash:    hashHex(data),
+		Size:    info.Size(),
+		ModTime: info.ModTime().UnixNano(),
+	})
+	return nil
 }
 
 // replaceLinkTag replaces <link rel="stylesheet" href="styles.css"> with inline CSS
@@ -152,3 +409,624 @@ func patchJSForInline(js string) string {
 
 	return js[:startIdx] + replacement + js[endIdx:]
 }
+
+// extractAssets replaces every base64 data: URL string in the JSON text with
+// a relative "assets/<sha>.<ext>" path and returns the decoded files keyed by
+// that file name. The rest of the JSON is copied through byte for byte, so
+// key order and formatting are unchanged. Identical images share one file.
+func extractAssets(jsonData string) (string, map[string][]byte) {
+	assets := make(map[string][]byte)
+	var out strings.Builder
+	out.Grow(len(jsonData))
+
+	i := 0
+	for i < len(jsonData) {
+		if jsonData[i] != '"' {
+			out.WriteByte(jsonData[i])
+			i++
+			continue
+		}
+
+		// Find the end of this string literal
+		j := i + 1
+		for j < len(jsonData) && jsonData[j] != '"' {
+			if jsonData[j] == '\\' {
+				j++
+			}
+			j++
+		}
+		if j >= len(jsonData) {
+			out.WriteString(jsonData[i:])
+			break
+		}
+		literal := jsonData[i : j+1]
+		i = j + 1
+
+		if !strings.HasPrefix(literal, `"data:`) {
+			out.WriteString(literal)
+			continue
+		}
+		var value string
+		if json.Unmarshal([]byte(literal), &value) != nil {
+			out.WriteString(literal)
+			continue
+		}
+		name, data, ok := decodeDataURL(value)
+		if !ok {
+			out.WriteString(literal)
+			continue
+		}
+		assets[name] = data
+		ref, _ := json.Marshal(assetsDirName + "/" + name)
+		out.Write(ref)
+	}
+	return out.String(), assets
+}
+
+// decodeDataURL decodes a "data:<type>;base64,<payload>" URL and returns the
+// content-addressed file name for it. ok is false for URLs that are not
+// base64, have a media type we do not extract, or do not decode.
+func decodeDataURL(url string) (name string, data []byte, ok bool) {
+	comma := strings.IndexByte(url, ',')
+	if comma < 0 {
+		return "", nil, false
+	}
+	meta := url[len("data:"):comma]
+	if !strings.HasSuffix(meta, ";base64") {
+		return "", nil, false
+	}
+	mime := strings.ToLower(strings.SplitN(meta, ";", 2)[0])
+	ext, known := assetExtensions[mime]
+	if !known {
+		return "", nil, false
+	}
+
+	payload := strings.Map(func(r rune) rune {
+		if r == ' ' || r == '\n' || r == '\r' || r == '\t' {
+			return -1
+		}
+		return r
+	}, url[comma+1:])
+	data, err := base64.StdEncoding.DecodeString(payload)
+	if err != nil {
+		data, err = base64.RawStdEncoding.DecodeString(strings.TrimRight(payload, "="))
+		if err != nil {
+			return "", nil, false
+		}
+	}
+
+	sum := sha256.Sum256(data)
+	return hex.EncodeToString(sum[:8]) + ext, data, true
+}
+
+// writeAssets writes each asset into dir and removes files left over from
+// earlier builds. Names are content hashes, so an existing file of the same
+// size is already correct and is not rewritten (its mtime, and therefore the
+// server's ETag, stays the same).
+func writeAssets(dir string, assets map[string][]byte, m *buildManifest) error {
+	if len(assets) == 0 {
+		os.RemoveAll(dir)
+		return nil
+	}
+	if err := os.MkdirAll(dir, 0755); err != nil {
+		return err
+	}
+
+	names := make([]string, 0, len(assets))
+	total, written := 0, 0
+	for name, data := range assets {
+		names = append(names, name)
+		total += len(data)
+	}
+	sort.Strings(names)
+
+	for _, name := range names {
+		data := assets[name]
+		path := filepath.Join(dir, name)
+		if info, err := os.Stat(path); err != nil || !info.Mode().IsRegular() || info.Size() != int64(len(data)) {
+			if err := writeFileAtomic(path, data); err != nil {
+				return err
+			}
+			written++
+		}
+		if err := m.record(filepath.Dir(dir), assetsDirName+"/"+name, data); err != nil {
+			return err
+		}
+	}
+
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		return err
+	}
+	for _, entry := range entries {
+		if _, keep := assets[entry.Name()]; !keep {
+			os.RemoveAll(filepath.Join(dir, entry.Name()))
+		}
+	}
+
+	fmt.Printf("Assets: %d file(s), %d KB in %s (%d written)\n", len(names), (total+1023)/1024, dir, written)
+	return nil
+}
+
+// readOutputSettings pulls site.outputFiles and site.outputMode out of the
+// data file. A file that does not parse yields empty settings, and the
+// defaults apply.
+func readOutputSettings(jsonBytes []byte) outputSettings {
+	var doc struct {
+		Site outputSettings `json:"site"`
+	}
+	json.Unmarshal(jsonBytes, &doc)
+	return doc.Site
+}
+
+// cleanOutputFiles checks that every output name is a plain file name inside
+// build/ and drops duplicates. An empty list means the default pages.
+func cleanOutputFiles(names []string) ([]string, error) {
+	if len(names) == 0 {
+		return defaultOutputFiles, nil
+	}
+	seen := make(map[string]bool)
+	var result []string
+	for _, name := range names {
+		name = strings.TrimSpace(name)
+		if name == "" || seen[name] {
+			continue
+		}
+		if name == "." || name == ".." || strings.ContainsAny(name, "/\\:") {
+			return nil, fmt.Errorf("%q is not a plain file name", name)
+		}
+		seen[name] = true
+		result = append(result, name)
+	}
+	if len(result) == 0 {
+		return defaultOutputFiles, nil
+	}
+	return result, nil
+}
+
+// writePages writes html to the first output file and derives the others
+// from it using mode. A page that already has the right contents (or is
+// already the right link) is left alone so its mtime and ETag do not
+// change. The first file is replaced with a rename, so pages hardlinked to
+// it by an earlier build keep their old contents until they are themselves
+// replaced below.
+func writePages(buildDir string, names []string, html, mode string, m *buildManifest) error {
+	primary := names[0]
+	primaryPath := filepath.Join(buildDir, primary)
+	changed, err := writeIfChanged(primaryPath, []byte(html))
+	if err != nil {
+		return fmt.Errorf("writing %s: %v", primary, err)
+	}
+	reportPage(primaryPath, changed, fmt.Sprintf("%d KB", (len(html)+1023)/1024))
+	if err := m.record(buildDir, primary, []byte(html)); err != nil {
+		return err
+	}
+	primaryInfo, _ := os.Stat(primaryPath)
+
+	stub := []byte(redirectStub(primary))
+	for _, name := range names[1:] {
+		outPath := filepath.Join(buildDir, name)
+		how := mode
+		content := []byte(html)
+		switch mode {
+		case "hardlink":
+			changed, err = true, nil
+			if info, statErr := os.Lstat(outPath); statErr == nil && os.SameFile(info, primaryInfo) {
+				changed = false
+			} else {
+				os.Remove(outPath)
+				err = os.Link(primaryPath, outPath)
+			}
+		case "symlink":
+			changed, err = true, nil
+			if target, linkErr := os.Readlink(outPath); linkErr == nil && target == primary {
+				changed = false
+			} else {
+				os.Remove(outPath)
+				err = os.Symlink(primary, outPath)
+			}
+		case "redirect":
+			content = stub
+			changed, err = writeIfChanged(outPath, content)
+		default:
+			if info, statErr := os.Lstat(outPath); statErr == nil && os.SameFile(info, primaryInfo) {
+				// Still a hard link from an earlier build: make it a real copy
+				os.Remove(outPath)
+			}
+			changed, err = writeIfChanged(outPath, content)
+		}
+		if err != nil && (mode == "hardlink" || mode == "symlink") {
+			// Filesystem without link support: fall back to a full copy
+			how = "copy"
+			changed, err = writeIfChanged(outPath, content)
+		}
+		if err != nil {
+			return fmt.Errorf("writing %s: %v", name, err)
+		}
+		reportPage(outPath, changed, how+" of "+primary)
+		if err := m.record(buildDir, name, content); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+func reportPage(path string, changed bool, detail string) {
+	if changed {
+		fmt.Printf("Built: %s (%s)\n", path, detail)
+	} else {
+		fmt.Printf("Unchanged: %s (%s)\n", path, detail)
+	}
+}
+
+// writeIfChanged writes data to path unless the file already holds exactly
+// those bytes. It reports whether it wrote anything.
+func writeIfChanged(path string, data []byte) (bool, error) {
+	if info, err := os.Lstat(path); err == nil && info.Mode().IsRegular() && info.Size() == int64(len(data)) {
+		if existing, err := os.ReadFile(path); err == nil && bytes.Equal(existing, data) {
+			return false, nil
+		}
+	}
+	return true, writeFileAtomic(path, data)
+}
+
+// redirectStub returns a page that forwards to target, keeping any query
+// string and fragment, for hosts where links are not an option.
+func redirectStub(target string) string {
+	t := strings.NewReplacer("&", "&amp;", "\"", "&quot;", "<", "&lt;", ">", "&gt;").Replace(target)
+	js, _ := json.Marshal(target)
+	return "<!DOCTYPE html>\n" +
+		"<html lang=\"en\">\n" +
+		"<head>\n" +
+		"<meta charset=\"UTF-8\">\n" +
+		"<title>Redirecting</title>\n" +
+		"<link rel=\"canonical\" href=\"" + t + "\">\n" +
+		"<meta http-equiv=\"refresh\" content=\"0; url=" + t + "\">\n" +
+		"<script>location.replace(" + string(js) + " + location.search + location.hash);</script>\n" +
+		"</head>\n" +
+		"<body>\n" +
+		"<p><a href=\"" + t + "\">Continue to " + t + "</a></p>\n" +
+		"</body>\n" +
+		"</html>\n"
+}
+
+// writeFileAtomic writes data to a temporary file next to path and renames
+// it into place, so readers never see a half-written page.
+func writeFileAtomic(path string, data []byte) error {
+	tmp := path + ".tmp"
+	if err := os.WriteFile(tmp, data, 0644); err != nil {
+		return err
+	}
+	if err := os.Rename(tmp, path); err != nil {
+		os.Remove(tmp)
+		return err
+	}
+	return nil
+}
+
+/*
+ * Minification. These follow the same rules as the beautify tool's
+ * --compact mode: never touch the inside of a string, and only drop what
+ * cannot change meaning. Each pass is a single forward scan.
+ */
+
+func reportMinify(name string, before, after int) {
+	saved := 0
+	if before > 0 {
+		saved = (before - after) * 100 / before
+	}
+	fmt.Printf("Minify: %-18s %7d -> %7d bytes (-%d%%)\n", name, before, after, saved)
+}
+
+func isSpace(c byte) bool {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'
+}
+
+// copyQuoted copies the string literal starting at src[i] (whose quote
+// character is src[i]) to out and returns the index just past it.
+func copyQuoted(out *strings.Builder, src string, i int) int {
+	quote := src[i]
+	out.WriteByte(quote)
+	for i++; i < len(src); i++ {
+		c := src[i]
+		out.WriteByte(c)
+		if c == '\\' && i+1 < len(src) {
+			i++
+			out.WriteByte(src[i])
+		} else if c == quote {
+			return i + 1
+		}
+	}
+	return i
+}
+
+// minifyJSON drops all whitespace outside strings, like compact_json in
+// beautify.c.
+func minifyJSON(src string) string {
+	var out strings.Builder
+	out.Grow(len(src))
+	for i := 0; i < len(src); {
+		c := src[i]
+		if c == '"' {
+			i = copyQuoted(&out, src, i)
+			continue
+		}
+		if !isSpace(c) {
+			out.WriteByte(c)
+		}
+		i++
+	}
+	return out.String()
+}
+
+// minifyCSS removes comments and collapses whitespace, dropping it next to
+// { } ; , > and after the colon of a declaration, along with the last
+// semicolon of each block. Text is gathered a segment at a time, up to the
+// next { ; or }, because a colon in "a :hover {" is part of a selector and
+// its space must stay. Spaces inside values such as calc(1px + 2px) or
+// "and (" in media queries are kept.
+func minifyCSS(src string) string {
+	const tight = "{};,>"
+	var out strings.Builder
+	out.Grow(len(src))
+	var seg []byte
+	colon := -1 // index in seg of a space after the segment's first colon
+	pendingSpace, pendingSemicolon := false, false
+
+	lastByte := func() byte {
+		if len(seg) > 0 {
+			return seg[len(seg)-1]
+		}
+		str := out.String()
+		if len(str) == 0 {
+			return 0
+		}
+		return str[len(str)-1]
+	}
+	flush := func(declaration bool) {
+		if declaration && colon >= 0 {
+			seg = append(seg[:colon], seg[colon+1:]...)
+		}
+		out.Write(seg)
+		seg = seg[:0]
+		colon = -1
+	}
+
+	for i := 0; i < len(src); {
+		c := src[i]
+		if c == '/' && i+1 < len(src) && src[i+1] == '*' {
+			end := strings.Index(src[i+2:], "*/")
+			if end < 0 {
+				break
+			}
+			i += end + 4
+			pendingSpace = true
+			continue
+		}
+		if isSpace(c) {
+			pendingSpace = true
+			i++
+			continue
+		}
+
+		if pendingSemicolon && c != '}' {
+			// Held back in case it is the last one in the block
+			out.WriteByte(';')
+		}
+		pendingSemicolon = false
+		last := lastByte()
+		if pendingSpace && last != 0 && !strings.ContainsRune(tight, rune(last)) && !strings.ContainsRune(tight, rune(c)) {
+			if last == ':' && colon < 0 && !strings.ContainsRune(string(seg[:len(seg)-1]), ':') {
+				colon = len(seg)
+			}
+			seg = append(seg, ' ')
+		}
+		pendingSpace = false
+
+		switch c {
+		case '"', '\'':
+			var lit strings.Builder
+			i = copyQuoted(&lit, src, i)
+			seg = append(seg, lit.String()...)
+			continue
+		case '{':
+			flush(false)
+			out.WriteByte('{')
+		case ';':
+			flush(true)
+			pendingSemicolon = true
+		case '}':
+			flush(true)
+			out.WriteByte('}')
+		default:
+			seg = append(seg, c)
+		}
+		i++
+	}
+	flush(true)
+	if pendingSemicolon {
+		out.WriteByte(';')
+	}
+	return out.String()
+}
+
+// jsRegexPrefix reports whether a '/' following the given output can only
+// start a regular expression literal rather than be a division.
+func jsRegexPrefix(prev string) bool {
+	prev = strings.TrimRight(prev, " \n")
+	if prev == "" {
+		return true
+	}
+	if strings.ContainsRune("(,=:[!&|?{};+-*%<>~^", rune(prev[len(prev)-1])) {
+		return true
+	}
+	for _, kw := range []string{"return", "typeof", "case", "do", "else", "in", "of", "new", "delete", "void", "throw"} {
+		if strings.HasSuffix(prev, kw) {
+			n := len(prev) - len(kw)
+			if n == 0 || !isIdentChar(prev[n-1]) {
+				return true
+			}
+		}
+	}
+	return false
+}
+
+func isIdentChar(c byte) bool {
+	return c == '_' || c == '$' || c >= 0x80 ||
+		(c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+}
+
+// minifyJS removes comments and collapses whitespace. Line breaks are kept
+// wherever automatic semicolon insertion could depend on them, which is
+// everywhere except after { ; , ( [ and before } ) ]. Spaces are dropped
+// next to punctuation that cannot merge with its neighbor into a different
+// token. Strings, template literals, and regex literals pass through as is.
+func minifyJS(src string) string {
+	const tight = "{}()[];,:=<>?!&|*%^~+-"
+	var out strings.Builder
+	out.Grow(len(src))
+	pendingSpace, pendingNewline := false, false
+	last := byte(0)
+
+	emit := func(c byte) {
+		if pendingNewline && last != 0 && !strings.ContainsRune("{;,([", rune(last)) && !strings.ContainsRune("})]", rune(c)) {
+			out.WriteByte('\n')
+		} else if pendingSpace && last != 0 {
+			keep := !strings.ContainsRune(tight, rune(last)) && !strings.ContainsRune(tight, rune(c))
+			if (last == '+' || last == '-') && (c == '+' || c == '-') {
+				keep = true
+			}
+			if keep {
+				out.WriteByte(' ')
+			}
+		}
+		pendingSpace, pendingNewline = false, false
+	}
+
+	for i := 0; i < len(src); {
+		c := src[i]
+		switch {
+		case c == '\n' || c == '\r':
+			pendingNewline = true
+			i++
+		case isSpace(c):
+			pendingSpace = true
+			i++
+		case c == '/' && i+1 < len(src) && src[i+1] == '/':
+			for i < len(src) && src[i] != '\n' {
+				i++
+			}
+		case c == '/' && i+1 < len(src) && src[i+1] == '*':
+			end := strings.Index(src[i+2:], "*/")
+			if end < 0 {
+				i = len(src)
+				break
+			}
+			if strings.ContainsRune(src[i:i+end+4], '\n') {
+				pendingNewline = true
+			}
+			pendingSpace = true
+			i += end + 4
+		case c == '"' || c == '\'' || c == '`':
+			emit(c)
+			i = copyQuoted(&out, src, i)
+			last = c
+		case c == '/' && jsRegexPrefix(out.String()):
+			emit(c)
+			start := i
+			inClass := false
+			for i++; i < len(src) && src[i] != '\n'; i++ {
+				if src[i] == '\\' {
+					i++
+				} else if src[i] == '[' {
+					inClass = true
+				} else if src[i] == ']' {
+					inClass = false
+				} else if src[i] == '/' && !inClass {
+					break
+				}
+			}
+			i++
+			for i < len(src) && isIdentChar(src[i]) {
+				i++
+			}
+			if i > len(src) {
+				i = len(src)
+			}
+			out.WriteString(src[start:i])
+			last = 'a'
+		default:
+			emit(c)
+			out.WriteByte(c)
+			last = c
+			i++
+		}
+	}
+	return out.String()
+}
+
+// minifyHTML drops comments (except conditional comments) and collapses
+// each run of whitespace in the markup to a single space or line break.
+// Whitespace between inline elements can be visible, so it is shortened
+// rather than removed. The contents of script, style, pre, and textarea
+// are copied unchanged.
+func minifyHTML(src string) string {
+	var out strings.Builder
+	out.Grow(len(src))
+	lower := strings.ToLower(src)
+
+	for i := 0; i < len(src); {
+		c := src[i]
+		if c == '<' {
+			if strings.HasPrefix(src[i:], "<!--") && !strings.HasPrefix(src[i:], "<!--[if") {
+				end := strings.Index(src[i+4:], "-->")
+				if end < 0 {
+					break
+				}
+				i += end + 7
+				continue
+			}
+			end := strings.IndexByte(src[i:], '>')
+			if end < 0 {
+				out.WriteString(src[i:])
+				break
+			}
+			tag := src[i : i+end+1]
+			out.WriteString(tag)
+			i += end + 1
+
+			for _, raw := range []string{"script", "style", "pre", "textarea"} {
+				if strings.HasPrefix(lower[i-len(tag):], "<"+raw) && !isIdentChar(lower[i-len(tag)+1+len(raw)]) {
+					close := strings.Index(lower[i:], "</"+raw)
+					if close < 0 {
+						close = len(src) - i
+					}
+					out.WriteString(src[i : i+close])
+					i += close
+					break
+				}
+			}
+			continue
+		}
+		if isSpace(c) {
+			j := i
+			newline := false
+			for j < len(src) && isSpace(src[j]) {
+				if src[j] == '\n' {
+					newline = true
+				}
+				j++
+			}
+			if newline {
+				out.WriteByte('\n')
+			} else {
+				out.WriteByte(' ')
+			}
+			i = j
+			continue
+		}
+		out.WriteByte(c)
+		i++
+	}
+	return out.String()
+}
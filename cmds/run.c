@@ -10,14 +10,20 @@
  * integrates with any tool-call protocol (MCP, function-calling JSON,
  * plain pipes, etc.).
  *
+ * Commands run in their own process group (a Job Object on Windows) with
+ * their output on pipes.  Output is passed through as it arrives and
+ * counted, and --timeout kills the whole group at the deadline, so a
+ * hung command cannot block the caller forever.
+ *
  * Exit codes
  *   0  - command ran and finished with exit code 0
  *   1  - command ran but returned a non-zero exit code (echoed to stderr)
  *   2  - operator rejected the command
  *   3  - usage error (no command supplied)
+ *   4  - command was killed at the --timeout deadline
  *
  * Build
- *   gcc -O2 -o run run.c              (macOS / Linux)
+ *   gcc -O2 -pthread -o run run.c     (macOS / Linux)
  *   cl run.c /Fe:run.exe              (Windows MSVC)
  *   gcc -O2 -o run.exe run.c          (Windows MinGW)
  *
@@ -26,25 +32,38 @@
  *   ./run "ls -la /tmp"
  *   ./run git status
  *   echo '{"cmd":"ls"}' | ./run --json
+ *   ./run --batch --parallel 4 < steps.ndjson
  *
  * Flags
- *   --json     Read a single JSON object from stdin with a "cmd" field.
- *              The approval prompt still appears on the terminal.
- *   --yes      Skip the approval prompt (use only in trusted pipelines).
- *   --timeout  Seconds to wait for approval input (0 = no timeout, default).
- *   --log      Path to an append-only log file that records every request
- *              and its approval/rejection status with a timestamp.
+ *   --json       Read a single JSON object from stdin with a "cmd" field.
+ *                The approval prompt still appears on the terminal.
+ *   --batch      Read one JSON object per line from stdin and run them
+ *                all after a single approval prompt.
+ *   --parallel   Commands to run at once in --batch mode (default 4).
+ *   --yes        Skip the approval prompt (use only in trusted pipelines).
+ *   --timeout    Seconds a command may run before its process group is
+ *                killed (0 = no limit, default).
+ *   --max-output Bytes of stdout and of stderr kept per command in
+ *                --batch results (default 1 MiB).
+ *   --log        Path to an append-only log file that records every request
+ *                and its approval/rejection status with a timestamp.
  *
  * Compiles on Windows (MSVC, MinGW), macOS, and Linux with no external
  * libraries.  Uses only the C standard library and POSIX / Win32 process
  * APIs.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE      /* pipe2 */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "../lib/json.h"
+
 /* ---- Platform ---- */
 
 #ifdef _WIN32
@@ -54,10 +73,50 @@
   #include <windows.h>
   #include <io.h>
   #include <fcntl.h>
+  #include <process.h>
   #define IS_TTY(f) _isatty(_fileno(f))
+  #define write_fd(fd, p, n) _write(fd, p, (unsigned)(n))
+
+  /* Threads: Win32 primitives (Vista+) */
+  typedef HANDLE thread_t;
+  typedef CRITICAL_SECTION mutex_t;
+  #define THREAD_FUNC unsigned __stdcall
+  #define THREAD_RETURN return 0
+  #define mutex_init(m)      InitializeCriticalSection(m)
+  #define mutex_lock(m)      EnterCriticalSection(m)
+  #define mutex_unlock(m)    LeaveCriticalSection(m)
+  static int thread_start(thread_t *t, unsigned (__stdcall *fn)(void *), void *arg) {
+      *t = (HANDLE)_beginthreadex(NULL, 0, fn, arg, 0, NULL);
+      return *t ? 0 : -1;
+  }
+  static void thread_join(thread_t t) {
+      WaitForSingleObject(t, INFINITE);
+      CloseHandle(t);
+  }
 #else
   #include <unistd.h>
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <signal.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+  #include <pthread.h>
   #define IS_TTY(f) isatty(fileno(f))
+  #define write_fd(fd, p, n) write(fd, p, n)
+
+  /* Threads: POSIX */
+  typedef pthread_t thread_t;
+  typedef pthread_mutex_t mutex_t;
+  #define THREAD_FUNC void *
+  #define THREAD_RETURN return NULL
+  #define mutex_init(m)      pthread_mutex_init(m, NULL)
+  #define mutex_lock(m)      pthread_mutex_lock(m)
+  #define mutex_unlock(m)    pthread_mutex_unlock(m)
+  static int thread_start(thread_t *t, void *(*fn)(void *), void *arg) {
+      return pthread_create(t, NULL, fn, arg) == 0 ? 0 : -1;
+  }
+  static void thread_join(thread_t t) { pthread_join(t, NULL); }
 #endif
 
 /* ---- Constants ---- */
@@ -66,18 +125,28 @@
 #define EXIT_CMDFAIL   1
 #define EXIT_REJECTED  2
 #define EXIT_USAGE     3
+#define EXIT_TIMEOUT   4
 
 #define CMD_MAX        8192
 #define LINE_MAX_BUF   256
 #define LOG_LINE_MAX   9000
 
+#define BATCH_MAX      1024             /* commands per --batch run */
+#define PARALLEL_MAX   64
+#define KILL_GRACE_MS  2000             /* SIGTERM, then SIGKILL this much later */
+
 /* ---- Globals set by flags ---- */
 
 static int  flag_yes     = 0;
 static int  flag_json    = 0;
 static int  flag_timeout = 0;
+static int  flag_batch   = 0;
+static int  flag_parallel = 4;
+static long flag_max_output = 1024 * 1024;
 static char flag_log[1024] = {0};
 
+static mutex_t log_lock;                /* batch workers log concurrently */
+
 /* ---- Helpers ---- */
 
 static void timestamp(char *buf, size_t len) {
@@ -88,14 +157,75 @@ static void timestamp(char *buf, size_t len) {
 
 static void log_entry(const char *cmd, const char *status) {
     if (flag_log[0] == '\0') return;
+    mutex_lock(&log_lock);
     FILE *fp = fopen(flag_log, "a");
-    if (!fp) return;
-    char ts[64];
-    timestamp(ts, sizeof(ts));
-    fprintf(fp, "[%s] %s | %s\n", ts, status, cmd);
-    fclose(fp);
+    if (fp) {
+        char ts[64];
+        timestamp(ts, sizeof(ts));
+        fprintf(fp, "[%s] %s | %s\n", ts, status, cmd);
+        fclose(fp);
+    }
+    mutex_unlock(&log_lock);
+}
+
+/* Monotonic milliseconds */
+static long long now_ms(void) {
+#ifdef _WIN32
+    return (long long)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
 }
 
+/* ---- JSON ---- */
+
+/*
+ * Reading {"cmd": ...} objects goes through lib/json.h, which matches
+ * keys among the top-level members only, so a "cmd" inside a string
+ * value or a nested object is never picked up.
+ */
+
+/*
+ * Decode the string member key of the object in json[0..len) into a new
+ * buffer of at most max bytes.  Returns 1 on success, 0 when the member
+ * is missing, -1 when it is not a string (or the object is malformed)
+ * and -2 when it is too long.
+ */
+static int json_string_member(const char *json, size_t len, const char *key,
+                              char **out, size_t max) {
+    json_lexer lx;
+    json_token val;
+    int found = json_find_member(&lx, json, len, key, &val);
+    if (found <= 0) return found;
+    if (val.type != JSON_TOK_STRING) return -1;
+    size_t n;
+    *out = json_strdup(&val, &n);
+    if (!*out) return -1;
+    if (n >= max) {
+        free(*out);
+        *out = NULL;
+        return -2;
+    }
+    return 1;
+}
+
+/*
+ * Write s as a JSON string.  Command output can be anything, so bytes
+ * that are not valid UTF-8 become U+FFFD rather than breaking the JSON.
+ */
+static void json_put_string(FILE *fp, const char *s, size_t len) {
+    json_buf b = JSON_BUF_INIT;
+    json_buf_string(&b, s, len);
+    if (b.failed) fputs("\"\"", fp);
+    else fwrite(b.data, 1, b.len, fp);
+    json_buf_free(&b);
+}
+
+/* ---- Input ---- */
+
+
 /*
  * Build a single command string from argv tokens.
  * Handles quoting on Windows where necessary.
@@ -138,74 +268,88 @@ static int build_command(int argc, char **argv, int start, char *out, size_t out
     return 0;
 }
 
+/* Read all of fp into a NUL-terminated heap buffer */
+static char *read_all(FILE *fp, size_t *out_len) {
+    size_t len = 0, cap = 4096;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    size_t got;
+    while ((got = fread(buf + len, 1, cap - len - 1, fp)) > 0) {
+        len += got;
+        if (cap - len - 1 == 0) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) { free(buf); return NULL; }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    buf[len] = '\0';
+    if (out_len) *out_len = len;
+    return buf;
+}
+
+/* Read one line of any length; returns its length, or -1 at EOF */
+static long read_line(FILE *fp, char **buf, size_t *cap) {
+    size_t len = 0;
+    int ch;
+    if (!*buf) {
+        *cap = 1024;
+        *buf = malloc(*cap);
+        if (!*buf) return -1;
+    }
+    while ((ch = fgetc(fp)) != EOF && ch != '\n') {
+        if (len + 1 >= *cap) {
+            char *grown = realloc(*buf, *cap * 2);
+            if (!grown) return -1;
+            *buf = grown;
+            *cap *= 2;
+        }
+        (*buf)[len++] = (char)ch;
+    }
+    if (ch == EOF && len == 0) return -1;
+    if (len > 0 && (*buf)[len - 1] == '\r') len--;
+    (*buf)[len] = '\0';
+    return (long)len;
+}
+
 /*
  * Read the "cmd" value from a JSON blob on stdin.
- * Minimal parser -- finds "cmd" key and extracts the string value.
  */
 static int read_json_cmd(char *out, size_t out_len) {
-    char buf[CMD_MAX];
-    size_t total = 0;
-    while (total < sizeof(buf) - 1) {
-        int ch = fgetc(stdin);
-        if (ch == EOF) break;
-        buf[total++] = (char)ch;
+    char *buf = read_all(stdin, NULL);
+    if (!buf) {
+        fprintf(stderr, "run: out of memory reading JSON input\n");
+        return -1;
     }
-    buf[total] = '\0';
 
-    /* Find "cmd" key */
-    char *key = strstr(buf, "\"cmd\"");
-    if (!key) {
-        key = strstr(buf, "'cmd'");
-    }
-    if (!key) {
+    char *cmd = NULL;
+    int rc = json_string_member(buf, strlen(buf), "cmd", &cmd, out_len);
+    free(buf);
+    if (rc == 0) {
         fprintf(stderr, "run: JSON input missing \"cmd\" field\n");
         return -1;
     }
-
-    /* Skip past key and colon */
-    char *p = key + 5;
-    while (*p && (*p == ' ' || *p == '\t' || *p == ':')) p++;
-
-    if (*p != '"' && *p != '\'') {
+    if (rc == -1) {
         fprintf(stderr, "run: \"cmd\" value must be a string\n");
         return -1;
     }
-    char quote = *p;
-    p++;
-
-    size_t i = 0;
-    while (*p && *p != quote && i < out_len - 1) {
-        if (*p == '\\' && *(p + 1)) {
-            p++;
-            switch (*p) {
-                case 'n':  out[i++] = '\n'; break;
-                case 't':  out[i++] = '\t'; break;
-                case '\\': out[i++] = '\\'; break;
-                case '"':  out[i++] = '"';  break;
-                case '\'': out[i++] = '\''; break;
-                default:   out[i++] = *p;   break;
-            }
-        } else {
-            out[i++] = *p;
-        }
-        p++;
+    if (rc == -2) {
+        fprintf(stderr, "run: \"cmd\" value is longer than %d bytes\n", CMD_MAX);
+        return -1;
     }
-    out[i] = '\0';
+    strcpy(out, cmd);
+    free(cmd);
     return 0;
 }
 
+/* ---- Approval ---- */
+
 /*
- * Prompt the operator for approval.
+ * Read the operator's answer.
  * Reads from /dev/tty (Unix) or CON (Windows) so it works even when
  * stdin is piped.
  */
-static int prompt_approval(const char *cmd) {
-    fprintf(stderr, "\n");
-    fprintf(stderr, "=== COMMAND APPROVAL REQUIRED ===\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "  %s\n", cmd);
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Approve? [y/N]: ");
+static int read_approval(void) {
     fflush(stderr);
 
     FILE *tty = NULL;
@@ -242,23 +386,610 @@ static int prompt_approval(const char *cmd) {
 }
 
 /*
- * Run the command and return its exit code.
+ * Prompt the operator for approval of a single command.
+ */
+static int prompt_approval(const char *cmd) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "=== COMMAND APPROVAL REQUIRED ===\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  %s\n", cmd);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Approve? [y/N]: ");
+    return read_approval();
+}
+
+/* ---- Process execution ---- */
+
+/*
+ * Where one output stream of a child goes.  In single mode the bytes are
+ * passed straight through to our own stdout/stderr (fd); in batch mode
+ * up to limit bytes are kept in data for the JSON result.  bytes always
+ * counts everything the command wrote.
  */
-static int run_command(const char *cmd) {
+typedef struct {
+    int        fd;          /* pass-through target, or -1 */
+    char      *data;
+    size_t     len;
+    size_t     cap;
+    size_t     limit;       /* bytes to keep in data (0 = none) */
+    long long  bytes;
+} out_sink;
+
+typedef struct {
+    int        exit_code;
+    int        timed_out;
+    int        spawn_failed;
+    long long  duration_ms;
+    out_sink   out;
+    out_sink   err;
+} child_result;
+
+static void sink_put(out_sink *s, const char *p, size_t n) {
+    s->bytes += (long long)n;
+
+    /* Pass-through; a closed reader just stops the echo, not the command */
+    size_t off = 0;
+    while (s->fd >= 0 && off < n) {
+        long w = (long)write_fd(s->fd, p + off, n - off);
+        if (w > 0) {
+            off += (size_t)w;
+            continue;
+        }
+#ifndef _WIN32
+        if (w < 0 && errno == EINTR) continue;
+#endif
+        s->fd = -1;
+    }
+
+    if (s->len >= s->limit) return;
+    if (n > s->limit - s->len) n = s->limit - s->len;
+    if (s->len + n > s->cap) {
+        size_t cap = s->cap ? s->cap : 4096;
+        while (cap < s->len + n) cap *= 2;
+        char *grown = realloc(s->data, cap);
+        if (!grown) return;
+        s->data = grown;
+        s->cap = cap;
+    }
+    memcpy(s->data + s->len, p, n);
+    s->len += n;
+}
+
 #ifdef _WIN32
-    /*
-     * On Windows, use CreateProcess for proper exit-code capture.
-     * Fall back to system() for simplicity.
-     */
-    int ret = system(cmd);
-    return ret;
+
+typedef struct {
+    HANDLE    pipe;
+    out_sink *sink;
+} pipe_reader;
+
+static THREAD_FUNC pipe_reader_main(void *arg) {
+    pipe_reader *pr = (pipe_reader *)arg;
+    char buf[16384];
+    DWORD got;
+    while (ReadFile(pr->pipe, buf, sizeof(buf), &got, NULL) && got > 0) {
+        sink_put(pr->sink, buf, got);
+    }
+    THREAD_RETURN;
+}
+
+/*
+ * Run cmd through cmd.exe inside a Job Object.  The job is what makes
+ * the timeout stick: TerminateJobObject takes down everything the
+ * command started, not just cmd.exe.
+ */
+static void run_child(const char *cmd, int timeout_s, int null_stdin, child_result *r) {
+    long long start = now_ms();
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+    HANDLE out_r, out_w, err_r, err_w;
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+
+    if (!CreatePipe(&out_r, &out_w, &sa, 0)) {
+        r->spawn_failed = 1;
+        return;
+    }
+    if (!CreatePipe(&err_r, &err_w, &sa, 0)) {
+        CloseHandle(out_r);
+        CloseHandle(out_w);
+        r->spawn_failed = 1;
+        return;
+    }
+    SetHandleInformation(out_r, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(err_r, HANDLE_FLAG_INHERIT, 0);
+    if (null_stdin) {
+        in = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         &sa, OPEN_EXISTING, 0, NULL);
+    }
+
+    STARTUPINFOA si;
+    memset(&si, 0, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = in;
+    si.hStdOutput = out_w;
+    si.hStdError = err_w;
+
+    char line[CMD_MAX + 32];
+    snprintf(line, sizeof(line), "cmd.exe /d /s /c \"%s\"", cmd);
+
+    HANDLE job = CreateJobObjectA(NULL, NULL);
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION li;
+    memset(&li, 0, sizeof(li));
+    li.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    if (job) SetInformationJobObject(job, JobObjectExtendedLimitInformation, &li, sizeof(li));
+
+    PROCESS_INFORMATION pi;
+    BOOL ok = CreateProcessA(NULL, line, NULL, NULL, TRUE, CREATE_SUSPENDED,
+                             NULL, NULL, &si, &pi);
+    CloseHandle(out_w);
+    CloseHandle(err_w);
+    if (null_stdin && in != INVALID_HANDLE_VALUE) CloseHandle(in);
+    if (!ok) {
+        CloseHandle(out_r);
+        CloseHandle(err_r);
+        if (job) CloseHandle(job);
+        r->spawn_failed = 1;
+        return;
+    }
+    if (job) AssignProcessToJobObject(job, pi.hProcess);
+    ResumeThread(pi.hThread);
+    CloseHandle(pi.hThread);
+
+    pipe_reader readers[2] = { { out_r, &r->out }, { err_r, &r->err } };
+    thread_t threads[2];
+    int started[2];
+    for (int i = 0; i < 2; i++) {
+        started[i] = thread_start(&threads[i], pipe_reader_main, &readers[i]) == 0;
+    }
+
+    DWORD wait = timeout_s > 0 ? (DWORD)timeout_s * 1000 : INFINITE;
+    if (WaitForSingleObject(pi.hProcess, wait) == WAIT_TIMEOUT) {
+        r->timed_out = 1;
+        if (job) TerminateJobObject(job, 124);
+        else TerminateProcess(pi.hProcess, 124);
+        WaitForSingleObject(pi.hProcess, INFINITE);
+    }
+    DWORD code = 1;
+    GetExitCodeProcess(pi.hProcess, &code);
+    r->exit_code = (int)code;
+    CloseHandle(pi.hProcess);
+
+    /* Closing the job ends anything left holding the pipes open */
+    if (job) CloseHandle(job);
+    for (int i = 0; i < 2; i++) {
+        if (started[i]) thread_join(threads[i]);
+    }
+    CloseHandle(out_r);
+    CloseHandle(err_r);
+    r->duration_ms = now_ms() - start;
+}
+
 #else
-    int ret = system(cmd);
-    if (ret == -1) return 1;
-    /* POSIX: system() returns the status from waitpid. Extract exit code. */
-    if (WIFEXITED(ret)) return WEXITSTATUS(ret);
-    return 1;
+
+/* Poll interval while waiting on a child that has closed its pipes */
+#define REAP_POLL_MS 50
+
+static int drain_fd(int fd, out_sink *sink) {
+    char buf[16384];
+    for (;;) {
+        ssize_t got = read(fd, buf, sizeof(buf));
+        if (got > 0) {
+            sink_put(sink, buf, (size_t)got);
+            return 1;
+        }
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && errno == EAGAIN) return 1;
+        return 0;       /* EOF or error: done with this fd */
+    }
+}
+
+/*
+ * A pipe whose ends are closed on exec, so the children other --batch
+ * workers fork meanwhile do not hold it open. dup2() in the child clears
+ * the flag on the copies it hands to the command.
+ */
+static int cloexec_pipe(int fds[2]) {
+    #if defined(__linux__) && defined(O_CLOEXEC)
+    return pipe2(fds, O_CLOEXEC);
+    #else
+    /* Not atomic: a fork between the two calls can still inherit the pipe */
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+    #endif
+}
+
+/*
+ * Run cmd through /bin/sh in a new process group with stdout and stderr
+ * on pipes.  At the deadline the whole group gets SIGTERM, then SIGKILL
+ * KILL_GRACE_MS later, so children the command started die with it.
+ */
+static void run_child(const char *cmd, int timeout_s, int null_stdin, child_result *r) {
+    long long start = now_ms();
+    int po[2], pe[2];
+
+    if (cloexec_pipe(po) != 0) {
+        r->spawn_failed = 1;
+        return;
+    }
+    if (cloexec_pipe(pe) != 0) {
+        close(po[0]);
+        close(po[1]);
+        r->spawn_failed = 1;
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(po[0]); close(po[1]);
+        close(pe[0]); close(pe[1]);
+        r->spawn_failed = 1;
+        return;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        signal(SIGPIPE, SIG_DFL);
+        if (null_stdin) {
+            int fd = open("/dev/null", O_RDONLY);
+            if (fd >= 0) {
+                dup2(fd, 0);
+                close(fd);
+            }
+        }
+        dup2(po[1], 1);
+        dup2(pe[1], 2);
+        close(po[0]); close(po[1]);
+        close(pe[0]); close(pe[1]);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    /* Set on both sides so kill(-pid) works whichever runs first */
+    setpgid(pid, pid);
+    close(po[1]);
+    close(pe[1]);
+
+    struct pollfd fds[2] = { { po[0], POLLIN, 0 }, { pe[0], POLLIN, 0 } };
+    out_sink *sinks[2] = { &r->out, &r->err };
+    long long deadline = timeout_s > 0 ? start + (long long)timeout_s * 1000 : 0;
+    long long kill_at = 0;
+    int status = 0, reaped = 0;
+
+    for (;;) {
+        long long now = now_ms();
+        if (deadline && !r->timed_out && now >= deadline) {
+            r->timed_out = 1;
+            kill(-pid, SIGTERM);
+            kill_at = now + KILL_GRACE_MS;
+        }
+        if (kill_at && now >= kill_at) {
+            kill(-pid, SIGKILL);
+            kill_at = 0;
+        }
+
+        /*
+         * A background job can keep the pipes open after the shell
+         * exits, so check for the exit on every pass rather than
+         * waiting for EOF.
+         */
+        if (!reaped) {
+            pid_t w = waitpid(pid, &status, WNOHANG);
+            if (w == pid) reaped = 1;
+            else if (w < 0 && errno != EINTR) break;
+        }
+        /*
+         * The shell usually dies of the SIGTERM at once, but the rest of
+         * its group may ignore it: after a timeout keep going until the
+         * SIGKILL has gone out or the group is empty.
+         */
+        if (reaped && (!kill_at || kill(-pid, 0) != 0)) break;
+
+        int wait = REAP_POLL_MS;
+        if (fds[0].fd < 0 && fds[1].fd < 0) {
+            /* Pipes are closed; only the exit or the deadline is left */
+            if (!reaped && !deadline && !kill_at) {
+                while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+                reaped = 1;
+                break;
+            }
+            wait = 10;
+        }
+        if (deadline && !r->timed_out && deadline - now < wait) wait = (int)(deadline - now);
+        if (kill_at && kill_at - now < wait) wait = (int)(kill_at - now);
+        if (wait < 0) wait = 0;
+
+        int n = poll(fds, 2, wait);
+        if (n < 0 && errno != EINTR) break;
+        for (int i = 0; n > 0 && i < 2; i++) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if (!drain_fd(fds[i].fd, sinks[i])) {
+                close(fds[i].fd);
+                fds[i].fd = -1;     /* poll ignores negative fds */
+            }
+        }
+    }
+
+    /* Pick up whatever the command wrote before it exited */
+    for (int i = 0; i < 2; i++) {
+        if (fds[i].fd < 0) continue;
+        fcntl(fds[i].fd, F_SETFL, fcntl(fds[i].fd, F_GETFL) | O_NONBLOCK);
+        while (drain_fd(fds[i].fd, sinks[i])) {
+            struct pollfd one = { fds[i].fd, POLLIN, 0 };
+            if (poll(&one, 1, 0) <= 0) break;
+        }
+        close(fds[i].fd);
+    }
+
+    if (!reaped) waitpid(pid, &status, 0);
+    if (WIFEXITED(status)) r->exit_code = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status)) r->exit_code = 128 + WTERMSIG(status);
+    else r->exit_code = 1;
+    r->duration_ms = now_ms() - start;
+}
+
 #endif
+
+/* ---- Batch mode ---- */
+
+/*
+ * --batch reads one JSON object per line from stdin:
+ *
+ *   {"cmd": "npm test", "id": "tests", "timeout": 300}
+ *
+ * "id" is echoed back verbatim in the result and "timeout" overrides
+ * --timeout for that command.  Everything is approved with one prompt,
+ * then up to --parallel commands run at once.  Each result is printed
+ * as one JSON line the moment its command finishes, so results arrive
+ * in completion order; match them up by "index" or "id".
+ */
+
+typedef struct {
+    char *cmd;
+    char *id;               /* raw JSON value, or NULL */
+    int   timeout;          /* seconds, -1 = use --timeout */
+} batch_item;
+
+typedef struct {
+    batch_item *items;
+    int         count;
+    int         next;
+    int         succeeded;
+    int         failed;
+    int         timed_out;
+    mutex_t     lock;       /* guards next, the tallies and stdout */
+} batch_queue;
+
+static void batch_free(batch_item *items, int count) {
+    for (int i = 0; i < count; i++) {
+        free(items[i].cmd);
+        free(items[i].id);
+    }
+    free(items);
+}
+
+/* Parse one NDJSON line into item; prints the reason and returns -1 on error */
+static int parse_batch_line(const char *line, long lineno, batch_item *item) {
+    item->cmd = NULL;
+    item->id = NULL;
+    item->timeout = -1;
+
+    size_t len = strlen(line);
+    int rc = json_string_member(line, len, "cmd", &item->cmd, CMD_MAX);
+    if (rc == -2) {
+        fprintf(stderr, "run: batch line %ld: \"cmd\" is longer than %d bytes\n",
+                lineno, CMD_MAX);
+        return -1;
+    }
+    if (rc != 1) {
+        fprintf(stderr, "run: batch line %ld: missing \"cmd\" string\n", lineno);
+        return -1;
+    }
+    if (item->cmd[0] == '\0') {
+        fprintf(stderr, "run: batch line %ld: empty command\n", lineno);
+        return -1;
+    }
+
+    json_lexer lx;
+    json_token val;
+    rc = json_find_member(&lx, line, len, "id", &val);
+    if (rc == 1) {
+        const char *start;
+        size_t n;
+        if (json_value_span(&lx, &val, &start, &n) != 0) {
+            fprintf(stderr, "run: batch line %ld: malformed \"id\"\n", lineno);
+            return -1;
+        }
+        item->id = malloc(n + 1);
+        if (!item->id) return -1;
+        memcpy(item->id, start, n);
+        item->id[n] = '\0';
+    }
+
+    rc = json_find_member(&lx, line, len, "timeout", &val);
+    if (rc == 1) {
+        char *end = NULL;
+        long t = val.type == JSON_TOK_NUMBER ? strtol(val.text, &end, 10) : -1;
+        if (t < 0 || end != val.text + val.len || t > 86400 * 7) {
+            fprintf(stderr, "run: batch line %ld: \"timeout\" must be whole seconds >= 0\n", lineno);
+            return -1;
+        }
+        item->timeout = (int)t;
+    }
+    return 0;
+}
+
+/* Read the whole batch from stdin; returns the count or -1 on error */
+static int read_batch(batch_item **out) {
+    batch_item *items = NULL;
+    int count = 0, cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    long lineno = 0, len;
+
+    while ((len = read_line(stdin, &line, &line_cap)) >= 0) {
+        lineno++;
+        const char *p = line;
+        while (json_is_space(*p)) p++;
+        if (*p == '\0') continue;
+        if (count == BATCH_MAX) {
+            fprintf(stderr, "run: batch is limited to %d commands\n", BATCH_MAX);
+            goto fail;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            batch_item *grown = realloc(items, (size_t)cap * sizeof(*items));
+            if (!grown) goto fail;
+            items = grown;
+        }
+        if (parse_batch_line(p, lineno, &items[count]) != 0) {
+            free(items[count].cmd);
+            free(items[count].id);
+            goto fail;
+        }
+        count++;
+    }
+    free(line);
+    *out = items;
+    return count;
+
+fail:
+    free(line);
+    batch_free(items, count);
+    return -1;
+}
+
+static int prompt_batch_approval(const batch_item *items, int count) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "=== BATCH APPROVAL REQUIRED (%d command%s) ===\n",
+            count, count == 1 ? "" : "s");
+    fprintf(stderr, "\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(stderr, "  %3d. %s\n", i + 1, items[i].cmd);
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Approve all? [y/N]: ");
+    return read_approval();
+}
+
+static void print_item_head(int index, const batch_item *item, const char *status) {
+    printf("{\"index\":%d,", index);
+    if (item->id) printf("\"id\":%s,", item->id);
+    printf("\"status\":\"%s\",\"command\":", status);
+    json_put_string(stdout, item->cmd, strlen(item->cmd));
+}
+
+static void print_batch_result(int index, const batch_item *item, const child_result *r) {
+    if (r->spawn_failed) {
+        print_item_head(index, item, "error");
+        printf(",\"error\":\"could not start command\"}\n");
+        return;
+    }
+    print_item_head(index, item, r->timed_out ? "timeout" : "executed");
+    printf(",\"exit_code\":%d,\"duration_ms\":%lld,\"timed_out\":%s",
+           r->exit_code, r->duration_ms, r->timed_out ? "true" : "false");
+    printf(",\"stdout\":");
+    json_put_string(stdout, r->out.data ? r->out.data : "", r->out.len);
+    printf(",\"stdout_bytes\":%lld,\"stdout_truncated\":%s",
+           r->out.bytes, r->out.bytes > (long long)r->out.len ? "true" : "false");
+    printf(",\"stderr\":");
+    json_put_string(stdout, r->err.data ? r->err.data : "", r->err.len);
+    printf(",\"stderr_bytes\":%lld,\"stderr_truncated\":%s}\n",
+           r->err.bytes, r->err.bytes > (long long)r->err.len ? "true" : "false");
+}
+
+static THREAD_FUNC batch_worker(void *arg) {
+    batch_queue *q = (batch_queue *)arg;
+    for (;;) {
+        mutex_lock(&q->lock);
+        int i = q->next < q->count ? q->next++ : -1;
+        mutex_unlock(&q->lock);
+        if (i < 0) break;
+
+        batch_item *item = &q->items[i];
+        child_result r;
+        memset(&r, 0, sizeof(r));
+        r.out.fd = r.err.fd = -1;
+        r.out.limit = r.err.limit = (size_t)flag_max_output;
+
+        int timeout = item->timeout >= 0 ? item->timeout : flag_timeout;
+        run_child(item->cmd, timeout, 1, &r);
+
+        const char *status;
+        mutex_lock(&q->lock);
+        if (r.spawn_failed) {
+            q->failed++;
+            status = "ERROR";
+        } else if (r.timed_out) {
+            q->timed_out++;
+            status = "TIMEOUT";
+        } else if (r.exit_code != 0) {
+            q->failed++;
+            status = "FAILED";
+        } else {
+            q->succeeded++;
+            status = "SUCCESS";
+        }
+        print_batch_result(i + 1, item, &r);
+        fflush(stdout);
+        mutex_unlock(&q->lock);
+
+        log_entry(item->cmd, status);
+        free(r.out.data);
+        free(r.err.data);
+    }
+    THREAD_RETURN;
+}
+
+static int run_batch(void) {
+    batch_item *items;
+    int count = read_batch(&items);
+    if (count < 0) return EXIT_USAGE;
+    if (count == 0) {
+        fprintf(stderr, "run: batch input has no commands\n");
+        free(items);
+        return EXIT_USAGE;
+    }
+
+    /* Approval gate: one answer covers the whole batch */
+    if (!flag_yes && !prompt_batch_approval(items, count)) {
+        fprintf(stderr, "run: batch rejected by operator\n");
+        for (int i = 0; i < count; i++) {
+            log_entry(items[i].cmd, "REJECTED");
+            print_item_head(i + 1, &items[i], "rejected");
+            printf("}\n");
+        }
+        batch_free(items, count);
+        return EXIT_REJECTED;
+    }
+    for (int i = 0; i < count; i++) log_entry(items[i].cmd, "APPROVED");
+
+    batch_queue q;
+    memset(&q, 0, sizeof(q));
+    q.items = items;
+    q.count = count;
+    mutex_init(&q.lock);
+
+    int nthreads = flag_parallel < count ? flag_parallel : count;
+    thread_t threads[PARALLEL_MAX];
+    int started = 0;
+    long long start = now_ms();
+
+    fprintf(stderr, "run: executing %d command%s (%d at a time)...\n",
+            count, count == 1 ? "" : "s", nthreads);
+    for (int i = 0; i < nthreads; i++) {
+        if (thread_start(&threads[started], batch_worker, &q) == 0) started++;
+    }
+    if (started == 0) batch_worker(&q);
+    for (int i = 0; i < started; i++) thread_join(threads[i]);
+
+    printf("{\"status\":\"batch_done\",\"commands\":%d,\"succeeded\":%d,"
+           "\"failed\":%d,\"timed_out\":%d,\"duration_ms\":%lld}\n",
+           count, q.succeeded, q.failed, q.timed_out, now_ms() - start);
+    batch_free(items, count);
+
+    if (q.timed_out) return EXIT_TIMEOUT;
+    if (q.failed) return EXIT_CMDFAIL;
+    return EXIT_OK;
 }
 
 /* ---- Usage ---- */
@@ -266,23 +997,31 @@ static int run_command(const char *cmd) {
 static void print_usage(void) {
     fprintf(stderr,
         "Usage: run [flags] <command> [args ...]\n"
+        "       run [flags] --batch < commands.ndjson\n"
         "\n"
         "Flags:\n"
-        "  --json      Read command from a JSON object on stdin ({\"cmd\": \"...\"})\n"
-        "  --yes       Skip approval prompt (trusted pipelines only)\n"
-        "  --timeout N Seconds to wait for approval (0 = no timeout)\n"
-        "  --log FILE  Append every request and result to FILE\n"
+        "  --json           Read command from a JSON object on stdin ({\"cmd\": \"...\"})\n"
+        "  --batch          Read one {\"cmd\": ...} object per line from stdin and run\n"
+        "                   them all after a single approval\n"
+        "  --parallel N     Commands to run at once in --batch mode (default 4)\n"
+        "  --yes            Skip approval prompt (trusted pipelines only)\n"
+        "  --timeout N      Kill the command after N seconds (0 = no limit)\n"
+        "  --max-output N   Bytes of stdout/stderr kept per --batch result (default 1048576)\n"
+        "  --log FILE       Append every request and result to FILE\n"
         "\n"
         "Examples:\n"
         "  ./run ls -la\n"
         "  ./run \"git status\"\n"
+        "  ./run --timeout 60 make test\n"
         "  echo '{\"cmd\":\"date\"}' | ./run --json\n"
+        "  printf '{\"cmd\":\"make lint\"}\\n{\"cmd\":\"make test\"}\\n' | ./run --batch\n"
         "\n"
         "Exit codes:\n"
         "  0  Command ran successfully\n"
         "  1  Command ran but returned non-zero\n"
         "  2  Operator rejected the command\n"
         "  3  Usage error\n"
+        "  4  Command was killed at the --timeout deadline\n"
     );
 }
 
@@ -292,6 +1031,16 @@ int main(int argc, char **argv) {
     char cmd[CMD_MAX];
     cmd[0] = '\0';
 
+    mutex_init(&log_lock);
+#ifdef _WIN32
+    /* Pass command output through byte for byte */
+    _setmode(_fileno(stdout), _O_BINARY);
+    _setmode(_fileno(stderr), _O_BINARY);
+#else
+    /* A caller that stops reading must not kill us before the result line */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
     /* Parse flags */
     int cmd_start = 1;
     for (int i = 1; i < argc; i++) {
@@ -301,8 +1050,31 @@ int main(int argc, char **argv) {
         } else if (strcmp(argv[i], "--json") == 0) {
             flag_json = 1;
             cmd_start = i + 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            flag_batch = 1;
+            cmd_start = i + 1;
         } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
             flag_timeout = atoi(argv[i + 1]);
+            if (flag_timeout < 0) {
+                fprintf(stderr, "run: --timeout must be >= 0\n");
+                return EXIT_USAGE;
+            }
+            i++;
+            cmd_start = i + 1;
+        } else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) {
+            flag_parallel = atoi(argv[i + 1]);
+            if (flag_parallel < 1 || flag_parallel > PARALLEL_MAX) {
+                fprintf(stderr, "run: --parallel must be between 1 and %d\n", PARALLEL_MAX);
+                return EXIT_USAGE;
+            }
+            i++;
+            cmd_start = i + 1;
+        } else if (strcmp(argv[i], "--max-output") == 0 && i + 1 < argc) {
+            flag_max_output = atol(argv[i + 1]);
+            if (flag_max_output < 0) {
+                fprintf(stderr, "run: --max-output must be >= 0\n");
+                return EXIT_USAGE;
+            }
             i++;
             cmd_start = i + 1;
         } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
@@ -319,6 +1091,14 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (flag_batch) {
+        if (flag_json || cmd_start < argc) {
+            fprintf(stderr, "run: --batch reads commands from stdin only\n");
+            return EXIT_USAGE;
+        }
+        return run_batch();
+    }
+
     /* Get the command string */
     if (flag_json) {
         if (read_json_cmd(cmd, sizeof(cmd)) != 0) {
@@ -347,24 +1127,49 @@ int main(int argc, char **argv) {
             log_entry(cmd, "REJECTED");
 
             /* Print structured result to stdout for the caller */
-            printf("{\"status\":\"rejected\",\"command\":\"%s\"}\n", cmd);
+            printf("{\"status\":\"rejected\",\"command\":");
+            json_put_string(stdout, cmd, strlen(cmd));
+            printf("}\n");
             return EXIT_REJECTED;
         }
     }
 
     log_entry(cmd, "APPROVED");
 
-    /* Run it */
+    /* Run it, passing its output straight through */
     fprintf(stderr, "run: executing...\n");
-    int exit_code = run_command(cmd);
+    fflush(stdout);
+
+    child_result r;
+    memset(&r, 0, sizeof(r));
+    r.out.fd = 1;
+    r.err.fd = 2;
+    run_child(cmd, flag_timeout, 0, &r);
+
+    if (r.spawn_failed) {
+        log_entry(cmd, "ERROR");
+        fprintf(stderr, "run: could not start command\n");
+        printf("{\"status\":\"error\",\"command\":");
+        json_put_string(stdout, cmd, strlen(cmd));
+        printf("}\n");
+        return EXIT_CMDFAIL;
+    }
 
     /* Print structured result */
-    printf("{\"status\":\"executed\",\"exit_code\":%d,\"command\":\"%s\"}\n",
-           exit_code, cmd);
+    printf("{\"status\":\"%s\",\"exit_code\":%d,\"command\":",
+           r.timed_out ? "timeout" : "executed", r.exit_code);
+    json_put_string(stdout, cmd, strlen(cmd));
+    printf(",\"duration_ms\":%lld,\"stdout_bytes\":%lld,\"stderr_bytes\":%lld,\"timed_out\":%s}\n",
+           r.duration_ms, r.out.bytes, r.err.bytes, r.timed_out ? "true" : "false");
 
-    if (exit_code != 0) {
+    if (r.timed_out) {
+        log_entry(cmd, "TIMEOUT");
+        fprintf(stderr, "run: command killed after %d s timeout\n", flag_timeout);
+        return EXIT_TIMEOUT;
+    }
+    if (r.exit_code != 0) {
         log_entry(cmd, "FAILED");
-        fprintf(stderr, "run: command exited with code %d\n", exit_code);
+        fprintf(stderr, "run: command exited with code %d\n", r.exit_code);
         return EXIT_CMDFAIL;
     }
 
@@ -2,6 +2,9 @@
  * deploy.c - Cross-platform GitHub Pages deploy tool
  * Pushes the contents of the build/ directory to a GitHub Pages repository.
  *
+ * Keeps a staging clone in $TMPDIR/portfolio-deploy between deploys and
+ * syncs only the build files that changed into it.
+ *
  * Reads the target repo URL from ../deploy.conf (or deploy.conf in cwd).
  * Can also accept the repo URL as a command-line argument.
  *
@@ -21,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #ifdef _WIN32
@@ -29,6 +33,7 @@
   #include <io.h>
   #define PATH_SEP '\\'
   #define MKDIR(d) _mkdir(d)
+  #define RMDIR(d) _rmdir(d)
   #define STAT _stat
   #define S_ISDIR(m) (((m) & _S_IFDIR) != 0)
   #define S_ISREG(m) (((m) & _S_IFREG) != 0)
@@ -41,6 +46,7 @@
   #include <errno.h>
   #define PATH_SEP '/'
   #define MKDIR(d) mkdir(d, 0755)
+  #define RMDIR(d) rmdir(d)
   #define STAT stat
 #endif
 
@@ -166,23 +172,263 @@ static int find_build_dir(char *out, int out_size) {
     return 0;
 }
 
-/* ---- Copy files from build dir to staging dir ---- */
+/* ---- Directory walking ---- */
+
+/*
+ * Deploys used to shell out to rm, cp -R / xcopy and rm -rf around every
+ * push. The staging clone now persists between deploys and is updated
+ * file by file, so directories are walked and copied natively here.
+ */
 
+typedef void (*dir_visit)(void *ctx, const char *dir, const char *name, int is_dir);
+
+/* Calls visit for every entry of dir except ".", ".." and ".git" */
+static void list_dir(const char *dir, dir_visit visit, void *ctx) {
 #ifdef _WIN32
-static int copy_build_files(const char *build_dir, const char *dest_dir) {
-    char cmd[MAX_CMD];
-    /* Use xcopy on Windows */
-    snprintf(cmd, sizeof(cmd), "xcopy /E /Y /Q \"%s\\*\" \"%s\\\"", build_dir, dest_dir);
-    return run_cmd(cmd);
-}
+    char pattern[MAX_PATH_LEN];
+    WIN32_FIND_DATAA fd;
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return;
+    do {
+        const char *name = fd.cFileName;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0) continue;
+        visit(ctx, dir, name, (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
 #else
-static int copy_build_files(const char *build_dir, const char *dest_dir) {
-    char cmd[MAX_CMD];
-    /* Use cp on Unix */
-    snprintf(cmd, sizeof(cmd), "cp -R \"%s\"/. \"%s\"/", build_dir, dest_dir);
-    return run_cmd(cmd);
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        const char *name = e->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0) continue;
+        char full[MAX_PATH_LEN];
+        struct stat st;
+        snprintf(full, sizeof(full), "%s/%s", dir, name);
+        if (lstat(full, &st) != 0) continue;
+        visit(ctx, dir, name, S_ISDIR(st.st_mode));
+    }
+    closedir(d);
+#endif
+}
+
+typedef struct {
+    char *path;             /* relative, '/'-separated */
+    long long size;
+    long long mtime;
+    int mode;               /* git file mode, e.g. 0100644 (--fast) */
+    char sha[41];           /* git object id in hex, "" if not known */
+} file_entry;
+
+typedef struct {
+    file_entry *items;
+    int count;
+    int cap;
+} file_list;
+
+static int list_add(file_list *l, const char *path, long long size, long long mtime) {
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        file_entry *items = (file_entry *)realloc(l->items, (size_t)cap * sizeof(file_entry));
+        if (!items) return 0;
+        l->items = items;
+        l->cap = cap;
+    }
+    file_entry *e = &l->items[l->count];
+    e->path = (char *)malloc(strlen(path) + 1);
+    if (!e->path) return 0;
+    strcpy(e->path, path);
+    e->size = size;
+    e->mtime = mtime;
+    e->mode = 0100644;
+    e->sha[0] = '\0';
+    l->count++;
+    return 1;
+}
+
+/* Drop items[i], keeping the order */
+static void list_remove(file_list *l, int i) {
+    free(l->items[i].path);
+    memmove(&l->items[i], &l->items[i + 1], (size_t)(l->count - i - 1) * sizeof(file_entry));
+    l->count--;
+}
+
+static void list_free(file_list *l) {
+    for (int i = 0; i < l->count; i++) free(l->items[i].path);
+    free(l->items);
+    l->items = NULL;
+    l->count = l->cap = 0;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    return strcmp(((const file_entry *)a)->path, ((const file_entry *)b)->path);
+}
+
+static void list_sort(file_list *l) {
+    if (l->count > 1) qsort(l->items, (size_t)l->count, sizeof(file_entry), entry_cmp);
 }
+
+/* The list must be sorted */
+static file_entry *list_find(const file_list *l, const char *path) {
+    file_entry key;
+    key.path = (char *)path;
+    if (l->count == 0) return NULL;
+    return (file_entry *)bsearch(&key, l->items, (size_t)l->count, sizeof(file_entry), entry_cmp);
+}
+
+typedef struct {
+    const char *root;
+    file_list *list;
+} walk_ctx;
+
+static void walk_visit(void *ctx, const char *dir, const char *name, int is_dir) {
+    walk_ctx *w = (walk_ctx *)ctx;
+    char full[MAX_PATH_LEN];
+    snprintf(full, sizeof(full), "%s%c%s", dir, PATH_SEP, name);
+    if (is_dir) {
+        list_dir(full, walk_visit, ctx);
+        return;
+    }
+    struct STAT st;
+    if (STAT(full, &st) != 0 || !S_ISREG(st.st_mode)) return;
+    /* Relative path below the root, with '/' on every platform */
+    char rel[MAX_PATH_LEN];
+    snprintf(rel, sizeof(rel), "%s", full + strlen(w->root) + 1);
+    for (char *p = rel; *p; p++) {
+        if (*p == '\\') *p = '/';
+    }
+    list_add(w->list, rel, (long long)st.st_size, (long long)st.st_mtime);
+}
+
+/* Every regular file below root, sorted by relative path */
+static void walk_tree(const char *root, file_list *out) {
+    walk_ctx w;
+    w.root = root;
+    w.list = out;
+    list_dir(root, walk_visit, &w);
+    list_sort(out);
+}
+
+/* ---- File operations ---- */
+
+/* 0 when root/rel does not fit in out */
+static int join_path(char *out, int out_size, const char *root, const char *rel) {
+    int n = snprintf(out, out_size, "%s%c%s", root, PATH_SEP, rel);
+    if (n < 0 || n >= out_size) return 0;
+#ifdef _WIN32
+    for (char *p = out; *p; p++) {
+        if (*p == '/') *p = '\\';
+    }
 #endif
+    return 1;
+}
+
+static int remove_file(const char *path) {
+#ifdef _WIN32
+    /* git marks its object files read-only */
+    SetFileAttributesA(path, FILE_ATTRIBUTE_NORMAL);
+    return DeleteFileA(path) ? 0 : -1;
+#else
+    return unlink(path);
+#endif
+}
+
+static void remove_visit(void *ctx, const char *dir, const char *name, int is_dir);
+
+/* ---- Remove directory recursively ---- */
+
+static void remove_dir(const char *path) {
+    if (!dir_exists(path)) return;
+    list_dir(path, remove_visit, NULL);
+    /* list_dir skips .git, so remove it explicitly */
+    char git_dir[MAX_PATH_LEN];
+    snprintf(git_dir, sizeof(git_dir), "%s%c.git", path, PATH_SEP);
+    if (dir_exists(git_dir)) {
+        list_dir(git_dir, remove_visit, NULL);
+        RMDIR(git_dir);
+    }
+    RMDIR(path);
+}
+
+static void remove_visit(void *ctx, const char *dir, const char *name, int is_dir) {
+    char full[MAX_PATH_LEN];
+    (void)ctx;
+    snprintf(full, sizeof(full), "%s%c%s", dir, PATH_SEP, name);
+    if (is_dir) remove_dir(full);
+    else remove_file(full);
+}
+
+/* Create every missing directory above path */
+static void make_parent_dirs(const char *path) {
+    char tmp[MAX_PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            char c = *p;
+            *p = '\0';
+            if (!dir_exists(tmp)) MKDIR(tmp);
+            *p = c;
+        }
+    }
+}
+
+/* Remove the directories above rel (inside root) that are left empty */
+static void prune_empty_dirs(const char *root, const char *rel) {
+    char dir[MAX_PATH_LEN];
+    if (!join_path(dir, sizeof(dir), root, rel)) return;
+    size_t root_len = strlen(root);
+    for (;;) {
+        char *sep = strrchr(dir, PATH_SEP);
+        if (!sep || (size_t)(sep - dir) <= root_len) break;
+        *sep = '\0';
+        if (RMDIR(dir) != 0) break;
+    }
+}
+
+static int copy_file(const char *src, const char *dst) {
+    static char buf[1 << 16];
+    FILE *in = fopen(src, "rb");
+    if (!in) return 0;
+    FILE *out = fopen(dst, "wb");
+    if (!out) {
+        make_parent_dirs(dst);
+        out = fopen(dst, "wb");
+    }
+    if (!out) {
+        fclose(in);
+        return 0;
+    }
+    size_t n;
+    int ok = 1;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            ok = 0;
+            break;
+        }
+    }
+    if (ferror(in)) ok = 0;
+    fclose(in);
+    if (fclose(out) != 0) ok = 0;
+    return ok;
+}
+
+/* Byte comparison of two files already known to have the same size */
+static int same_contents(const char *a, const char *b) {
+    static char buf_a[1 << 16], buf_b[1 << 16];
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa && fb;
+    while (same) {
+        size_t na = fread(buf_a, 1, sizeof(buf_a), fa);
+        size_t nb = fread(buf_b, 1, sizeof(buf_b), fb);
+        if (na != nb || memcmp(buf_a, buf_b, na) != 0) same = 0;
+        if (na == 0) break;
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
 
 /* ---- Get temp directory ---- */
 
@@ -199,43 +445,926 @@ static void get_temp_dir(char *out, int out_size) {
 #endif
 }
 
-/* ---- Remove directory recursively ---- */
+/* ---- Deploy manifest ---- */
 
-static void remove_dir(const char *path) {
-    char cmd[MAX_CMD];
-#ifdef _WIN32
-    snprintf(cmd, sizeof(cmd), "rmdir /S /Q \"%s\" 2>nul", path);
-#else
-    snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", path);
-#endif
-    run_cmd_quiet(cmd);
+/*
+ * .git/portfolio-deploy.manifest records which repo the staging clone
+ * belongs to and, for every file the last deploy took from build/, the
+ * size and mtime of both the build file and its staged copy. A file
+ * whose two pairs still match is skipped without being read. Living in
+ * .git keeps it out of every commit. Like git's index, an mtime that is
+ * not older than the manifest itself is not trusted, because the file
+ * may have changed again within the same second.
+ */
+
+#define MANIFEST_NAME "portfolio-deploy.manifest"
+
+typedef struct {
+    char url[MAX_URL];
+    long long written;      /* when the manifest was saved */
+    file_list build;        /* each build file as last deployed */
+    file_list staged;       /* its staged copy, same order */
+} deploy_manifest;
+
+static void manifest_path(char *out, int out_size, const char *staging) {
+    snprintf(out, out_size, "%s%c.git%c%s", staging, PATH_SEP, PATH_SEP, MANIFEST_NAME);
 }
 
-/* ---- Read domain from config ---- */
+static void manifest_free(deploy_manifest *m) {
+    list_free(&m->build);
+    list_free(&m->staged);
+    m->url[0] = '\0';
+    m->written = 0;
+}
 
-static int read_domain(char *domain, int domain_size) {
+static int manifest_load(deploy_manifest *m, const char *staging) {
+    char path[MAX_PATH_LEN];
+    char line[MAX_PATH_LEN + 128];
+    manifest_path(path, sizeof(path), staging);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    if (!fgets(line, sizeof(line), f) || strncmp(line, "portfolio-deploy 1", 18) != 0) {
+        fclose(f);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        long long bs, bm, ss, sm;
+        int n = 0;
+        trim(line);
+        if (strncmp(line, "url ", 4) == 0) {
+            int len = snprintf(m->url, sizeof(m->url), "%s", line + 4);
+            if (len < 0 || len >= (int)sizeof(m->url)) m->url[0] = '\0';   /* not this repo */
+        } else if (strncmp(line, "time ", 5) == 0) {
+            m->written = atoll(line + 5);
+        } else if (sscanf(line, "%lld %lld %lld %lld %n", &bs, &bm, &ss, &sm, &n) == 4 && line[n]) {
+            list_add(&m->build, line + n, bs, bm);
+            list_add(&m->staged, line + n, ss, sm);
+        }
+    }
+    fclose(f);
+    /* Saved in sorted order, so both lists can be searched as they are */
+    return m->url[0] != '\0';
+}
+
+static void manifest_save(const deploy_manifest *m, const char *staging) {
+    char path[MAX_PATH_LEN];
+    manifest_path(path, sizeof(path), staging);
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "portfolio-deploy 1\nurl %s\ntime %lld\n", m->url, (long long)time(NULL));
+    for (int i = 0; i < m->build.count; i++) {
+        fprintf(f, "%lld %lld %lld %lld %s\n",
+                m->build.items[i].size, m->build.items[i].mtime,
+                m->staged.items[i].size, m->staged.items[i].mtime, m->build.items[i].path);
+    }
+    fclose(f);
+}
+
+/* ---- Sync build files into the staging clone ---- */
+
+typedef struct {
+    int copied;
+    int deleted;
+    int unchanged;
+    int failed;
+} sync_stats;
+
+/*
+ * Files the build owns even when no manifest says so: top-level pages,
+ * styles, scripts and data, and everything under assets/. Anything else
+ * in the repo (README, CNAME, files added by hand) is left alone.
+ */
+static int build_owned(const char *rel) {
+    if (strncmp(rel, "assets/", 7) == 0) return 1;
+    if (strchr(rel, '/')) return 0;
+    const char *dot = strrchr(rel, '.');
+    if (!dot) return 0;
+    return strcmp(dot, ".html") == 0 || strcmp(dot, ".htm") == 0 || strcmp(dot, ".css") == 0 ||
+           strcmp(dot, ".js") == 0 || strcmp(dot, ".json") == 0;
+}
+
+static int unchanged_since(const deploy_manifest *m, const file_entry *b, const file_entry *s) {
+    const file_entry *mb = list_find(&m->build, b->path);
+    if (!mb || !s) return 0;
+    const file_entry *ms = &m->staged.items[mb - m->build.items];
+    return mb->size == b->size && mb->mtime == b->mtime && mb->mtime < m->written &&
+           ms->size == s->size && ms->mtime == s->mtime && ms->mtime < m->written;
+}
+
+/*
+ * Make the staging work tree match build/: copy files that are new or
+ * whose contents changed, and delete build files that are gone. Records
+ * the result in now for the next deploy.
+ */
+static void sync_build(const char *build_dir, const char *staging, const deploy_manifest *old,
+                       deploy_manifest *now, sync_stats *stats) {
+    file_list files = { NULL, 0, 0 }, staged = { NULL, 0, 0 };
+    char src[MAX_PATH_LEN], dst[MAX_PATH_LEN];
+    walk_tree(build_dir, &files);
+    walk_tree(staging, &staged);
+
+    for (int i = 0; i < staged.count; i++) {
+        const char *rel = staged.items[i].path;
+        if (list_find(&files, rel)) continue;
+        if (!build_owned(rel) && !list_find(&old->build, rel)) continue;
+        if (!join_path(dst, sizeof(dst), staging, rel)) {
+            fprintf(stderr, "Error: Path too long, not deleted: %s\n", rel);
+            continue;
+        }
+        if (remove_file(dst) == 0) {
+            stats->deleted++;
+            prune_empty_dirs(staging, rel);
+        }
+    }
+
+    for (int i = 0; i < files.count; i++) {
+        const file_entry *b = &files.items[i];
+        const file_entry *s = list_find(&staged, b->path);
+        if (!join_path(src, sizeof(src), build_dir, b->path) ||
+            !join_path(dst, sizeof(dst), staging, b->path)) {
+            fprintf(stderr, "Error: Path too long, skipped: %s\n", b->path);
+            continue;
+        }
+        if (unchanged_since(old, b, s) || (s && s->size == b->size && same_contents(src, dst))) {
+            stats->unchanged++;
+        } else if (copy_file(src, dst)) {
+            stats->copied++;
+        } else {
+            fprintf(stderr, "Error: Could not copy %s\n", b->path);
+            stats->failed++;
+            continue;
+        }
+        struct STAT st;
+        if (STAT(dst, &st) != 0) continue;
+        list_add(&now->build, b->path, b->size, b->mtime);
+        list_add(&now->staged, b->path, (long long)st.st_size, (long long)st.st_mtime);
+    }
+
+    list_free(&files);
+    list_free(&staged);
+}
+
+/* ---- Read domain and mode from config ---- */
+
+/* key includes the '=', e.g. "domain=" */
+static int read_config_value(const char *key, char *value, int value_size) {
     char config_path[MAX_PATH_LEN];
-    domain[0] = '\0';
+    size_t key_len = strlen(key);
+    value[0] = '\0';
     if (!find_config(config_path, sizeof(config_path))) return 0;
     FILE *cf = fopen(config_path, "r");
     if (!cf) return 0;
     char line[MAX_URL];
     while (fgets(line, sizeof(line), cf)) {
         trim(line);
-        if (strncmp(line, "domain=", 7) == 0) {
-            strncpy(domain, line + 7, domain_size - 1);
-            domain[domain_size - 1] = '\0';
-            trim(domain);
+        if (strncmp(line, key, key_len) == 0) {
+            strncpy(value, line + key_len, value_size - 1);
+            value[value_size - 1] = '\0';
+            trim(value);
             break;
         }
     }
     fclose(cf);
-    return domain[0] != '\0';
+    return value[0] != '\0';
+}
+
+static int read_domain(char *domain, int domain_size) {
+    return read_config_value("domain=", domain, domain_size);
+}
+
+/* ---- Push and report ---- */
+
+/* Normal push (not force -- preserves history and config), with fallbacks */
+static int push_staging(const char *staging) {
+    char cmd[MAX_CMD];
+    snprintf(cmd, sizeof(cmd),
+        "cd \"%s\" && git push origin main", staging);
+    int push_rc = run_cmd(cmd);
+
+    if (push_rc != 0) {
+        /* If normal push fails (diverged history), do a force push */
+        printf("\nNormal push failed, force pushing...\n");
+        snprintf(cmd, sizeof(cmd),
+            "cd \"%s\" && git push -f origin main", staging);
+        push_rc = run_cmd(cmd);
+    }
+
+    if (push_rc != 0) {
+        /* Try gh-pages branch as last fallback */
+        printf("\nTrying gh-pages branch...\n");
+        snprintf(cmd, sizeof(cmd),
+            "cd \"%s\" && git push -f origin main:gh-pages",
+            staging);
+        push_rc = run_cmd(cmd);
+    }
+    return push_rc;
+}
+
+static void print_live_url(const char *domain, const char *repo_url) {
+    if (domain[0]) {
+        printf("Your site is live at: https://%s/\n", domain);
+    } else {
+        /* Derive the pages URL from the repo URL */
+        char pages_url[MAX_URL] = {0};
+        const char *gh = strstr(repo_url, "github.com/");
+        if (gh) {
+            const char *after = gh + 11;
+            char user[256] = {0};
+            char repo[256] = {0};
+            int i = 0;
+            while (after[i] && after[i] != '/' && i < 255) {
+                user[i] = after[i];
+                i++;
+            }
+            user[i] = '\0';
+            if (after[i] == '/') {
+                i++;
+                int j = 0;
+                while (after[i] && after[i] != '/' && after[i] != '.' && j < 255) {
+                    repo[j++] = after[i++];
+                }
+                repo[j] = '\0';
+            }
+            if (user[0] && repo[0]) {
+                char user_pages[512];
+                snprintf(user_pages, sizeof(user_pages), "%s.github.io", user);
+                if (strcmp(repo, user_pages) == 0) {
+                    snprintf(pages_url, sizeof(pages_url),
+                        "https://%s.github.io/", user);
+                } else {
+                    snprintf(pages_url, sizeof(pages_url),
+                        "https://%s.github.io/%s/", user, repo);
+                }
+                printf("Your site is live at: %s\n", pages_url);
+            }
+        }
+    }
+    printf("Zero downtime -- no settings were disrupted.\n");
+}
+
+/* ---- SHA-1 ---- */
+
+/* Git names objects by SHA-1, so --fast hashes blobs and trees itself */
+
+typedef struct {
+    unsigned int h[5];
+    unsigned long long len;
+    unsigned char buf[64];
+    size_t n;
+} sha1_ctx;
+
+#define ROL32(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+
+static void sha1_block(sha1_ctx *c, const unsigned char *p) {
+    unsigned int w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (unsigned int)p[4 * i] << 24 | (unsigned int)p[4 * i + 1] << 16 |
+               (unsigned int)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    unsigned int a = c->h[0], b = c->h[1], d = c->h[3], e = c->h[4], cc = c->h[2];
+    for (int i = 0; i < 80; i++) {
+        unsigned int f, k;
+        if (i < 20)      { f = (b & cc) | (~b & d);           k = 0x5A827999; }
+        else if (i < 40) { f = b ^ cc ^ d;                    k = 0x6ED9EBA1; }
+        else if (i < 60) { f = (b & cc) | (b & d) | (cc & d); k = 0x8F1BBCDC; }
+        else             { f = b ^ cc ^ d;                    k = 0xCA62C1D6; }
+        unsigned int t = ROL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = cc;
+        cc = ROL32(b, 30);
+        b = a;
+        a = t;
+    }
+    c->h[0] += a;
+    c->h[1] += b;
+    c->h[2] += cc;
+    c->h[3] += d;
+    c->h[4] += e;
+}
+
+static void sha1_init(sha1_ctx *c) {
+    c->h[0] = 0x67452301;
+    c->h[1] = 0xEFCDAB89;
+    c->h[2] = 0x98BADCFE;
+    c->h[3] = 0x10325476;
+    c->h[4] = 0xC3D2E1F0;
+    c->len = 0;
+    c->n = 0;
+}
+
+static void sha1_update(sha1_ctx *c, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    c->len += len;
+    if (c->n) {
+        while (len && c->n < 64) {
+            c->buf[c->n++] = *p++;
+            len--;
+        }
+        if (c->n < 64) return;
+        sha1_block(c, c->buf);
+        c->n = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) sha1_block(c, p);
+    memcpy(c->buf, p, len);
+    c->n = len;
+}
+
+static void sha1_final(sha1_ctx *c, unsigned char out[20]) {
+    unsigned long long bits = c->len * 8;
+    unsigned char pad = 0x80;
+    sha1_update(c, &pad, 1);
+    pad = 0;
+    while (c->n != 56) sha1_update(c, &pad, 1);
+    unsigned char tail[8];
+    for (int i = 0; i < 8; i++) tail[i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha1_update(c, tail, 8);
+    for (int i = 0; i < 5; i++) {
+        out[4 * i] = (unsigned char)(c->h[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(c->h[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(c->h[i] >> 8);
+        out[4 * i + 3] = (unsigned char)c->h[i];
+    }
+}
+
+static void to_hex(const unsigned char *bin, int n, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < n; i++) {
+        hex[2 * i] = digits[bin[i] >> 4];
+        hex[2 * i + 1] = digits[bin[i] & 15];
+    }
+    hex[2 * n] = '\0';
+}
+
+static int from_hex(const char *hex, unsigned char *bin, int n) {
+    for (int i = 0; i < 2 * n; i++) {
+        char c = hex[i];
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (v < 0) return 0;
+        if (i & 1) bin[i / 2] |= (unsigned char)v;
+        else bin[i / 2] = (unsigned char)(v << 4);
+    }
+    return 1;
+}
+
+/* ---- Git objects ---- */
+
+/* Object id of "blob <len>\0<data>" */
+static void hash_blob(const void *data, size_t len, char sha[41]) {
+    sha1_ctx c;
+    char header[32];
+    unsigned char out[20];
+    int n = snprintf(header, sizeof(header), "blob %lu", (unsigned long)len);
+    sha1_init(&c);
+    sha1_update(&c, header, (size_t)n + 1);
+    sha1_update(&c, data, len);
+    sha1_final(&c, out);
+    to_hex(out, 20, sha);
+}
+
+/* Whole file into memory; returns NULL when it cannot be read */
+static unsigned char *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *buf = size >= 0 ? (unsigned char *)malloc((size_t)size + 1) : NULL;
+    if (buf && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} byte_buf;
+
+static int buf_append(byte_buf *b, const void *data, size_t len) {
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 4096;
+        while (cap < b->len + len) cap *= 2;
+        unsigned char *p = (unsigned char *)realloc(b->data, cap);
+        if (!p) return 0;
+        b->data = p;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 1;
+}
+
+/*
+ * Tree object id for entries [lo, hi) of a sorted listing, all below the
+ * directory prefix of length skip. Sorting full paths with strcmp gives
+ * git's tree order, where a directory sorts as its name plus '/'.
+ */
+static int hash_tree(const file_list *l, int lo, int hi, size_t skip, unsigned char out[20]) {
+    byte_buf b = { NULL, 0, 0 };
+    char head[64];
+    int ok = 1;
+    for (int i = lo; i < hi && ok; ) {
+        const char *name = l->items[i].path + skip;
+        const char *slash = strchr(name, '/');
+        unsigned char id[20];
+        int n;
+        if (slash) {
+            size_t name_len = (size_t)(slash - name);
+            int j = i + 1;
+            while (j < hi && strncmp(l->items[j].path + skip, name, name_len + 1) == 0) j++;
+            ok = hash_tree(l, i, j, skip + name_len + 1, id);
+            n = snprintf(head, sizeof(head), "40000 ");
+            ok = ok && buf_append(&b, head, (size_t)n) && buf_append(&b, name, name_len);
+            i = j;
+        } else {
+            ok = from_hex(l->items[i].sha, id, 20);
+            n = snprintf(head, sizeof(head), "%o ", (unsigned)l->items[i].mode);
+            ok = ok && buf_append(&b, head, (size_t)n) && buf_append(&b, name, strlen(name));
+            i++;
+        }
+        ok = ok && buf_append(&b, "", 1) && buf_append(&b, id, 20);
+    }
+    if (ok) {
+        sha1_ctx c;
+        int n = snprintf(head, sizeof(head), "tree %lu", (unsigned long)b.len);
+        sha1_init(&c);
+        sha1_update(&c, head, (size_t)n + 1);
+        if (b.len) sha1_update(&c, b.data, b.len);
+        sha1_final(&c, out);
+    }
+    free(b.data);
+    return ok;
+}
+
+static int tree_id(const file_list *l, char sha[41]) {
+    unsigned char id[20];
+    if (!hash_tree(l, 0, l->count, 0, id)) return 0;
+    to_hex(id, 20, sha);
+    return 1;
+}
+
+/* Parse "git ls-tree -r -z" output: "<mode> <type> <sha>\t<path>\0" */
+static int read_remote_tree(const char *staging, const char *commit, file_list *out) {
+    char cmd[MAX_CMD];
+    snprintf(cmd, sizeof(cmd), "cd \"%s\" && git ls-tree -r -z --full-tree %s", staging, commit);
+    FILE *p = popen(cmd, "r");
+    if (!p) return 0;
+    byte_buf b = { NULL, 0, 0 };
+    char chunk[8192];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), p)) > 0) buf_append(&b, chunk, n);
+    int rc = pclose(p);
+    for (size_t i = 0; i < b.len; ) {
+        char *rec = (char *)b.data + i;
+        size_t len = strnlen(rec, b.len - i);
+        if (i + len == b.len) break;
+        char *tab = memchr(rec, '\t', len);
+        char *sp = memchr(rec, ' ', len);
+        char *sp2 = sp ? memchr(sp + 1, ' ', len - (size_t)(sp + 1 - rec)) : NULL;
+        if (tab && sp2 && tab - sp2 == 41 && list_add(out, tab + 1, 0, 0)) {
+            file_entry *e = &out->items[out->count - 1];
+            e->mode = (int)strtol(rec, NULL, 8);
+            memcpy(e->sha, sp2 + 1, 40);
+            e->sha[40] = '\0';
+        }
+        i += len + 1;
+    }
+    free(b.data);
+    list_sort(out);
+    return rc == 0;
+}
+
+/* Commit id git fetch left in .git/FETCH_HEAD */
+static int read_fetch_head(const char *staging, char sha[41]) {
+    char path[MAX_PATH_LEN];
+    unsigned char id[20];
+    int n = snprintf(path, sizeof(path), "%s%c.git%cFETCH_HEAD", staging, PATH_SEP, PATH_SEP);
+    if (n < 0 || n >= (int)sizeof(path)) return 0;
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int ok = fread(sha, 1, 40, f) == 40;
+    fclose(f);
+    sha[40] = '\0';
+    return ok && from_hex(sha, id, 20);
+}
+
+/* ---- Fast deploy (git fast-import) ---- */
+
+/*
+ * --fast, or mode=fast in deploy.conf, never touches a work tree. Build
+ * files are hashed as git blobs here, with the ids cached by size and
+ * mtime, and the tree the deploy would produce is hashed from the
+ * listing of the remote commit. When it matches the tree of the last
+ * deploy the run stops there, without a fetch. Otherwise the changed
+ * blobs are streamed through a single git fast-import and the commit is
+ * pushed. .git/portfolio-deploy.tree keeps the listing and the ids.
+ */
+
+#define TREE_STATE_NAME "portfolio-deploy.tree"
+#define EMPTY_BLOB "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391"
+
+#ifdef _WIN32
+#define PIPE_WRITE "wb"
+#else
+#define PIPE_WRITE "w"
+#endif
+
+typedef struct {
+    char url[MAX_URL];
+    long long written;      /* when the state was saved */
+    char remote[41];        /* remote commit as last fetched or pushed, "" if none */
+    file_list tree;         /* that commit's files, with mode and id */
+    file_list build;        /* build files last deployed, with id */
+} tree_state;
+
+static void tree_state_path(char *out, int out_size, const char *staging) {
+    snprintf(out, out_size, "%s%c.git%c%s", staging, PATH_SEP, PATH_SEP, TREE_STATE_NAME);
+}
+
+static void tree_state_free(tree_state *t) {
+    list_free(&t->tree);
+    list_free(&t->build);
+    t->url[0] = t->remote[0] = '\0';
+    t->written = 0;
+}
+
+static int tree_state_load(tree_state *t, const char *staging) {
+    char path[MAX_PATH_LEN];
+    char line[MAX_PATH_LEN + 128];
+    tree_state_path(path, sizeof(path), staging);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    if (!fgets(line, sizeof(line), f) || strncmp(line, "portfolio-deploy-tree 1", 23) != 0) {
+        fclose(f);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        long long size, mtime;
+        unsigned mode;
+        char sha[41];
+        int n = 0;
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "url ", 4) == 0) {
+            int len = snprintf(t->url, sizeof(t->url), "%s", line + 4);
+            if (len < 0 || len >= (int)sizeof(t->url)) t->url[0] = '\0';
+        } else if (strncmp(line, "time ", 5) == 0) {
+            t->written = atoll(line + 5);
+        } else if (strncmp(line, "remote ", 7) == 0) {
+            snprintf(t->remote, sizeof(t->remote), "%.40s", line + 7);
+        } else if (sscanf(line, "R %o %40s %n", &mode, sha, &n) == 2 && line[n] &&
+                   list_add(&t->tree, line + n, 0, 0)) {
+            t->tree.items[t->tree.count - 1].mode = (int)mode;
+            strcpy(t->tree.items[t->tree.count - 1].sha, sha);
+        } else if (sscanf(line, "B %lld %lld %40s %n", &size, &mtime, sha, &n) == 3 && line[n] &&
+                   list_add(&t->build, line + n, size, mtime)) {
+            strcpy(t->build.items[t->build.count - 1].sha, sha);
+        }
+    }
+    fclose(f);
+    list_sort(&t->tree);
+    list_sort(&t->build);
+    return t->url[0] != '\0';
+}
+
+static void tree_state_save(const tree_state *t, const char *staging) {
+    char path[MAX_PATH_LEN];
+    tree_state_path(path, sizeof(path), staging);
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "portfolio-deploy-tree 1\nurl %s\ntime %lld\nremote %s\n",
+            t->url, (long long)time(NULL), t->remote);
+    for (int i = 0; i < t->tree.count; i++) {
+        const file_entry *e = &t->tree.items[i];
+        fprintf(f, "R %o %s %s\n", (unsigned)e->mode, e->sha, e->path);
+    }
+    for (int i = 0; i < t->build.count; i++) {
+        const file_entry *e = &t->build.items[i];
+        fprintf(f, "B %lld %lld %s %s\n", e->size, e->mtime, e->sha, e->path);
+    }
+    fclose(f);
+}
+
+static int add_entry(file_list *l, const char *path, int mode, const char *sha) {
+    if (!list_add(l, path, 0, 0)) return 0;
+    l->items[l->count - 1].mode = mode;
+    strcpy(l->items[l->count - 1].sha, sha);
+    return 1;
+}
+
+/*
+ * The tree this deploy produces from base (the remote's files): build
+ * files replace their namesakes, build files that are gone and the
+ * build-owned leftovers are dropped, CNAME follows deploy.conf and a
+ * .nojekyll is always present. Same rules as sync_build.
+ */
+static void desired_tree(const file_list *base, const file_list *files, const file_list *last,
+                         const char *cname_sha, file_list *out) {
+    for (int i = 0; i < base->count; i++) {
+        const file_entry *e = &base->items[i];
+        if (list_find(files, e->path) || build_owned(e->path) || list_find(last, e->path)) continue;
+        if (cname_sha && strcmp(e->path, "CNAME") == 0) continue;
+        add_entry(out, e->path, e->mode, e->sha);
+    }
+    for (int i = 0; i < files->count; i++) {
+        const file_entry *e = &files->items[i];
+        if (cname_sha && strcmp(e->path, "CNAME") == 0) continue;
+        add_entry(out, e->path, 0100644, e->sha);
+    }
+    if (cname_sha) add_entry(out, "CNAME", 0100644, cname_sha);
+    list_sort(out);
+    if (!list_find(out, ".nojekyll")) {
+        add_entry(out, ".nojekyll", 0100644, EMPTY_BLOB);
+        list_sort(out);
+    }
+}
+
+/* Paths starting with a quote or holding a newline must be C-quoted */
+static void fi_path(FILE *fi, const char *path) {
+    if (path[0] != '"' && !strchr(path, '\n')) {
+        fputs(path, fi);
+        return;
+    }
+    fputc('"', fi);
+    for (const char *p = path; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', fi);
+        if (*p == '\n') fputs("\\n", fi);
+        else fputc(*p, fi);
+    }
+    fputc('"', fi);
+}
+
+static void fi_blob(FILE *fi, const char *path, const void *data, size_t len) {
+    fputs("M 100644 inline ", fi);
+    fi_path(fi, path);
+    fprintf(fi, "\ndata %lu\n", (unsigned long)len);
+    if (len) fwrite(data, 1, len, fi);
+    fputc('\n', fi);
+}
+
+/* Output of a git command run in dir, first line only */
+static int git_line(const char *dir, const char *args, char *out, int out_size) {
+    char cmd[MAX_CMD];
+    snprintf(cmd, sizeof(cmd), "cd \"%s\" && git %s", dir, args);
+    FILE *p = popen(cmd, "r");
+    if (!p) return 0;
+    out[0] = '\0';
+    if (!fgets(out, out_size, p)) out[0] = '\0';
+    int rc = pclose(p);
+    trim(out);
+    return rc == 0 && out[0];
+}
+
+/* Whether the staging repo was last used, in either mode, for repo_url */
+static int staging_for(const char *staging, const char *repo_url) {
+    char git_dir[MAX_PATH_LEN];
+    deploy_manifest m;
+    tree_state t;
+    snprintf(git_dir, sizeof(git_dir), "%s%c.git", staging, PATH_SEP);
+    if (!dir_exists(git_dir)) return 0;
+    memset(&m, 0, sizeof(m));
+    memset(&t, 0, sizeof(t));
+    int same = (manifest_load(&m, staging) && strcmp(m.url, repo_url) == 0) ||
+               (tree_state_load(&t, staging) && strcmp(t.url, repo_url) == 0);
+    manifest_free(&m);
+    tree_state_free(&t);
+    return same;
+}
+
+static int deploy_fast(const char *repo_url, const char *build_dir, const char *domain) {
+    char staging[MAX_PATH_LEN], git_dir[MAX_PATH_LEN], cmd[MAX_CMD];
+    char cname_text[300], cname_sha[41], tree_sha[41], base_sha[41];
+    const char *cname = NULL;
+    file_list files = { NULL, 0, 0 }, want = { NULL, 0, 0 };
+    tree_state st;
+    int rc = 1;
+
+    /* 1. The staging repo only needs its object store and the remote */
+    memset(&st, 0, sizeof(st));
+    get_temp_dir(staging, sizeof(staging));
+    int n = snprintf(git_dir, sizeof(git_dir), "%s%c.git", staging, PATH_SEP);
+    if (n < 0 || n >= (int)sizeof(git_dir)) {
+        fprintf(stderr, "Error: Staging path too long: %s\n", staging);
+        return 1;
+    }
+    if (!(dir_exists(git_dir) && tree_state_load(&st, staging) && strcmp(st.url, repo_url) == 0)) {
+        tree_state_free(&st);
+        if (!staging_for(staging, repo_url)) {
+            printf("Creating staging repo %s ...\n", staging);
+            remove_dir(staging);
+            MKDIR(staging);
+            snprintf(cmd, sizeof(cmd),
+                "cd \"%s\" && git init -q && git symbolic-ref HEAD refs/heads/main && "
+                "git remote add origin \"%s\"", staging, repo_url);
+            if (!dir_exists(staging) || run_cmd(cmd) != 0) {
+                fprintf(stderr, "Error: Could not create staging repo: %s\n", staging);
+                return 1;
+            }
+        }
+    }
+    snprintf(st.url, sizeof(st.url), "%s", repo_url);
+
+    /* 2. Hash build files as git blobs, reusing ids whose size and mtime held */
+    walk_tree(build_dir, &files);
+    int hashed = 0;
+    for (int i = 0; i < files.count; i++) {
+        file_entry *e = &files.items[i];
+        const file_entry *old = list_find(&st.build, e->path);
+        if (old && old->sha[0] && old->size == e->size && old->mtime == e->mtime &&
+            old->mtime < st.written) {
+            strcpy(e->sha, old->sha);
+            continue;
+        }
+        char src[MAX_PATH_LEN];
+        size_t len;
+        if (!join_path(src, sizeof(src), build_dir, e->path)) {
+            fprintf(stderr, "Error: Path too long, skipped: %s\n", e->path);
+            list_remove(&files, i--);
+            continue;
+        }
+        unsigned char *data = load_file(src, &len);
+        if (!data) {
+            fprintf(stderr, "Error: Could not read %s\n", src);
+            goto done;
+        }
+        hash_blob(data, len, e->sha);
+        free(data);
+        hashed++;
+    }
+    printf("Hashed %d of %d build files\n", hashed, files.count);
+    if (domain[0]) {
+        snprintf(cname_text, sizeof(cname_text), "%s\n", domain);
+        hash_blob(cname_text, strlen(cname_text), cname_sha);
+        cname = cname_sha;
+        printf("CNAME: %s\n", domain);
+    }
+
+    /*
+     * 3. Same tree as the last deploy left on the remote? Then stop, offline.
+     * Only while origin/main is still the commit the state was saved for:
+     * any other push or fetch from this repo moves it.
+     */
+    char tracked[64];
+    desired_tree(&st.tree, &files, &st.build, cname, &want);
+    if (st.remote[0] &&
+        git_line(staging, "rev-parse -q --verify refs/remotes/origin/main", tracked, sizeof(tracked)) &&
+        strcmp(tracked, st.remote) == 0 &&
+        tree_id(&want, tree_sha) && tree_id(&st.tree, base_sha) && strcmp(tree_sha, base_sha) == 0) {
+        printf("\nNo changes since the last deploy (checked without contacting the remote).\n");
+        list_free(&st.build);
+        st.build = files;
+        memset(&files, 0, sizeof(files));
+        tree_state_save(&st, staging);
+        rc = 0;
+        goto done;
+    }
+
+    /* 4. Fetch the remote branch; list its tree again only if it moved */
+    char parent[41] = "";
+    snprintf(cmd, sizeof(cmd), "cd \"%s\" && git fetch -q --depth 1 origin main", staging);
+    if (run_cmd(cmd) == 0 && read_fetch_head(staging, parent)) {
+        if (strcmp(parent, st.remote) != 0) {
+            list_free(&st.tree);
+            if (!read_remote_tree(staging, parent, &st.tree)) {
+                fprintf(stderr, "Error: Could not list the remote tree.\n");
+                goto done;
+            }
+        }
+    } else if (st.remote[0]) {
+        fprintf(stderr, "Error: git fetch failed.\n");
+        goto done;
+    } else {
+        printf("Remote has no main branch yet, starting a new history.\n");
+        list_free(&st.tree);
+    }
+    snprintf(st.remote, sizeof(st.remote), "%s", parent);
+    list_free(&want);
+    desired_tree(&st.tree, &files, &st.build, cname, &want);
+    if (parent[0] && tree_id(&want, tree_sha) && tree_id(&st.tree, base_sha) &&
+        strcmp(tree_sha, base_sha) == 0) {
+        printf("\nNo changes detected. Site is already up to date.\n");
+        list_free(&st.build);
+        st.build = files;
+        memset(&files, 0, sizeof(files));
+        tree_state_save(&st, staging);
+        rc = 0;
+        goto done;
+    }
+
+    /* 5. One fast-import carries the changed blobs, the deletions and the commit */
+    char ident[512], marks[MAX_PATH_LEN], commit[41] = "";
+    if (!git_line(staging, "var GIT_COMMITTER_IDENT", ident, sizeof(ident))) {
+        fprintf(stderr, "Error: git has no committer identity (set user.name and user.email).\n");
+        goto done;
+    }
+    n = snprintf(marks, sizeof(marks), "%s%cportfolio-deploy.marks", git_dir, PATH_SEP);
+    if (n < 0 || n >= (int)sizeof(marks)) {
+        fprintf(stderr, "Error: Staging path too long: %s\n", staging);
+        goto done;
+    }
+    n = snprintf(cmd, sizeof(cmd),
+        "cd \"%s\" && git fast-import --quiet --force --export-marks=\"%s\"", staging, marks);
+    if (n < 0 || n >= (int)sizeof(cmd)) {
+        fprintf(stderr, "Error: Staging path too long: %s\n", staging);
+        goto done;
+    }
+    printf("  > %s\n", cmd);
+    FILE *fi = popen(cmd, PIPE_WRITE);
+    if (!fi) {
+        fprintf(stderr, "Error: Could not start git fast-import.\n");
+        goto done;
+    }
+    const char *message = "Deploy portfolio\n";
+    fprintf(fi, "commit refs/heads/main\nmark :1\nauthor %s\ncommitter %s\ndata %lu\n%s",
+            ident, ident, (unsigned long)strlen(message), message);
+    if (parent[0]) fprintf(fi, "from %s\n", parent);
+    int changed = 0, deleted = 0, failed = 0;
+    for (int i = 0; i < st.tree.count; i++) {
+        if (list_find(&want, st.tree.items[i].path)) continue;
+        fputs("D ", fi);
+        fi_path(fi, st.tree.items[i].path);
+        fputc('\n', fi);
+        deleted++;
+    }
+    for (int i = 0; i < want.count; i++) {
+        file_entry *w = &want.items[i];
+        const file_entry *b = list_find(&st.tree, w->path);
+        file_entry *f;
+        if (b && b->mode == w->mode && strcmp(b->sha, w->sha) == 0) continue;
+        changed++;
+        if (cname && strcmp(w->path, "CNAME") == 0) {
+            fi_blob(fi, w->path, cname_text, strlen(cname_text));
+        } else if ((f = list_find(&files, w->path)) != NULL) {
+            char src[MAX_PATH_LEN];
+            size_t len;
+            unsigned char *data = join_path(src, sizeof(src), build_dir, f->path) ?
+                                  load_file(src, &len) : NULL;
+            if (!data) {
+                fprintf(stderr, "Error: Could not read %s\n", src);
+                failed = 1;
+                break;
+            }
+            /* Hash what is actually sent, in case the build rewrote the file meanwhile */
+            hash_blob(data, len, f->sha);
+            strcpy(w->sha, f->sha);
+            fi_blob(fi, w->path, data, len);
+            free(data);
+        } else {
+            fi_blob(fi, w->path, "", 0);        /* .nojekyll */
+        }
+    }
+    if (pclose(fi) != 0 || failed) {
+        fprintf(stderr, "Error: git fast-import failed.\n");
+        goto done;
+    }
+    {
+        FILE *mf = fopen(marks, "r");
+        char line[128];
+        if (mf) {
+            if (fgets(line, sizeof(line), mf) && strncmp(line, ":1 ", 3) == 0) {
+                snprintf(commit, sizeof(commit), "%.40s", line + 3);
+            }
+            fclose(mf);
+            remove(marks);
+        }
+    }
+    printf("Committed %d changed and %d deleted files\n", changed, deleted);
+
+    /* 6. Push */
+    printf("\nPushing to %s ...\n", repo_url);
+    int push_rc = push_staging(staging);
+    if (push_rc == 0 && commit[0]) {
+        strcpy(st.remote, commit);
+        list_free(&st.tree);
+        st.tree = want;
+        memset(&want, 0, sizeof(want));
+        list_free(&st.build);
+        st.build = files;
+        memset(&files, 0, sizeof(files));
+    }
+    tree_state_save(&st, staging);
+    if (push_rc != 0) {
+        fprintf(stderr, "\nError: Push failed. Check your git credentials and repo URL.\n");
+        goto done;
+    }
+    printf("\n--- Deploy complete ---\n");
+    print_live_url(domain, repo_url);
+    rc = 0;
+
+done:
+    list_free(&files);
+    list_free(&want);
+    tree_state_free(&st);
+    return rc;
 }
 
 /* ---- Deploy ---- */
 
-static int deploy(const char *repo_url) {
+static int deploy(const char *repo_url, int fast) {
     char build_dir[MAX_PATH_LEN];
     char staging[MAX_PATH_LEN];
     char cmd[MAX_CMD];
@@ -255,41 +1384,69 @@ static int deploy(const char *repo_url) {
     /* Read custom domain from config */
     read_domain(domain, sizeof(domain));
 
-    /* 2. Prepare staging directory */
-    get_temp_dir(staging, sizeof(staging));
-    remove_dir(staging);
+    if (fast) return deploy_fast(repo_url, build_dir, domain);
 
-    /* 3. Try to clone the existing repo (shallow, single branch, fast) */
-    printf("Cloning existing repo...\n");
-    snprintf(cmd, sizeof(cmd),
-        "git clone --depth 1 \"%s\" \"%s\" 2>&1", repo_url, staging);
-    int clone_rc = run_cmd(cmd);
-
-    if (clone_rc != 0) {
-        /* Repo might be empty or not exist yet -- fall back to fresh init */
-        printf("Clone failed (repo may be empty). Initializing fresh.\n");
-        remove_dir(staging);
-        MKDIR(staging);
-        if (!dir_exists(staging)) {
-            fprintf(stderr, "Error: Could not create staging directory: %s\n", staging);
-            return 1;
-        }
+    /*
+     * 2. Reuse the staging clone from the last deploy when it belongs to
+     * this repo: fetching and resetting it costs one round trip, and git
+     * can tell from its index which files actually changed. checkout -B
+     * rather than reset, so HEAD is main even in a repo --fast created.
+     */
+    get_temp_dir(staging, sizeof(staging));
+    deploy_manifest old_manifest, manifest;
+    memset(&old_manifest, 0, sizeof(old_manifest));
+    memset(&manifest, 0, sizeof(manifest));
+    int reuse = staging_for(staging, repo_url);
+    if (reuse && !(manifest_load(&old_manifest, staging) && strcmp(old_manifest.url, repo_url) == 0)) {
+        manifest_free(&old_manifest);   /* last used by --fast: compare every file */
+    }
+    if (reuse) {
+        printf("Updating staging clone %s ...\n", staging);
         snprintf(cmd, sizeof(cmd),
-            "cd \"%s\" && git init && git checkout -b main", staging);
+            "cd \"%s\" && git fetch -q --depth 1 origin main && "
+            "git checkout -q -f -B main FETCH_HEAD", staging);
         if (run_cmd(cmd) != 0) {
-            fprintf(stderr, "Error: git init failed.\n");
-            remove_dir(staging);
-            return 1;
+            /* Empty remote, rewritten branch or broken clone: start over */
+            printf("Could not update the staging clone, cloning again.\n");
+            reuse = 0;
         }
+    }
+    if (!reuse) {
+        manifest_free(&old_manifest);
+        remove_dir(staging);
+
+        /* 3. Clone the existing repo (shallow, single branch, fast) */
+        printf("Cloning existing repo...\n");
         snprintf(cmd, sizeof(cmd),
-            "cd \"%s\" && git remote add origin \"%s\"", staging, repo_url);
-        run_cmd(cmd);
-    } else {
-        /* Ensure we are on main branch */
-        snprintf(cmd, sizeof(cmd),
-            "cd \"%s\" && git checkout main 2>/dev/null || git checkout -b main",
-            staging);
-        run_cmd(cmd);
+            "git clone --depth 1 \"%s\" \"%s\" 2>&1", repo_url, staging);
+        int clone_rc = run_cmd(cmd);
+
+        if (clone_rc != 0) {
+            /* Repo might be empty or not exist yet -- fall back to fresh init */
+            printf("Clone failed (repo may be empty). Initializing fresh.\n");
+            remove_dir(staging);
+            MKDIR(staging);
+            if (!dir_exists(staging)) {
+                fprintf(stderr, "Error: Could not create staging directory: %s\n", staging);
+                return 1;
+            }
+            snprintf(cmd, sizeof(cmd),
+                "cd \"%s\" && git init && git checkout -b main", staging);
+            if (run_cmd(cmd) != 0) {
+                fprintf(stderr, "Error: git init failed.\n");
+                remove_dir(staging);
+                return 1;
+            }
+            snprintf(cmd, sizeof(cmd),
+                "cd \"%s\" && git remote add origin \"%s\"", staging, repo_url);
+            run_cmd(cmd);
+        } else {
+            /* Ensure we are on main branch */
+            snprintf(cmd, sizeof(cmd),
+                "cd \"%s\" && git checkout main 2>/dev/null || git checkout -b main",
+                staging);
+            run_cmd(cmd);
+        }
     }
 
     /* 4. Read existing CNAME from the cloned repo (if any) before overwriting */
@@ -313,29 +1470,21 @@ static int deploy(const char *repo_url) {
         }
     }
 
-    /* 5. Remove old HTML files from staging (but keep .git, CNAME, .nojekyll, etc.) */
-    {
-        char rm_path[MAX_PATH_LEN];
-        const char *exts[] = { "*.html", "*.htm", "*.css", "*.js", "*.json", NULL };
-        for (int i = 0; exts[i]; i++) {
-            #ifdef _WIN32
-            snprintf(rm_path, sizeof(rm_path),
-                "del /Q \"%s\\%s\" 2>nul", staging, exts[i]);
-            #else
-            snprintf(rm_path, sizeof(rm_path),
-                "rm -f \"%s\"/%s 2>/dev/null", staging, exts[i]);
-            #endif
-            run_cmd_quiet(rm_path);
-        }
-    }
-
-    /* 6. Copy new build files to staging */
-    printf("Copying build files...\n");
-    if (copy_build_files(build_dir, staging) != 0) {
+    /* 5-6. Copy new and changed build files, delete build files that are gone */
+    printf("Syncing build files...\n");
+    sync_stats stats = { 0, 0, 0, 0 };
+    snprintf(manifest.url, sizeof(manifest.url), "%s", repo_url);
+    sync_build(build_dir, staging, &old_manifest, &manifest, &stats);
+    manifest_free(&old_manifest);
+    printf("  %d copied, %d deleted, %d unchanged\n", stats.copied, stats.deleted, stats.unchanged);
+    if (stats.failed) {
         fprintf(stderr, "Error: Failed to copy build files.\n");
+        manifest_free(&manifest);
         remove_dir(staging);
         return 1;
     }
+    manifest_save(&manifest, staging);
+    manifest_free(&manifest);
 
     /* 7. Ensure .nojekyll exists */
     {
@@ -363,7 +1512,6 @@ static int deploy(const char *repo_url) {
     snprintf(cmd, sizeof(cmd), "cd \"%s\" && git add -A", staging);
     if (run_cmd(cmd) != 0) {
         fprintf(stderr, "Error: git add failed.\n");
-        remove_dir(staging);
         return 1;
     }
 
@@ -372,7 +1520,6 @@ static int deploy(const char *repo_url) {
         "cd \"%s\" && git diff --cached --quiet", staging);
     if (run_cmd_quiet(cmd) == 0) {
         printf("\nNo changes detected. Site is already up to date.\n");
-        remove_dir(staging);
         return 0;
     }
 
@@ -382,83 +1529,29 @@ static int deploy(const char *repo_url) {
         staging);
     if (run_cmd(cmd) != 0) {
         fprintf(stderr, "Error: git commit failed.\n");
-        remove_dir(staging);
         return 1;
     }
 
     /* 12. Push (normal push, not force -- preserves history and config) */
     printf("\nPushing to %s ...\n", repo_url);
-    snprintf(cmd, sizeof(cmd),
-        "cd \"%s\" && git push origin main", staging);
-    int push_rc = run_cmd(cmd);
-
-    if (push_rc != 0) {
-        /* If normal push fails (diverged history), do a force push */
-        printf("\nNormal push failed, force pushing...\n");
-        snprintf(cmd, sizeof(cmd),
-            "cd \"%s\" && git push -f origin main", staging);
-        push_rc = run_cmd(cmd);
-    }
-
-    if (push_rc != 0) {
-        /* Try gh-pages branch as last fallback */
-        printf("\nTrying gh-pages branch...\n");
-        snprintf(cmd, sizeof(cmd),
-            "cd \"%s\" && git push -f origin main:gh-pages",
-            staging);
-        push_rc = run_cmd(cmd);
-    }
-
-    /* 13. Cleanup */
-    remove_dir(staging);
+    int push_rc = push_staging(staging);
 
+    /* 13. The staging clone is kept for the next deploy */
     if (push_rc != 0) {
         fprintf(stderr, "\nError: Push failed. Check your git credentials and repo URL.\n");
         return 1;
     }
 
+    /* The tree --fast recorded no longer describes the remote */
+    {
+        char state[MAX_PATH_LEN];
+        tree_state_path(state, sizeof(state), staging);
+        remove(state);
+    }
+
     printf("\n--- Deploy complete ---\n");
 
-    /* Print the live URL */
-    if (domain[0]) {
-        printf("Your site is live at: https://%s/\n", domain);
-    } else {
-        /* Derive the pages URL from the repo URL */
-        char pages_url[MAX_URL] = {0};
-        const char *gh = strstr(repo_url, "github.com/");
-        if (gh) {
-            const char *after = gh + 11;
-            char user[256] = {0};
-            char repo[256] = {0};
-            int i = 0;
-            while (after[i] && after[i] != '/' && i < 255) {
-                user[i] = after[i];
-                i++;
-            }
-            user[i] = '\0';
-            if (after[i] == '/') {
-                i++;
-                int j = 0;
-                while (after[i] && after[i] != '/' && after[i] != '.' && j < 255) {
-                    repo[j++] = after[i++];
-                }
-                repo[j] = '\0';
-            }
-            if (user[0] && repo[0]) {
-                char user_pages[512];
-                snprintf(user_pages, sizeof(user_pages), "%s.github.io", user);
-                if (strcmp(repo, user_pages) == 0) {
-                    snprintf(pages_url, sizeof(pages_url),
-                        "https://%s.github.io/", user);
-                } else {
-                    snprintf(pages_url, sizeof(pages_url),
-                        "https://%s.github.io/%s/", user, repo);
-                }
-                printf("Your site is live at: %s\n", pages_url);
-            }
-        }
-    }
-    printf("Zero downtime -- no settings were disrupted.\n");
+    print_live_url(domain, repo_url);
 
     return 0;
 }
@@ -468,6 +1561,19 @@ static int deploy(const char *repo_url) {
 int main(int argc, char *argv[]) {
     char repo_url[MAX_URL] = {0};
     char config_path[MAX_PATH_LEN] = {0};
+    char mode[32];
+    int fast = 0;
+
+    /* --fast may appear anywhere; mode=fast in deploy.conf makes it the default */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fast") == 0) {
+            fast = 1;
+            for (int j = i; j < argc - 1; j++) argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+    }
+    if (read_config_value("mode=", mode, sizeof(mode)) && strcmp(mode, "fast") == 0) fast = 1;
 
     /* Determine config file path (prefer parent dir for when run from deploy/) */
     if (file_exists("deploy.conf")) {
@@ -495,6 +1601,8 @@ int main(int argc, char *argv[]) {
             printf("  deploy <repo-url>          Deploy and save repo URL\n");
             printf("  deploy --set <repo-url>    Save repo URL without deploying\n");
             printf("  deploy --config            Show current config\n");
+            printf("  deploy --fast [<repo-url>] Deploy through git fast-import, without\n");
+            printf("                             a work tree (or set mode=fast in deploy.conf)\n");
             return 0;
         }
         /* Treat as repo URL */
@@ -525,5 +1633,5 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    return deploy(repo_url);
+    return deploy(repo_url, fast);
 }
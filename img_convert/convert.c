@@ -7,13 +7,15 @@
  * works on GitHub Pages and any other static host because the image
  * data lives inside the file itself -- no external references needed.
  *
- * Optimization uses platform-native tools with zero extra dependencies:
+ * Image dimensions are read straight from PNG, JPEG, GIF and WebP headers,
+ * and PNGs are decoded, resampled and re-encoded in memory by the built-in
+ * codec.  Other formats fall back to platform tools:
  *   macOS  -- sips (built in)
  *   Linux  -- magick / convert (ImageMagick) if available
  *   Windows -- PowerShell System.Drawing
  *
  * Build:
- *   gcc -O2 -o convert convert.c          (macOS / Linux)
+ *   gcc -O2 -pthread -o convert convert.c (macOS / Linux)
  *   cl convert.c /Fe:convert.exe          (Windows MSVC)
  *   gcc -O2 -o convert.exe convert.c      (Windows MinGW)
  *
@@ -21,6 +23,7 @@
  *   ./convert photo.png                    (auto-optimizes to 512px max)
  *   ./convert --max 256 avatar.png         (resize to 256px max)
  *   ./convert --no-optimize photo.png      (skip optimization, encode raw)
+ *   ./convert --jobs 8 --json a.png b.png  (parallel, output in order)
  *   ./convert --json photo.png logo.svg
  *   ./convert --field site.image avatar.jpg
  *   ./convert --css bg.png
@@ -32,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdarg.h>
 
 /* ---- Platform ---- */
 
@@ -39,55 +43,349 @@
   #ifndef _CRT_SECURE_NO_WARNINGS
     #define _CRT_SECURE_NO_WARNINGS
   #endif
+  #include <windows.h>
   #include <io.h>
   #include <fcntl.h>
   #include <process.h>
   #include <direct.h>
   #define PATH_SEP '\\'
+  #define getpid _getpid
+  #define make_dir(p) _mkdir(p)
+
+  /* Threads: Win32 primitives (Vista+) */
+  typedef HANDLE thread_t;
+  typedef CRITICAL_SECTION mutex_t;
+  typedef CONDITION_VARIABLE cond_t;
+  #define THREAD_FUNC unsigned __stdcall
+  #define THREAD_RETURN return 0
+  #define mutex_init(m)      InitializeCriticalSection(m)
+  #define mutex_lock(m)      EnterCriticalSection(m)
+  #define mutex_unlock(m)    LeaveCriticalSection(m)
+  #define cond_init(c)       InitializeConditionVariable(c)
+  #define cond_wait(c, m)    SleepConditionVariableCS(c, m, INFINITE)
+  #define cond_broadcast(c)  WakeAllConditionVariable(c)
+  static int thread_start(thread_t *t, unsigned (__stdcall *fn)(void *), void *arg) {
+      *t = (HANDLE)_beginthreadex(NULL, 0, fn, arg, 0, NULL);
+      return *t ? 0 : -1;
+  }
+  static void thread_join(thread_t t) {
+      WaitForSingleObject(t, INFINITE);
+      CloseHandle(t);
+  }
 #else
   #include <unistd.h>
   #include <sys/stat.h>
+  #include <pthread.h>
   #define PATH_SEP '/'
+  #define make_dir(p) mkdir(p, 0755)
+
+  /* Threads: POSIX */
+  typedef pthread_t thread_t;
+  typedef pthread_mutex_t mutex_t;
+  typedef pthread_cond_t cond_t;
+  #define THREAD_FUNC void *
+  #define THREAD_RETURN return NULL
+  #define mutex_init(m)      pthread_mutex_init(m, NULL)
+  #define mutex_lock(m)      pthread_mutex_lock(m)
+  #define mutex_unlock(m)    pthread_mutex_unlock(m)
+  #define cond_init(c)       pthread_cond_init(c, NULL)
+  #define cond_wait(c, m)    pthread_cond_wait(c, m)
+  #define cond_broadcast(c)  pthread_cond_broadcast(c)
+  static int thread_start(thread_t *t, void *(*fn)(void *), void *arg) {
+      return pthread_create(t, NULL, fn, arg) == 0 ? 0 : -1;
+  }
+  static void thread_join(thread_t t) { pthread_join(t, NULL); }
 #endif
 
+/* ---- Buffered output ---- */
+
+/*
+ * Everything written to stdout goes through one buffer, so the encoder
+ * can write base64 straight into it and nothing is emitted a byte at a
+ * time.
+ */
+
+#define OUT_BUF_SIZE (256 * 1024)
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len = 0;
+
+static void out_flush(void) {
+    if (out_len) fwrite(out_buf, 1, out_len, stdout);
+    out_len = 0;
+}
+
+static void out_char(char c) {
+    if (out_len == OUT_BUF_SIZE) out_flush();
+    out_buf[out_len++] = c;
+}
+
+static void out_write(const char *p, size_t n) {
+    if (n > OUT_BUF_SIZE - out_len) {
+        out_flush();
+        if (n >= OUT_BUF_SIZE) {
+            fwrite(p, 1, n, stdout);
+            return;
+        }
+    }
+    memcpy(out_buf + out_len, p, n);
+    out_len += n;
+}
+
+static void out_str(const char *s) {
+    out_write(s, strlen(s));
+}
+
+static void out_printf(const char *fmt, ...) {
+    char tmp[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > 0) out_write(tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
 /* ---- Base64 encoding ---- */
 
 static const char B64[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 /*
- * Encode src (len bytes) into a null-terminated base64 string.
- * Caller must free the returned pointer.
+ * Kernels encode as many whole input blocks as they can and return the
+ * number of input bytes consumed (always a multiple of 3); the scalar
+ * loop finishes the rest. x86 picks SSSE3 or AVX2 at run time, so a plain
+ * "gcc -O2" build still uses them; ARM64 always has NEON.
  */
-static char *base64_encode(const unsigned char *src, size_t len) {
-    size_t out_len = 4 * ((len + 2) / 3);
-    char *out = (char *)malloc(out_len + 1);
-    if (!out) return NULL;
+typedef size_t (*b64_kernel)(const unsigned char *src, size_t len, char *dst);
+
+static size_t b64_scalar(const unsigned char *src, size_t len, char *dst) {
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        unsigned int triple = ((unsigned)src[i] << 16) | ((unsigned)src[i + 1] << 8) | src[i + 2];
+        *dst++ = B64[(triple >> 18) & 0x3F];
+        *dst++ = B64[(triple >> 12) & 0x3F];
+        *dst++ = B64[(triple >>  6) & 0x3F];
+        *dst++ = B64[(triple      ) & 0x3F];
+    }
+    return i;
+}
 
-    size_t i = 0, j = 0;
-    while (i < len) {
-        unsigned int a = i < len ? src[i++] : 0;
-        unsigned int b = i < len ? src[i++] : 0;
-        unsigned int c = i < len ? src[i++] : 0;
-        unsigned int triple = (a << 16) | (b << 8) | c;
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+  #define B64_X86 1
+  #define B64_TARGET(t) __attribute__((target(t)))
+  static int cpu_has_ssse3(void) { return __builtin_cpu_supports("ssse3"); }
+  static int cpu_has_avx2(void)  { return __builtin_cpu_supports("avx2"); }
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  #include <immintrin.h>
+  #include <intrin.h>
+  #define B64_X86 1
+  #define B64_TARGET(t)
+  static int cpu_has_ssse3(void) {
+      int info[4];
+      __cpuid(info, 1);
+      return (info[2] >> 9) & 1;
+  }
+  static int cpu_has_avx2(void) {
+      int info[4];
+      __cpuid(info, 1);
+      if (!((info[2] >> 27) & 1) || (_xgetbv(0) & 6) != 6) return 0;   /* OS saves YMM */
+      __cpuidex(info, 7, 0);
+      return (info[1] >> 5) & 1;
+  }
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define B64_NEON 1
+#endif
 
-        out[j++] = B64[(triple >> 18) & 0x3F];
-        out[j++] = B64[(triple >> 12) & 0x3F];
-        out[j++] = B64[(triple >>  6) & 0x3F];
-        out[j++] = B64[(triple      ) & 0x3F];
+#ifdef B64_X86
+/*
+ * 12 input bytes -> 16 characters per 128-bit lane: pshufb spreads each
+ * 3-byte group over 4 bytes, two multiplies move the 6-bit fields into
+ * place, then a second pshufb turns each index into its ASCII offset.
+ */
+B64_TARGET("ssse3")
+static size_t b64_ssse3(const unsigned char *src, size_t len, char *dst) {
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m128i shift_lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 12, dst += 16) {
+        __m128i in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), spread);
+        __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                                     _mm_set1_epi32(0x04000040));
+        __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                                     _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(t0, t1);
+        __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+        r = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, r), idx);
+        _mm_storeu_si128((__m128i *)dst, r);
     }
+    return i;
+}
 
-    /* Pad */
-    size_t mod = len % 3;
-    if (mod == 1) {
-        out[j - 1] = '=';
-        out[j - 2] = '=';
-    } else if (mod == 2) {
-        out[j - 1] = '=';
+/* Same steps on two lanes: 24 input bytes -> 32 characters */
+B64_TARGET("avx2")
+static size_t b64_avx2(const unsigned char *src, size_t len, char *dst) {
+    const __m256i spread = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift_lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    for (; i + 28 <= len; i += 24, dst += 32) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i))),
+            _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, spread);
+        __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                                        _mm256_set1_epi32(0x04000040));
+        __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                                        _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t0, t1);
+        __m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx),
+                                                _mm256_set1_epi8(13)));
+        r = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, r), idx);
+        _mm256_storeu_si256((__m256i *)dst, r);
     }
+    return i;
+}
+#endif
 
-    out[j] = '\0';
-    return out;
+#ifdef B64_NEON
+/* vld3 de-interleaves 48 bytes, tbl4 maps 64 indices, vst4 re-interleaves */
+static size_t b64_neon(const unsigned char *src, size_t len, char *dst) {
+    uint8x16x4_t lut;
+    for (int k = 0; k < 4; k++) lut.val[k] = vld1q_u8((const uint8_t *)B64 + 16 * k);
+    size_t i = 0;
+    for (; i + 48 <= len; i += 48, dst += 64) {
+        uint8x16x3_t in = vld3q_u8(src + i);
+        uint8x16x4_t out;
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vorrq_u8(vandq_u8(vshlq_n_u8(in.val[0], 4), vdupq_n_u8(0x30)),
+                              vshrq_n_u8(in.val[1], 4));
+        out.val[2] = vorrq_u8(vandq_u8(vshlq_n_u8(in.val[1], 2), vdupq_n_u8(0x3C)),
+                              vshrq_n_u8(in.val[2], 6));
+        out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+        for (int k = 0; k < 4; k++) out.val[k] = vqtbl4q_u8(lut, out.val[k]);
+        vst4q_u8((uint8_t *)dst, out);
+    }
+    return i;
+}
+#endif
+
+static b64_kernel b64_pick(const char **name) {
+#ifdef B64_X86
+    if (cpu_has_avx2())  { *name = "avx2";  return b64_avx2; }
+    if (cpu_has_ssse3()) { *name = "ssse3"; return b64_ssse3; }
+#elif defined(B64_NEON)
+    *name = "neon";
+    return b64_neon;
+#endif
+    *name = "scalar";
+    return b64_scalar;
+}
+
+/*
+ * Encode len bytes into dst (which must hold 4 * ((len + 2) / 3) chars).
+ * Padding is only written when final is set; otherwise len must be a
+ * multiple of 3. Returns the number of characters written.
+ */
+static size_t base64_encode_block(const unsigned char *src, size_t len, char *dst, int final) {
+    static b64_kernel kernel = NULL;
+    if (!kernel) {
+        const char *name;
+        kernel = b64_pick(&name);
+    }
+    size_t i = kernel(src, len, dst);
+    i += b64_scalar(src + i, len - i, dst + i / 3 * 4);
+    char *o = dst + i / 3 * 4;
+    size_t rem = len - i;
+    if (final && rem) {
+        unsigned a = src[i], b = rem > 1 ? src[i + 1] : 0;
+        *o++ = B64[a >> 2];
+        *o++ = B64[((a & 3) << 4) | (b >> 4)];
+        *o++ = rem > 1 ? B64[(b & 15) << 2] : '=';
+        *o++ = '=';
+    }
+    return (size_t)(o - dst);
+}
+
+/*
+ * Streaming encoder: input arrives in any sized pieces, leftover bytes
+ * (fewer than 3) carry over, and the characters go straight into the
+ * output buffer. With wrap > 0 a newline is inserted every wrap
+ * characters, counting whatever was written through b64_put before.
+ */
+
+#define B64_CHUNK (48 * 1024)    /* input bytes per block, a multiple of 48 */
+
+typedef struct {
+    unsigned char carry[3];
+    int ncarry;
+    int wrap;
+    long col;
+} b64_stream;
+
+/* Write text, breaking lines every s->wrap characters */
+static void b64_put(b64_stream *s, const char *p, size_t n) {
+    if (s->wrap <= 0) {
+        out_write(p, n);
+        return;
+    }
+    while (n > 0) {
+        if (s->col == s->wrap) {
+            out_char('\n');
+            s->col = 0;
+        }
+        size_t k = (size_t)(s->wrap - s->col);
+        if (k > n) k = n;
+        out_write(p, k);
+        s->col += (long)k;
+        p += k;
+        n -= k;
+    }
+}
+
+static void b64_encode_out(b64_stream *s, const unsigned char *src, size_t len, int final) {
+    static char block[B64_CHUNK / 3 * 4 + 4];
+    size_t need = 4 * ((len + 2) / 3);
+    if (s->wrap <= 0) {
+        if (need > OUT_BUF_SIZE - out_len) out_flush();
+        out_len += base64_encode_block(src, len, out_buf + out_len, final);
+    } else {
+        b64_put(s, block, base64_encode_block(src, len, block, final));
+    }
+}
+
+static void b64_write(b64_stream *s, const unsigned char *src, size_t len) {
+    while (s->ncarry > 0 && s->ncarry < 3 && len > 0) {
+        s->carry[s->ncarry++] = *src++;
+        len--;
+    }
+    if (s->ncarry == 3) {
+        b64_encode_out(s, s->carry, 3, 0);
+        s->ncarry = 0;
+    }
+    while (len >= 3) {
+        size_t n = len < B64_CHUNK ? len - len % 3 : B64_CHUNK;
+        b64_encode_out(s, src, n, 0);
+        src += n;
+        len -= n;
+    }
+    memcpy(s->carry + s->ncarry, src, len);
+    s->ncarry += (int)len;
+}
+
+static void b64_end(b64_stream *s) {
+    if (s->ncarry) b64_encode_out(s, s->carry, (size_t)s->ncarry, 1);
+    s->ncarry = 0;
 }
 
 /* ---- MIME type detection ---- */
@@ -141,12 +439,9 @@ static const char *detect_mime(const char *filename) {
 
 /* ---- File reading ---- */
 
-static unsigned char *read_file(const char *path, size_t *out_len) {
-#ifdef _WIN32
-    FILE *fp = fopen(path, "rb");
-#else
+/* Open a file for reading and report its size; NULL (with a message) on failure */
+static FILE *open_sized(const char *path, size_t *out_len) {
     FILE *fp = fopen(path, "rb");
-#endif
     if (!fp) {
         fprintf(stderr, "convert: cannot open %s\n", path);
         return NULL;
@@ -161,30 +456,39 @@ static unsigned char *read_file(const char *path, size_t *out_len) {
         fclose(fp);
         return NULL;
     }
+    *out_len = (size_t)fsize;
+    return fp;
+}
+
+static unsigned char *read_file(const char *path, size_t *out_len) {
+    size_t fsize = 0;
+    FILE *fp = open_sized(path, &fsize);
+    if (!fp) return NULL;
 
-    unsigned char *buf = (unsigned char *)malloc((size_t)fsize);
+    unsigned char *buf = (unsigned char *)malloc(fsize);
     if (!buf) {
         fprintf(stderr, "convert: out of memory reading %s\n", path);
         fclose(fp);
         return NULL;
     }
 
-    size_t nread = fread(buf, 1, (size_t)fsize, fp);
+    size_t nread = fread(buf, 1, fsize, fp);
     fclose(fp);
 
-    if (nread != (size_t)fsize) {
+    if (nread != fsize) {
         fprintf(stderr, "convert: short read on %s\n", path);
         free(buf);
         return NULL;
     }
 
-    *out_len = (size_t)fsize;
+    *out_len = fsize;
     return buf;
 }
 
 /* ---- Temp file path ---- */
 
-static void make_temp_path(char *buf, size_t buf_len, const char *original) {
+/* tag keeps parallel jobs on same-named files apart */
+static void make_temp_path(char *buf, size_t buf_len, const char *original, int tag) {
     const char *base = original;
     const char *p = original;
     while (*p) {
@@ -200,22 +504,1165 @@ static void make_temp_path(char *buf, size_t buf_len, const char *original) {
         p++;
     }
 
-#ifdef _WIN32
-    const char *tmp = getenv("TEMP");
-    if (!tmp) tmp = getenv("TMP");
-    if (!tmp) tmp = ".";
-    if (dot) {
-        snprintf(buf, buf_len, "%s\\_cvt_opt_%s", tmp, base);
-    } else {
-        snprintf(buf, buf_len, "%s\\_cvt_opt_%s.png", tmp, base);
+#ifdef _WIN32
+    const char *tmp = getenv("TEMP");
+    if (!tmp) tmp = getenv("TMP");
+    if (!tmp) tmp = ".";
+    if (dot) {
+        snprintf(buf, buf_len, "%s\\_cvt_opt_%d_%d_%s", tmp, (int)getpid(), tag, base);
+    } else {
+        snprintf(buf, buf_len, "%s\\_cvt_opt_%d_%d_%s.png", tmp, (int)getpid(), tag, base);
+    }
+#else
+    if (dot) {
+        snprintf(buf, buf_len, "/tmp/_cvt_opt_%d_%d_%s", (int)getpid(), tag, base);
+    } else {
+        snprintf(buf, buf_len, "/tmp/_cvt_opt_%d_%d_%s.png", (int)getpid(), tag, base);
+    }
+#endif
+}
+
+/* ---- Image headers ---- */
+
+static unsigned long be32(const unsigned char *p) {
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+           ((unsigned long)p[2] << 8) | p[3];
+}
+static unsigned be16(const unsigned char *p) { return ((unsigned)p[0] << 8) | p[1]; }
+static unsigned le16(const unsigned char *p) { return p[0] | ((unsigned)p[1] << 8); }
+static unsigned long le24(const unsigned char *p) {
+    return p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16);
+}
+
+static const unsigned char PNG_SIG[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static int is_png(const unsigned char *d, size_t len) {
+    return len >= 8 && memcmp(d, PNG_SIG, 8) == 0;
+}
+
+/*
+ * Read pixel dimensions straight from a PNG, GIF, WebP or JPEG header.
+ * Returns 1 on success, 0 if the format is not recognized (the caller
+ * then falls back to the platform tools).
+ */
+static int header_dimensions(const unsigned char *d, size_t len, int *w, int *h) {
+    *w = *h = 0;
+
+    /* PNG: IHDR is always the first chunk */
+    if (is_png(d, len) && len >= 24 && memcmp(d + 12, "IHDR", 4) == 0) {
+        *w = (int)be32(d + 16);
+        *h = (int)be32(d + 20);
+    }
+    /* GIF87a / GIF89a: logical screen size */
+    else if (len >= 10 && memcmp(d, "GIF8", 4) == 0) {
+        *w = (int)le16(d + 6);
+        *h = (int)le16(d + 8);
+    }
+    /* WebP: RIFF container, first chunk is VP8 (lossy), VP8L or VP8X */
+    else if (len >= 30 && memcmp(d, "RIFF", 4) == 0 && memcmp(d + 8, "WEBP", 4) == 0) {
+        if (memcmp(d + 12, "VP8 ", 4) == 0 && d[23] == 0x9d && d[24] == 0x01 && d[25] == 0x2a) {
+            *w = (int)(le16(d + 26) & 0x3fff);
+            *h = (int)(le16(d + 28) & 0x3fff);
+        } else if (memcmp(d + 12, "VP8L", 4) == 0 && d[20] == 0x2f) {
+            unsigned long bits = d[21] | ((unsigned long)d[22] << 8) |
+                                 ((unsigned long)d[23] << 16) | ((unsigned long)d[24] << 24);
+            *w = (int)(bits & 0x3fff) + 1;
+            *h = (int)((bits >> 14) & 0x3fff) + 1;
+        } else if (memcmp(d + 12, "VP8X", 4) == 0) {
+            *w = (int)le24(d + 24) + 1;
+            *h = (int)le24(d + 27) + 1;
+        }
+    }
+    /* JPEG: walk the marker segments up to the first start-of-frame */
+    else if (len >= 4 && d[0] == 0xFF && d[1] == 0xD8) {
+        size_t i = 2;
+        while (i + 9 <= len && d[i] == 0xFF) {
+            unsigned m = d[i + 1];
+            if (m == 0xFF) { i++; continue; }                 /* fill byte */
+            if (m == 0x01 || (m >= 0xD0 && m <= 0xD8)) { i += 2; continue; }
+            if (m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) {
+                *h = (int)be16(d + i + 5);
+                *w = (int)be16(d + i + 7);
+                break;
+            }
+            unsigned seg = be16(d + i + 2);
+            if (seg < 2) break;
+            i += 2 + seg;
+        }
+    }
+    return *w > 0 && *h > 0;
+}
+
+/* ---- Growable buffer ---- */
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} membuf;
+
+static void membuf_append(membuf *b, const void *src, size_t n) {
+    if (b->failed) return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 65536;
+        while (cap < b->len + n) cap *= 2;
+        unsigned char *tmp = (unsigned char *)realloc(b->data, cap);
+        if (!tmp) { b->failed = 1; return; }
+        b->data = tmp;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+}
+
+static void membuf_be32(membuf *b, unsigned long v) {
+    unsigned char p[4] = {
+        (unsigned char)(v >> 24), (unsigned char)(v >> 16),
+        (unsigned char)(v >> 8), (unsigned char)v
+    };
+    membuf_append(b, p, 4);
+}
+
+static void membuf_printf(membuf *b, const char *fmt, ...) {
+    char tmp[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n > 0) membuf_append(b, tmp, (size_t)n < sizeof(tmp) ? (size_t)n : sizeof(tmp) - 1);
+}
+
+/* ---- Checksums ---- */
+
+static unsigned long crc_table[256];
+
+static void crc32_init(void) {
+    for (unsigned long n = 0; n < 256; n++) {
+        unsigned long c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static unsigned long crc32_update(unsigned long crc, const unsigned char *p, size_t len) {
+    crc ^= 0xFFFFFFFFUL;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+static unsigned long adler32_update(unsigned long adler, const unsigned char *p, size_t len) {
+    unsigned long a = adler & 0xFFFF, b = adler >> 16;
+    while (len > 0) {
+        size_t n = len < 5552 ? len : 5552;     /* largest run without overflow */
+        len -= n;
+        while (n--) { a += *p++; b += a; }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+/* ---- Deflate encoder ---- */
+
+/*
+ * The same LZ77 + dynamic Huffman encoder serve.c uses for gzip, wrapped
+ * in a zlib stream (RFC 1950) here because that is what PNG IDAT holds.
+ */
+
+#define DZ_WSIZE      32768
+#define DZ_WMASK      (DZ_WSIZE - 1)
+#define DZ_HASH_BITS  15
+#define DZ_HASH_SIZE  (1 << DZ_HASH_BITS)
+#define DZ_MIN_MATCH  3
+#define DZ_MAX_MATCH  258
+#define DZ_LOOKAHEAD  (DZ_MAX_MATCH + DZ_MIN_MATCH + 1)
+#define DZ_MAX_CHAIN  48
+#define DZ_GOOD_MATCH 64
+#define DZ_BLOCK_SYMS 16384
+#define DZ_OUT_SIZE   65536
+
+typedef void (*dz_emit_fn)(void *ctx, const unsigned char *data, size_t len);
+
+typedef struct {
+    unsigned char window[2 * DZ_WSIZE];
+    int head[DZ_HASH_SIZE];
+    int prev[DZ_WSIZE];
+    long win_len;                        /* valid bytes in window */
+    long pos;                            /* next byte to encode */
+    unsigned short sym_lit[DZ_BLOCK_SYMS];  /* literal byte or match length */
+    unsigned short sym_dist[DZ_BLOCK_SYMS]; /* match distance, 0 for literals */
+    int nsyms;
+    unsigned long bitbuf;
+    int bitcount;
+    unsigned char out[DZ_OUT_SIZE];
+    size_t out_len;
+    unsigned long adler;
+    dz_emit_fn emit;
+    void *ctx;
+} dz_stream;
+
+static const unsigned short dz_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char dz_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dz_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char dz_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char dz_clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static int dz_len_code(int len) {
+    int i = 28;
+    while (dz_len_base[i] > len) i--;
+    return i;
+}
+
+static int dz_dist_code(int dist) {
+    int i = 29;
+    while (dz_dist_base[i] > dist) i--;
+    return i;
+}
+
+static void dz_flush_out(dz_stream *z) {
+    if (z->out_len > 0) {
+        z->emit(z->ctx, z->out, z->out_len);
+        z->out_len = 0;
+    }
+}
+
+static void dz_put_byte(dz_stream *z, unsigned char c) {
+    if (z->out_len == DZ_OUT_SIZE) dz_flush_out(z);
+    z->out[z->out_len++] = c;
+}
+
+/* Write nbits of value, least significant bit first */
+static void dz_put_bits(dz_stream *z, unsigned long value, int nbits) {
+    z->bitbuf |= value << z->bitcount;
+    z->bitcount += nbits;
+    while (z->bitcount >= 8) {
+        dz_put_byte(z, (unsigned char)(z->bitbuf & 0xFF));
+        z->bitbuf >>= 8;
+        z->bitcount -= 8;
+    }
+}
+
+/*
+ * Compute Huffman code lengths for n symbols, none longer than limit.
+ * When the optimal tree is too deep the frequencies are flattened and the
+ * tree rebuilt, which converges quickly and costs very little ratio.
+ */
+static void dz_build_lengths(const unsigned long *freq_in, int n, int limit, unsigned char *lens) {
+    unsigned long freq[288];
+    unsigned long weight[2 * 288];
+    int parent[2 * 288];
+    int alive[2 * 288];
+    for (int i = 0; i < n; i++) freq[i] = freq_in[i];
+
+    for (;;) {
+        int nodes = 0, used = 0;
+        memset(lens, 0, n);
+        for (int i = 0; i < n; i++) {
+            weight[i] = freq[i];
+            parent[i] = -1;
+            alive[i] = freq[i] > 0;
+            used += alive[i];
+        }
+        nodes = n;
+        if (used == 0) return;
+        if (used == 1) {
+            for (int i = 0; i < n; i++) if (freq[i]) lens[i] = 1;
+            return;
+        }
+        for (int remaining = used; remaining > 1; remaining--) {
+            int a = -1, b = -1;
+            for (int i = 0; i < nodes; i++) {
+                if (!alive[i]) continue;
+                if (a < 0 || weight[i] < weight[a]) { b = a; a = i; }
+                else if (b < 0 || weight[i] < weight[b]) { b = i; }
+            }
+            weight[nodes] = weight[a] + weight[b];
+            parent[nodes] = -1;
+            alive[nodes] = 1;
+            alive[a] = alive[b] = 0;
+            parent[a] = parent[b] = nodes;
+            nodes++;
+        }
+        int maxlen = 0;
+        for (int i = 0; i < n; i++) {
+            if (!freq[i]) continue;
+            int d = 0;
+            for (int p = parent[i]; p >= 0; p = parent[p]) d++;
+            lens[i] = (unsigned char)d;
+            if (d > maxlen) maxlen = d;
+        }
+        if (maxlen <= limit) return;
+        for (int i = 0; i < n; i++) if (freq[i]) freq[i] = (freq[i] >> 1) | 1;
+    }
+}
+
+/* Canonical codes from lengths, bit-reversed for LSB-first output */
+static void dz_build_codes(const unsigned char *lens, int n, unsigned short *codes) {
+    int bl_count[16] = {0};
+    int next_code[16];
+    for (int i = 0; i < n; i++) bl_count[lens[i]]++;
+    bl_count[0] = 0;
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        int len = lens[i];
+        if (!len) { codes[i] = 0; continue; }
+        int c = next_code[len]++;
+        int r = 0;
+        for (int k = 0; k < len; k++) { r = (r << 1) | (c & 1); c >>= 1; }
+        codes[i] = (unsigned short)r;
+    }
+}
+
+/* Make sure a tree has at least two codes so every decoder accepts it */
+static void dz_min_two(unsigned long *freq, int n) {
+    int used = 0;
+    for (int i = 0; i < n; i++) used += freq[i] > 0;
+    for (int i = 0; used < 2 && i < n; i++) {
+        if (!freq[i]) { freq[i] = 1; used++; }
+    }
+}
+
+/* Emit the buffered symbols as one dynamic-Huffman block */
+static void dz_flush_block(dz_stream *z, int final) {
+    unsigned long lfreq[286] = {0}, dfreq[30] = {0}, cfreq[19] = {0};
+    unsigned char llens[286], dlens[30], clens[19];
+    unsigned short lcodes[286], dcodes[30], ccodes[19];
+
+    for (int i = 0; i < z->nsyms; i++) {
+        if (z->sym_dist[i] == 0) {
+            lfreq[z->sym_lit[i]]++;
+        } else {
+            lfreq[257 + dz_len_code(z->sym_lit[i])]++;
+            dfreq[dz_dist_code(z->sym_dist[i])]++;
+        }
+    }
+    lfreq[256] = 1;
+    dz_min_two(lfreq, 286);
+    dz_min_two(dfreq, 30);
+    dz_build_lengths(lfreq, 286, 15, llens);
+    dz_build_lengths(dfreq, 30, 15, dlens);
+    dz_build_codes(llens, 286, lcodes);
+    dz_build_codes(dlens, 30, dcodes);
+
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && llens[hlit - 1] == 0) hlit--;
+    while (hdist > 1 && dlens[hdist - 1] == 0) hdist--;
+
+    /* Run-length encode the concatenated code lengths (symbols 16/17/18) */
+    unsigned char all[286 + 30];
+    unsigned char rle_sym[286 + 30];
+    unsigned char rle_extra[286 + 30];
+    int total = hlit + hdist, nrle = 0;
+    memcpy(all, llens, hlit);
+    memcpy(all + hlit, dlens, hdist);
+    for (int i = 0; i < total;) {
+        int len = all[i], run = 1;
+        while (i + run < total && all[i + run] == len) run++;
+        if (len == 0 && run >= 3) {
+            int r = run > 138 ? 138 : run;
+            if (r >= 11) { rle_sym[nrle] = 18; rle_extra[nrle++] = (unsigned char)(r - 11); }
+            else         { rle_sym[nrle] = 17; rle_extra[nrle++] = (unsigned char)(r - 3); }
+            i += r;
+        } else if (len != 0 && run >= 4) {
+            rle_sym[nrle] = (unsigned char)len; rle_extra[nrle++] = 0;
+            int r = run - 1 > 6 ? 6 : run - 1;
+            rle_sym[nrle] = 16; rle_extra[nrle++] = (unsigned char)(r - 3);
+            i += r + 1;
+        } else {
+            rle_sym[nrle] = (unsigned char)len; rle_extra[nrle++] = 0;
+            i++;
+        }
+    }
+    for (int i = 0; i < nrle; i++) cfreq[rle_sym[i]]++;
+    dz_min_two(cfreq, 19);
+    dz_build_lengths(cfreq, 19, 7, clens);
+    dz_build_codes(clens, 19, ccodes);
+    int hclen = 19;
+    while (hclen > 4 && clens[dz_clen_order[hclen - 1]] == 0) hclen--;
+
+    dz_put_bits(z, final ? 1 : 0, 1);
+    dz_put_bits(z, 2, 2);
+    dz_put_bits(z, (unsigned long)(hlit - 257), 5);
+    dz_put_bits(z, (unsigned long)(hdist - 1), 5);
+    dz_put_bits(z, (unsigned long)(hclen - 4), 4);
+    for (int i = 0; i < hclen; i++) dz_put_bits(z, clens[dz_clen_order[i]], 3);
+    for (int i = 0; i < nrle; i++) {
+        int sym = rle_sym[i];
+        dz_put_bits(z, ccodes[sym], clens[sym]);
+        if (sym == 16) dz_put_bits(z, rle_extra[i], 2);
+        else if (sym == 17) dz_put_bits(z, rle_extra[i], 3);
+        else if (sym == 18) dz_put_bits(z, rle_extra[i], 7);
+    }
+
+    for (int i = 0; i < z->nsyms; i++) {
+        int lit = z->sym_lit[i], dist = z->sym_dist[i];
+        if (dist == 0) {
+            dz_put_bits(z, lcodes[lit], llens[lit]);
+        } else {
+            int lc = dz_len_code(lit);
+            dz_put_bits(z, lcodes[257 + lc], llens[257 + lc]);
+            if (dz_len_extra[lc]) dz_put_bits(z, (unsigned long)(lit - dz_len_base[lc]), dz_len_extra[lc]);
+            int dc = dz_dist_code(dist);
+            dz_put_bits(z, dcodes[dc], dlens[dc]);
+            if (dz_dist_extra[dc]) dz_put_bits(z, (unsigned long)(dist - dz_dist_base[dc]), dz_dist_extra[dc]);
+        }
+    }
+    dz_put_bits(z, lcodes[256], llens[256]);
+    z->nsyms = 0;
+}
+
+static unsigned dz_hash(const unsigned char *p) {
+    return ((unsigned)p[0] * 506832829u ^ (unsigned)p[1] * 2654435761u ^ (unsigned)p[2]) >> 3
+           & (DZ_HASH_SIZE - 1);
+}
+
+static void dz_insert(dz_stream *z, long pos) {
+    unsigned h = dz_hash(z->window + pos);
+    z->prev[pos & DZ_WMASK] = z->head[h];
+    z->head[h] = (int)pos;
+}
+
+/* Encode window bytes up to the lookahead margin (or all of them when flushing) */
+static void dz_compress(dz_stream *z, int flush) {
+    long limit = flush ? z->win_len : z->win_len - DZ_LOOKAHEAD;
+    while (z->pos < limit) {
+        long pos = z->pos;
+        long avail = z->win_len - pos;
+        int best_len = 0, best_dist = 0;
+
+        if (avail >= DZ_MIN_MATCH) {
+            int max_len = avail < DZ_MAX_MATCH ? (int)avail : DZ_MAX_MATCH;
+            const unsigned char *cur_p = z->window + pos;
+            int cand = z->head[dz_hash(cur_p)];
+            int chain = DZ_MAX_CHAIN;
+            while (cand >= 0 && chain-- > 0) {
+                long dist = pos - cand;
+                if (dist <= 0 || dist > DZ_WSIZE) break;
+                const unsigned char *m = z->window + cand;
+                if (m[best_len] == cur_p[best_len] && m[0] == cur_p[0] && m[1] == cur_p[1]) {
+                    int len = 2;
+                    while (len < max_len && m[len] == cur_p[len]) len++;
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = (int)dist;
+                        if (len >= max_len || len >= DZ_GOOD_MATCH) break;
+                    }
+                }
+                int next = z->prev[cand & DZ_WMASK];
+                if (next >= cand) break;
+                cand = next;
+            }
+            dz_insert(z, pos);
+        }
+
+        if (best_len >= DZ_MIN_MATCH) {
+            z->sym_lit[z->nsyms] = (unsigned short)best_len;
+            z->sym_dist[z->nsyms++] = (unsigned short)best_dist;
+            for (int k = 1; k < best_len; k++) {
+                if (z->win_len - (pos + k) >= DZ_MIN_MATCH) dz_insert(z, pos + k);
+            }
+            z->pos += best_len;
+        } else {
+            z->sym_lit[z->nsyms] = z->window[pos];
+            z->sym_dist[z->nsyms++] = 0;
+            z->pos++;
+        }
+        if (z->nsyms == DZ_BLOCK_SYMS) dz_flush_block(z, 0);
+    }
+}
+
+static dz_stream *zlib_begin(dz_emit_fn emit, void *ctx) {
+    dz_stream *z = (dz_stream *)malloc(sizeof(dz_stream));
+    if (!z) return NULL;
+    z->win_len = 0;
+    z->pos = 0;
+    z->nsyms = 0;
+    z->bitbuf = 0;
+    z->bitcount = 0;
+    z->out_len = 0;
+    z->adler = 1;
+    z->emit = emit;
+    z->ctx = ctx;
+    for (int i = 0; i < DZ_HASH_SIZE; i++) z->head[i] = -1;
+    for (int i = 0; i < DZ_WSIZE; i++) z->prev[i] = -1;
+
+    dz_put_byte(z, 0x78);   /* deflate, 32 KB window */
+    dz_put_byte(z, 0x9C);
+    return z;
+}
+
+static void zlib_write(dz_stream *z, const unsigned char *data, size_t len) {
+    z->adler = adler32_update(z->adler, data, len);
+    while (len > 0) {
+        if (z->win_len == (long)sizeof(z->window)) {
+            /* Slide the upper half down; positions in the lower half expire */
+            memmove(z->window, z->window + DZ_WSIZE, DZ_WSIZE);
+            z->win_len -= DZ_WSIZE;
+            z->pos -= DZ_WSIZE;
+            for (int i = 0; i < DZ_HASH_SIZE; i++) {
+                z->head[i] = z->head[i] >= DZ_WSIZE ? z->head[i] - DZ_WSIZE : -1;
+            }
+            for (int i = 0; i < DZ_WSIZE; i++) {
+                z->prev[i] = z->prev[i] >= DZ_WSIZE ? z->prev[i] - DZ_WSIZE : -1;
+            }
+        }
+        size_t room = sizeof(z->window) - (size_t)z->win_len;
+        size_t n = len < room ? len : room;
+        memcpy(z->window + z->win_len, data, n);
+        z->win_len += (long)n;
+        data += n;
+        len -= n;
+        dz_compress(z, 0);
+    }
+}
+
+/* Flush the final block and Adler-32 trailer, then free the stream */
+static void zlib_end(dz_stream *z) {
+    dz_compress(z, 1);
+    dz_flush_block(z, 1);
+    if (z->bitcount > 0) dz_put_bits(z, 0, 8 - z->bitcount);
+    for (int i = 3; i >= 0; i--) dz_put_byte(z, (unsigned char)(z->adler >> (8 * i)));
+    dz_flush_out(z);
+    free(z);
+}
+
+static void membuf_emit(void *ctx, const unsigned char *data, size_t len) {
+    membuf_append((membuf *)ctx, data, len);
+}
+
+/* ---- Inflate ---- */
+
+/*
+ * zlib/deflate decoder (RFC 1950/1951) for PNG image data. Each Huffman
+ * code is resolved with one probe into a full 15-bit table whose entries
+ * are (symbol << 4) | code length.
+ */
+
+#define IF_BITS 15
+
+typedef struct {
+    const unsigned char *src;
+    size_t len;
+    size_t pos;
+    unsigned long long bits;
+    int nbits;
+    unsigned short lit[1 << IF_BITS];
+    unsigned short dist[1 << IF_BITS];
+} inflater;
+
+/* Past the end of input reads zeros; inflate_zlib checks for overrun */
+static void if_refill(inflater *s) {
+    while (s->nbits <= 56) {
+        unsigned long long b = s->pos < s->len ? s->src[s->pos] : 0;
+        s->pos++;
+        s->bits |= b << s->nbits;
+        s->nbits += 8;
+    }
+}
+
+static unsigned if_getbits(inflater *s, int n) {
+    if (s->nbits < n) if_refill(s);
+    unsigned v = (unsigned)(s->bits & ((1ULL << n) - 1));
+    s->bits >>= n;
+    s->nbits -= n;
+    return v;
+}
+
+static int if_decode(inflater *s, const unsigned short *table) {
+    if (s->nbits < IF_BITS) if_refill(s);
+    unsigned e = table[s->bits & ((1u << IF_BITS) - 1)];
+    int len = (int)(e & 15);
+    if (!len) return -1;
+    s->bits >>= len;
+    s->nbits -= len;
+    return (int)(e >> 4);
+}
+
+static int if_build(unsigned short *table, const unsigned char *lens, int n) {
+    int count[16] = {0}, next[16];
+    for (int i = 0; i < n; i++) count[lens[i]]++;
+    count[0] = 0;
+    int left = 1, code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        left = (left << 1) - count[bits];
+        if (left < 0) return -1;                /* over-subscribed */
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    memset(table, 0, sizeof(unsigned short) << IF_BITS);
+    for (int sym = 0; sym < n; sym++) {
+        int len = lens[sym];
+        if (!len) continue;
+        int c = next[len]++, r = 0;
+        for (int k = 0; k < len; k++) { r = (r << 1) | (c & 1); c >>= 1; }
+        for (int k = r; k < (1 << IF_BITS); k += 1 << len) {
+            table[k] = (unsigned short)((sym << 4) | len);
+        }
+    }
+    return 0;
+}
+
+/* Inflate a zlib stream into dst; returns the byte count or -1 */
+static long inflate_zlib(const unsigned char *src, size_t len, unsigned char *dst, size_t cap) {
+    if (len < 2 || (src[0] & 0x0F) != 8 || ((src[0] << 8) | src[1]) % 31 != 0 || (src[1] & 0x20)) {
+        return -1;
+    }
+    inflater *s = (inflater *)malloc(sizeof(inflater));
+    if (!s) return -1;
+    s->src = src + 2;
+    s->len = len - 2;
+    s->pos = 0;
+    s->bits = 0;
+    s->nbits = 0;
+
+    size_t out = 0;
+    int final = 0;
+    long result = -1;
+    do {
+        final = (int)if_getbits(s, 1);
+        int type = (int)if_getbits(s, 2);
+        if (type == 0) {
+            int drop = s->nbits & 7;
+            s->bits >>= drop;
+            s->nbits -= drop;
+            unsigned n = if_getbits(s, 16), nc = if_getbits(s, 16);
+            if ((n ^ 0xFFFF) != nc || n > cap - out) goto done;
+            while (n--) dst[out++] = (unsigned char)if_getbits(s, 8);
+            continue;
+        }
+        if (type == 3) goto done;
+
+        unsigned char lens[288 + 32];
+        int hlit, hdist;
+        if (type == 1) {
+            hlit = 288;
+            hdist = 30;
+            for (int i = 0; i < 288; i++) lens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            for (int i = 0; i < 30; i++) lens[hlit + i] = 5;
+        } else {
+            hlit = (int)if_getbits(s, 5) + 257;
+            hdist = (int)if_getbits(s, 5) + 1;
+            int hclen = (int)if_getbits(s, 4) + 4;
+            unsigned char clens[19] = {0};
+            for (int i = 0; i < hclen; i++) clens[dz_clen_order[i]] = (unsigned char)if_getbits(s, 3);
+            if (if_build(s->lit, clens, 19) != 0) goto done;
+            for (int i = 0; i < hlit + hdist;) {
+                int sym = if_decode(s, s->lit), rep, val = 0;
+                if (sym < 0) goto done;
+                if (sym < 16) { lens[i++] = (unsigned char)sym; continue; }
+                if (sym == 16) {
+                    if (i == 0) goto done;
+                    val = lens[i - 1];
+                    rep = 3 + (int)if_getbits(s, 2);
+                } else if (sym == 17) {
+                    rep = 3 + (int)if_getbits(s, 3);
+                } else {
+                    rep = 11 + (int)if_getbits(s, 7);
+                }
+                if (i + rep > hlit + hdist) goto done;
+                while (rep--) lens[i++] = (unsigned char)val;
+            }
+            if (hlit > 286 || hdist > 30) goto done;
+        }
+        if (if_build(s->lit, lens, hlit) != 0 || if_build(s->dist, lens + hlit, hdist) != 0) goto done;
+
+        for (;;) {
+            int sym = if_decode(s, s->lit);
+            if (sym < 0) goto done;
+            if (sym < 256) {
+                if (out == cap) goto done;
+                dst[out++] = (unsigned char)sym;
+            } else if (sym == 256) {
+                break;
+            } else {
+                sym -= 257;
+                if (sym >= 29) goto done;
+                size_t n = dz_len_base[sym] + if_getbits(s, dz_len_extra[sym]);
+                int dsym = if_decode(s, s->dist);
+                if (dsym < 0 || dsym >= 30) goto done;
+                size_t d = dz_dist_base[dsym] + if_getbits(s, dz_dist_extra[dsym]);
+                if (d > out || n > cap - out) goto done;
+                unsigned char *p = dst + out;
+                const unsigned char *m = p - d;
+                out += n;
+                while (n--) *p++ = *m++;
+            }
+        }
+    } while (!final);
+
+    /* Bytes actually consumed must not run past the input */
+    if (s->pos - (size_t)(s->nbits / 8) <= s->len) result = (long)out;
+done:
+    free(s);
+    return result;
+}
+
+/* ---- PNG decode ---- */
+
+/*
+ * Decodes every standard PNG (all color types and bit depths, palette and
+ * tRNS transparency, Adam7 interlacing) to 8-bit RGBA. Color chunks
+ * (sRGB, gAMA, cHRM, iCCP) and pHYs are kept verbatim so the re-encoded
+ * file renders the same.
+ */
+
+typedef struct {
+    int w, h;
+    unsigned char *rgba;        /* w * h * 4, straight alpha */
+} image;
+
+static unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = p > a ? p - a : a - p;
+    int pb = p > b ? p - b : b - p;
+    int pc = p > c ? p - c : c - p;
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    return (unsigned char)(pb <= pc ? b : c);
+}
+
+/* Undo one row's filter in place; prev is NULL for the first row */
+static int png_unfilter(unsigned char *row, const unsigned char *prev, size_t stride, int bpp, int type) {
+    switch (type) {
+        case 0: break;
+        case 1:
+            for (size_t i = (size_t)bpp; i < stride; i++) row[i] += row[i - bpp];
+            break;
+        case 2:
+            if (prev) for (size_t i = 0; i < stride; i++) row[i] += prev[i];
+            break;
+        case 3:
+            for (size_t i = 0; i < stride; i++) {
+                int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+                int b = prev ? prev[i] : 0;
+                row[i] += (unsigned char)((a + b) >> 1);
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < stride; i++) {
+                int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = prev && i >= (size_t)bpp ? prev[i - bpp] : 0;
+                row[i] += paeth(a, b, c);
+            }
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    int depth, ctype, channels;
+    unsigned char palette[256 * 4];
+    int has_key;
+    unsigned key[3];            /* tRNS color key, at bit depth */
+} png_format;
+
+/* Sample n of a row at the image's bit depth */
+static unsigned png_sample(const unsigned char *row, size_t n, int depth) {
+    if (depth == 8) return row[n];
+    if (depth == 16) return be16(row + 2 * n);
+    size_t bit = n * (size_t)depth;
+    return (row[bit >> 3] >> (8 - depth - (int)(bit & 7))) & ((1u << depth) - 1);
+}
+
+static void png_row_to_rgba(const png_format *f, const unsigned char *row, int pw,
+                            unsigned char *dst, int step) {
+    unsigned maxv = (1u << f->depth) - 1;
+    for (int x = 0; x < pw; x++, dst += step) {
+        size_t s = (size_t)x * (size_t)f->channels;
+        unsigned v[4] = { 0, 0, 0, 0 };
+        for (int c = 0; c < f->channels; c++) v[c] = png_sample(row, s + (size_t)c, f->depth);
+        if (f->ctype == 3) {
+            memcpy(dst, f->palette + 4 * (v[0] & 0xFF), 4);
+            continue;
+        }
+        int opaque = 1;
+        if (f->has_key) {
+            opaque = f->ctype == 0 ? v[0] != f->key[0]
+                   : (v[0] != f->key[0] || v[1] != f->key[1] || v[2] != f->key[2]);
+        }
+        for (int c = 0; c < f->channels; c++) v[c] = (v[c] * 255 + maxv / 2) / maxv;
+        switch (f->ctype) {
+            case 0: dst[0] = dst[1] = dst[2] = (unsigned char)v[0]; dst[3] = opaque ? 255 : 0; break;
+            case 2: dst[0] = (unsigned char)v[0]; dst[1] = (unsigned char)v[1];
+                    dst[2] = (unsigned char)v[2]; dst[3] = opaque ? 255 : 0; break;
+            case 4: dst[0] = dst[1] = dst[2] = (unsigned char)v[0]; dst[3] = (unsigned char)v[1]; break;
+            case 6: dst[0] = (unsigned char)v[0]; dst[1] = (unsigned char)v[1];
+                    dst[2] = (unsigned char)v[2]; dst[3] = (unsigned char)v[3]; break;
+        }
+    }
+}
+
+static const int ADAM7[7][4] = {   /* x0, y0, dx, dy */
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+    { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+};
+
+#define PNG_MAX_PIXELS 100000000ULL
+
+/* Returns 1 on success; keep receives the color chunks to carry over */
+static int png_decode(const unsigned char *d, size_t len, image *img, membuf *keep) {
+    png_format f;
+    membuf idat = { NULL, 0, 0, 0 };
+    int w = 0, h = 0, interlace = 0, seen_end = 0;
+    memset(&f, 0, sizeof(f));
+    for (int i = 0; i < 256; i++) f.palette[4 * i + 3] = 255;
+
+    if (!is_png(d, len)) return 0;
+    for (size_t i = 8; i + 12 <= len;) {
+        unsigned long n = be32(d + i);
+        const unsigned char *type = d + i + 4, *body = d + i + 8;
+        if (n > len - i - 12) break;
+        if (memcmp(type, "IHDR", 4) == 0 && n >= 13) {
+            w = (int)be32(body);
+            h = (int)be32(body + 4);
+            f.depth = body[8];
+            f.ctype = body[9];
+            interlace = body[12];
+            if (body[10] != 0 || body[11] != 0 || interlace > 1) return 0;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            for (unsigned long k = 0; k < n / 3 && k < 256; k++) memcpy(f.palette + 4 * k, body + 3 * k, 3);
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            if (f.ctype == 3) {
+                for (unsigned long k = 0; k < n && k < 256; k++) f.palette[4 * k + 3] = body[k];
+            } else if (f.ctype == 0 && n >= 2) {
+                f.has_key = 1;
+                f.key[0] = be16(body);
+            } else if (f.ctype == 2 && n >= 6) {
+                f.has_key = 1;
+                for (int c = 0; c < 3; c++) f.key[c] = be16(body + 2 * c);
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            membuf_append(&idat, body, n);
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            seen_end = 1;
+            break;
+        } else if (memcmp(type, "sRGB", 4) == 0 || memcmp(type, "gAMA", 4) == 0 ||
+                   memcmp(type, "cHRM", 4) == 0 || memcmp(type, "iCCP", 4) == 0 ||
+                   memcmp(type, "pHYs", 4) == 0) {
+            membuf_append(keep, d + i, n + 12);
+        }
+        i += n + 12;
+    }
+
+    static const int channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    int ok_depth = f.ctype <= 6 && channels[f.ctype] &&
+        (f.depth == 8 || f.depth == 16 ||
+         ((f.ctype == 0 || f.ctype == 3) && (f.depth == 1 || f.depth == 2 || f.depth == 4)));
+    if (f.ctype == 3 && f.depth == 16) ok_depth = 0;
+    if (!seen_end || idat.failed || !idat.len || w <= 0 || h <= 0 || !ok_depth ||
+        (unsigned long long)w * (unsigned long long)h > PNG_MAX_PIXELS) {
+        free(idat.data);
+        return 0;
+    }
+    f.channels = channels[f.ctype];
+    int bits = f.channels * f.depth;
+    int bpp = bits >= 8 ? bits / 8 : 1;
+
+    /* Size of the filtered data for every pass */
+    int passes = interlace ? 7 : 1;
+    size_t raw_len = 0;
+    for (int p = 0; p < passes; p++) {
+        int x0 = interlace ? ADAM7[p][0] : 0, y0 = interlace ? ADAM7[p][1] : 0;
+        int dx = interlace ? ADAM7[p][2] : 1, dy = interlace ? ADAM7[p][3] : 1;
+        size_t pw = (size_t)(w - x0 + dx - 1) / (size_t)dx, ph = (size_t)(h - y0 + dy - 1) / (size_t)dy;
+        if (w > x0 && h > y0) raw_len += ph * (1 + (pw * (size_t)bits + 7) / 8);
+    }
+    unsigned char *raw = (unsigned char *)malloc(raw_len);
+    img->rgba = (unsigned char *)malloc((size_t)w * (size_t)h * 4);
+    int ok = raw && img->rgba &&
+             inflate_zlib(idat.data, idat.len, raw, raw_len) == (long)raw_len;
+    free(idat.data);
+
+    unsigned char *row = raw;
+    for (int p = 0; ok && p < passes; p++) {
+        int x0 = interlace ? ADAM7[p][0] : 0, y0 = interlace ? ADAM7[p][1] : 0;
+        int dx = interlace ? ADAM7[p][2] : 1, dy = interlace ? ADAM7[p][3] : 1;
+        if (w <= x0 || h <= y0) continue;
+        int pw = (w - x0 + dx - 1) / dx, ph = (h - y0 + dy - 1) / dy;
+        size_t stride = ((size_t)pw * (size_t)bits + 7) / 8;
+        const unsigned char *prev = NULL;
+        for (int y = 0; ok && y < ph; y++) {
+            if (png_unfilter(row + 1, prev, stride, bpp, row[0]) != 0) { ok = 0; break; }
+            unsigned char *dst = img->rgba + (((size_t)(y0 + y * dy) * (size_t)w) + (size_t)x0) * 4;
+            png_row_to_rgba(&f, row + 1, pw, dst, 4 * dx);
+            prev = row + 1;
+            row += 1 + stride;
+        }
+    }
+    free(raw);
+    if (!ok) {
+        free(img->rgba);
+        img->rgba = NULL;
+        return 0;
+    }
+    img->w = w;
+    img->h = h;
+    return 1;
+}
+
+/* ---- Resampling ---- */
+
+/*
+ * Separable downscale with premultiplied alpha so transparent pixels do
+ * not bleed color into their neighbours. FILTER_AREA weights each source
+ * pixel by how much of it the destination pixel covers (a box filter, no
+ * ringing); FILTER_LANCZOS is a windowed sinc with 3 lobes and keeps
+ * more detail. libm is avoided so the tool builds without -lm.
+ */
+
+enum resample_filter { FILTER_AREA, FILTER_LANCZOS };
+
+typedef struct {
+    int start;                  /* first source index */
+    int n;                      /* number of weights */
+    int off;                    /* offset into the weight array */
+} contrib;
+
+/* sin(pi * x) from a Taylor series after reducing x to [-0.5, 0.5] */
+static double sin_pi(double x) {
+    long k = (long)(x >= 0 ? x + 0.5 : x - 0.5);
+    double r = x - (double)k;
+    double t = 3.14159265358979323846 * r, t2 = t * t;
+    double s = t * (1 - t2 / 6 * (1 - t2 / 20 * (1 - t2 / 42 * (1 - t2 / 72 * (1 - t2 / 110)))));
+    return (k & 1) ? -s : s;
+}
+
+static double lanczos3(double x) {
+    if (x < 0) x = -x;
+    if (x < 1e-8) return 1.0;
+    if (x >= 3.0) return 0.0;
+    return 3.0 * sin_pi(x) * sin_pi(x / 3.0) / (9.8696044010893586 * x * x);
+}
+
+static int floor_int(double v) {
+    int i = (int)v;
+    return (double)i > v ? i - 1 : i;
+}
+
+/* Weights mapping src samples to dst samples along one axis */
+static contrib *make_contribs(int src, int dst, int filter, float **weights) {
+    double scale = (double)src / (double)dst;
+    if (scale < 1.0) scale = 1.0;
+    double support = filter == FILTER_LANCZOS ? 3.0 * scale : 0.5 * scale + 1.0;
+    int max_n = (int)(2 * support) + 3;
+    contrib *c = (contrib *)malloc(sizeof(contrib) * (size_t)dst);
+    float *w = (float *)malloc(sizeof(float) * (size_t)dst * (size_t)max_n);
+    if (!c || !w) { free(c); free(w); return NULL; }
+
+    double step = (double)src / (double)dst;
+    for (int i = 0; i < dst; i++) {
+        int lo, hi, n = 0;
+        double sum = 0;
+        float *cw = w + (size_t)i * (size_t)max_n;
+        if (filter == FILTER_LANCZOS) {
+            double center = (i + 0.5) * step;
+            lo = floor_int(center - support);
+            hi = floor_int(center + support) + 1;
+            if (lo < 0) lo = 0;
+            if (hi > src) hi = src;
+            for (int j = lo; j < hi && n < max_n; j++) {
+                cw[n] = (float)lanczos3((j + 0.5 - center) / scale);
+                sum += cw[n++];
+            }
+        } else {
+            double a = i * step, b = (i + 1) * step;
+            lo = floor_int(a);
+            hi = floor_int(b) + 1;
+            if (hi > src) hi = src;
+            for (int j = lo; j < hi && n < max_n; j++) {
+                double l = j > a ? j : a, r = j + 1 < b ? j + 1 : b;
+                cw[n] = (float)(r > l ? r - l : 0);
+                sum += cw[n++];
+            }
+        }
+        if (sum <= 0) { cw[0] = 1; n = 1; sum = 1; }
+        for (int k = 0; k < n; k++) cw[k] = (float)(cw[k] / sum);
+        c[i].start = lo;
+        c[i].n = n;
+        c[i].off = i * max_n;
+    }
+    *weights = w;
+    return c;
+}
+
+static unsigned char clamp_byte(float v) {
+    if (v <= 0) return 0;
+    if (v >= 255) return 255;
+    return (unsigned char)(v + 0.5f);
+}
+
+/* Resize src into a new dst_w x dst_h image; returns 1 on success */
+static int resample(const image *src, int dst_w, int dst_h, int filter, image *dst) {
+    float *wx = NULL, *wy = NULL;
+    contrib *cx = make_contribs(src->w, dst_w, filter, &wx);
+    contrib *cy = make_contribs(src->h, dst_h, filter, &wy);
+    float *tmp = (float *)malloc(sizeof(float) * 4 * (size_t)dst_w * (size_t)src->h);
+    dst->rgba = (unsigned char *)malloc((size_t)dst_w * (size_t)dst_h * 4);
+    int ok = cx && cy && tmp && dst->rgba;
+
+    /* Horizontal pass into premultiplied floats */
+    for (int y = 0; ok && y < src->h; y++) {
+        const unsigned char *row = src->rgba + (size_t)y * (size_t)src->w * 4;
+        float *out = tmp + (size_t)y * (size_t)dst_w * 4;
+        for (int x = 0; x < dst_w; x++, out += 4) {
+            float r = 0, g = 0, b = 0, a = 0;
+            const float *w = wx + cx[x].off;
+            const unsigned char *p = row + (size_t)cx[x].start * 4;
+            for (int k = 0; k < cx[x].n; k++, p += 4) {
+                float wa = w[k] * p[3];
+                r += wa * p[0];
+                g += wa * p[1];
+                b += wa * p[2];
+                a += wa;
+            }
+            out[0] = r; out[1] = g; out[2] = b; out[3] = a;
+        }
+    }
+
+    /* Vertical pass, then back to straight alpha */
+    for (int y = 0; ok && y < dst_h; y++) {
+        const float *w = wy + cy[y].off;
+        unsigned char *out = dst->rgba + (size_t)y * (size_t)dst_w * 4;
+        for (int x = 0; x < dst_w; x++, out += 4) {
+            float r = 0, g = 0, b = 0, a = 0;
+            const float *p = tmp + ((size_t)cy[y].start * (size_t)dst_w + (size_t)x) * 4;
+            for (int k = 0; k < cy[y].n; k++, p += (size_t)dst_w * 4) {
+                r += w[k] * p[0];
+                g += w[k] * p[1];
+                b += w[k] * p[2];
+                a += w[k] * p[3];
+            }
+            if (a < 0.5f) {
+                out[0] = out[1] = out[2] = out[3] = 0;
+                continue;
+            }
+            out[0] = clamp_byte(r / a);
+            out[1] = clamp_byte(g / a);
+            out[2] = clamp_byte(b / a);
+            out[3] = clamp_byte(a);
+        }
+    }
+
+    free(cx); free(cy); free(wx); free(wy); free(tmp);
+    if (!ok) {
+        free(dst->rgba);
+        dst->rgba = NULL;
+        return 0;
     }
-#else
-    if (dot) {
-        snprintf(buf, buf_len, "/tmp/_cvt_opt_%s", base);
-    } else {
-        snprintf(buf, buf_len, "/tmp/_cvt_opt_%s.png", base);
+    dst->w = dst_w;
+    dst->h = dst_h;
+    return 1;
+}
+
+/* ---- PNG encode ---- */
+
+static void png_chunk(membuf *out, const char *type, const unsigned char *data, size_t len) {
+    membuf_be32(out, (unsigned long)len);
+    size_t start = out->len;
+    membuf_append(out, type, 4);
+    if (len) membuf_append(out, data, len);
+    if (out->failed) return;
+    membuf_be32(out, crc32_update(0, out->data + start, len + 4));
+}
+
+/*
+ * Encode RGBA as the smallest of gray, gray+alpha, RGB or RGBA that holds
+ * it exactly. Each row gets the filter whose output has the lowest sum
+ * of absolute values, the usual heuristic for picking PNG filters.
+ */
+static int png_encode(const image *img, const membuf *keep, membuf *out) {
+    size_t npix = (size_t)img->w * (size_t)img->h;
+    int alpha = 0, gray = 1;
+    for (size_t i = 0; i < npix; i++) {
+        const unsigned char *p = img->rgba + 4 * i;
+        if (p[3] != 255) alpha = 1;
+        if (p[0] != p[1] || p[1] != p[2]) gray = 0;
     }
-#endif
+    int channels = (gray ? 1 : 3) + alpha;
+    int ctype = gray ? (alpha ? 4 : 0) : (alpha ? 6 : 2);
+    size_t stride = (size_t)img->w * (size_t)channels;
+
+    unsigned char ihdr[13];
+    unsigned long dims[2] = { (unsigned long)img->w, (unsigned long)img->h };
+    for (int k = 0; k < 2; k++) {
+        for (int b = 0; b < 4; b++) ihdr[4 * k + b] = (unsigned char)(dims[k] >> (24 - 8 * b));
+    }
+    ihdr[8] = 8;
+    ihdr[9] = (unsigned char)ctype;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+    membuf_append(out, PNG_SIG, 8);
+    png_chunk(out, "IHDR", ihdr, 13);
+    if (keep->len) membuf_append(out, keep->data, keep->len);
+
+    unsigned char *cur = (unsigned char *)malloc(stride);
+    unsigned char *prev = (unsigned char *)calloc(stride, 1);
+    unsigned char *trial = (unsigned char *)malloc(5 * (stride + 1));
+    membuf zdata = { NULL, 0, 0, 0 };
+    dz_stream *z = zlib_begin(membuf_emit, &zdata);
+    if (!cur || !prev || !trial || !z) {
+        free(cur); free(prev); free(trial); free(z);
+        return 0;
+    }
+
+    for (int y = 0; y < img->h; y++) {
+        const unsigned char *src = img->rgba + (size_t)y * (size_t)img->w * 4;
+        unsigned char *c = cur;
+        for (int x = 0; x < img->w; x++, src += 4) {
+            if (gray) *c++ = src[0];
+            else { *c++ = src[0]; *c++ = src[1]; *c++ = src[2]; }
+            if (alpha) *c++ = src[3];
+        }
+
+        int best = 0;
+        unsigned long best_sum = ~0UL;
+        for (int type = 0; type < 5; type++) {
+            unsigned char *t = trial + (size_t)type * (stride + 1);
+            unsigned long sum = 0;
+            t[0] = (unsigned char)type;
+            for (size_t i = 0; i < stride; i++) {
+                int a = i >= (size_t)channels ? cur[i - channels] : 0;
+                int b = prev[i];
+                int cc = i >= (size_t)channels ? prev[i - channels] : 0;
+                int pred = type == 0 ? 0 : type == 1 ? a : type == 2 ? b :
+                           type == 3 ? (a + b) >> 1 : paeth(a, b, cc);
+                unsigned char v = (unsigned char)(cur[i] - pred);
+                t[i + 1] = v;
+                sum += v < 128 ? v : 256 - v;
+            }
+            if (sum < best_sum) { best_sum = sum; best = type; }
+        }
+        zlib_write(z, trial + (size_t)best * (stride + 1), stride + 1);
+        unsigned char *swap = prev; prev = cur; cur = swap;
+    }
+    zlib_end(z);
+    free(cur); free(prev); free(trial);
+
+    if (!zdata.failed) png_chunk(out, "IDAT", zdata.data, zdata.len);
+    free(zdata.data);
+    png_chunk(out, "IEND", NULL, 0);
+    return !out->failed && !zdata.failed;
 }
 
 /* ---- Image optimization ---- */
@@ -321,35 +1768,11 @@ static int get_image_dimensions(const char *path, int *w, int *h) {
 }
 
 /*
- * Optimize an image: resize to fit within max_dim x max_dim
- * while preserving aspect ratio. Saves result to tmp_path.
- * Returns 1 on success, 0 on failure (caller should use original).
+ * Resize with the platform tool, writing the result to tmp_path.
+ * Used for formats the built-in decoder does not handle.
+ * Returns 1 on success, 0 on failure.
  */
-static int optimize_image(const char *src, const char *tmp_path,
-                          int max_dim, int quiet) {
-    int w = 0, h = 0;
-
-    if (!get_image_dimensions(src, &w, &h)) {
-        if (!quiet) {
-            fprintf(stderr, "  [optimize] cannot read dimensions, skipping optimization\n");
-        }
-        return 0;
-    }
-
-    /* Already small enough? */
-    if (w <= max_dim && h <= max_dim) {
-        if (!quiet) {
-            fprintf(stderr, "  [optimize] %dx%d already within %dpx, no resize needed\n",
-                    w, h, max_dim);
-        }
-        return 0;
-    }
-
-    if (!quiet) {
-        fprintf(stderr, "  [optimize] %dx%d -> resizing to fit %dpx ...\n",
-                w, h, max_dim);
-    }
-
+static int optimize_external(const char *src, const char *tmp_path, int max_dim) {
     char cmd[4096];
     int ret;
 
@@ -417,47 +1840,684 @@ static int optimize_image(const char *src, const char *tmp_path,
         remove(tmp_path);
         return 0;
     }
+    return 1;
+}
+
+/* Same rounding as sips --resampleHeightWidthMax and magick -resize NxN> */
+static void fit_box(int w, int h, int max_dim, int *nw, int *nh) {
+    double r = (double)max_dim / (double)(w > h ? w : h);
+    *nw = (int)(w * r + 0.5);
+    *nh = (int)(h * r + 0.5);
+    if (*nw < 1) *nw = 1;
+    if (*nh < 1) *nh = 1;
+}
+
+/* --srcset widths never upscale */
+static void fit_width(int w, int h, int width, int *nw, int *nh) {
+    *nw = width < w ? width : w;
+    *nh = (int)((double)h * *nw / w + 0.5);
+    if (*nh < 1) *nh = 1;
+}
+
+/*
+ * Resize the image in data (w x h, read from src) to nw x nh. PNGs are
+ * decoded into *decoded on the first call and resampled from there, so
+ * every --srcset width shares a single decode; anything else goes
+ * through the platform tool and a temp file. Progress lines go to log
+ * (NULL for --quiet) so parallel jobs can print them in order. Returns
+ * 1 with a malloc'd result in *out, 0 when it could not be resized.
+ */
+static int resize_image(const char *src, const unsigned char *data, size_t len,
+                        int w, int h, int nw, int nh, int filter, int tag,
+                        image *decoded, membuf *keep, membuf *log,
+                        unsigned char **out, size_t *out_len) {
+    if (is_png(data, len)) {
+        if (decoded->rgba || png_decode(data, len, decoded, keep)) {
+            image dst = { 0, 0, NULL };
+            membuf png = { NULL, 0, 0, 0 };
+            int ok = resample(decoded, nw, nh, filter, &dst) && png_encode(&dst, keep, &png);
+            free(dst.rgba);
+            if (ok) {
+                *out = png.data;
+                *out_len = png.len;
+                if (log) {
+                    membuf_printf(log, "  [optimize] %dx%d -> %dx%d (built-in, %s), %zu bytes\n",
+                                  w, h, nw, nh, filter == FILTER_LANCZOS ? "lanczos" : "area",
+                                  *out_len);
+                }
+                return 1;
+            }
+            free(png.data);
+        }
+        if (log) membuf_printf(log, "  [optimize] built-in PNG decoder failed, trying platform tool\n");
+    }
+
+    int box = nw > nh ? nw : nh;
+    if (log) membuf_printf(log, "  [optimize] %dx%d -> resizing to fit %dpx ...\n", w, h, box);
+    char tmp_path[2048];
+    make_temp_path(tmp_path, sizeof(tmp_path), src, tag);
+    if (!optimize_external(src, tmp_path, box)) return 0;
+    *out = read_file(tmp_path, out_len);
+    remove(tmp_path);
+    if (!*out) return 0;
+    if (log) membuf_printf(log, "  [optimize] optimized file: %zu bytes\n", *out_len);
+    return 1;
+}
+
+/* ---- Modern formats ---- */
+
+/*
+ * --format webp|avif re-encodes each optimized image, and --format auto
+ * keeps whichever of AVIF, WebP and the input is smallest. There is no
+ * built-in WebP or AVIF encoder: both are large codecs, so this shells
+ * out to cwebp and avifenc, or ImageMagick when those are missing.
+ * --target-bytes N binary-searches the encoder quality for the best
+ * result that fits in N bytes, which usually takes 6 or 7 encodes.
+ */
+
+enum out_format { FORMAT_SAME, FORMAT_WEBP, FORMAT_AVIF, FORMAT_AUTO };
+
+#define QUALITY_MIN 10
+#define QUALITY_MAX 95
+
+#ifdef _WIN32
+#define SHQ "\""
+#define SH_QUIET " >nul 2>nul"
+#else
+#define SHQ "'"
+#define SH_QUIET " >/dev/null 2>&1"
+#endif
+
+static int have_cwebp, have_avifenc;
+static const char *magick_cmd;      /* "magick", "convert" (ImageMagick 6) or NULL */
+
+static int tool_exists(const char *probe) {
+    char cmd[256];
+#ifdef _WIN32
+    snprintf(cmd, sizeof(cmd), "where %s >nul 2>nul", probe);
+#else
+    snprintf(cmd, sizeof(cmd), "command -v %s >/dev/null 2>&1", probe);
+#endif
+    return system(cmd) == 0;
+}
+
+/* Runs once, before any worker starts */
+static void detect_encoders(void) {
+    have_cwebp = tool_exists("cwebp");
+    have_avifenc = tool_exists("avifenc");
+    if (tool_exists("magick")) {
+        magick_cmd = "magick";
+    } else {
+#ifndef _WIN32
+        /* "convert" is also this tool's name, so make sure it is ImageMagick */
+        if (system("convert -version 2>/dev/null | grep -q ImageMagick") == 0) magick_cmd = "convert";
+#endif
+    }
+}
+
+/* The mime of an encoded image, from its magic bytes */
+static const char *sniff_mime(const unsigned char *p, size_t len, const char *fallback) {
+    if (is_png(p, len)) return "image/png";
+    if (len >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) return "image/jpeg";
+    if (len >= 6 && memcmp(p, "GIF8", 4) == 0) return "image/gif";
+    if (len >= 12 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0) return "image/webp";
+    if (len >= 12 && memcmp(p + 4, "ftyp", 4) == 0 &&
+        (memcmp(p + 8, "avif", 4) == 0 || memcmp(p + 8, "avis", 4) == 0)) return "image/avif";
+    return fallback;
+}
+
+static const char *format_name(int format) {
+    switch (format) {
+        case FORMAT_WEBP: return "webp";
+        case FORMAT_AVIF: return "avif";
+        case FORMAT_AUTO: return "auto";
+    }
+    return "same";
+}
+
+static void make_work_path(char *buf, size_t len, int tag, const char *name) {
+#ifdef _WIN32
+    const char *tmp = getenv("TEMP");
+    if (!tmp) tmp = getenv("TMP");
+    if (!tmp) tmp = ".";
+    snprintf(buf, len, "%s\\_cvt_enc_%d_%d_%s", tmp, (int)getpid(), tag, name);
+#else
+    snprintf(buf, len, "/tmp/_cvt_enc_%d_%d_%s", (int)getpid(), tag, name);
+#endif
+}
+
+static int write_file(const char *path, const unsigned char *data, size_t len) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return 0;
+    int ok = fwrite(data, 1, len, fp) == len;
+    if (fclose(fp) != 0) ok = 0;
+    return ok;
+}
+
+/* One encoder run. Returns the output size, or -1 when no tool could do it */
+static long encode_once(int format, const char *in, const char *in_mime, const char *out, int q) {
+    char cmd[4600];
+    int avif_input = strcmp(in_mime, "image/png") == 0 || strcmp(in_mime, "image/jpeg") == 0;
+    if (format == FORMAT_WEBP && have_cwebp) {
+        snprintf(cmd, sizeof(cmd), "cwebp -quiet -q %d -metadata icc " SHQ "%s" SHQ " -o " SHQ "%s" SHQ SH_QUIET,
+                 q, in, out);
+    } else if (format == FORMAT_AVIF && have_avifenc && avif_input) {
+        snprintf(cmd, sizeof(cmd), "avifenc -q %d -s 6 " SHQ "%s" SHQ " " SHQ "%s" SHQ SH_QUIET,
+                 q, in, out);
+    } else if (magick_cmd) {
+        snprintf(cmd, sizeof(cmd), "%s " SHQ "%s" SHQ " -quality %d " SHQ "%s" SHQ SH_QUIET,
+                 magick_cmd, in, q, out);
+    } else {
+        return -1;
+    }
+    if (system(cmd) != 0) {
+        remove(out);
+        return -1;
+    }
+    FILE *fp = fopen(out, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+    if (size <= 0) {
+        remove(out);
+        return -1;
+    }
+    return size;
+}
+
+/*
+ * Encode the file at in as format. Without a target this is a single
+ * run at the encoder's usual quality; with one it keeps the highest
+ * quality that fits, or the lowest when nothing does.
+ */
+static int encode_search(int format, const char *in, const char *in_mime, long target, int tag,
+                         membuf *log, unsigned char **out, size_t *out_len) {
+    const char *name = format_name(format);
+    char path[2048], file[16];
+    snprintf(file, sizeof(file), "out.%s", name);
+    make_work_path(path, sizeof(path), tag, file);
+
+    int q = format == FORMAT_AVIF ? 60 : 80;
+    int runs = 0, last = -1;
+    if (target > 0) {
+        int lo = QUALITY_MIN, hi = QUALITY_MAX, best = -1;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            long size = encode_once(format, in, in_mime, path, mid);
+            runs++;
+            last = mid;
+            if (size < 0) return 0;
+            if (size <= target) {
+                best = mid;
+                lo = mid + 1;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        q = best >= 0 ? best : QUALITY_MIN;
+        if (log && best < 0) {
+            membuf_printf(log, "  [format] %s cannot reach %ld bytes, using q=%d\n", name, target, q);
+        }
+    }
+    /* The search usually ends on a run that did not fit */
+    if (q != last) {
+        if (encode_once(format, in, in_mime, path, q) < 0) return 0;
+        runs++;
+    }
+    *out = read_file(path, out_len);
+    remove(path);
+    if (!*out) return 0;
+    if (log) membuf_printf(log, "  [format] %s q=%d, %zu bytes (%d run%s)\n", name, q, *out_len,
+                           runs, runs == 1 ? "" : "s");
+    return 1;
+}
+
+/*
+ * Re-encode data for --format. src is the original file when data is its
+ * unmodified contents, NULL when data has to be written out first.
+ * Returns 1 with a malloc'd result in *out, 0 to keep data as it is
+ * (auto found nothing smaller), -1 when no encoder was available.
+ */
+static int transcode(int format, long target, const char *src, const unsigned char *data,
+                     size_t len, int tag, membuf *log, unsigned char **out, size_t *out_len) {
+    const char *mime = sniff_mime(data, len, "application/octet-stream");
+    const char *ext = strrchr(mime, '/') + 1;
+    char in[2048];
+    if (src) {
+        snprintf(in, sizeof(in), "%s", src);
+    } else {
+        char file[32];
+        snprintf(file, sizeof(file), "in.%s", ext);
+        make_work_path(in, sizeof(in), tag, file);
+        if (!write_file(in, data, len)) {
+            remove(in);
+            return -1;
+        }
+    }
+
+    int tries[2], ntries = 0;
+    if (format == FORMAT_AUTO) {
+        tries[ntries++] = FORMAT_AVIF;
+        tries[ntries++] = FORMAT_WEBP;
+    } else {
+        tries[ntries++] = format;
+    }
+    unsigned char *best = NULL;
+    size_t best_len = 0;
+    int encoded = 0;
+    for (int t = 0; t < ntries; t++) {
+        unsigned char *buf;
+        size_t buf_len;
+        if (strcmp(mime + 6, format_name(tries[t])) == 0 && target <= 0) {
+            encoded = 1;        /* already in that format */
+            continue;
+        }
+        if (!encode_search(tries[t], in, mime, target, tag, log, &buf, &buf_len)) continue;
+        encoded = 1;
+        if (!best || buf_len < best_len) {
+            free(best);
+            best = buf;
+            best_len = buf_len;
+        } else {
+            free(buf);
+        }
+    }
+    if (!src) remove(in);
+
+    if (!encoded) {
+        const char *tools = format == FORMAT_WEBP ? "cwebp or ImageMagick"
+                          : format == FORMAT_AVIF ? "avifenc or ImageMagick"
+                          : "cwebp, avifenc or ImageMagick";
+        if (log) membuf_printf(log, "  [format] no %s encoder found (%s), keeping %s\n",
+                               format_name(format), tools, ext);
+        return -1;
+    }
+    if (best && format == FORMAT_AUTO && best_len >= len && (target <= 0 || len <= (size_t)target)) {
+        if (log) membuf_printf(log, "  [format] %s is smallest, %zu bytes\n", ext, len);
+        free(best);
+        best = NULL;
+    }
+    if (!best) return 0;
+    *out = best;
+    *out_len = best_len;
+    return 1;
+}
+
+/* ---- Result cache ---- */
+
+/*
+ * Optimized images are cached on disk under a key of (source content
+ * hash, --max or --srcset width, filter, --target-bytes, output
+ * format), so re-running over unchanged screenshots skips decoding,
+ * resizing and re-encoding entirely. An empty entry records "already
+ * small enough, use the original". Entries are written
+ * to a temp name and renamed into place, so parallel runs never see a
+ * partial file. Bump CACHE_VERSION when the optimizer's output changes.
+ */
+
+#define CACHE_VERSION 1
+
+/* 64-bit content hash: four multiply-xorshift lanes over 8-byte words */
+static unsigned long long hash64(const unsigned char *p, size_t len) {
+    const unsigned long long K = 0x9E3779B97F4A7C15ULL;
+    unsigned long long h[4] = { K, K ^ 1, K ^ 2, K ^ 3 };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            unsigned long long v;
+            memcpy(&v, p + i + 8 * k, 8);
+            h[k] = (h[k] ^ v) * K;
+            h[k] ^= h[k] >> 29;
+        }
+    }
+    unsigned long long r = (unsigned long long)len * K;
+    for (int k = 0; k < 4; k++) r = (r ^ h[k]) * K ^ (h[k] >> 31);
+    for (; i < len; i++) r = (r ^ p[i]) * 0x100000001B3ULL;
+    r ^= r >> 33;
+    r *= 0xFF51AFD7ED558CCDULL;
+    r ^= r >> 33;
+    return r;
+}
+
+/* Default: $XDG_CACHE_HOME/img_convert, ~/.cache/img_convert, %LOCALAPPDATA%\img_convert */
+static int default_cache_dir(char *buf, size_t len) {
+#ifdef _WIN32
+    const char *base = getenv("LOCALAPPDATA");
+    if (!base) return 0;
+    snprintf(buf, len, "%s\\img_convert", base);
+#else
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && *xdg) snprintf(buf, len, "%s/img_convert", xdg);
+    else if (home && *home) snprintf(buf, len, "%s/.cache/img_convert", home);
+    else return 0;
+#endif
+    return 1;
+}
 
-    if (!quiet) {
-        fprintf(stderr, "  [optimize] optimized file: %ld bytes\n", sz);
+/* mkdir -p */
+static int make_dirs(const char *path) {
+    char tmp[2048];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            char c = *p;
+            *p = '\0';
+            make_dir(tmp);
+            *p = c;
+        }
     }
+    make_dir(tmp);
+    FILE *probe;
+    char probe_path[2100];
+    snprintf(probe_path, sizeof(probe_path), "%s%c.probe-%d", tmp, PATH_SEP, (int)getpid());
+    probe = fopen(probe_path, "wb");
+    if (!probe) return 0;
+    fclose(probe);
+    remove(probe_path);
     return 1;
 }
 
-/* ---- JSON string escaping (for the data URL value) ---- */
+/* size is "512" for --max 512 or "w320" for a --srcset width; target 0 means none */
+static void cache_entry_path(char *buf, size_t len, const char *dir, unsigned long long hash,
+                             const char *size, int filter, long target, const char *format) {
+    char budget[32] = "";
+    if (target > 0) snprintf(budget, sizeof(budget), "-t%ld", target);
+    snprintf(buf, len, "%s%cv%d-%016llx-%s-%s%s.%s", dir, PATH_SEP, CACHE_VERSION, hash, size,
+             filter == FILTER_LANCZOS ? "lanczos" : "area", budget, format);
+}
+
+/* Returns 1 on a hit: *out is the cached image, or NULL for "use the original" */
+static int cache_load(const char *path, unsigned char **out, size_t *out_len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    *out = NULL;
+    *out_len = 0;
+    if (size > 0) {
+        *out = (unsigned char *)malloc((size_t)size);
+        if (!*out || fread(*out, 1, (size_t)size, fp) != (size_t)size) {
+            free(*out);
+            *out = NULL;
+            fclose(fp);
+            return 0;
+        }
+        *out_len = (size_t)size;
+    }
+    fclose(fp);
+    return size >= 0;
+}
+
+static void cache_store(const char *path, const unsigned char *data, size_t len, int tag) {
+    char tmp[2500];
+    snprintf(tmp, sizeof(tmp), "%s.tmp-%d-%d", path, (int)getpid(), tag);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return;
+    int ok = len == 0 || fwrite(data, 1, len, fp) == len;
+    if (fclose(fp) != 0) ok = 0;
+#ifdef _WIN32
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tmp, path) != 0) remove(tmp);
+}
+
+/* ---- Batch jobs ---- */
+
+/*
+ * With --jobs N the expensive part of each file (load, cache lookup,
+ * decode and resize, or a platform tool run) happens on N worker
+ * threads. The main thread waits for the files in input order and does
+ * the encoding and output itself. Encoding runs at GB/s, so output stays
+ * in argument order and the total time is close to that of the slowest
+ * image.
+ */
+
+#define SRCSET_MAX 16
+
+typedef struct {
+    int do_optimize;
+    int max_dim;
+    int filter;
+    int quiet;
+    const char *cache_dir;      /* NULL when caching is off */
+    int format;                 /* enum out_format */
+    long target_bytes;          /* 0 for no budget */
+    const int *srcset;          /* --srcset widths, ascending */
+    int nsrcset;
+} convert_opts;
+
+/* One output image; data is NULL when it is the original file */
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    const char *mime;
+    int width;
+} image_variant;
+
+typedef struct {
+    const char *path;
+    int index;
+    unsigned char *data;        /* file to encode; NULL to stream it from disk */
+    size_t fsize;
+    const char *mime;
+    int w, h;                   /* source size once read, w = -1 if unknown */
+    image_variant *srcset;      /* --srcset results, narrowest first */
+    int nsrcset;
+    int failed;
+    membuf log;                 /* stderr lines, printed when the file is output */
+    int done;
+} convert_job;
+
+static int job_dimensions(convert_job *j, membuf *log) {
+    if (j->w == 0 && !header_dimensions(j->data, j->fsize, &j->w, &j->h) &&
+        !get_image_dimensions(j->path, &j->w, &j->h)) {
+        if (log) membuf_printf(log, "  [optimize] cannot read dimensions, skipping optimization\n");
+        j->w = -1;
+    }
+    return j->w > 0;
+}
+
+/*
+ * Produce one output image from j->data: fit within box x box, or
+ * exactly width pixels wide for --srcset, then --format. The cache is
+ * checked before the dimensions are even read.
+ */
+static void make_variant(convert_job *j, const convert_opts *o, unsigned long long hash,
+                         int box, int width, int tag, image *decoded, membuf *keep,
+                         membuf *log, image_variant *v) {
+    char size[16], entry[2400];
+    v->data = NULL;
+    v->len = j->fsize;
+    v->mime = j->mime;
+    v->width = width;
+    if (width) snprintf(size, sizeof(size), "w%d", width);
+    else snprintf(size, sizeof(size), "%d", box);
+    if (o->cache_dir) {
+        const char *format = format_name(o->format);
+        if (o->format == FORMAT_SAME) {
+            format = strrchr(j->mime, '/') + 1;
+            if (strcmp(format, "svg+xml") == 0) format = "svg";
+        }
+        cache_entry_path(entry, sizeof(entry), o->cache_dir, hash, size, o->filter,
+                         o->target_bytes, format);
+        unsigned char *hit = NULL;
+        size_t hit_len = 0;
+        if (cache_load(entry, &hit, &hit_len)) {
+            if (hit) {
+                v->data = hit;
+                v->len = hit_len;
+                v->mime = sniff_mime(hit, hit_len, j->mime);
+            }
+            if (log) membuf_printf(log, "  [optimize] cache hit, %zu bytes\n", v->len);
+            return;
+        }
+    }
+    if (!job_dimensions(j, log)) return;
+
+    int w = j->w, h = j->h, nw = w, nh = h;
+    if (width) {
+        fit_width(w, h, width, &nw, &nh);
+    } else if (w > box || h > box) {
+        fit_box(w, h, box, &nw, &nh);
+    } else if (log) {
+        membuf_printf(log, "  [optimize] %dx%d already within %dpx, no resize needed\n", w, h, box);
+    }
+
+    unsigned char *cur = NULL;
+    size_t cur_len = 0;
+    int ok = 1;
+    if (nw != w || nh != h) {
+        ok = resize_image(j->path, j->data, j->fsize, w, h, nw, nh, o->filter, tag,
+                          decoded, keep, log, &cur, &cur_len);
+    }
+    if (ok && o->format != FORMAT_SAME) {
+        unsigned char *enc;
+        size_t enc_len;
+        int rc = transcode(o->format, o->target_bytes, cur ? NULL : j->path,
+                           cur ? cur : j->data, cur ? cur_len : j->fsize, tag, log,
+                           &enc, &enc_len);
+        if (rc < 0) ok = 0;
+        if (rc == 1) {
+            free(cur);
+            cur = enc;
+            cur_len = enc_len;
+        }
+    }
+    if (cur) {
+        v->data = cur;
+        v->len = cur_len;
+        v->mime = sniff_mime(cur, cur_len, j->mime);
+    }
+    /* Failures are not cached: a missing platform tool may be installed later */
+    if (o->cache_dir && ok) cache_store(entry, cur, cur_len, tag);
+}
+
+static void prepare_job(convert_job *j, const convert_opts *o) {
+    j->mime = detect_mime(j->path);
+    if (!(o->do_optimize && is_optimizable(j->path))) return;   /* streamed later */
+
+    j->data = read_file(j->path, &j->fsize);
+    if (!j->data) {
+        j->failed = 1;
+        return;
+    }
+    membuf *log = o->quiet ? NULL : &j->log;
+    unsigned long long hash = o->cache_dir ? hash64(j->data, j->fsize) : 0;
+    image decoded = { 0, 0, NULL };
+    membuf keep = { NULL, 0, 0, 0 };
+
+    if (o->nsrcset == 0) {
+        image_variant v;
+        make_variant(j, o, hash, o->max_dim, 0, j->index * SRCSET_MAX, &decoded, &keep, log, &v);
+        if (v.data) {
+            free(j->data);
+            j->data = v.data;
+            j->fsize = v.len;
+            j->mime = v.mime;
+        }
+    } else if (job_dimensions(j, log) &&
+               (j->srcset = (image_variant *)calloc((size_t)o->nsrcset, sizeof(image_variant)))) {
+        /* Widths past the source clamp to it; keep each resulting width once */
+        for (int k = 0; k < o->nsrcset; k++) {
+            int nw, nh;
+            fit_width(j->w, j->h, o->srcset[k], &nw, &nh);
+            if (j->nsrcset > 0 && j->srcset[j->nsrcset - 1].width == nw) continue;
+            make_variant(j, o, hash, 0, nw, j->index * SRCSET_MAX + k, &decoded, &keep, log,
+                         &j->srcset[j->nsrcset++]);
+        }
+    }
+    free(decoded.rgba);
+    free(keep.data);
+}
+
+typedef struct {
+    convert_job *jobs;
+    int count;
+    int next;
+    const convert_opts *opts;
+    mutex_t lock;
+    cond_t changed;
+} job_queue;
+
+static THREAD_FUNC job_worker(void *arg) {
+    job_queue *q = (job_queue *)arg;
+    for (;;) {
+        mutex_lock(&q->lock);
+        int i = q->next < q->count ? q->next++ : -1;
+        mutex_unlock(&q->lock);
+        if (i < 0) break;
+        prepare_job(&q->jobs[i], q->opts);
+        mutex_lock(&q->lock);
+        q->jobs[i].done = 1;
+        cond_broadcast(&q->changed);
+        mutex_unlock(&q->lock);
+    }
+    THREAD_RETURN;
+}
+
+/* ---- JSON string escaping ---- */
 
+/* Only names need this: data URLs are base64 and never need escaping */
 static void print_json_string(const char *s) {
-    putchar('"');
+    out_char('"');
     while (*s) {
         switch (*s) {
-            case '"':  fputs("\\\"", stdout); break;
-            case '\\': fputs("\\\\", stdout); break;
-            case '\n': fputs("\\n", stdout);  break;
-            case '\r': fputs("\\r", stdout);  break;
-            case '\t': fputs("\\t", stdout);  break;
-            default:   putchar(*s);           break;
+            case '"':  out_str("\\\""); break;
+            case '\\': out_str("\\\\"); break;
+            case '\n': out_str("\\n");  break;
+            case '\r': out_str("\\r");  break;
+            case '\t': out_str("\\t");  break;
+            default:   out_char(*s);     break;
         }
         s++;
     }
-    putchar('"');
+    out_char('"');
 }
 
-/* ---- Output with optional line wrapping ---- */
+/* ---- Data URL output ---- */
 
-static void print_wrapped(const char *s, int wrap) {
-    if (wrap <= 0) {
-        fputs(s, stdout);
-        return;
+/*
+ * Write "data:<mime>;base64,..." from either an in-memory buffer or an
+ * open file, which is read and encoded B64_CHUNK bytes at a time so the
+ * image is never held in memory. wrap applies to the whole URL.
+ */
+static int print_data_url(const char *mime, const unsigned char *data, size_t len,
+                          FILE *fp, int wrap) {
+    static unsigned char chunk[B64_CHUNK];
+    b64_stream s = { { 0, 0, 0 }, 0, wrap, 0 };
+    b64_put(&s, "data:", 5);
+    b64_put(&s, mime, strlen(mime));
+    b64_put(&s, ";base64,", 8);
+    if (data) {
+        b64_write(&s, data, len);
+    } else {
+        size_t total = 0, n;
+        while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+            b64_write(&s, chunk, n);
+            total += n;
+        }
+        if (total != len) {
+            b64_end(&s);
+            return 0;
+        }
     }
-    size_t len = strlen(s);
-    size_t pos = 0;
-    while (pos < len) {
-        size_t chunk = (size_t)wrap;
-        if (pos + chunk > len) chunk = len - pos;
-        fwrite(s + pos, 1, chunk, stdout);
-        pos += chunk;
-        if (pos < len) putchar('\n');
+    b64_end(&s);
+    return 1;
+}
+
+/* "data:... 320w, data:... 640w" for a srcset attribute */
+static int print_srcset(const convert_job *j) {
+    int ok = 1;
+    for (int k = 0; k < j->nsrcset; k++) {
+        const image_variant *v = &j->srcset[k];
+        if (k) out_str(", ");
+        ok &= print_data_url(v->mime, v->data ? v->data : j->data, v->len, NULL, 0);
+        out_printf(" %dw", v->width);
     }
+    return ok;
 }
 
 /* ---- Filename extraction ---- */
@@ -485,8 +2545,27 @@ static void print_usage(void) {
         "  --max N         Max pixel dimension (default 512). Images\n"
         "                  larger than NxN are resized to fit, keeping\n"
         "                  aspect ratio. SVG and ICO are never resized.\n"
+        "  --filter F      Resampling filter for built-in resizing:\n"
+        "                  area (default, box average) or lanczos\n"
         "  --no-optimize   Skip optimization, encode the raw file as-is\n"
         "\n"
+        "Formats and sizes:\n"
+        "  --format F      Re-encode optimized images as webp or avif, or\n"
+        "                  auto to keep the smallest of AVIF, WebP and\n"
+        "                  the original (default: keep the format)\n"
+        "  --target-bytes N  Pick the highest quality that fits in N bytes\n"
+        "                  (K and M suffixes work; needs --format)\n"
+        "  --srcset W,...  Emit one image per width from a single decode,\n"
+        "                  as a srcset list (raw, --field, --html) or a\n"
+        "                  srcset array (--json); --max is not used\n"
+        "\n"
+        "Batches and caching:\n"
+        "  --jobs N        Optimize up to N files at once (default 1);\n"
+        "                  output keeps the order files were given in\n"
+        "  --cache DIR     Cache optimized images in DIR (default\n"
+        "                  ~/.cache/img_convert, %%LOCALAPPDATA%%\\img_convert)\n"
+        "  --no-cache      Do not read or write the cache\n"
+        "\n"
         "Output modes (default is raw data URL):\n"
         "  --json          Wrap each output in a JSON object\n"
         "  --field KEY     Output as a JSON key:value pair\n"
@@ -498,16 +2577,22 @@ static void print_usage(void) {
         "  --quiet         Suppress the file info line on stderr\n"
         "  --help          Print this message\n"
         "\n"
-        "Optimization uses platform tools with zero extra dependencies:\n"
+        "Dimensions are read from PNG, JPEG, GIF and WebP headers, and PNGs\n"
+        "are decoded, resized and re-encoded in memory. Other formats fall\n"
+        "back to platform tools with zero extra dependencies:\n"
         "  macOS   sips (built in to every Mac)\n"
         "  Linux   magick or convert (ImageMagick)\n"
         "  Windows PowerShell System.Drawing\n"
+        "WebP and AVIF are encoded with cwebp and avifenc, or ImageMagick.\n"
         "\n"
         "Examples:\n"
         "  ./convert photo.png                  (auto-optimize to 512px)\n"
         "  ./convert --max 256 avatar.png       (optimize to 256px max)\n"
         "  ./convert --max 800 screenshot.png   (optimize to 800px max)\n"
         "  ./convert --no-optimize photo.png    (skip optimization)\n"
+        "  ./convert --jobs 8 --json shots/*.png\n"
+        "  ./convert --format auto --target-bytes 40K hero.png\n"
+        "  ./convert --srcset 320,640,1280 --format webp --html hero.png\n"
         "  ./convert --json avatar.jpg logo.svg\n"
         "  ./convert --field site.image avatar.png\n"
         "  ./convert --css background.webp\n"
@@ -527,6 +2612,28 @@ enum output_mode {
     MODE_HTML     /* <img src="data:..." alt="..."> */
 };
 
+/* "320,640,1280" -> sorted, de-duplicated widths; returns the count, 0 if malformed */
+static int parse_widths(const char *spec, int *widths) {
+    int n = 0;
+    while (*spec) {
+        char *end;
+        long v = strtol(spec, &end, 10);
+        if (end == spec || v < 16 || v > 16384 || (*end && *end != ',') || n == SRCSET_MAX) return 0;
+        int k = n++;
+        while (k > 0 && widths[k - 1] > v) {
+            widths[k] = widths[k - 1];
+            k--;
+        }
+        widths[k] = (int)v;
+        if (k > 0 && widths[k - 1] == v) {
+            memmove(widths + k, widths + k + 1, (size_t)(n - k - 1) * sizeof(int));
+            n--;
+        }
+        spec = *end ? end + 1 : end;
+    }
+    return n;
+}
+
 /* ---- Main ---- */
 
 int main(int argc, char **argv) {
@@ -536,6 +2643,15 @@ int main(int argc, char **argv) {
     int quiet = 0;
     int do_optimize = 1;       /* on by default */
     int max_dim = 512;         /* default max pixel dimension */
+    int filter = FILTER_AREA;
+    int jobs = 1;
+    int use_cache = 1;
+    const char *cache_dir = NULL;
+    char cache_buf[2048];
+    int format = FORMAT_SAME;
+    long target_bytes = 0;
+    int srcset[SRCSET_MAX];
+    int nsrcset = 0;
     int file_count = 0;
     char *files[256];
 
@@ -562,6 +2678,54 @@ int main(int argc, char **argv) {
         } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
             max_dim = atoi(argv[++i]);
             if (max_dim < 16) max_dim = 16;  /* sanity floor */
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "area") == 0) {
+                filter = FILTER_AREA;
+            } else if (strcmp(argv[i], "lanczos") == 0) {
+                filter = FILTER_LANCZOS;
+            } else {
+                fprintf(stderr, "convert: --filter must be area or lanczos\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "webp") == 0) {
+                format = FORMAT_WEBP;
+            } else if (strcmp(argv[i], "avif") == 0) {
+                format = FORMAT_AVIF;
+            } else if (strcmp(argv[i], "auto") == 0) {
+                format = FORMAT_AUTO;
+            } else if (strcmp(argv[i], "same") == 0) {
+                format = FORMAT_SAME;
+            } else {
+                fprintf(stderr, "convert: --format must be webp, avif, auto or same\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--target-bytes") == 0 && i + 1 < argc) {
+            char *end;
+            target_bytes = strtol(argv[++i], &end, 10);
+            if (*end == 'k' || *end == 'K') target_bytes *= 1024, end++;
+            else if (*end == 'm' || *end == 'M') target_bytes *= 1024 * 1024, end++;
+            if (*end || target_bytes <= 0) {
+                fprintf(stderr, "convert: --target-bytes needs a positive size\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--srcset") == 0 && i + 1 < argc) {
+            nsrcset = parse_widths(argv[++i], srcset);
+            if (nsrcset == 0) {
+                fprintf(stderr, "convert: --srcset takes up to %d comma-separated widths (16-16384)\n",
+                        SRCSET_MAX);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+            if (jobs < 1) jobs = 1;
+            if (jobs > 64) jobs = 64;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = 0;
         } else if (strcmp(argv[i], "--no-optimize") == 0) {
             do_optimize = 0;
         } else if (strcmp(argv[i], "--quiet") == 0) {
@@ -584,114 +2748,204 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    int first_json = 1;
-    if (mode == MODE_JSON && file_count > 1) {
-        printf("[\n");
+    if (nsrcset && mode == MODE_CSS) {
+        fprintf(stderr, "convert: --srcset cannot be used with --css\n");
+        return 1;
+    }
+    if (target_bytes && format == FORMAT_SAME) {
+        if (!quiet) fprintf(stderr, "convert: --target-bytes has no effect without --format\n");
+        target_bytes = 0;
     }
 
-    for (int f = 0; f < file_count; f++) {
-        const char *path = files[f];
-        const char *read_path = path;  /* may point to optimized temp */
-        char tmp_path[2048];
-        int used_tmp = 0;
-        size_t fsize = 0;
-
-        /* Auto-optimize if enabled and format supports it */
-        if (do_optimize && is_optimizable(path)) {
-            make_temp_path(tmp_path, sizeof(tmp_path), path);
-            if (optimize_image(path, tmp_path, max_dim, quiet)) {
-                read_path = tmp_path;
-                used_tmp = 1;
-            }
-        }
+    crc32_init();
+    if (do_optimize && format != FORMAT_SAME) detect_encoders();
+
+    if (!do_optimize) use_cache = 0;
+    if (use_cache && !cache_dir && default_cache_dir(cache_buf, sizeof(cache_buf))) {
+        cache_dir = cache_buf;
+    }
+    if (use_cache && cache_dir && !make_dirs(cache_dir)) {
+        if (!quiet) fprintf(stderr, "convert: cache directory %s is not writable, caching off\n", cache_dir);
+        cache_dir = NULL;
+    }
+    convert_opts opts = { do_optimize, max_dim, filter, quiet, use_cache ? cache_dir : NULL,
+                          format, target_bytes, srcset, nsrcset };
 
-        unsigned char *data = read_file(read_path, &fsize);
+    convert_job *job = (convert_job *)calloc((size_t)file_count, sizeof(convert_job));
+    if (!job) {
+        fprintf(stderr, "convert: out of memory\n");
+        return 1;
+    }
+    for (int f = 0; f < file_count; f++) {
+        job[f].path = files[f];
+        job[f].index = f;
+    }
 
-        /* Clean up temp file immediately after reading */
-        if (used_tmp) {
-            remove(tmp_path);
+    job_queue queue;
+    thread_t workers[64];
+    int nworkers = 0;
+    queue.jobs = job;
+    queue.count = file_count;
+    queue.next = 0;
+    queue.opts = &opts;
+    mutex_init(&queue.lock);
+    cond_init(&queue.changed);
+    if (jobs > file_count) jobs = file_count;
+    if (jobs > 1) {
+        for (int t = 0; t < jobs; t++) {
+            if (thread_start(&workers[nworkers], job_worker, &queue) == 0) nworkers++;
         }
+    }
 
-        if (!data) continue;
+    int first_json = 1;
+    if (mode == MODE_JSON && file_count > 1) {
+        out_str("[\n");
+    }
 
-        const char *mime = detect_mime(path);
-        char *b64 = base64_encode(data, fsize);
-        free(data);
+    for (int f = 0; f < file_count; f++) {
+        convert_job *j = &job[f];
+        const char *path = j->path;
 
-        if (!b64) {
-            fprintf(stderr, "convert: encoding failed for %s\n", path);
+        if (nworkers > 0) {
+            mutex_lock(&queue.lock);
+            while (!j->done) cond_wait(&queue.changed, &queue.lock);
+            mutex_unlock(&queue.lock);
+        } else {
+            prepare_job(j, &opts);
+        }
+        if (j->log.len) fwrite(j->log.data, 1, j->log.len, stderr);
+        free(j->log.data);
+        if (j->failed) continue;
+
+        if (j->nsrcset) {
+            if (!quiet) {
+                for (int k = 0; k < j->nsrcset; k++) {
+                    fprintf(stderr, "%s  %dw (%s, %zu bytes)\n", basename_of(path),
+                            j->srcset[k].width, j->srcset[k].mime, j->srcset[k].len);
+                }
+            }
+            const image_variant *widest = &j->srcset[j->nsrcset - 1];
+            int ok = 1;
+            switch (mode) {
+                case MODE_JSON:
+                    if (file_count > 1) {
+                        if (!first_json) out_str(",\n");
+                        out_str("  ");
+                    }
+                    out_str("{\"file\": ");
+                    print_json_string(basename_of(path));
+                    out_str(", \"srcset\": [");
+                    for (int k = 0; k < j->nsrcset; k++) {
+                        const image_variant *v = &j->srcset[k];
+                        out_printf("%s{\"width\": %d, \"mime\": ", k ? ", " : "", v->width);
+                        print_json_string(v->mime);
+                        out_printf(", \"size\": %zu, \"dataUrl\": \"", v->len);
+                        ok &= print_data_url(v->mime, v->data ? v->data : j->data, v->len, NULL, 0);
+                        out_str("\"}");
+                    }
+                    out_str("]}");
+                    if (file_count == 1) out_char('\n');
+                    first_json = 0;
+                    break;
+
+                case MODE_FIELD:
+                    out_printf("\"%s\": \"", field_key ? field_key : "image");
+                    ok = print_srcset(j);
+                    out_str("\"\n");
+                    break;
+
+                case MODE_HTML:
+                    out_str("<img src=\"");
+                    ok = print_data_url(widest->mime, widest->data ? widest->data : j->data,
+                                        widest->len, NULL, 0);
+                    out_str("\" srcset=\"");
+                    ok &= print_srcset(j);
+                    out_printf("\" alt=\"%s\">\n", basename_of(path));
+                    break;
+
+                default:
+                    ok = print_srcset(j);
+                    out_char('\n');
+                    break;
+            }
+            if (!ok) fprintf(stderr, "convert: short read on %s\n", path);
+            for (int k = 0; k < j->nsrcset; k++) free(j->srcset[k].data);
+            free(j->srcset);
+            free(j->data);
             continue;
         }
 
-        /* Build the data URL */
-        size_t url_len = strlen("data:") + strlen(mime) + strlen(";base64,") + strlen(b64) + 1;
-        char *data_url = (char *)malloc(url_len);
-        if (!data_url) {
-            free(b64);
-            fprintf(stderr, "convert: out of memory\n");
-            continue;
+        size_t fsize = j->fsize;
+        unsigned char *data = j->data;
+        FILE *fp = NULL;
+        if (!data) {
+            fp = open_sized(path, &fsize);
+            if (!fp) continue;
         }
-        snprintf(data_url, url_len, "data:%s;base64,%s", mime, b64);
-        free(b64);
+
+        const char *mime = j->mime;
+        size_t url_len = strlen("data:") + strlen(mime) + strlen(";base64,") + 4 * ((fsize + 2) / 3);
 
         /* Info line on stderr */
         if (!quiet) {
             fprintf(stderr, "%s  (%s, %zu bytes, %zu chars base64)\n",
-                    basename_of(path), mime, fsize, strlen(data_url));
+                    basename_of(path), mime, fsize, url_len);
         }
 
         /* Output */
+        int ok = 1;
         switch (mode) {
             case MODE_RAW:
-                print_wrapped(data_url, wrap);
-                printf("\n");
+                ok = print_data_url(mime, data, fsize, fp, wrap);
+                out_char('\n');
                 break;
 
             case MODE_JSON:
                 if (file_count > 1) {
-                    if (!first_json) printf(",\n");
-                    printf("  {\"file\": ");
-                    print_json_string(basename_of(path));
-                    printf(", \"mime\": ");
-                    print_json_string(mime);
-                    printf(", \"size\": %zu, \"dataUrl\": ", fsize);
-                    print_json_string(data_url);
-                    printf("}");
-                } else {
-                    printf("{\"file\": ");
-                    print_json_string(basename_of(path));
-                    printf(", \"mime\": ");
-                    print_json_string(mime);
-                    printf(", \"size\": %zu, \"dataUrl\": ", fsize);
-                    print_json_string(data_url);
-                    printf("}\n");
+                    if (!first_json) out_str(",\n");
+                    out_str("  ");
                 }
+                out_str("{\"file\": ");
+                print_json_string(basename_of(path));
+                out_str(", \"mime\": ");
+                print_json_string(mime);
+                out_printf(", \"size\": %zu, \"dataUrl\": \"", fsize);
+                ok = print_data_url(mime, data, fsize, fp, 0);
+                out_str("\"}");
+                if (file_count == 1) out_char('\n');
                 first_json = 0;
                 break;
 
             case MODE_FIELD:
-                printf("\"%s\": ", field_key ? field_key : "image");
-                print_json_string(data_url);
-                printf("\n");
+                out_printf("\"%s\": \"", field_key ? field_key : "image");
+                ok = print_data_url(mime, data, fsize, fp, 0);
+                out_str("\"\n");
                 break;
 
             case MODE_CSS:
-                printf("url(%s)", data_url);
-                printf("\n");
+                out_str("url(");
+                ok = print_data_url(mime, data, fsize, fp, 0);
+                out_str(")\n");
                 break;
 
             case MODE_HTML:
-                printf("<img src=\"%s\" alt=\"%s\">\n",
-                       data_url, basename_of(path));
+                out_str("<img src=\"");
+                ok = print_data_url(mime, data, fsize, fp, 0);
+                out_printf("\" alt=\"%s\">\n", basename_of(path));
                 break;
         }
 
-        free(data_url);
+        if (!ok) fprintf(stderr, "convert: short read on %s\n", path);
+        free(data);
+        if (fp) fclose(fp);
     }
 
     if (mode == MODE_JSON && file_count > 1) {
-        printf("\n]\n");
+        out_str("\n]\n");
     }
 
+    out_flush();
+    for (int t = 0; t < nworkers; t++) thread_join(workers[t]);
+    free(job);
     return 0;
 }
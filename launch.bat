@@ -9,6 +9,15 @@ set PORT=%1
 if "%PORT%"=="" set PORT=9090
 set BINARY=serve.exe
 
+REM Everything after the port is passed on to the server (e.g. --watch)
+set SERVE_ARGS=
+:nextarg
+shift
+if "%~1"=="" goto :argsdone
+set SERVE_ARGS=%SERVE_ARGS% %1
+goto :nextarg
+:argsdone
+
 REM Check if binary needs to be built
 if exist "%BINARY%" (
     REM Check if source is newer (basic: just rebuild if source changed recently)
@@ -20,7 +29,7 @@ REM Try MSVC first
 where cl >nul 2>&1
 if %ERRORLEVEL%==0 (
     echo Compiling serve.c with MSVC ...
-    cl /nologo /O2 serve.c /Fe:%BINARY% ws2_32.lib
+    cl /nologo /O2 serve.c /Fe:%BINARY% ws2_32.lib mswsock.lib
     if %ERRORLEVEL% neq 0 goto :compilefail
     goto :run
 )
@@ -29,7 +38,7 @@ REM Try MinGW gcc
 where gcc >nul 2>&1
 if %ERRORLEVEL%==0 (
     echo Compiling serve.c with GCC ...
-    gcc -O2 -o %BINARY% serve.c -lws2_32
+    gcc -O2 -o %BINARY% serve.c -lws2_32 -lmswsock
     if %ERRORLEVEL% neq 0 goto :compilefail
     goto :run
 )
@@ -38,7 +47,7 @@ REM Try clang
 where clang >nul 2>&1
 if %ERRORLEVEL%==0 (
     echo Compiling serve.c with Clang ...
-    clang -O2 -o %BINARY% serve.c -lws2_32
+    clang -O2 -o %BINARY% serve.c -lws2_32 -lmswsock
     if %ERRORLEVEL% neq 0 goto :compilefail
     goto :run
 )
@@ -65,8 +74,24 @@ pause
 exit /b 1
 
 :run
+REM Compile the build tool once so builds from the manager do not pay for
+REM "go run" recompiling it every time. serve.c also does this on demand.
+REM It is rebuilt only when missing or older than build.go.
+if not exist build.go goto :serve
+where go >nul 2>&1
+if %ERRORLEVEL% neq 0 goto :serve
+if not exist portfolio-build.exe goto :buildtool
+REM dir /o:d lists oldest first, so NEWEST ends up as the newer of the two
+for /f "delims=" %%F in ('dir /b /o:d build.go portfolio-build.exe') do set NEWEST=%%F
+if /i not "%NEWEST%"=="build.go" goto :serve
+:buildtool
+echo Compiling build.go ...
+go build -o portfolio-build.exe build.go
+if %ERRORLEVEL% neq 0 echo Could not compile build.go; builds will fall back to go run.
+
+:serve
 echo.
 echo Starting portfolio server on port %PORT% ...
 echo.
-%BINARY% %PORT%
+%BINARY% %PORT%%SERVE_ARGS%
 pause
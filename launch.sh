@@ -9,6 +9,7 @@ SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
 cd "$SCRIPT_DIR"
 
 PORT="${1:-9090}"
+[ $# -gt 0 ] && shift
 BINARY="./serve"
 
 # Find a C compiler
@@ -34,7 +35,7 @@ if [ -z "$CC" ]; then
 fi
 
 # Compile if binary is missing or source is newer
-if [ ! -f "$BINARY" ] || [ "serve.c" -nt "$BINARY" ]; then
+if [ ! -f "$BINARY" ] || [ "serve.c" -nt "$BINARY" ] || [ "lib/json.h" -nt "$BINARY" ]; then
     echo "Compiling serve.c ..."
     # On macOS, pass the SDK sysroot if available
     SYSROOT_FLAG=""
@@ -44,11 +45,25 @@ if [ ! -f "$BINARY" ] || [ "serve.c" -nt "$BINARY" ]; then
             SYSROOT_FLAG="--sysroot=$SDK_PATH"
         fi
     fi
-    $CC -O2 -o "$BINARY" serve.c $SYSROOT_FLAG
+    $CC -O2 -pthread -o "$BINARY" serve.c $SYSROOT_FLAG
     echo "Done."
 fi
 
+# Compile the build tool once so builds from the manager do not pay for
+# "go run" recompiling it every time. serve.c also does this on demand.
+BUILD_TOOL="./portfolio-build"
+if [ -f build.go ] && command -v go >/dev/null 2>&1; then
+    if [ ! -f "$BUILD_TOOL" ] || [ "build.go" -nt "$BUILD_TOOL" ]; then
+        echo "Compiling build.go ..."
+        if go build -o "$BUILD_TOOL" build.go; then
+            echo "Done."
+        else
+            echo "Could not compile build.go; builds will fall back to go run."
+        fi
+    fi
+fi
+
 echo ""
 echo "Starting portfolio server on port $PORT ..."
 echo ""
-exec "$BINARY" "$PORT"
+exec "$BINARY" "$PORT" "$@"
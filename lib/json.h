@@ -0,0 +1,640 @@
+/*
+ * json.h - JSON tokenizer and writer shared by the C tools
+ *
+ * Header-only: a tool includes it and every function is compiled in as
+ * static, so each tool still builds from its one .c file with one
+ * compiler command. Used by serve.c, cmds/run.c and beautify/beautify.c.
+ *
+ * Reading is a pull tokenizer over text already in memory. json_next()
+ * returns one token at a time (SAX style) as a slice of the input. No
+ * memory is allocated, and string contents are left escaped until a
+ * caller asks for them with json_unescape(). The grammar is checked as
+ * tokens are handed out: no missing commas, unbalanced brackets, bad
+ * escapes, raw control characters or malformed numbers get through. A
+ * caller that stops early has only paid for the bytes it looked at.
+ *
+ * Nearly all of the bytes in a document like crissy-data.json sit inside
+ * strings (base64 images), so that is where the vector code goes:
+ * json_string_run() finds the next quote, backslash or control character
+ * 16 bytes at a time with SSE2 or NEON. On other targets it compares
+ * eight bytes at a time with SWAR.
+ *
+ * Writing goes to a json_buf, a growable output buffer that starts out as
+ * JSON_BUF_INIT. json_buf_string() escapes as it copies and turns bytes
+ * that are not valid UTF-8 into U+FFFD, so output built from file names
+ * or command output is always valid JSON. A failed allocation sets
+ * json_buf.failed, and later appends are dropped, so callers can check
+ * once at the end.
+ *
+ * Build: nothing to do; include it with a path relative to the tool,
+ * e.g. #include "../lib/json.h".
+ */
+
+#ifndef PORTFOLIO_JSON_H
+#define PORTFOLIO_JSON_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_DEPTH 256
+
+/* Unused helpers in a tool that includes this should not warn */
+#if defined(_MSC_VER) && !defined(__cplusplus)
+  #define JSON_API static __inline
+#else
+  #define JSON_API static inline
+#endif
+
+/* SSE2 on x86-64 (and 32-bit x86 built for it), NEON on ARM64 */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define JSON_SIMD_SSE2 1
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+  #include <arm_neon.h>
+  #define JSON_SIMD_NEON 1
+#endif
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+  JSON_API int json_ctz32(unsigned v) { unsigned long i; _BitScanForward(&i, v); return (int)i; }
+  JSON_API int json_ctz64(unsigned long long v) { unsigned long i; _BitScanForward64(&i, v); return (int)i; }
+#else
+  #define json_ctz32(v) __builtin_ctz(v)
+  #define json_ctz64(v) __builtin_ctzll(v)
+#endif
+
+/* ---- Scanning ---- */
+
+/*
+ * Find the first byte equal to a or b in p[0..n), or n if there is none.
+ * Used by formatters that copy the inside of strings in bulk.
+ */
+JSON_API long json_scan2(const char *p, long n, char a, char b) {
+    long i = 0;
+#if defined(JSON_SIMD_SSE2)
+    __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask) return i + json_ctz32((unsigned)mask);
+    }
+#elif defined(JSON_SIMD_NEON)
+    uint8x16_t va = vdupq_n_u8((uint8_t)a), vb = vdupq_n_u8((uint8_t)b);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(p + i));
+        uint8x16_t m = vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb));
+        /* Narrow to 4 bits per byte to get a 64-bit mask */
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (bits) return i + (json_ctz64(bits) >> 2);
+    }
+#endif
+    for (; i < n; i++) {
+        if (p[i] == a || p[i] == b) return i;
+    }
+    return n;
+}
+
+/*
+ * Length of the run of plain string bytes at p: everything up to the
+ * first '"', '\\' or control character (< 0x20), or n.
+ */
+JSON_API long json_string_run(const char *p, long n) {
+    long i = 0;
+#if defined(JSON_SIMD_SSE2)
+    const __m128i quote = _mm_set1_epi8('"'), slash = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        /* v <= 0x1F unsigned is max(v, 0x1F) == 0x1F */
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+                                 _mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return i + json_ctz32((unsigned)mask);
+    }
+#elif defined(JSON_SIMD_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"'), slash = vdupq_n_u8('\\'), ctl = vdupq_n_u8(0x1F);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(p + i));
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, slash)), vcleq_u8(v, ctl));
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (bits) return i + (json_ctz64(bits) >> 2);
+    }
+#else
+    /* SWAR: a byte of x is zero iff the matching bit of the "haszero" mask is set */
+    const unsigned long long ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    for (; i + 8 <= n; i += 8) {
+        unsigned long long x;
+        memcpy(&x, p + i, 8);
+        unsigned long long q = x ^ (ones * '"'), s = x ^ (ones * '\\');
+        unsigned long long hit = ((q - ones) & ~q) | ((s - ones) & ~s) | ((x - ones * 0x20) & ~x);
+        if (hit & highs) break;
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c == '"' || c == '\\' || c < 0x20) return i;
+    }
+    return n;
+}
+
+JSON_API int json_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+JSON_API int json_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Value of four hex digits at p, or -1 */
+JSON_API long json_hex4(const char *p) {
+    long v = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = json_hex_digit(p[i]);
+        if (d < 0) return -1;
+        v = (v << 4) | d;
+    }
+    return v;
+}
+
+/* ---- Tokenizer ---- */
+
+enum {
+    JSON_TOK_ERROR = -1,
+    JSON_TOK_END = 0,        /* the document is complete */
+    JSON_TOK_OBJECT,         /* '{' */
+    JSON_TOK_OBJECT_END,     /* '}' */
+    JSON_TOK_ARRAY,          /* '[' */
+    JSON_TOK_ARRAY_END,      /* ']' */
+    JSON_TOK_KEY,            /* member name; text is the escaped contents */
+    JSON_TOK_STRING,         /* text is the escaped contents, without quotes */
+    JSON_TOK_NUMBER,
+    JSON_TOK_TRUE,
+    JSON_TOK_FALSE,
+    JSON_TOK_NULL
+};
+
+typedef struct {
+    int type;
+    const char *text;        /* slice of the input; brackets point at themselves */
+    size_t len;
+} json_token;
+
+/* What the lexer accepts next */
+enum {
+    JSON_ST_VALUE, JSON_ST_VALUE_OR_CLOSE, JSON_ST_KEY, JSON_ST_KEY_OR_CLOSE,
+    JSON_ST_COLON, JSON_ST_COMMA_OR_CLOSE, JSON_ST_DONE
+};
+
+typedef struct {
+    const char *start;
+    const char *p;
+    const char *end;
+    int state;
+    int depth;
+    char stack[JSON_MAX_DEPTH];  /* '{' or '[' for each open container */
+    const char *err;             /* set when JSON_TOK_ERROR is returned */
+} json_lexer;
+
+JSON_API void json_lexer_init(json_lexer *lx, const char *text, size_t len) {
+    lx->start = lx->p = text;
+    lx->end = text + len;
+    lx->state = JSON_ST_VALUE;
+    lx->depth = 0;
+    lx->err = NULL;
+}
+
+/* Byte offset of the lexer, e.g. for "error at byte N" messages */
+JSON_API size_t json_lexer_offset(const json_lexer *lx) {
+    return (size_t)(lx->p - lx->start);
+}
+
+JSON_API int json_fail(json_lexer *lx, const char *err) {
+    lx->err = err;
+    lx->state = JSON_ST_DONE;
+    lx->end = lx->p;         /* every later call fails too */
+    return JSON_TOK_ERROR;
+}
+
+/* Scan the string whose opening quote is at lx->p */
+JSON_API int json_lex_string(json_lexer *lx, json_token *tok, int type) {
+    const char *p = lx->p + 1;
+    for (;;) {
+        p += json_string_run(p, (long)(lx->end - p));
+        if (p >= lx->end) {
+            lx->p = p;
+            return json_fail(lx, "unterminated string");
+        }
+        if (*p == '"') break;
+        if (*p != '\\') {
+            lx->p = p;
+            return json_fail(lx, "control character in string");
+        }
+        if (p + 1 >= lx->end) {
+            lx->p = p;
+            return json_fail(lx, "unterminated string");
+        }
+        char e = p[1];
+        if (e == 'u') {
+            if (lx->end - p < 6 || json_hex4(p + 2) < 0) {
+                lx->p = p;
+                return json_fail(lx, "bad \\u escape");
+            }
+            p += 6;
+        } else if (e == '"' || e == '\\' || e == '/' || e == 'b' || e == 'f' ||
+                   e == 'n' || e == 'r' || e == 't') {
+            p += 2;
+        } else {
+            lx->p = p;
+            return json_fail(lx, "bad escape");
+        }
+    }
+    tok->type = type;
+    tok->text = lx->p + 1;
+    tok->len = (size_t)(p - tok->text);
+    lx->p = p + 1;
+    return type;
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+JSON_API int json_lex_number(json_lexer *lx, json_token *tok) {
+    const char *p = lx->p, *end = lx->end;
+    if (p < end && *p == '-') p++;
+    if (p < end && *p == '0') {
+        p++;
+    } else if (p < end && *p >= '1' && *p <= '9') {
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    } else {
+        return json_fail(lx, "unexpected character");
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || *p < '0' || *p > '9') return json_fail(lx, "bad number");
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (p >= end || *p < '0' || *p > '9') return json_fail(lx, "bad number");
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    tok->type = JSON_TOK_NUMBER;
+    tok->text = lx->p;
+    tok->len = (size_t)(p - lx->p);
+    lx->p = p;
+    return JSON_TOK_NUMBER;
+}
+
+/*
+ * Return the next token in tok and as the result: JSON_TOK_END once the
+ * top-level value is complete and only whitespace follows, or
+ * JSON_TOK_ERROR with lx->err set.
+ */
+JSON_API int json_next(json_lexer *lx, json_token *tok) {
+    for (;;) {
+        while (lx->p < lx->end && json_is_space(*lx->p)) lx->p++;
+        if (lx->p >= lx->end) {
+            if (lx->state == JSON_ST_DONE && !lx->err) {
+                tok->type = JSON_TOK_END;
+                tok->text = lx->p;
+                tok->len = 0;
+                return JSON_TOK_END;
+            }
+            return json_fail(lx, lx->err ? lx->err : "unexpected end of input");
+        }
+        char c = *lx->p;
+        char top = lx->depth > 0 ? lx->stack[lx->depth - 1] : 0;
+        int type;
+
+        switch (lx->state) {
+            case JSON_ST_DONE:
+                return json_fail(lx, "trailing characters");
+            case JSON_ST_COLON:
+                if (c != ':') return json_fail(lx, "expected ':'");
+                lx->p++;
+                lx->state = JSON_ST_VALUE;
+                continue;
+            case JSON_ST_COMMA_OR_CLOSE:
+                if (c == ',') {
+                    lx->p++;
+                    lx->state = top == '{' ? JSON_ST_KEY : JSON_ST_VALUE;
+                    continue;
+                }
+                if (c != (top == '{' ? '}' : ']')) {
+                    return json_fail(lx, top == '{' ? "expected ',' or '}'" : "expected ',' or ']'");
+                }
+                goto close;
+            case JSON_ST_KEY_OR_CLOSE:
+                if (c == '}') goto close;
+                /* fall through */
+            case JSON_ST_KEY:
+                if (c != '"') return json_fail(lx, "expected member name");
+                type = json_lex_string(lx, tok, JSON_TOK_KEY);
+                if (type == JSON_TOK_KEY) lx->state = JSON_ST_COLON;
+                return type;
+            case JSON_ST_VALUE_OR_CLOSE:
+                if (c == ']') goto close;
+                /* fall through */
+            default:
+                break;
+        }
+
+        /* A value */
+        if (c == '{' || c == '[') {
+            if (lx->depth == JSON_MAX_DEPTH) return json_fail(lx, "nested too deeply");
+            lx->stack[lx->depth++] = c;
+            lx->state = c == '{' ? JSON_ST_KEY_OR_CLOSE : JSON_ST_VALUE_OR_CLOSE;
+            tok->type = c == '{' ? JSON_TOK_OBJECT : JSON_TOK_ARRAY;
+            tok->text = lx->p++;
+            tok->len = 1;
+            return tok->type;
+        }
+        if (c == '"') {
+            type = json_lex_string(lx, tok, JSON_TOK_STRING);
+        } else if (c == 't' || c == 'f' || c == 'n') {
+            static const char *const words[] = { "true", "false", "null" };
+            static const int types[] = { JSON_TOK_TRUE, JSON_TOK_FALSE, JSON_TOK_NULL };
+            int w = c == 't' ? 0 : c == 'f' ? 1 : 2;
+            size_t n = strlen(words[w]);
+            if ((size_t)(lx->end - lx->p) < n || memcmp(lx->p, words[w], n) != 0) {
+                return json_fail(lx, "unexpected character");
+            }
+            tok->type = type = types[w];
+            tok->text = lx->p;
+            tok->len = n;
+            lx->p += n;
+        } else {
+            type = json_lex_number(lx, tok);
+        }
+        if (type != JSON_TOK_ERROR) {
+            lx->state = lx->depth == 0 ? JSON_ST_DONE : JSON_ST_COMMA_OR_CLOSE;
+        }
+        return type;
+
+    close:
+        lx->depth--;
+        tok->type = c == '}' ? JSON_TOK_OBJECT_END : JSON_TOK_ARRAY_END;
+        tok->text = lx->p++;
+        tok->len = 1;
+        lx->state = lx->depth == 0 ? JSON_ST_DONE : JSON_ST_COMMA_OR_CLOSE;
+        return tok->type;
+    }
+}
+
+/*
+ * tok is the first token of a value. Skip the rest of it (a whole object
+ * or array) and report the span of its source text. Returns 0, or -1 if
+ * the input is malformed.
+ */
+JSON_API int json_value_span(json_lexer *lx, const json_token *tok,
+                           const char **start, size_t *len) {
+    json_token t;
+    if (tok->type == JSON_TOK_OBJECT || tok->type == JSON_TOK_ARRAY) {
+        int depth = lx->depth - 1;
+        while (lx->depth > depth) {
+            if (json_next(lx, &t) <= JSON_TOK_END) return -1;
+        }
+        *start = tok->text;
+        *len = (size_t)(lx->p - tok->text);
+        return 0;
+    }
+    if (tok->type < JSON_TOK_STRING) return -1;
+    *start = tok->type == JSON_TOK_STRING ? tok->text - 1 : tok->text;
+    *len = tok->type == JSON_TOK_STRING ? tok->len + 2 : tok->len;
+    return 0;
+}
+
+/* ---- Decoding ---- */
+
+/* Encode a code point as UTF-8 into out (4 bytes); returns the byte count */
+JSON_API size_t json_utf8_put(unsigned long cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/*
+ * Decode the escaped contents of a string token into out, which must
+ * hold len bytes (decoding never makes a string longer). Surrogate pairs
+ * become one code point. Returns the decoded length.
+ */
+JSON_API size_t json_unescape(const char *raw, size_t len, char *out) {
+    size_t o = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char *bs = (const char *)memchr(raw + i, '\\', len - i);
+        size_t run = bs ? (size_t)(bs - (raw + i)) : len - i;
+        memmove(out + o, raw + i, run);
+        o += run;
+        i += run;
+        if (i >= len) break;
+
+        char e = raw[++i];
+        switch (e) {
+            case 'b': out[o++] = '\b'; break;
+            case 'f': out[o++] = '\f'; break;
+            case 'n': out[o++] = '\n'; break;
+            case 'r': out[o++] = '\r'; break;
+            case 't': out[o++] = '\t'; break;
+            case 'u': {
+                unsigned long cp = (unsigned long)json_hex4(raw + i + 1);
+                i += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && i + 6 < len &&
+                    raw[i + 1] == '\\' && raw[i + 2] == 'u') {
+                    long lo = json_hex4(raw + i + 3);
+                    if (lo >= 0xDC00 && lo < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + ((unsigned long)lo - 0xDC00);
+                        i += 6;
+                    }
+                }
+                o += json_utf8_put(cp, out + o);
+                break;
+            }
+            default: out[o++] = e; break;   /* \" \\ \/ */
+        }
+    }
+    return o;
+}
+
+/* A decoded, NUL-terminated copy of a string token, or NULL if out of memory */
+JSON_API char *json_strdup(const json_token *tok, size_t *out_len) {
+    char *s = (char *)malloc(tok->len + 1);
+    if (!s) return NULL;
+    size_t n = json_unescape(tok->text, tok->len, s);
+    s[n] = '\0';
+    if (out_len) *out_len = n;
+    return s;
+}
+
+/* Does the escaped string raw decode to exactly s[0..n)? */
+JSON_API int json_raw_equals(const char *raw, size_t raw_len, const char *s, size_t n) {
+    if (!memchr(raw, '\\', raw_len)) return raw_len == n && memcmp(raw, s, n) == 0;
+    if (raw_len < n) return 0;
+    char small[256];
+    char *buf = raw_len <= sizeof(small) ? small : (char *)malloc(raw_len);
+    if (!buf) return 0;
+    size_t len = json_unescape(raw, raw_len, buf);
+    int eq = len == n && memcmp(buf, s, n) == 0;
+    if (buf != small) free(buf);
+    return eq;
+}
+
+/*
+ * Find the member called name (compared after decoding) among the
+ * top-level members of the object in text. On success the lexer is left
+ * just after the value's first token, which is stored in val, and 1 is
+ * returned. Returns 0 if there is no such member, -1 if the text is not a
+ * well-formed object up to that point. Members nested deeper, or names
+ * that only appear inside strings, never match.
+ */
+JSON_API int json_find_member(json_lexer *lx, const char *text, size_t len,
+                            const char *name, json_token *val) {
+    json_token t;
+    size_t name_len = strlen(name);
+    json_lexer_init(lx, text, len);
+    if (json_next(lx, &t) != JSON_TOK_OBJECT) return -1;
+    for (;;) {
+        int type = json_next(lx, &t);
+        if (type == JSON_TOK_OBJECT_END) return 0;
+        if (type != JSON_TOK_KEY) return -1;
+        int match = json_raw_equals(t.text, t.len, name, name_len);
+        if (json_next(lx, val) <= JSON_TOK_END) return -1;
+        if (match) return 1;
+        const char *s;
+        size_t n;
+        if (json_value_span(lx, val, &s, &n) != 0) return -1;
+    }
+}
+
+/* ---- Writer ---- */
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int failed;              /* an allocation failed; the contents are incomplete */
+} json_buf;
+
+#define JSON_BUF_INIT { NULL, 0, 0, 0 }
+
+/* Append len bytes, keeping data NUL-terminated; returns -1 on failure */
+JSON_API int json_buf_append(json_buf *b, const void *data, size_t len) {
+    if (b->failed) return -1;
+    if (b->len + len + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len + 1) cap *= 2;
+        char *tmp = (char *)realloc(b->data, cap);
+        if (!tmp) {
+            b->failed = 1;
+            return -1;
+        }
+        b->data = tmp;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+    return 0;
+}
+
+JSON_API void json_buf_printf(json_buf *b, const char *fmt, ...) {
+    char small[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(small)) {
+        json_buf_append(b, small, (size_t)n);
+        return;
+    }
+    char *big = (char *)malloc((size_t)n + 1);
+    if (!big) {
+        b->failed = 1;
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(big, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    json_buf_append(b, big, (size_t)n);
+    free(big);
+}
+
+/*
+ * Append s[0..len) as a quoted JSON string. Bytes that are not valid
+ * UTF-8 become U+FFFD rather than breaking the JSON.
+ */
+JSON_API void json_buf_string(json_buf *b, const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s, *end = p + len;
+    json_buf_append(b, "\"", 1);
+    while (p < end) {
+        const unsigned char *run = p;
+        while (p < end && *p >= 0x20 && *p < 0x7F && *p != '"' && *p != '\\') p++;
+        if (p > run) json_buf_append(b, run, (size_t)(p - run));
+        if (p >= end) break;
+
+        unsigned char c = *p;
+        if (c < 0x80) {
+            char esc[8];
+            switch (c) {
+                case '"':  json_buf_append(b, "\\\"", 2); break;
+                case '\\': json_buf_append(b, "\\\\", 2); break;
+                case '\n': json_buf_append(b, "\\n", 2); break;
+                case '\r': json_buf_append(b, "\\r", 2); break;
+                case '\t': json_buf_append(b, "\\t", 2); break;
+                default:
+                    snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    json_buf_append(b, esc, 6);
+            }
+            p++;
+            continue;
+        }
+        size_t n = c >= 0xC2 && c <= 0xDF ? 2 : c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 0;
+        int ok = n > 0 && (size_t)(end - p) >= n;
+        for (size_t k = 1; ok && k < n; k++) ok = (p[k] & 0xC0) == 0x80;
+        if (ok && n == 3) ok = !(c == 0xE0 && p[1] < 0xA0) && !(c == 0xED && p[1] > 0x9F);
+        if (ok && n == 4) ok = !(c == 0xF0 && p[1] < 0x90) && !(c == 0xF4 && p[1] > 0x8F);
+        if (ok) {
+            json_buf_append(b, p, n);
+            p += n;
+        } else {
+            json_buf_append(b, "\\ufffd", 6);
+            p++;
+        }
+    }
+    json_buf_append(b, "\"", 1);
+}
+
+/* Append a NUL-terminated string as a quoted JSON string */
+JSON_API void json_buf_cstring(json_buf *b, const char *s) {
+    json_buf_string(b, s, strlen(s));
+}
+
+JSON_API void json_buf_free(json_buf *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+    b->failed = 0;
+}
+
+#endif /* PORTFOLIO_JSON_H */
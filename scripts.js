@@ -10,7 +10,7 @@
 
   function loadData(callback) {
     var xhr = new XMLHttpRequest();
-    xhr.open("GET", "crissy-data.json?v=" + Date.now(), true);
+    xhr.open("GET", "crissy-data.json", true);
     xhr.onreadystatechange = function () {
       if (xhr.readyState === 4) {
         if (xhr.status === 200) {
@@ -2,19 +2,30 @@
  * serve.c - Cross-platform static file HTTP server
  * Compiles and runs on Windows, macOS, and Linux with no dependencies.
  * Serves the current directory on a configurable port and opens the browser.
+ * Connections are handled by a pool of worker threads so long-running API
+ * calls (build, deploy, deploy-check) do not block static file requests.
  *
  * Build:
- *   gcc -o serve serve.c        (macOS / Linux)
- *   cl serve.c /Fe:serve.exe    (Windows MSVC)
- *   gcc -o serve.exe serve.c -lws2_32  (Windows MinGW)
+ *   gcc -pthread -o serve serve.c      (macOS / Linux)
+ *   cl serve.c /Fe:serve.exe           (Windows MSVC)
+ *   gcc -o serve.exe serve.c -lws2_32 -lmswsock  (Windows MinGW)
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE      /* pipe2 */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <time.h>
 #include <sys/stat.h>
 
+#include "lib/json.h"
+
 /* ---- Platform Abstractions ---- */
 
 #ifdef _WIN32
@@ -26,7 +37,10 @@
   #include <windows.h>
   #include <io.h>
   #include <fcntl.h>
+  #include <process.h>
+  #include <mswsock.h>
   #pragma comment(lib, "ws2_32.lib")
+  #pragma comment(lib, "mswsock.lib")
   typedef SOCKET sock_t;
   #define CLOSESOCKET closesocket
   #define INVALID_SOCK INVALID_SOCKET
@@ -44,12 +58,67 @@
   #define PATH_SEP '\\'
   #define S_ISDIR(m) (((m) & _S_IFDIR) != 0)
   #define S_ISREG(m) (((m) & _S_IFREG) != 0)
+
+  /* Threads: Win32 primitives (Vista+) */
+  typedef HANDLE thread_t;
+  typedef CRITICAL_SECTION mutex_t;
+  typedef CONDITION_VARIABLE cond_t;
+  #define THREAD_FUNC unsigned __stdcall
+  #define THREAD_RETURN return 0
+  #define mutex_init(m)      InitializeCriticalSection(m)
+  #define mutex_lock(m)      EnterCriticalSection(m)
+  #define mutex_unlock(m)    LeaveCriticalSection(m)
+  #define cond_init(c)       InitializeConditionVariable(c)
+  #define cond_wait(c, m)    SleepConditionVariableCS(c, m, INFINITE)
+  #define cond_timedwait(c, m, ms) SleepConditionVariableCS(c, m, ms)
+  #define cond_signal(c)     WakeConditionVariable(c)
+  #define cond_broadcast(c)  WakeAllConditionVariable(c)
+  static int thread_start(thread_t *t, unsigned (__stdcall *fn)(void *), void *arg) {
+      *t = (HANDLE)_beginthreadex(NULL, 0, fn, arg, 0, NULL);
+      return *t ? 0 : -1;
+  }
+  static void thread_join(thread_t t) {
+      WaitForSingleObject(t, INFINITE);
+      CloseHandle(t);
+  }
+  /* Milliseconds from a monotonic clock, for measuring intervals */
+  static long long now_ms(void) { return (long long)GetTickCount64(); }
+  /* Microseconds from the same kind of clock, for request phase timings */
+  static long long now_us(void) {
+      static LARGE_INTEGER freq;
+      LARGE_INTEGER t;
+      if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+      QueryPerformanceCounter(&t);
+      return (long long)(t.QuadPart / freq.QuadPart * 1000000 +
+                         t.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+  }
+
+  /* Lock-free counters (see Metrics) */
+  #define counter_add(p, v) InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(v))
+  #define counter_get(p)    InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0)
+  static int counter_cas(volatile long long *p, long long expect, long long want) {
+      return InterlockedCompareExchange64((volatile LONG64 *)p, want, expect) == expect;
+  }
 #else
   #include <unistd.h>
   #include <sys/socket.h>
   #include <netinet/in.h>
   #include <arpa/inet.h>
   #include <errno.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <pthread.h>
+  #include <netinet/tcp.h>
+  #include <sys/mman.h>
+  #include <sys/wait.h>
+  #include <spawn.h>
+  #include <dirent.h>
+  #if defined(__linux__)
+    #include <sys/sendfile.h>
+    #include <sys/inotify.h>
+  #elif defined(__APPLE__)
+    #include <sys/uio.h>
+  #endif
   typedef int sock_t;
   #define CLOSESOCKET close
   #define INVALID_SOCK (-1)
@@ -69,6 +138,56 @@
       system(cmd);
   }
   #define PATH_SEP '/'
+
+  /* Threads: POSIX */
+  typedef pthread_t thread_t;
+  typedef pthread_mutex_t mutex_t;
+  typedef pthread_cond_t cond_t;
+  #define THREAD_FUNC void *
+  #define THREAD_RETURN return NULL
+  #define mutex_init(m)      pthread_mutex_init(m, NULL)
+  #define mutex_lock(m)      pthread_mutex_lock(m)
+  #define mutex_unlock(m)    pthread_mutex_unlock(m)
+  #define cond_init(c)       pthread_cond_init(c, NULL)
+  #define cond_wait(c, m)    pthread_cond_wait(c, m)
+  #define cond_signal(c)     pthread_cond_signal(c)
+  #define cond_broadcast(c)  pthread_cond_broadcast(c)
+  static int thread_start(thread_t *t, void *(*fn)(void *), void *arg) {
+      return pthread_create(t, NULL, fn, arg) == 0 ? 0 : -1;
+  }
+  static void thread_join(thread_t t) { pthread_join(t, NULL); }
+  /* Wait at most ms milliseconds; spurious and timed-out wakeups look alike */
+  static void cond_timedwait(cond_t *c, mutex_t *m, int ms) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += ms / 1000;
+      ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+      if (ts.tv_nsec >= 1000000000L) {
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(c, m, &ts);
+  }
+  /* Milliseconds from a monotonic clock, for measuring intervals */
+  static long long now_ms(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  }
+  /* Microseconds from the same clock, for request phase timings */
+  static long long now_us(void) {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  /* Lock-free counters (see Metrics) */
+  #define counter_add(p, v) __atomic_fetch_add((p), (long long)(v), __ATOMIC_RELAXED)
+  #define counter_get(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+  static int counter_cas(volatile long long *p, long long expect, long long want) {
+      return __atomic_compare_exchange_n(p, &expect, want, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  }
+  extern char **environ;
 #endif
 
 /* ---- Globals ---- */
@@ -76,6 +195,23 @@
 static volatile int running = 1;
 static sock_t server_sock = INVALID_SOCK;
 
+/* Server options (see print_usage) */
+#define DEFAULT_WORKERS 8
+#define DEFAULT_BACKLOG 128
+#define MAX_WORKERS     64
+
+static int cfg_workers = DEFAULT_WORKERS;
+static int cfg_backlog = DEFAULT_BACKLOG;
+static int cfg_compress = 1;  /* gzip text responses on the fly */
+
+/*
+ * API handlers that shell out or rewrite project files are serialized so
+ * two workers never clone into the same temp dir or write crissy-data.json
+ * while a build is reading it. Static GETs never take these locks.
+ */
+static mutex_t api_lock;    /* save, build, deploy, deploy-config */
+static mutex_t check_lock;  /* deploy-check bare repo and memo */
+
 static void handle_signal(int sig) {
     (void)sig;
     running = 0;
@@ -85,6 +221,164 @@ static void handle_signal(int sig) {
     }
 }
 
+/* ---- Metrics ---- */
+
+/*
+ * Counters behind GET /api/metrics. Every request adds to its route's
+ * totals and latency histogram, and every child process the server
+ * waits on (build, deploy, git) adds to a histogram of its own. All of
+ * it is plain relaxed atomic adds on fixed arrays, with no locks and no
+ * allocation on the request path. --no-metrics skips the clock reads as
+ * well, unless --access-log needs them.
+ *
+ * Histograms are log-linear in the HDR style: values under 8 us get a
+ * bucket each, and each power of two above that is split into 8 equal
+ * buckets, so any recorded value is known to within 12.5%. The top
+ * bucket holds everything from 2^27 us (about 134 s) up.
+ */
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_GROUPS   25
+#define HIST_BUCKETS  (HIST_GROUPS * HIST_SUB + 1)
+
+typedef struct {
+    volatile long long count;
+    volatile long long sum_us;
+    volatile long long max_us;
+    volatile long long buckets[HIST_BUCKETS];
+} histogram;
+
+enum {
+    ROUTE_STATIC, ROUTE_SAVE, ROUTE_BUILD, ROUTE_DEPLOY, ROUTE_DEPLOY_CONFIG,
+    ROUTE_DEPLOY_CHECK, ROUTE_LIVE_RELOAD, ROUTE_CACHE_STATS, ROUTE_JOBS,
+    ROUTE_METRICS, ROUTE_DATA, ROUTE_OTHER, ROUTE_COUNT
+};
+
+static const char *const route_names[ROUTE_COUNT] = {
+    "static", "save", "build", "deploy", "deploy_config", "deploy_check",
+    "live_reload", "cache_stats", "jobs", "metrics", "data", "other"
+};
+
+/* Status codes the server sends; anything else is counted as "other" */
+static const int metric_statuses[] = {
+    200, 202, 204, 206, 304, 400, 403, 404, 405, 408, 409, 412, 413, 415, 416, 431, 500,
+    502, 503
+};
+#define STATUS_COUNT ((int)(sizeof(metric_statuses) / sizeof(metric_statuses[0])) + 1)
+
+typedef struct {
+    volatile long long status[STATUS_COUNT];
+    volatile long long bytes_in;
+    volatile long long bytes_out;
+    histogram latency;
+} route_metrics;
+
+enum {
+    CHILD_BUILD, CHILD_DEPLOY, CHILD_BUILD_TOOL, CHILD_LS_REMOTE, CHILD_FETCH, CHILD_COUNT
+};
+
+static const char *const child_names[CHILD_COUNT] = {
+    "build", "deploy", "build_tool_compile", "git_ls_remote", "git_fetch"
+};
+
+typedef struct {
+    volatile long long failures;
+    histogram duration;
+} child_metrics;
+
+/* deploy-check outcomes, see Remote Deploy State */
+enum { CHECK_MEMO, CHECK_UNCHANGED, CHECK_FETCHED, CHECK_UNREACHABLE, CHECK_COUNT };
+
+static const char *const check_names[CHECK_COUNT] = {
+    "memo", "unchanged", "fetched", "unreachable"
+};
+
+static int cfg_metrics = 1;
+static FILE *access_log = NULL;    /* --access-log, NULL = off */
+static mutex_t access_log_lock;
+static time_t metrics_started;
+
+static route_metrics route_stats[ROUTE_COUNT];
+static child_metrics child_stats[CHILD_COUNT];
+static volatile long long check_stats[CHECK_COUNT];
+static volatile long long connections_accepted;
+
+/* Request timings are only taken when something will read them */
+#define METRICS_TIMING (cfg_metrics || access_log)
+
+static int hist_index(long long v) {
+    if (v < HIST_SUB) return v < 0 ? 0 : (int)v;
+    int e = HIST_SUB_BITS;              /* highest set bit */
+    while (e < 62 && (v >> (e + 1)) != 0) e++;
+    int group = e - HIST_SUB_BITS + 1;
+    if (group >= HIST_GROUPS) return HIST_BUCKETS - 1;
+    return group * HIST_SUB + (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value that no longer fits in bucket i */
+static long long hist_bucket_limit(int i) {
+    int group = i / HIST_SUB, sub = i % HIST_SUB;
+    if (group == 0) return sub + 1;
+    return (long long)(HIST_SUB + sub + 1) << (group - 1);
+}
+
+static void hist_record(histogram *h, long long us) {
+    if (us < 0) us = 0;
+    counter_add(&h->count, 1);
+    counter_add(&h->sum_us, us);
+    counter_add(&h->buckets[hist_index(us)], 1);
+    long long cur = counter_get(&h->max_us);
+    while (us > cur && !counter_cas(&h->max_us, cur, us)) cur = counter_get(&h->max_us);
+}
+
+/* Upper bound of the bucket holding quantile q (0..1), capped at the max */
+static long long hist_quantile(const histogram *h, double q) {
+    long long count = counter_get(&h->count);
+    if (count == 0) return 0;
+    long long rank = (long long)(q * (double)count + 0.5);
+    if (rank < 1) rank = 1;
+    long long seen = 0;
+    long long max = counter_get(&h->max_us);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += counter_get(&h->buckets[i]);
+        if (seen >= rank) {
+            long long v = i == HIST_BUCKETS - 1 ? max : hist_bucket_limit(i) - 1;
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+static int status_slot(int status) {
+    for (int i = 0; i < STATUS_COUNT - 1; i++) {
+        if (metric_statuses[i] == status) return i;
+    }
+    return STATUS_COUNT - 1;
+}
+
+static void metrics_request(int route, int status, long long bytes_in, long long bytes_out,
+                            long long total_us) {
+    if (!cfg_metrics) return;
+    if (route < 0 || route >= ROUTE_COUNT) route = ROUTE_OTHER;
+    route_metrics *m = &route_stats[route];
+    counter_add(&m->status[status_slot(status)], 1);
+    counter_add(&m->bytes_in, bytes_in);
+    counter_add(&m->bytes_out, bytes_out);
+    hist_record(&m->latency, total_us);
+}
+
+static void metrics_child(int kind, long long start_ms, int rc) {
+    if (!cfg_metrics) return;
+    child_metrics *m = &child_stats[kind];
+    if (rc != 0) counter_add(&m->failures, 1);
+    hist_record(&m->duration, (now_ms() - start_ms) * 1000);
+}
+
+static void metrics_check(int outcome) {
+    if (cfg_metrics) counter_add(&check_stats[outcome], 1);
+}
+
 /* ---- MIME Types ---- */
 
 typedef struct {
@@ -102,6 +396,8 @@ static const mime_entry mime_table[] = {
     { ".jpg",  "image/jpeg" },
     { ".jpeg", "image/jpeg" },
     { ".gif",  "image/gif" },
+    { ".webp", "image/webp" },
+    { ".avif", "image/avif" },
     { ".svg",  "image/svg+xml" },
     { ".ico",  "image/x-icon" },
     { ".txt",  "text/plain; charset=utf-8" },
@@ -137,184 +433,4568 @@ static int path_is_safe(const char *path) {
     return 1;
 }
 
+/* ---- Connections ---- */
+
+/*
+ * One conn_t per client connection. The receive buffer may hold more than
+ * one pipelined request; `consumed` marks where the current request (its
+ * headers plus whatever body the handler read) ends so the rest can be
+ * shifted down for the next iteration of the request loop.
+ */
+
+#define CONN_BUF_SIZE 65536
+
+typedef struct {
+    sock_t sock;
+    char buf[CONN_BUF_SIZE];
+    int len;              /* bytes currently in buf */
+    int head_len;         /* request line + headers + blank line */
+    int consumed;         /* bytes of buf belonging to the current request */
+    long body_remaining;  /* body bytes not yet read (current chunk if chunked) */
+    int body_chunked;     /* Transfer-Encoding: chunked request body */
+    int chunk_state;      /* chunked framing position, see body_read() */
+    int expect_continue;  /* client waits for "100 Continue" before the body */
+    int keep_alive;       /* keep the connection open after this response */
+    int head_only;        /* HEAD request: send headers without a body */
+    int http11;           /* client spoke HTTP/1.1 (chunked encoding allowed) */
+    int requests;         /* requests served on this connection */
+    int route;            /* ROUTE_* of the current request, for metrics */
+    int status;           /* status code sent, 0 until send_head() */
+    long long bytes_in;   /* socket bytes read while serving the request */
+    long long bytes_out;
+    long long send_us;    /* time spent in send calls (with METRICS_TIMING) */
+    long long recv_start; /* us when the request's first byte was in buf */
+} conn_t;
+
+/*
+ * Look up a request header (case-insensitive) in the raw header block.
+ * Copies the trimmed value into out and returns 1, or returns 0 if absent.
+ */
+static int find_header(const char *headers, int headers_len, const char *name,
+                       char *out, int out_len) {
+    size_t nlen = strlen(name);
+    const char *p = headers;
+    const char *end = headers + headers_len;
+
+    /* Skip the request line */
+    while (p < end && *p != '\n') p++;
+    while (p < end) {
+        p++; /* past '\n' */
+        const char *line = p;
+        while (p < end && *p != '\n') p++;
+        size_t llen = (size_t)(p - line);
+        if (llen > nlen && line[nlen] == ':') {
+            size_t k = 0;
+            while (k < nlen) {
+                char a = line[k], b = name[k];
+                if (a >= 'A' && a <= 'Z') a = (char)(a + 32);
+                if (b >= 'A' && b <= 'Z') b = (char)(b + 32);
+                if (a != b) break;
+                k++;
+            }
+            if (k == nlen) {
+                const char *v = line + nlen + 1;
+                const char *ve = line + llen;
+                while (v < ve && (*v == ' ' || *v == '\t')) v++;
+                while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ' || ve[-1] == '\t')) ve--;
+                int vlen = (int)(ve - v);
+                if (vlen >= out_len) vlen = out_len - 1;
+                memcpy(out, v, vlen);
+                out[vlen] = '\0';
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Case-insensitive check for a token in a comma-separated header value */
+static int header_has_token(const char *value, const char *token) {
+    size_t tlen = strlen(token);
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        const char *start = p;
+        while (*p && *p != ',') p++;
+        const char *e = p;
+        while (e > start && e[-1] == ' ') e--;
+        if ((size_t)(e - start) == tlen) {
+            size_t k = 0;
+            while (k < tlen) {
+                char a = start[k], b = token[k];
+                if (a >= 'A' && a <= 'Z') a = (char)(a + 32);
+                if (b >= 'A' && b <= 'Z') b = (char)(b + 32);
+                if (a != b) break;
+                k++;
+            }
+            if (k == tlen) return 1;
+        }
+    }
+    return 0;
+}
+
+/* Send len bytes; returns 0 on success, -1 if the peer went away */
+static int send_all(conn_t *conn, const char *data, long len) {
+    long sent = 0;
+    long long start = METRICS_TIMING ? now_us() : 0;
+    int rc = 0;
+    while (sent < len) {
+        long chunk = len - sent;
+        if (chunk > 8192) chunk = 8192;
+        int n = send(conn->sock, data + sent, (int)chunk, 0);
+        if (n <= 0) {
+            conn->keep_alive = 0;
+            rc = -1;
+            break;
+        }
+        sent += n;
+    }
+    conn->bytes_out += sent;
+    if (start) conn->send_us += now_us() - start;
+    return rc;
+}
+
 /* ---- Send Helpers ---- */
 
-static void send_response(sock_t client, int status, const char *status_text,
+/*
+ * Write the status line and headers. content_type may be NULL and
+ * body_len may be -1 (e.g. 304 responses carry neither). extra is an
+ * optional block of additional "Name: value\r\n" lines.
+ */
+static void send_head(conn_t *conn, int status, const char *status_text,
+                      const char *content_type, long body_len, const char *extra) {
+    char header[2048];
+    if (!conn->status) conn->status = status;
+    int hlen = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\n", status, status_text);
+    if (content_type) {
+        hlen += snprintf(header + hlen, sizeof(header) - hlen, "Content-Type: %s\r\n", content_type);
+    }
+    if (body_len >= 0) {
+        hlen += snprintf(header + hlen, sizeof(header) - hlen, "Content-Length: %ld\r\n", body_len);
+    }
+    if (extra && (size_t)hlen < sizeof(header)) {
+        hlen += snprintf(header + hlen, sizeof(header) - hlen, "%s", extra);
+    }
+    if ((size_t)hlen < sizeof(header)) {
+        hlen += snprintf(header + hlen, sizeof(header) - hlen,
+            "Connection: %s\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "\r\n",
+            conn->keep_alive ? "keep-alive" : "close");
+    }
+    if ((size_t)hlen >= sizeof(header)) hlen = (int)sizeof(header) - 1;
+    send_all(conn, header, hlen);
+}
+
+static void send_response(conn_t *conn, int status, const char *status_text,
                           const char *content_type, const char *body, long body_len) {
-    char header[1024];
-    int hlen = snprintf(header, sizeof(header),
-        "HTTP/1.1 %d %s\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %ld\r\n"
-        "Connection: close\r\n"
-        "Access-Control-Allow-Origin: *\r\n"
-        "\r\n",
-        status, status_text, content_type, body_len);
-    send(client, header, hlen, 0);
-    if (body && body_len > 0) {
-        long sent = 0;
-        while (sent < body_len) {
-            long chunk = body_len - sent;
-            if (chunk > 8192) chunk = 8192;
-            int n = send(client, body + sent, (int)chunk, 0);
-            if (n <= 0) break;
-            sent += n;
-        }
-    }
-}
-
-static void send_error(sock_t client, int status, const char *text) {
+    send_head(conn, status, status_text, content_type, body_len, NULL);
+    if (body && body_len > 0 && !conn->head_only) {
+        send_all(conn, body, body_len);
+    }
+}
+
+static void send_error(conn_t *conn, int status, const char *text) {
     char body[256];
     int blen = snprintf(body, sizeof(body),
         "<html><body><h1>%d %s</h1></body></html>", status, text);
-    send_response(client, status, text, "text/html; charset=utf-8", body, blen);
+    send_response(conn, status, text, "text/html; charset=utf-8", body, blen);
 }
 
-static void send_file(sock_t client, const char *filepath) {
-    FILE *f = fopen(filepath, "rb");
-    if (!f) {
-        send_error(client, 404, "Not Found");
-        return;
+/* Send one chunk of a chunked body; len must be > 0 (0 ends the body) */
+static int send_chunk(conn_t *conn, const char *data, size_t len) {
+    char size_line[32];
+    int n = snprintf(size_line, sizeof(size_line), "%lx\r\n", (unsigned long)len);
+    if (send_all(conn, size_line, n) != 0 ||
+        send_all(conn, data, (long)len) != 0 ||
+        send_all(conn, "\r\n", 2) != 0) {
+        return -1;
     }
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    return 0;
+}
 
-    char *buf = (char *)malloc(fsize);
-    if (!buf) {
-        fclose(f);
-        send_error(client, 500, "Internal Server Error");
-        return;
+/* ---- Streamed Responses ---- */
+
+/*
+ * Generated responses (deploy-check, job logs, metrics) are written
+ * through a body_stream rather than sized up front. Bytes collect in a
+ * json_buf and go out as one HTTP chunk whenever STREAM_CHUNK_BYTES have
+ * built up, so the head and the first part leave while the rest is still
+ * being produced. HTTP/1.0 clients get the same bytes unframed and the
+ * connection closes at the end. Once the head is out the status cannot
+ * change, so a failure part way through drops the connection instead of
+ * ending the body, and the client sees it as truncated.
+ */
+
+#define STREAM_CHUNK_BYTES (16 * 1024)
+
+typedef struct {
+    conn_t *conn;
+    json_buf buf;            /* writers append here, then call stream_check() */
+    int chunked;
+    int failed;
+} body_stream;
+
+static void stream_begin(body_stream *s, conn_t *conn, const char *content_type) {
+    s->conn = conn;
+    s->buf.data = NULL;
+    s->buf.len = s->buf.cap = 0;
+    s->buf.failed = 0;
+    s->chunked = conn->http11;
+    s->failed = 0;
+    if (!s->chunked) conn->keep_alive = 0;
+    send_head(conn, 200, "OK", content_type, -1,
+              s->chunked ? "Transfer-Encoding: chunked\r\n" : NULL);
+}
+
+/* Send whatever is buffered */
+static void stream_flush(body_stream *s) {
+    if (s->buf.failed) s->failed = 1;
+    if (s->buf.len > 0 && !s->failed && !s->conn->head_only) {
+        int rc = s->chunked ? send_chunk(s->conn, s->buf.data, s->buf.len)
+                            : send_all(s->conn, s->buf.data, (long)s->buf.len);
+        if (rc != 0) s->failed = 1;
+    }
+    s->buf.len = 0;
+}
+
+/* Send the buffer once a chunk's worth has built up */
+static void stream_check(body_stream *s) {
+    if (s->buf.len >= STREAM_CHUNK_BYTES || s->buf.failed) stream_flush(s);
+}
+
+static void stream_write(body_stream *s, const void *data, size_t len) {
+    json_buf_append(&s->buf, data, len);
+    stream_check(s);
+}
+
+/* Finish the body; returns 0 if all of it was sent */
+static int stream_end(body_stream *s) {
+    stream_flush(s);
+    if (s->chunked && !s->failed && !s->conn->head_only &&
+        send_all(s->conn, "0\r\n\r\n", 5) != 0) {
+        s->failed = 1;
+    }
+    if (s->failed) s->conn->keep_alive = 0;
+    json_buf_free(&s->buf);
+    return s->failed ? -1 : 0;
+}
+
+/* ---- Deflate / Gzip Encoder ---- */
+
+/*
+ * A small streaming gzip encoder (RFC 1951/1952) so text responses can be
+ * compressed without zlib. LZ77 uses hash chains over a 32 KB window;
+ * every block is written with dynamic Huffman codes, which is what makes
+ * base64-heavy files (6 bits of entropy per 8-bit character) shrink.
+ * Compressed bytes are handed to an emit callback as the buffer fills.
+ */
+
+#define DZ_WSIZE      32768
+#define DZ_WMASK      (DZ_WSIZE - 1)
+#define DZ_HASH_BITS  15
+#define DZ_HASH_SIZE  (1 << DZ_HASH_BITS)
+#define DZ_MIN_MATCH  3
+#define DZ_MAX_MATCH  258
+#define DZ_LOOKAHEAD  (DZ_MAX_MATCH + DZ_MIN_MATCH + 1)
+#define DZ_MAX_CHAIN  48
+#define DZ_GOOD_MATCH 64
+#define DZ_BLOCK_SYMS 16384
+#define DZ_OUT_SIZE   65536
+
+typedef void (*dz_emit_fn)(void *ctx, const unsigned char *data, size_t len);
+
+typedef struct {
+    unsigned char window[2 * DZ_WSIZE];
+    int head[DZ_HASH_SIZE];
+    int prev[DZ_WSIZE];
+    long win_len;                        /* valid bytes in window */
+    long pos;                            /* next byte to encode */
+    unsigned short sym_lit[DZ_BLOCK_SYMS];  /* literal byte or match length */
+    unsigned short sym_dist[DZ_BLOCK_SYMS]; /* match distance, 0 for literals */
+    int nsyms;
+    unsigned long bitbuf;
+    int bitcount;
+    unsigned char out[DZ_OUT_SIZE];
+    size_t out_len;
+    unsigned long crc;
+    unsigned long total_in;
+    dz_emit_fn emit;
+    void *ctx;
+} dz_stream;
+
+static const unsigned short dz_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char dz_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dz_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char dz_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char dz_clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static unsigned long crc_table[256];
+
+/* Called once from main() before any worker starts */
+static void crc32_init(void) {
+    for (unsigned long n = 0; n < 256; n++) {
+        unsigned long c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static unsigned long crc32_update(unsigned long crc, const unsigned char *p, size_t len) {
+    crc ^= 0xFFFFFFFFUL;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+static int dz_len_code(int len) {
+    int i = 28;
+    while (dz_len_base[i] > len) i--;
+    return i;
+}
+
+static int dz_dist_code(int dist) {
+    int i = 29;
+    while (dz_dist_base[i] > dist) i--;
+    return i;
+}
+
+static void dz_flush_out(dz_stream *z) {
+    if (z->out_len > 0) {
+        z->emit(z->ctx, z->out, z->out_len);
+        z->out_len = 0;
+    }
+}
+
+static void dz_put_byte(dz_stream *z, unsigned char c) {
+    if (z->out_len == DZ_OUT_SIZE) dz_flush_out(z);
+    z->out[z->out_len++] = c;
+}
+
+/* Write nbits of value, least significant bit first */
+static void dz_put_bits(dz_stream *z, unsigned long value, int nbits) {
+    z->bitbuf |= value << z->bitcount;
+    z->bitcount += nbits;
+    while (z->bitcount >= 8) {
+        dz_put_byte(z, (unsigned char)(z->bitbuf & 0xFF));
+        z->bitbuf >>= 8;
+        z->bitcount -= 8;
+    }
+}
+
+/*
+ * Compute Huffman code lengths for n symbols, none longer than limit.
+ * When the optimal tree is too deep the frequencies are flattened and the
+ * tree rebuilt, which converges quickly and costs very little ratio.
+ */
+static void dz_build_lengths(const unsigned long *freq_in, int n, int limit, unsigned char *lens) {
+    unsigned long freq[288];
+    unsigned long weight[2 * 288];
+    int parent[2 * 288];
+    int alive[2 * 288];
+    for (int i = 0; i < n; i++) freq[i] = freq_in[i];
+
+    for (;;) {
+        int nodes = 0, used = 0;
+        memset(lens, 0, n);
+        for (int i = 0; i < n; i++) {
+            weight[i] = freq[i];
+            parent[i] = -1;
+            alive[i] = freq[i] > 0;
+            used += alive[i];
+        }
+        nodes = n;
+        if (used == 0) return;
+        if (used == 1) {
+            for (int i = 0; i < n; i++) if (freq[i]) lens[i] = 1;
+            return;
+        }
+        for (int remaining = used; remaining > 1; remaining--) {
+            int a = -1, b = -1;
+            for (int i = 0; i < nodes; i++) {
+                if (!alive[i]) continue;
+                if (a < 0 || weight[i] < weight[a]) { b = a; a = i; }
+                else if (b < 0 || weight[i] < weight[b]) { b = i; }
+            }
+            weight[nodes] = weight[a] + weight[b];
+            parent[nodes] = -1;
+            alive[nodes] = 1;
+            alive[a] = alive[b] = 0;
+            parent[a] = parent[b] = nodes;
+            nodes++;
+        }
+        int maxlen = 0;
+        for (int i = 0; i < n; i++) {
+            if (!freq[i]) continue;
+            int d = 0;
+            for (int p = parent[i]; p >= 0; p = parent[p]) d++;
+            lens[i] = (unsigned char)d;
+            if (d > maxlen) maxlen = d;
+        }
+        if (maxlen <= limit) return;
+        for (int i = 0; i < n; i++) if (freq[i]) freq[i] = (freq[i] >> 1) | 1;
+    }
+}
+
+/* Canonical codes from lengths, bit-reversed for LSB-first output */
+static void dz_build_codes(const unsigned char *lens, int n, unsigned short *codes) {
+    int bl_count[16] = {0};
+    int next_code[16];
+    for (int i = 0; i < n; i++) bl_count[lens[i]]++;
+    bl_count[0] = 0;
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        int len = lens[i];
+        if (!len) { codes[i] = 0; continue; }
+        int c = next_code[len]++;
+        int r = 0;
+        for (int k = 0; k < len; k++) { r = (r << 1) | (c & 1); c >>= 1; }
+        codes[i] = (unsigned short)r;
+    }
+}
+
+/* Make sure a tree has at least two codes so every decoder accepts it */
+static void dz_min_two(unsigned long *freq, int n) {
+    int used = 0;
+    for (int i = 0; i < n; i++) used += freq[i] > 0;
+    for (int i = 0; used < 2 && i < n; i++) {
+        if (!freq[i]) { freq[i] = 1; used++; }
+    }
+}
+
+/* Emit the buffered symbols as one dynamic-Huffman block */
+static void dz_flush_block(dz_stream *z, int final) {
+    unsigned long lfreq[286] = {0}, dfreq[30] = {0}, cfreq[19] = {0};
+    unsigned char llens[286], dlens[30], clens[19];
+    unsigned short lcodes[286], dcodes[30], ccodes[19];
+
+    for (int i = 0; i < z->nsyms; i++) {
+        if (z->sym_dist[i] == 0) {
+            lfreq[z->sym_lit[i]]++;
+        } else {
+            lfreq[257 + dz_len_code(z->sym_lit[i])]++;
+            dfreq[dz_dist_code(z->sym_dist[i])]++;
+        }
+    }
+    lfreq[256] = 1;
+    dz_min_two(lfreq, 286);
+    dz_min_two(dfreq, 30);
+    dz_build_lengths(lfreq, 286, 15, llens);
+    dz_build_lengths(dfreq, 30, 15, dlens);
+    dz_build_codes(llens, 286, lcodes);
+    dz_build_codes(dlens, 30, dcodes);
+
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && llens[hlit - 1] == 0) hlit--;
+    while (hdist > 1 && dlens[hdist - 1] == 0) hdist--;
+
+    /* Run-length encode the concatenated code lengths (symbols 16/17/18) */
+    unsigned char all[286 + 30];
+    unsigned char rle_sym[286 + 30];
+    unsigned char rle_extra[286 + 30];
+    int total = hlit + hdist, nrle = 0;
+    memcpy(all, llens, hlit);
+    memcpy(all + hlit, dlens, hdist);
+    for (int i = 0; i < total;) {
+        int len = all[i], run = 1;
+        while (i + run < total && all[i + run] == len) run++;
+        if (len == 0 && run >= 3) {
+            int r = run > 138 ? 138 : run;
+            if (r >= 11) { rle_sym[nrle] = 18; rle_extra[nrle++] = (unsigned char)(r - 11); }
+            else         { rle_sym[nrle] = 17; rle_extra[nrle++] = (unsigned char)(r - 3); }
+            i += r;
+        } else if (len != 0 && run >= 4) {
+            rle_sym[nrle] = (unsigned char)len; rle_extra[nrle++] = 0;
+            int r = run - 1 > 6 ? 6 : run - 1;
+            rle_sym[nrle] = 16; rle_extra[nrle++] = (unsigned char)(r - 3);
+            i += r + 1;
+        } else {
+            rle_sym[nrle] = (unsigned char)len; rle_extra[nrle++] = 0;
+            i++;
+        }
+    }
+    for (int i = 0; i < nrle; i++) cfreq[rle_sym[i]]++;
+    dz_min_two(cfreq, 19);
+    dz_build_lengths(cfreq, 19, 7, clens);
+    dz_build_codes(clens, 19, ccodes);
+    int hclen = 19;
+    while (hclen > 4 && clens[dz_clen_order[hclen - 1]] == 0) hclen--;
+
+    dz_put_bits(z, final ? 1 : 0, 1);
+    dz_put_bits(z, 2, 2);
+    dz_put_bits(z, (unsigned long)(hlit - 257), 5);
+    dz_put_bits(z, (unsigned long)(hdist - 1), 5);
+    dz_put_bits(z, (unsigned long)(hclen - 4), 4);
+    for (int i = 0; i < hclen; i++) dz_put_bits(z, clens[dz_clen_order[i]], 3);
+    for (int i = 0; i < nrle; i++) {
+        int sym = rle_sym[i];
+        dz_put_bits(z, ccodes[sym], clens[sym]);
+        if (sym == 16) dz_put_bits(z, rle_extra[i], 2);
+        else if (sym == 17) dz_put_bits(z, rle_extra[i], 3);
+        else if (sym == 18) dz_put_bits(z, rle_extra[i], 7);
+    }
+
+    for (int i = 0; i < z->nsyms; i++) {
+        int lit = z->sym_lit[i], dist = z->sym_dist[i];
+        if (dist == 0) {
+            dz_put_bits(z, lcodes[lit], llens[lit]);
+        } else {
+            int lc = dz_len_code(lit);
+            dz_put_bits(z, lcodes[257 + lc], llens[257 + lc]);
+            if (dz_len_extra[lc]) dz_put_bits(z, (unsigned long)(lit - dz_len_base[lc]), dz_len_extra[lc]);
+            int dc = dz_dist_code(dist);
+            dz_put_bits(z, dcodes[dc], dlens[dc]);
+            if (dz_dist_extra[dc]) dz_put_bits(z, (unsigned long)(dist - dz_dist_base[dc]), dz_dist_extra[dc]);
+        }
+    }
+    dz_put_bits(z, lcodes[256], llens[256]);
+    z->nsyms = 0;
+}
+
+static unsigned dz_hash(const unsigned char *p) {
+    return ((unsigned)p[0] * 506832829u ^ (unsigned)p[1] * 2654435761u ^ (unsigned)p[2]) >> 3
+           & (DZ_HASH_SIZE - 1);
+}
+
+static void dz_insert(dz_stream *z, long pos) {
+    unsigned h = dz_hash(z->window + pos);
+    z->prev[pos & DZ_WMASK] = z->head[h];
+    z->head[h] = (int)pos;
+}
+
+/* Encode window bytes up to the lookahead margin (or all of them when flushing) */
+static void dz_compress(dz_stream *z, int flush) {
+    long limit = flush ? z->win_len : z->win_len - DZ_LOOKAHEAD;
+    while (z->pos < limit) {
+        long pos = z->pos;
+        long avail = z->win_len - pos;
+        int best_len = 0, best_dist = 0;
+
+        if (avail >= DZ_MIN_MATCH) {
+            int max_len = avail < DZ_MAX_MATCH ? (int)avail : DZ_MAX_MATCH;
+            const unsigned char *cur_p = z->window + pos;
+            int cand = z->head[dz_hash(cur_p)];
+            int chain = DZ_MAX_CHAIN;
+            while (cand >= 0 && chain-- > 0) {
+                long dist = pos - cand;
+                if (dist <= 0 || dist > DZ_WSIZE) break;
+                const unsigned char *m = z->window + cand;
+                if (m[best_len] == cur_p[best_len] && m[0] == cur_p[0] && m[1] == cur_p[1]) {
+                    int len = 2;
+                    while (len < max_len && m[len] == cur_p[len]) len++;
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = (int)dist;
+                        if (len >= max_len || len >= DZ_GOOD_MATCH) break;
+                    }
+                }
+                int next = z->prev[cand & DZ_WMASK];
+                if (next >= cand) break;
+                cand = next;
+            }
+            dz_insert(z, pos);
+        }
+
+        if (best_len >= DZ_MIN_MATCH) {
+            z->sym_lit[z->nsyms] = (unsigned short)best_len;
+            z->sym_dist[z->nsyms++] = (unsigned short)best_dist;
+            for (int k = 1; k < best_len; k++) {
+                if (z->win_len - (pos + k) >= DZ_MIN_MATCH) dz_insert(z, pos + k);
+            }
+            z->pos += best_len;
+        } else {
+            z->sym_lit[z->nsyms] = z->window[pos];
+            z->sym_dist[z->nsyms++] = 0;
+            z->pos++;
+        }
+        if (z->nsyms == DZ_BLOCK_SYMS) dz_flush_block(z, 0);
+    }
+}
+
+static dz_stream *gzip_begin(dz_emit_fn emit, void *ctx) {
+    dz_stream *z = (dz_stream *)malloc(sizeof(dz_stream));
+    if (!z) return NULL;
+    z->win_len = 0;
+    z->pos = 0;
+    z->nsyms = 0;
+    z->bitbuf = 0;
+    z->bitcount = 0;
+    z->out_len = 0;
+    z->crc = 0;
+    z->total_in = 0;
+    z->emit = emit;
+    z->ctx = ctx;
+    for (int i = 0; i < DZ_HASH_SIZE; i++) z->head[i] = -1;
+    for (int i = 0; i < DZ_WSIZE; i++) z->prev[i] = -1;
+
+    static const unsigned char gz_header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255 };
+    for (int i = 0; i < 10; i++) dz_put_byte(z, gz_header[i]);
+    return z;
+}
+
+static void gzip_write(dz_stream *z, const unsigned char *data, size_t len) {
+    z->crc = crc32_update(z->crc, data, len);
+    z->total_in += (unsigned long)len;
+    while (len > 0) {
+        if (z->win_len == (long)sizeof(z->window)) {
+            /* Slide the upper half down; positions in the lower half expire */
+            memmove(z->window, z->window + DZ_WSIZE, DZ_WSIZE);
+            z->win_len -= DZ_WSIZE;
+            z->pos -= DZ_WSIZE;
+            for (int i = 0; i < DZ_HASH_SIZE; i++) {
+                z->head[i] = z->head[i] >= DZ_WSIZE ? z->head[i] - DZ_WSIZE : -1;
+            }
+            for (int i = 0; i < DZ_WSIZE; i++) {
+                z->prev[i] = z->prev[i] >= DZ_WSIZE ? z->prev[i] - DZ_WSIZE : -1;
+            }
+        }
+        size_t room = sizeof(z->window) - (size_t)z->win_len;
+        size_t n = len < room ? len : room;
+        memcpy(z->window + z->win_len, data, n);
+        z->win_len += (long)n;
+        data += n;
+        len -= n;
+        dz_compress(z, 0);
+    }
+}
+
+/* Flush the final block and gzip trailer, then free the stream */
+static void gzip_end(dz_stream *z) {
+    dz_compress(z, 1);
+    dz_flush_block(z, 1);
+    if (z->bitcount > 0) dz_put_bits(z, 0, 8 - z->bitcount);
+    for (int i = 0; i < 4; i++) dz_put_byte(z, (unsigned char)(z->crc >> (8 * i)));
+    for (int i = 0; i < 4; i++) dz_put_byte(z, (unsigned char)(z->total_in >> (8 * i)));
+    dz_flush_out(z);
+    free(z);
+}
+
+static void buf_emit(void *ctx, const unsigned char *data, size_t len) {
+    json_buf_append((json_buf *)ctx, data, len);
+}
+
+/* Compress a whole buffer into a new malloc'd gzip member; NULL on failure */
+static char *gzip_buffer(const char *data, long len, long *out_len) {
+    json_buf out = JSON_BUF_INIT;
+    dz_stream *z = gzip_begin(buf_emit, &out);
+    if (!z) return NULL;
+    gzip_write(z, (const unsigned char *)data, (size_t)len);
+    gzip_end(z);
+    *out_len = (long)out.len;
+    return out.data;
+}
+
+/* ---- Static File Cache ---- */
+
+/*
+ * Bounded LRU cache of file contents keyed by path. Each entry remembers
+ * the size and mtime it was loaded with; handle_request passes in the
+ * stat() it already did, so a changed file is reloaded on the next hit.
+ * Entries are reference counted because several workers may be sending
+ * the same file while another one evicts it.
+ */
+
+#if defined(__APPLE__)
+  #define ST_MTIME_NSEC(st) ((long)(st)->st_mtimespec.tv_nsec)
+#elif defined(_WIN32)
+  #define ST_MTIME_NSEC(st) 0L
+#else
+  #define ST_MTIME_NSEC(st) ((long)(st)->st_mtim.tv_nsec)
+#endif
+
+#define DEFAULT_CACHE_MB      64
+#define DEFAULT_CACHE_FILE_MB 8
+#define CACHE_BUCKETS         256
+#define CACHE_PATH_MAX        1024
+
+typedef struct cache_entry {
+    char path[CACHE_PATH_MAX];
+    char *data;
+    long size;
+    time_t mtime;
+    long mtime_nsec;
+    const char *mime;
+    char *gz;                      /* gzip variant, compressed on first request */
+    long gz_size;
+    int gz_state;                  /* 0 untried, 1 gz valid, 2 not worth it */
+    int refs;
+    int dead;                      /* unlinked, free when refs drops to 0 */
+    struct cache_entry *hash_next;
+    struct cache_entry *prev;      /* LRU list: head is most recent */
+    struct cache_entry *next;
+} cache_entry;
+
+static long cfg_cache_bytes = (long)DEFAULT_CACHE_MB * 1024 * 1024;
+static long cfg_cache_max_file = (long)DEFAULT_CACHE_FILE_MB * 1024 * 1024;
+
+static mutex_t cache_lock;
+static cache_entry *cache_table[CACHE_BUCKETS];
+static cache_entry *lru_head = NULL;
+static cache_entry *lru_tail = NULL;
+static long cache_used = 0;
+static long cache_entries = 0;
+static long cache_hits = 0;
+static long cache_misses = 0;
+static long cache_evictions = 0;
+
+static unsigned cache_hash(const char *path) {
+    unsigned h = 2166136261u;
+    while (*path) {
+        h ^= (unsigned char)*path++;
+        h *= 16777619u;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+static void lru_unlink(cache_entry *e) {
+    if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(cache_entry *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+static void cache_entry_free(cache_entry *e) {
+    free(e->data);
+    free(e->gz);
+    free(e);
+}
+
+/* Remove from the table and LRU list. Caller holds cache_lock. */
+static void cache_remove_locked(cache_entry *e) {
+    cache_entry **pp = &cache_table[cache_hash(e->path)];
+    while (*pp && *pp != e) pp = &(*pp)->hash_next;
+    if (*pp) *pp = e->hash_next;
+    lru_unlink(e);
+    cache_used -= e->size + e->gz_size;
+    cache_entries--;
+    if (e->refs > 0) e->dead = 1;
+    else cache_entry_free(e);
+}
+
+static cache_entry *cache_find_locked(const char *path) {
+    cache_entry *e = cache_table[cache_hash(path)];
+    while (e && strcmp(e->path, path) != 0) e = e->hash_next;
+    return e;
+}
+
+/* Drop every cached file whose path starts with prefix (e.g. after a build) */
+static void cache_invalidate_prefix(const char *prefix) {
+    size_t plen = strlen(prefix);
+    mutex_lock(&cache_lock);
+    cache_entry *e = lru_head;
+    while (e) {
+        cache_entry *next = e->next;
+        if (strncmp(e->path, prefix, plen) == 0) cache_remove_locked(e);
+        e = next;
+    }
+    mutex_unlock(&cache_lock);
+}
+
+static void cache_release(cache_entry *e) {
+    mutex_lock(&cache_lock);
+    e->refs--;
+    if (e->dead && e->refs == 0) cache_entry_free(e);
+    mutex_unlock(&cache_lock);
+}
+
+/* Read a whole file into a new buffer; returns NULL on failure */
+static char *load_file(const char *filepath, long expect_size) {
+    FILE *f = fopen(filepath, "rb");
+    if (!f) return NULL;
+    char *buf = (char *)malloc(expect_size > 0 ? expect_size : 1);
+    if (!buf) {
+        fclose(f);
+        return NULL;
+    }
+    long got = (long)fread(buf, 1, expect_size, f);
+    fclose(f);
+    if (got != expect_size) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * Return a referenced cache entry for filepath whose size/mtime match st,
+ * loading it on a miss. Returns NULL when caching is disabled, the file is
+ * over the per-file limit, or it could not be read; the caller then sends
+ * it straight from disk. Release the entry with cache_release().
+ */
+static cache_entry *cache_get(const char *filepath, const struct stat *st) {
+    if (cfg_cache_bytes <= 0 || (long)st->st_size > cfg_cache_max_file ||
+        (long)st->st_size > cfg_cache_bytes || strlen(filepath) >= CACHE_PATH_MAX) {
+        return NULL;
+    }
+
+    mutex_lock(&cache_lock);
+    cache_entry *e = cache_find_locked(filepath);
+    if (e && e->size == (long)st->st_size && e->mtime == st->st_mtime &&
+        e->mtime_nsec == ST_MTIME_NSEC(st)) {
+        e->refs++;
+        lru_unlink(e);
+        lru_push_front(e);
+        cache_hits++;
+        mutex_unlock(&cache_lock);
+        return e;
+    }
+    if (e) cache_remove_locked(e);  /* stale */
+    cache_misses++;
+    mutex_unlock(&cache_lock);
+
+    /* Load outside the lock so other workers keep serving hits */
+    long size = (long)st->st_size;
+    char *data = load_file(filepath, size);
+    if (!data) return NULL;
+
+    cache_entry *ne = (cache_entry *)calloc(1, sizeof(cache_entry));
+    if (!ne) {
+        free(data);
+        return NULL;
+    }
+    snprintf(ne->path, sizeof(ne->path), "%s", filepath);
+    ne->data = data;
+    ne->size = size;
+    ne->mtime = st->st_mtime;
+    ne->mtime_nsec = ST_MTIME_NSEC(st);
+    ne->mime = get_mime(filepath);
+    ne->refs = 1;
+
+    mutex_lock(&cache_lock);
+    /* Another worker may have loaded the same file meanwhile */
+    e = cache_find_locked(filepath);
+    if (e) cache_remove_locked(e);
+    while (cache_used + size > cfg_cache_bytes && lru_tail) {
+        cache_remove_locked(lru_tail);
+        cache_evictions++;
+    }
+    unsigned b = cache_hash(filepath);
+    ne->hash_next = cache_table[b];
+    cache_table[b] = ne;
+    lru_push_front(ne);
+    cache_used += size;
+    cache_entries++;
+    mutex_unlock(&cache_lock);
+    return ne;
+}
+
+/* Handle GET /api/cache-stats - report static file cache counters */
+static void handle_api_cache_stats(conn_t *conn) {
+    char json[512];
+    mutex_lock(&cache_lock);
+    long lookups = cache_hits + cache_misses;
+    snprintf(json, sizeof(json),
+        "{\"enabled\":%s,\"entries\":%ld,\"bytes\":%ld,\"limitBytes\":%ld,"
+        "\"maxFileBytes\":%ld,\"hits\":%ld,\"misses\":%ld,\"evictions\":%ld,"
+        "\"hitRate\":%.3f,\"compress\":%s}",
+        cfg_cache_bytes > 0 ? "true" : "false", cache_entries, cache_used,
+        cfg_cache_bytes, cfg_cache_max_file, cache_hits, cache_misses, cache_evictions,
+        lookups ? (double)cache_hits / (double)lookups : 0.0, cfg_compress ? "true" : "false");
+    mutex_unlock(&cache_lock);
+    send_response(conn, 200, "OK", "application/json; charset=utf-8",
+                  json, (long)strlen(json));
+}
+
+/* ---- Zero-Copy File Transmission ---- */
+
+/*
+ * Files that are not served from the cache (too large, cache disabled, or
+ * cache allocation failed) are streamed straight from the file descriptor:
+ * sendfile(2) on Linux and macOS, TransmitFile on Windows. Other systems,
+ * or filesystems where sendfile is not supported, fall back to mmap and
+ * finally to a fixed-size read loop. Memory use stays flat regardless of
+ * file size.
+ */
+
+#define SEND_MAX_PER_CALL (64L * 1024 * 1024)
+
+#ifdef _WIN32
+  #define file_open_ro(p) _open(p, _O_RDONLY | _O_BINARY)
+  #define file_close      _close
+#else
+  #define file_open_ro(p) open(p, O_RDONLY)
+  #define file_close      close
+#endif
+
+/* Plain read()+send() loop used when nothing better is available */
+static long send_fd_copy(conn_t *conn, int fd, long offset, long length) {
+    char chunk[65536];
+    #ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return 0;
+    #else
+    if (lseek(fd, (off_t)offset, SEEK_SET) < 0) return 0;
+    #endif
+    long sent = 0;
+    while (sent < length) {
+        long want = length - sent;
+        if (want > (long)sizeof(chunk)) want = (long)sizeof(chunk);
+        #ifdef _WIN32
+        int n = _read(fd, chunk, (unsigned)want);
+        #else
+        long n = (long)read(fd, chunk, (size_t)want);
+        #endif
+        if (n <= 0) break;
+        if (send_all(conn, chunk, n) != 0) break;
+        sent += n;
+    }
+    return sent;
+}
+
+#ifndef _WIN32
+static long send_fd_mmap(conn_t *conn, int fd, long offset, long length) {
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) page = 4096;
+    long map_off = offset - (offset % page);
+    long delta = offset - map_off;
+    void *map = mmap(NULL, (size_t)(length + delta), PROT_READ, MAP_PRIVATE, fd, (off_t)map_off);
+    if (map == MAP_FAILED) return send_fd_copy(conn, fd, offset, length);
+    #ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t)(length + delta), MADV_SEQUENTIAL);
+    #endif
+    int rc = send_all(conn, (const char *)map + delta, length);
+    munmap(map, (size_t)(length + delta));
+    return rc == 0 ? length : 0;
+}
+#endif
+
+/* Send length bytes of fd starting at offset; returns the bytes sent */
+static long send_fd_range(conn_t *conn, int fd, long offset, long length) {
+    long sent = 0;
+    if (length <= 0) return 0;
+    /* The fallbacks below go through send_all(), which does its own accounting */
+    long long start = METRICS_TIMING ? now_us() : 0;
+
+    #if defined(_WIN32)
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    while (sent < length) {
+        LARGE_INTEGER pos;
+        pos.QuadPart = offset + sent;
+        if (!SetFilePointerEx(h, pos, NULL, FILE_BEGIN)) break;
+        long want = length - sent;
+        if (want > SEND_MAX_PER_CALL) want = SEND_MAX_PER_CALL;
+        if (!TransmitFile(conn->sock, h, (DWORD)want, 0, NULL, NULL, 0)) {
+            if (sent == 0) return send_fd_copy(conn, fd, offset, length);
+            break;
+        }
+        sent += want;
+    }
+    #elif defined(__linux__)
+    off_t off = (off_t)offset;
+    while (sent < length) {
+        long want = length - sent;
+        if (want > SEND_MAX_PER_CALL) want = SEND_MAX_PER_CALL;
+        ssize_t n = sendfile(conn->sock, fd, &off, (size_t)want);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            return send_fd_mmap(conn, fd, offset, length);
+        }
+        if (n <= 0) break;
+        sent += (long)n;
+    }
+    #elif defined(__APPLE__)
+    while (sent < length) {
+        off_t len = length - sent;
+        if (len > SEND_MAX_PER_CALL) len = SEND_MAX_PER_CALL;
+        int rc = sendfile(fd, conn->sock, (off_t)(offset + sent), &len, NULL, 0);
+        sent += (long)len;
+        if (rc == -1 && errno != EINTR && errno != EAGAIN) {
+            if (sent == 0 && (errno == ENOTSUP || errno == EOPNOTSUPP || errno == ENOTSOCK)) {
+                return send_fd_mmap(conn, fd, offset, length);
+            }
+            break;
+        }
+        if (rc == 0 && len == 0) break;  /* EOF: file shrank */
+    }
+    #else
+    return send_fd_mmap(conn, fd, offset, length);
+    #endif
+
+    conn->bytes_out += sent;
+    if (start) conn->send_us += now_us() - start;
+    if (sent < length) conn->keep_alive = 0;
+    return sent;
+}
+
+/* ---- Conditional Requests ---- */
+
+/*
+ * Static files carry a strong ETag built from size and mtime plus a
+ * Last-Modified date, and are sent with "Cache-Control: no-cache" so the
+ * browser keeps its copy but revalidates on every use. A matching
+ * If-None-Match (or, without one, an If-Modified-Since that is not older
+ * than the file) gets a bodiless 304.
+ *
+ * The exception is build/assets/, where build.go writes extracted images
+ * under a name derived from their content hash. Such a URL can never
+ * point at different bytes, so it is cached for a year without revalidation.
+ */
+
+#define CACHE_CONTROL_DEFAULT "no-cache"
+#define CACHE_CONTROL_IMMUTABLE "public, max-age=31536000, immutable"
+#define ASSET_HASH_MIN 16
+
+/* True for "<...>/assets/<hex hash>.<ext>" as written by build.go. */
+static int path_is_hashed_asset(const char *filepath) {
+    const char *name = filepath + strlen(filepath);
+    while (name > filepath && name[-1] != '/' && name[-1] != '\\') name--;
+    if (name - filepath < 7) return 0;
+    const char *dir = name - 7;
+    if (strncmp(dir, "assets", 6) != 0) return 0;
+    if (dir != filepath && dir[-1] != '/' && dir[-1] != '\\') return 0;
+
+    int hex = 0;
+    while (isxdigit((unsigned char)name[hex])) hex++;
+    return hex >= ASSET_HASH_MIN && name[hex] == '.' && name[hex + 1] != '\0';
+}
+
+static void make_etag(const struct stat *st, char *out, size_t out_len) {
+    snprintf(out, out_len, "\"%lx-%lx-%lx\"",
+             (unsigned long)st->st_size, (unsigned long)st->st_mtime,
+             (unsigned long)ST_MTIME_NSEC(st));
+}
+
+static const char *const month_names[12] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+static const char *const day_names[7] = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+/* Format t as an IMF-fixdate: "Sun, 06 Nov 1994 08:49:37 GMT" */
+static void format_http_date(time_t t, char *out, size_t out_len) {
+    struct tm tmv;
+    #ifdef _WIN32
+    gmtime_s(&tmv, &t);
+    #else
+    gmtime_r(&t, &tmv);
+    #endif
+    snprintf(out, out_len, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             day_names[tmv.tm_wday], tmv.tm_mday, month_names[tmv.tm_mon],
+             tmv.tm_year + 1900, tmv.tm_hour, tmv.tm_min, tmv.tm_sec);
+}
+
+/* Days since 1970-01-01 for a proleptic Gregorian date (no timegm on Windows) */
+static long days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153L * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ * Parse the three HTTP date formats (IMF-fixdate, RFC 850, asctime).
+ * Returns 1 and sets *out on success.
+ */
+static int parse_http_date(const char *s, time_t *out) {
+    char mon[4] = {0};
+    int d = 0, y = 0, hh = 0, mm = 0, ss = 0;
+    const char *p = strchr(s, ',');
+    if (p) {
+        p++;
+        if (sscanf(p, " %d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6 &&
+            sscanf(p, " %d-%3s-%d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6) {
+            return 0;
+        }
+        if (y < 100) y += y < 70 ? 2000 : 1900;
+    } else if (sscanf(s, "%*3s %3s %d %d:%d:%d %d", mon, &d, &hh, &mm, &ss, &y) != 6) {
+        return 0;
+    }
+    int m = -1;
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(mon, month_names[i]) == 0) { m = i + 1; break; }
+    }
+    if (m < 0 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60) return 0;
+    *out = (time_t)(days_from_civil(y, m, d) * 86400L + hh * 3600L + mm * 60L + ss);
+    return 1;
+}
+
+/* Weak comparison of etag against a comma-separated If-None-Match list */
+static int etag_matches(const char *list, const char *etag) {
+    const char *p = list;
+    size_t elen = strlen(etag);
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        if (*p == '*') return 1;
+        if (p[0] == 'W' && p[1] == '/') p += 2;
+        const char *start = p;
+        if (*p == '"') {
+            p++;
+            while (*p && *p != '"') p++;
+            if (*p == '"') p++;
+        } else {
+            while (*p && *p != ',') p++;
+        }
+        if ((size_t)(p - start) == elen && strncmp(start, etag, elen) == 0) return 1;
+        while (*p && *p != ',') p++;
+    }
+    return 0;
+}
+
+/* Returns 1 if the request's validators say the client copy is current */
+static int request_not_modified(conn_t *conn, const char *etag, time_t mtime) {
+    char value[1024];
+    if (find_header(conn->buf, conn->head_len, "If-None-Match", value, sizeof(value))) {
+        return etag_matches(value, etag);
+    }
+    if (find_header(conn->buf, conn->head_len, "If-Modified-Since", value, sizeof(value))) {
+        time_t since;
+        if (parse_http_date(value, &since)) return mtime <= since;
+    }
+    return 0;
+}
+
+/* ---- Range Requests ---- */
+
+/*
+ * GET requests for static files may ask for byte ranges (RFC 7233), so an
+ * interrupted download resumes where it stopped and media can seek. One
+ * range is answered with a plain 206; several become multipart/byteranges,
+ * after overlapping and adjacent ranges are merged. Ranges always apply to
+ * the identity bytes, so a request with a Range header is not compressed.
+ * A header that cannot be parsed, or asks for more than RANGE_MAX pieces,
+ * is ignored and the whole file is sent, as the RFC allows.
+ */
+
+#define RANGE_MAX 16
+
+typedef struct {
+    long start;
+    long end;            /* inclusive */
+} byte_range;
+
+static int compare_ranges(const void *a, const void *b) {
+    long x = ((const byte_range *)a)->start, y = ((const byte_range *)b)->start;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Parse a Range value against a file of size bytes. Returns the number
+ * of satisfiable ranges stored in out, 0 to ignore the header, or -1 if
+ * every range lies past the end of the file (416).
+ */
+static int parse_range(const char *value, long size, byte_range *out) {
+    const char *p = value;
+    if ((p[0] | 0x20) != 'b' || (p[1] | 0x20) != 'y' || (p[2] | 0x20) != 't' ||
+        (p[3] | 0x20) != 'e' || (p[4] | 0x20) != 's') {
+        return 0;
+    }
+    p += 5;
+    while (*p == ' ') p++;
+    if (*p++ != '=') return 0;
+
+    int count = 0, specs = 0;
+    for (;;) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == ',') {         /* empty list elements are allowed */
+            p++;
+            continue;
+        }
+        if (*p == '\0') break;
+        if (++specs > RANGE_MAX) return 0;
+
+        long first = -1, last = -1;
+        char *e;
+        if (*p == '-') {
+            /* Suffix: the final N bytes */
+            long n = strtol(p + 1, &e, 10);
+            if (e == p + 1 || n < 0 || p[1] == '-' || p[1] == '+') return 0;
+            p = e;
+            if (n > 0 && size > 0) {
+                first = n < size ? size - n : 0;
+                last = size - 1;
+            }
+        } else {
+            if (*p < '0' || *p > '9') return 0;
+            first = strtol(p, &e, 10);
+            p = e;
+            if (*p++ != '-') return 0;
+            if (*p >= '0' && *p <= '9') {
+                last = strtol(p, &e, 10);
+                p = e;
+                if (last < first) return 0;
+            } else {
+                last = size - 1;
+            }
+            if (first >= size) first = -1;              /* unsatisfiable */
+            else if (last >= size) last = size - 1;
+        }
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != ',' && *p != '\0') return 0;
+        if (first >= 0) {
+            out[count].start = first;
+            out[count].end = last;
+            count++;
+        }
+    }
+    if (specs == 0) return 0;
+    if (count == 0) return -1;
+
+    qsort(out, count, sizeof(byte_range), compare_ranges);
+    int merged = 0;
+    for (int i = 1; i < count; i++) {
+        if (out[i].start <= out[merged].end + 1) {
+            if (out[i].end > out[merged].end) out[merged].end = out[i].end;
+        } else {
+            out[++merged] = out[i];
+        }
+    }
+    return merged + 1;
+}
+
+/*
+ * The ranges a GET asks for, or 0 for the whole file. If-Range makes the
+ * Range conditional: an entity tag must match etag exactly (weak tags
+ * never do), a date must equal the file's Last-Modified.
+ */
+static int request_ranges(conn_t *conn, const char *etag, time_t mtime, long size,
+                          byte_range *out) {
+    char value[512];
+    if (conn->head_only) return 0;
+    if (!find_header(conn->buf, conn->head_len, "Range", value, sizeof(value))) return 0;
+    char cond[256];
+    if (find_header(conn->buf, conn->head_len, "If-Range", cond, sizeof(cond))) {
+        if (cond[0] == '"') {
+            if (strcmp(cond, etag) != 0) return 0;
+        } else {
+            time_t since;
+            if (cond[0] == 'W' && cond[1] == '/') return 0;
+            if (!parse_http_date(cond, &since) || since != mtime) return 0;
+        }
+    }
+    return parse_range(value, size, out);
+}
+
+/* Send length bytes at offset from the cached copy, or else from fd */
+static int send_file_bytes(conn_t *conn, const cache_entry *e, int fd, long offset, long length) {
+    if (e) return send_all(conn, e->data + offset, length);
+    return send_fd_range(conn, fd, offset, length) == length ? 0 : -1;
+}
+
+/*
+ * The text before part i of a multipart/byteranges body ("--boundary",
+ * the part's Content-Type and Content-Range, a blank line), or the
+ * closing delimiter when i == count. Returns its length.
+ */
+static int range_part_head(char *out, size_t out_len, const char *boundary, const char *mime,
+                           const byte_range *r, int i, int count, long size) {
+    if (i == count) return snprintf(out, out_len, "\r\n--%s--\r\n", boundary);
+    return snprintf(out, out_len, "%s--%s\r\nContent-Type: %s\r\n"
+                    "Content-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                    i ? "\r\n" : "", boundary, mime, r[i].start, r[i].end, size);
+}
+
+/*
+ * Answer with the given ranges. extra holds the validator headers; the
+ * body comes from e when the file is cached, otherwise from fd.
+ */
+static void send_ranges(conn_t *conn, const char *mime, long size, const char *extra,
+                        const byte_range *r, int count, const cache_entry *e, int fd) {
+    char head[640];
+    if (count == 1) {
+        snprintf(head, sizeof(head), "%sContent-Range: bytes %ld-%ld/%ld\r\n",
+                 extra, r[0].start, r[0].end, size);
+        send_head(conn, 206, "Partial Content", mime, r[0].end - r[0].start + 1, head);
+        send_file_bytes(conn, e, fd, r[0].start, r[0].end - r[0].start + 1);
+        return;
+    }
+
+    /* The total length is known up front, so no chunking is needed */
+    static volatile long long boundary_seq;
+    char boundary[48];
+    snprintf(boundary, sizeof(boundary), "portfolio-%llx-%llx",
+             (unsigned long long)now_us(), (unsigned long long)counter_add(&boundary_seq, 1));
+    char part[384];
+    long total = 0;
+    for (int i = 0; i <= count; i++) {
+        total += range_part_head(part, sizeof(part), boundary, mime, r, i, count, size);
+        if (i < count) total += r[i].end - r[i].start + 1;
+    }
+    char type[96];
+    snprintf(type, sizeof(type), "multipart/byteranges; boundary=%s", boundary);
+    send_head(conn, 206, "Partial Content", type, total, extra);
+    for (int i = 0; i <= count; i++) {
+        int n = range_part_head(part, sizeof(part), boundary, mime, r, i, count, size);
+        if (send_all(conn, part, n) != 0) return;
+        if (i < count && send_file_bytes(conn, e, fd, r[i].start, r[i].end - r[i].start + 1) != 0) {
+            conn->keep_alive = 0;
+            return;
+        }
+    }
+}
+
+/* ---- Compression ---- */
+
+/*
+ * Text responses are offered in a compressed form when the client's
+ * Accept-Encoding allows it. Precompressed sidecars (file.br, file.gz)
+ * written by a build step win when they are at least as new as the
+ * original; otherwise gzip is produced on the fly with the encoder above.
+ * Cached files keep their gzip variant next to the plain copy so it is
+ * compressed once per mtime, uncached ones are streamed chunked.
+ */
+
+#define COMPRESS_MIN_SIZE 1024
+
+static int mime_is_compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 || strstr(mime, "javascript") != NULL ||
+           strstr(mime, "json") != NULL || strstr(mime, "xml") != NULL;
+}
+
+/*
+ * Quality value (0..1000) the Accept-Encoding header gives coding, falling
+ * back to a "*" entry. Returns 0 when the coding is absent or refused.
+ */
+static int accept_encoding_q(conn_t *conn, const char *coding) {
+    char value[512];
+    if (!find_header(conn->buf, conn->head_len, "Accept-Encoding", value, sizeof(value))) {
+        return 0;
+    }
+    size_t clen = strlen(coding);
+    int star = 0;
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        const char *name = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ') p++;
+        size_t nlen = (size_t)(p - name);
+        int q = 1000;
+        while (*p && *p != ',') {
+            if (*p == ';') {
+                p++;
+                while (*p == ' ') p++;
+                if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                    q = (int)(atof(p + 2) * 1000.0 + 0.5);
+                }
+            } else {
+                p++;
+            }
+        }
+        if (nlen == clen && strncmp(name, coding, clen) == 0) return q;
+        if (nlen == 1 && name[0] == '*') star = q;
+    }
+    return star;
+}
+
+/* Append a quoted-string suffix to an ETag: "abc" -> "abc-gz" */
+static void etag_with_suffix(const char *etag, const char *suffix, char *out, size_t out_len) {
+    size_t elen = strlen(etag);
+    snprintf(out, out_len, "%.*s-%s\"", (int)(elen > 0 ? elen - 1 : 0), etag, suffix);
+}
+
+static void file_headers(char *out, size_t out_len, const char *filepath, const char *etag,
+                         time_t mtime, const char *encoding, int vary) {
+    char modified[64];
+    format_http_date(mtime, modified, sizeof(modified));
+    int n = snprintf(out, out_len, "ETag: %s\r\nLast-Modified: %s\r\nCache-Control: %s\r\n",
+                     etag, modified,
+                     path_is_hashed_asset(filepath) ? CACHE_CONTROL_IMMUTABLE : CACHE_CONTROL_DEFAULT);
+    if (n > 0 && (size_t)n < out_len) {
+        /* Ranges are only served on the identity bytes */
+        n += encoding ? snprintf(out + n, out_len - n, "Content-Encoding: %s\r\n", encoding)
+                      : snprintf(out + n, out_len - n, "Accept-Ranges: bytes\r\n");
+    }
+    if (vary && n > 0 && (size_t)n < out_len) {
+        snprintf(out + n, out_len - n, "Vary: Accept-Encoding\r\n");
+    }
+}
+
+/*
+ * Serve filepath.br or filepath.gz if the client accepts it and the
+ * sidecar is not older than the original. Returns 1 if a response was sent.
+ */
+static int send_precompressed(conn_t *conn, const char *filepath, const struct stat *st,
+                              const char *mime) {
+    static const char *const codings[2] = { "br", "gzip" };
+    static const char *const suffixes[2] = { ".br", ".gz" };
+    int qs[2];
+    qs[0] = accept_encoding_q(conn, codings[0]);
+    qs[1] = accept_encoding_q(conn, codings[1]);
+    int order[2] = { 0, 1 };
+    if (qs[1] > qs[0]) { order[0] = 1; order[1] = 0; }
+
+    for (int k = 0; k < 2; k++) {
+        int i = order[k];
+        if (qs[i] <= 0) continue;
+        char side[1024];
+        struct stat sst;
+        if (snprintf(side, sizeof(side), "%s%s", filepath, suffixes[i]) >= (int)sizeof(side)) continue;
+        if (stat(side, &sst) != 0 || !S_ISREG(sst.st_mode) || sst.st_mtime < st->st_mtime) continue;
+
+        char etag[64], sidetag[80], extra[384];
+        make_etag(&sst, etag, sizeof(etag));
+        etag_with_suffix(etag, suffixes[i] + 1, sidetag, sizeof(sidetag));
+        file_headers(extra, sizeof(extra), filepath, sidetag, st->st_mtime, codings[i], 1);
+        if (request_not_modified(conn, sidetag, st->st_mtime)) {
+            send_head(conn, 304, "Not Modified", NULL, -1, extra);
+            return 1;
+        }
+
+        cache_entry *e = cache_get(side, &sst);
+        if (e) {
+            send_head(conn, 200, "OK", mime, e->size, extra);
+            if (!conn->head_only) send_all(conn, e->data, e->size);
+            cache_release(e);
+            return 1;
+        }
+        int fd = file_open_ro(side);
+        if (fd < 0) continue;
+        send_head(conn, 200, "OK", mime, (long)sst.st_size, extra);
+        if (!conn->head_only) send_fd_range(conn, fd, 0, (long)sst.st_size);
+        file_close(fd);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Make sure a cached entry has its gzip variant. Compression runs outside
+ * the lock; if two workers race, the first result is kept. Variants that
+ * save less than an eighth of the size are not kept (gz_state 2).
+ */
+static void cache_entry_gzip(cache_entry *e) {
+    mutex_lock(&cache_lock);
+    int state = e->gz_state;
+    mutex_unlock(&cache_lock);
+    if (state != 0) return;
+
+    long gz_len = 0;
+    char *gz = gzip_buffer(e->data, e->size, &gz_len);
+
+    mutex_lock(&cache_lock);
+    if (e->gz_state == 0 && !e->dead) {
+        if (gz && gz_len < e->size - e->size / 8) {
+            e->gz = gz;
+            e->gz_size = gz_len;
+            e->gz_state = 1;
+            cache_used += gz_len;
+            gz = NULL;
+            while (cache_used > cfg_cache_bytes && lru_tail && lru_tail != e) {
+                cache_remove_locked(lru_tail);
+                cache_evictions++;
+            }
+        } else {
+            e->gz_state = 2;
+        }
+    }
+    mutex_unlock(&cache_lock);
+    free(gz);
+}
+
+typedef struct {
+    conn_t *conn;
+    int failed;
+} chunk_writer;
+
+/* Emit callback for streamed gzip: one HTTP chunk per encoder flush */
+static void chunk_emit(void *ctx, const unsigned char *data, size_t len) {
+    chunk_writer *w = (chunk_writer *)ctx;
+    if (w->failed || len == 0) return;
+    if (send_chunk(w->conn, (const char *)data, len) != 0) w->failed = 1;
+}
+
+/* Gzip fd to the client as a chunked body; returns 0 on success */
+static int send_fd_gzip_chunked(conn_t *conn, int fd) {
+    chunk_writer w = { conn, 0 };
+    dz_stream *z = gzip_begin(chunk_emit, &w);
+    if (!z) return -1;
+    char *buf = (char *)malloc(65536);
+    if (!buf) {
+        free(z);
+        return -1;
+    }
+    int ok = 0;
+    while (!w.failed) {
+        #ifdef _WIN32
+        int n = _read(fd, buf, 65536);
+        #else
+        long n = (long)read(fd, buf, 65536);
+        #endif
+        if (n < 0) { ok = -1; break; }
+        if (n == 0) break;
+        gzip_write(z, (const unsigned char *)buf, (size_t)n);
+    }
+    gzip_end(z);
+    free(buf);
+    if (w.failed) ok = -1;
+    if (ok == 0 && send_all(conn, "0\r\n\r\n", 5) != 0) ok = -1;
+    if (ok != 0) conn->keep_alive = 0;
+    return ok;
+}
+
+static void send_file(conn_t *conn, const char *filepath, const struct stat *st) {
+    const char *mime = get_mime(filepath);
+    int vary = mime_is_compressible(mime) && (long)st->st_size >= COMPRESS_MIN_SIZE;
+    long fsize = (long)st->st_size;
+
+    char etag[64];
+    char extra[384];
+    make_etag(st, etag, sizeof(etag));
+    byte_range ranges[RANGE_MAX];
+    int nranges = request_ranges(conn, etag, st->st_mtime, fsize, ranges);
+
+    if (vary && nranges == 0 && send_precompressed(conn, filepath, st, mime)) return;
+    if (vary && nranges == 0 && cfg_compress && accept_encoding_q(conn, "gzip") > 0) {
+        char gztag[80];
+        etag_with_suffix(etag, "gz", gztag, sizeof(gztag));
+        file_headers(extra, sizeof(extra), filepath, gztag, st->st_mtime, "gzip", 1);
+        if (request_not_modified(conn, gztag, st->st_mtime)) {
+            send_head(conn, 304, "Not Modified", NULL, -1, extra);
+            return;
+        }
+        cache_entry *e = cache_get(filepath, st);
+        if (e) {
+            cache_entry_gzip(e);
+            if (e->gz_state == 1) {
+                send_head(conn, 200, "OK", e->mime, e->gz_size, extra);
+                if (!conn->head_only) send_all(conn, e->gz, e->gz_size);
+                cache_release(e);
+                return;
+            }
+            /* Did not compress well: fall through to the identity copy */
+            cache_release(e);
+        } else if (conn->http11) {
+            /* Too big for the cache: compress while streaming */
+            int fd = file_open_ro(filepath);
+            if (fd < 0) {
+                send_error(conn, 404, "Not Found");
+                return;
+            }
+            size_t used = strlen(extra);
+            snprintf(extra + used, sizeof(extra) - used, "Transfer-Encoding: chunked\r\n");
+            send_head(conn, 200, "OK", mime, -1, extra);
+            if (!conn->head_only) send_fd_gzip_chunked(conn, fd);
+            file_close(fd);
+            return;
+        }
+    }
+
+    file_headers(extra, sizeof(extra), filepath, etag, st->st_mtime, NULL, vary);
+    if (request_not_modified(conn, etag, st->st_mtime)) {
+        send_head(conn, 304, "Not Modified", NULL, -1, extra);
+        return;
+    }
+    if (nranges < 0) {
+        char head[448];
+        snprintf(head, sizeof(head), "%sContent-Range: bytes */%ld\r\n", extra, fsize);
+        send_head(conn, 416, "Range Not Satisfiable", NULL, 0, head);
+        return;
+    }
+
+    cache_entry *e = cache_get(filepath, st);
+    if (e) {
+        if (nranges > 0) {
+            send_ranges(conn, e->mime, e->size, extra, ranges, nranges, e, -1);
+        } else {
+            send_head(conn, 200, "OK", e->mime, e->size, extra);
+            if (!conn->head_only) send_all(conn, e->data, e->size);
+        }
+        cache_release(e);
+        return;
+    }
+
+    int fd = file_open_ro(filepath);
+    if (fd < 0) {
+        send_error(conn, 404, "Not Found");
+        return;
+    }
+    if (nranges > 0) {
+        send_ranges(conn, mime, fsize, extra, ranges, nranges, NULL, fd);
+        file_close(fd);
+        return;
+    }
+    send_head(conn, 200, "OK", mime, fsize, extra);
+    if (!conn->head_only) send_fd_range(conn, fd, 0, fsize);
+    file_close(fd);
+}
+
+/* ---- Remote Deploy State ---- */
+
+/*
+ * /api/deploy-check used to clone the Pages repo (about 7 MB of inlined
+ * HTML) into a temp dir on every call. Now a bare repository is kept
+ * between calls and the answer is memoized. Within --check-ttl seconds the
+ * previous result is returned without touching the network. After that,
+ * `git ls-remote` (one round trip, no objects) tells whether the remote
+ * HEAD moved, and only then is the bare repo fetched, shallow and without
+ * blobs, and its top-level file list read with `git ls-tree`. CNAME is
+ * the only blob read, and git fetches just that one on demand.
+ */
+
+#define DEFAULT_CHECK_TTL 30
+
+static int cfg_check_ttl = DEFAULT_CHECK_TTL;
+
+typedef struct {
+    char repo[1024];      /* URL the memo belongs to */
+    char head[64];        /* remote HEAD sha the file list was read at */
+    time_t checked_at;    /* last ls-remote, 0 = expired */
+    int exists;
+    char cname[256];
+    json_buf files;       /* body of a JSON array: "a","b",... */
+} remote_state;
+
+static remote_state remote_memo;   /* guarded by check_lock */
+
+#ifdef _WIN32
+  #define DEVNULL_REDIRECT " 2>nul"
+#else
+  #define DEVNULL_REDIRECT " 2>/dev/null"
+#endif
+
+/* Run a shell command, appending its stdout to out (may be NULL); returns the exit status */
+static int run_capture(const char *cmd, json_buf *out) {
+    #ifdef _WIN32
+    FILE *p = _popen(cmd, "rb");
+    #else
+    FILE *p = popen(cmd, "r");
+    #endif
+    if (!p) return -1;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), p)) > 0) {
+        if (out) json_buf_append(out, buf, n);
+    }
+    #ifdef _WIN32
+    return _pclose(p);
+    #else
+    int status = pclose(p);
+    return (status != -1 && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+    #endif
+}
+
+/* The repo URL is pasted into shell commands inside double quotes */
+static int repo_url_is_safe(const char *url) {
+    for (const char *p = url; *p; p++) {
+        if (*p == '"' || *p == '`' || *p == '$' || *p == '\n' || *p == '\r' || *p == '%') {
+            return 0;
+        }
+    }
+    return url[0] != '\0' && url[0] != '-';
+}
+
+static void remote_bare_path(char *out, size_t out_len) {
+    #ifdef _WIN32
+    const char *tmp = getenv("TEMP");
+    if (!tmp) tmp = "C:\\Temp";
+    snprintf(out, out_len, "%s\\portfolio-deploy-check.git", tmp);
+    #else
+    const char *tmp = getenv("TMPDIR");
+    if (!tmp) tmp = "/tmp";
+    snprintf(out, out_len, "%s/portfolio-deploy-check.git", tmp);
+    #endif
+}
+
+static void remote_state_clear(void) {
+    remote_memo.head[0] = '\0';
+    remote_memo.cname[0] = '\0';
+    remote_memo.files.len = 0;
+    if (remote_memo.files.data) remote_memo.files.data[0] = '\0';
+}
+
+/* Fetch HEAD into the kept bare repo and re-read the file list. Caller holds check_lock. */
+static int remote_state_fetch(const char *repo) {
+    char bare[1024];
+    char cmd[3072];
+    remote_bare_path(bare, sizeof(bare));
+
+    snprintf(cmd, sizeof(cmd), "git init --quiet --bare \"%s\"" DEVNULL_REDIRECT, bare);
+    if (run_capture(cmd, NULL) != 0) return -1;
+    snprintf(cmd, sizeof(cmd), "git --git-dir=\"%s\" config remote.origin.url \"%s\"", bare, repo);
+    run_capture(cmd, NULL);
+    snprintf(cmd, sizeof(cmd), "git --git-dir=\"%s\" config remote.origin.promisor true", bare);
+    run_capture(cmd, NULL);
+    snprintf(cmd, sizeof(cmd),
+             "git --git-dir=\"%s\" config remote.origin.partialclonefilter blob:none", bare);
+    run_capture(cmd, NULL);
+
+    /* Blobless first; older git or servers without filter support get a plain shallow fetch */
+    snprintf(cmd, sizeof(cmd),
+             "git --git-dir=\"%s\" fetch --quiet --depth 1 --filter=blob:none origin "
+             "+HEAD:refs/deploy-check/head" DEVNULL_REDIRECT, bare);
+    if (run_capture(cmd, NULL) != 0) {
+        snprintf(cmd, sizeof(cmd),
+                 "git --git-dir=\"%s\" fetch --quiet --depth 1 origin "
+                 "+HEAD:refs/deploy-check/head" DEVNULL_REDIRECT, bare);
+        if (run_capture(cmd, NULL) != 0) return -1;
+    }
+
+    json_buf names = JSON_BUF_INIT;
+    snprintf(cmd, sizeof(cmd),
+             "git --git-dir=\"%s\" ls-tree -z --name-only refs/deploy-check/head" DEVNULL_REDIRECT,
+             bare);
+    if (run_capture(cmd, &names) != 0) {
+        free(names.data);
+        return -1;
+    }
+
+    remote_state_clear();
+    int has_cname = 0;
+    for (size_t i = 0; i < names.len;) {
+        const char *name = names.data + i;
+        size_t nlen = strlen(name);
+        if (nlen > 0) {
+            if (remote_memo.files.len > 0) json_buf_append(&remote_memo.files, ",", 1);
+            json_buf_cstring(&remote_memo.files, name);
+            if (strcmp(name, "CNAME") == 0) has_cname = 1;
+        }
+        i += nlen + 1;
+    }
+    free(names.data);
+
+    if (has_cname) {
+        json_buf cname = JSON_BUF_INIT;
+        snprintf(cmd, sizeof(cmd),
+                 "git --git-dir=\"%s\" cat-file blob refs/deploy-check/head:CNAME" DEVNULL_REDIRECT,
+                 bare);
+        if (run_capture(cmd, &cname) == 0 && cname.data) {
+            size_t len = strcspn(cname.data, "\r\n");
+            if (len >= sizeof(remote_memo.cname)) len = sizeof(remote_memo.cname) - 1;
+            memcpy(remote_memo.cname, cname.data, len);
+            remote_memo.cname[len] = '\0';
+        }
+        free(cname.data);
+    }
+    return 0;
+}
+
+/* Bring remote_memo up to date for repo. Caller holds check_lock. */
+static void remote_state_refresh(const char *repo) {
+    time_t now = time(NULL);
+    int same_repo = strcmp(remote_memo.repo, repo) == 0;
+    if (same_repo && remote_memo.checked_at && now - remote_memo.checked_at < cfg_check_ttl) {
+        metrics_check(CHECK_MEMO);
+        return;
+    }
+    if (!same_repo) {
+        snprintf(remote_memo.repo, sizeof(remote_memo.repo), "%s", repo);
+        remote_state_clear();
+    }
+
+    char cmd[2048];
+    json_buf out = JSON_BUF_INIT;
+    snprintf(cmd, sizeof(cmd), "git ls-remote \"%s\" HEAD" DEVNULL_REDIRECT, repo);
+    long long start = now_ms();
+    int rc = run_capture(cmd, &out);
+    metrics_child(CHILD_LS_REMOTE, start, rc);
+    char head[64] = {0};
+    if (rc == 0 && out.data) sscanf(out.data, "%63s", head);
+    free(out.data);
+
+    remote_memo.checked_at = now;
+    remote_memo.exists = rc == 0;
+    if (rc != 0 || head[0] == '\0') {
+        /* Unreachable, or reachable but empty (no HEAD yet) */
+        metrics_check(CHECK_UNREACHABLE);
+        remote_state_clear();
+        return;
+    }
+    if (strcmp(head, remote_memo.head) == 0) {
+        metrics_check(CHECK_UNCHANGED);
+        return;
+    }
+
+    metrics_check(CHECK_FETCHED);
+    start = now_ms();
+    rc = remote_state_fetch(repo);
+    metrics_child(CHILD_FETCH, start, rc);
+    if (rc == 0) {
+        snprintf(remote_memo.head, sizeof(remote_memo.head), "%s", head);
+    } else {
+        remote_state_clear();
+        remote_memo.checked_at = 0;  /* try again on the next request */
+    }
+}
+
+/* Force the next deploy-check to ask the remote again (e.g. after a deploy) */
+static void remote_state_expire(void) {
+    mutex_lock(&check_lock);
+    remote_memo.checked_at = 0;
+    mutex_unlock(&check_lock);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ * Append the visible entries of dir to out as sorted JSON strings.
+ * Returns -1 if the directory cannot be read.
+ */
+static int list_dir_json(const char *dir, json_buf *out) {
+    char **names = NULL;
+    int count = 0, cap = 0;
+    #ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    do {
+        const char *name = fd.cFileName;
+    #else
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        const char *name = ent->d_name;
+    #endif
+        if (name[0] == '.') continue;
+        if (count == cap) {
+            int ncap = cap ? cap * 2 : 32;
+            char **tmp = (char **)realloc(names, ncap * sizeof(char *));
+            if (!tmp) break;
+            names = tmp;
+            cap = ncap;
+        }
+        names[count] = (char *)malloc(strlen(name) + 1);
+        if (!names[count]) break;
+        strcpy(names[count], name);
+        count++;
+    #ifdef _WIN32
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+    #else
+    }
+    closedir(d);
+    #endif
+
+    qsort(names, count, sizeof(char *), compare_names);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) json_buf_append(out, ",", 1);
+        json_buf_cstring(out, names[i]);
+        free(names[i]);
+    }
+    free(names);
+    return 0;
+}
+
+/* ---- Background Jobs ---- */
+
+/*
+ * Build and deploy run on a dedicated job thread instead of inside the
+ * HTTP request. POST /api/build and POST /api/deploy queue a job and
+ * answer 202 with its id right away; the child's stdout and stderr are
+ * read through a pipe into the job's log (and echoed to the terminal as
+ * before), and GET /api/jobs/<id>/events streams that log to the browser
+ * as Server-Sent Events.
+ *
+ * Jobs run one at a time in FIFO order, so a deploy queued after a build
+ * always sees that build's output. A request for a kind that already has
+ * a job waiting in the queue joins that job. If the only job of that kind
+ * is already running a single follow-up job is queued, because the
+ * running child may have read crissy-data.json before the latest save.
+ */
+
+#define JOB_HISTORY           32
+#define JOB_LOG_MAX           (1024 * 1024)
+#define SSE_CHUNK             16384
+#define SSE_HEARTBEAT_SECONDS 15
+
+enum { JOB_BUILD, JOB_DEPLOY };
+enum { JOB_QUEUED, JOB_RUNNING, JOB_SUCCEEDED, JOB_FAILED };
+
+static const char *const job_kind_names[2] = { "build", "deploy" };
+static const char *const job_state_names[4] = { "queued", "running", "succeeded", "failed" };
+
+typedef struct {
+    int id;               /* 0 = free slot */
+    int kind;
+    int state;
+    int exit_code;
+    int requests;         /* POSTs coalesced into this job */
+    char *log;            /* combined stdout/stderr, capped at JOB_LOG_MAX */
+    long log_len;
+    long log_cap;
+    int log_truncated;
+    time_t queued_at;
+    time_t started_at;
+    time_t finished_at;
+} job_t;
+
+static job_t jobs[JOB_HISTORY];
+static int job_next_id = 1;
+static mutex_t job_lock;
+static cond_t job_changed;   /* new job, new output, or a state change */
+static long live_generation = 0;  /* bumped after each successful build (see File Watcher) */
+
+/* Caller holds job_lock. Slots are reused round-robin by id. */
+static job_t *job_find_locked(int id) {
+    if (id <= 0) return NULL;
+    job_t *j = &jobs[id % JOB_HISTORY];
+    return j->id == id ? j : NULL;
+}
+
+/* Queue a job of the given kind, or join one already waiting */
+static int job_submit(int kind, int *coalesced) {
+    mutex_lock(&job_lock);
+    for (int i = 0; i < JOB_HISTORY; i++) {
+        if (jobs[i].id && jobs[i].kind == kind && jobs[i].state == JOB_QUEUED) {
+            jobs[i].requests++;
+            int id = jobs[i].id;
+            mutex_unlock(&job_lock);
+            *coalesced = 1;
+            return id;
+        }
+    }
+    int id = job_next_id++;
+    job_t *j = &jobs[id % JOB_HISTORY];
+    free(j->log);
+    memset(j, 0, sizeof(*j));
+    j->id = id;
+    j->kind = kind;
+    j->state = JOB_QUEUED;
+    j->exit_code = -1;
+    j->requests = 1;
+    j->queued_at = time(NULL);
+    cond_broadcast(&job_changed);
+    mutex_unlock(&job_lock);
+    *coalesced = 0;
+    return id;
+}
+
+/* Record child output for job id and echo it to the server terminal */
+static void job_append(int id, const char *data, long len) {
+    fwrite(data, 1, (size_t)len, stdout);
+    fflush(stdout);
+
+    mutex_lock(&job_lock);
+    job_t *j = job_find_locked(id);
+    if (j && !j->log_truncated) {
+        if (j->log_len + len > JOB_LOG_MAX) {
+            len = JOB_LOG_MAX - j->log_len;
+            j->log_truncated = 1;
+        }
+        if (j->log_len + len > j->log_cap) {
+            long cap = j->log_cap ? j->log_cap : 8192;
+            while (cap < j->log_len + len) cap *= 2;
+            char *tmp = (char *)realloc(j->log, cap);
+            if (tmp) {
+                j->log = tmp;
+                j->log_cap = cap;
+            } else {
+                len = 0;
+                j->log_truncated = 1;
+            }
+        }
+        if (len > 0) {
+            memcpy(j->log + j->log_len, data, len);
+            j->log_len += len;
+        }
+        cond_broadcast(&job_changed);
+    }
+    mutex_unlock(&job_lock);
+}
+
+/*
+ * "go run build.go" compiles the build tool from scratch on every build,
+ * which costs seconds per click. Instead the first build compiles it once
+ * into BUILD_TOOL_BIN (the same file the README's "go build" step makes,
+ * and the one the launchers build at startup) and later builds run that
+ * binary directly. It is rebuilt only when build.go is newer.
+ */
+#ifdef _WIN32
+  #define BUILD_TOOL_BIN "portfolio-build.exe"
+  #define BUILD_TOOL_RUN "portfolio-build.exe"
+#else
+  #define BUILD_TOOL_BIN "portfolio-build"
+  #define BUILD_TOOL_RUN "./portfolio-build"
+#endif
+
+/*
+ * Pick the command for a job kind. Returns NULL and sets *err to a JSON
+ * error body when the tool is missing, so the POST can fail immediately.
+ */
+static const char *const *job_command(int kind, const char **err) {
+    struct stat st;
+    #ifdef _WIN32
+    static const char *const prebuilt[] = { BUILD_TOOL_RUN, ".", NULL };
+    static const char *const go_run[] = { "go", "run", "build.go", ".", NULL };
+    static const char *const deploy[] = { "deploy\\deploy.exe", NULL };
+    if (kind == JOB_BUILD) {
+        if (stat(BUILD_TOOL_BIN, &st) == 0) return prebuilt;
+        if (stat("build.go", &st) == 0) return go_run;
+        *err = "{\"error\":\"No build tool found (portfolio-build.exe or build.go)\"}";
+        return NULL;
+    }
+    if (stat("deploy\\deploy.exe", &st) == 0) return deploy;
+    if (stat("deploy\\deploy.c", &st) == 0) {
+        *err = "{\"error\":\"deploy.exe not compiled. Run: cd deploy && cl deploy.c /Fe:deploy.exe\"}";
+    } else {
+        *err = "{\"error\":\"No deploy tool found in deploy/ directory\"}";
+    }
+    return NULL;
+    #else
+    static const char *const prebuilt[] = { BUILD_TOOL_RUN, ".", NULL };
+    static const char *const go_run[] = { "go", "run", "build.go", ".", NULL };
+    static const char *const deploy[] = { "./deploy/deploy", NULL };
+    if (kind == JOB_BUILD) {
+        if (stat(BUILD_TOOL_BIN, &st) == 0) return prebuilt;
+        if (stat("build.go", &st) == 0) return go_run;
+        *err = "{\"error\":\"No build tool found (portfolio-build or build.go)\"}";
+        return NULL;
+    }
+    if (stat("deploy/deploy", &st) == 0) return deploy;
+    if (stat("deploy/deploy.c", &st) == 0) {
+        *err = "{\"error\":\"deploy binary not compiled. Run: cd deploy && cc -O2 -o deploy deploy.c\"}";
+    } else {
+        *err = "{\"error\":\"No deploy tool found in deploy/ directory\"}";
+    }
+    return NULL;
+    #endif
+}
+
+/*
+ * Run argv with stdout and stderr on a pipe, feeding everything into the
+ * job log. Returns the exit code, or -1 if the child could not start.
+ */
+static int job_spawn(int id, const char *const *argv) {
+    #ifdef _WIN32
+    char cmdline[1024];
+    size_t pos = 0;
+    for (int i = 0; argv[i]; i++) {
+        int n = snprintf(cmdline + pos, sizeof(cmdline) - pos, "%s%s", i ? " " : "", argv[i]);
+        if (n < 0 || (size_t)n >= sizeof(cmdline) - pos) return -1;
+        pos += (size_t)n;
+    }
+
+    SECURITY_ATTRIBUTES sa;
+    sa.nLength = sizeof(sa);
+    sa.lpSecurityDescriptor = NULL;
+    sa.bInheritHandle = TRUE;
+    HANDLE rd, wr;
+    if (!CreatePipe(&rd, &wr, &sa, 0)) return -1;
+    SetHandleInformation(rd, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = wr;
+    si.hStdError = wr;
+    if (!CreateProcessA(NULL, cmdline, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi)) {
+        CloseHandle(rd);
+        CloseHandle(wr);
+        return -1;
+    }
+    CloseHandle(wr);
+
+    char buf[4096];
+    DWORD n;
+    while (ReadFile(rd, buf, sizeof(buf), &n, NULL) && n > 0) job_append(id, buf, (long)n);
+    CloseHandle(rd);
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD code = 1;
+    GetExitCodeProcess(pi.hProcess, &code);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return (int)code;
+    #else
+    /* Keep the pipe out of children that deploy-check popen()s meanwhile */
+    int fds[2];
+    #if defined(__linux__) && defined(O_CLOEXEC)
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    #else
+    /* Not atomic: a popen() between the two calls can still inherit the pipe */
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    #endif
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], 1);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], 2);
+
+    /* The job thread blocks SIGINT and the server ignores SIGPIPE; the child should not */
+    posix_spawnattr_t attr;
+    sigset_t none, defaults;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &fa, &attr, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fds[0], buf, sizeof(buf));
+        if (n > 0) job_append(id, buf, (long)n);
+        else if (n < 0 && errno == EINTR) continue;
+        else break;
+    }
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+    #endif
+}
+
+/* Compile build.go into BUILD_TOOL_BIN if it is missing or out of date */
+static void build_tool_prepare(int id) {
+    struct stat src, bin;
+    if (stat("build.go", &src) != 0) return;
+    int have_bin = stat(BUILD_TOOL_BIN, &bin) == 0;
+    if (have_bin && bin.st_mtime >= src.st_mtime) return;
+
+    static const char *const go_build[] = { "go", "build", "-o", BUILD_TOOL_BIN, "build.go", NULL };
+    const char *msg = have_bin ? "build.go changed, recompiling " BUILD_TOOL_BIN "...\n"
+                               : "Compiling build.go into " BUILD_TOOL_BIN "...\n";
+    job_append(id, msg, (long)strlen(msg));
+    long long start = now_ms();
+    int rc = job_spawn(id, go_build);
+    metrics_child(CHILD_BUILD_TOOL, start, rc);
+    if (rc != 0) {
+        msg = have_bin ? "Compile failed, using the existing " BUILD_TOOL_BIN "\n"
+                       : "Compile failed, falling back to go run\n";
+        job_append(id, msg, (long)strlen(msg));
+    }
+}
+
+static void data_flush(void);
+
+/* Job thread: run queued jobs oldest first until shutdown */
+static THREAD_FUNC job_main(void *arg) {
+    (void)arg;
+    mutex_lock(&job_lock);
+    while (running) {
+        job_t *next = NULL;
+        for (int i = 0; i < JOB_HISTORY; i++) {
+            if (jobs[i].id && jobs[i].state == JOB_QUEUED && (!next || jobs[i].id < next->id)) {
+                next = &jobs[i];
+            }
+        }
+        if (!next) {
+            cond_timedwait(&job_changed, &job_lock, 1000);
+            continue;
+        }
+        int id = next->id;
+        int kind = next->kind;
+        next->state = JOB_RUNNING;
+        next->started_at = time(NULL);
+        cond_broadcast(&job_changed);
+        mutex_unlock(&job_lock);
+
+        /* api_lock keeps saves and deploy-config writes out while the child runs */
+        mutex_lock(&api_lock);
+        data_flush();
+        if (kind == JOB_BUILD) build_tool_prepare(id);
+        const char *err = NULL;
+        const char *const *argv = job_command(kind, &err);
+        int rc = -1;
+        if (argv) {
+            long long start = now_ms();
+            rc = job_spawn(id, argv);
+            metrics_child(kind == JOB_BUILD ? CHILD_BUILD : CHILD_DEPLOY, start, rc);
+            if (rc < 0) {
+                char msg[256];
+                int n = snprintf(msg, sizeof(msg), "Failed to start %s\n", argv[0]);
+                job_append(id, msg, n);
+            }
+        } else {
+            const char *msg = "Tool not found\n";
+            job_append(id, msg, (long)strlen(msg));
+        }
+        if (kind == JOB_DEPLOY) remote_state_expire();
+        if (kind == JOB_BUILD) {
+            char prefix[8];
+            snprintf(prefix, sizeof(prefix), "build%c", PATH_SEP);
+            cache_invalidate_prefix(prefix);
+        }
+        mutex_unlock(&api_lock);
+
+        if (rc == 0) {
+            printf("%s job %d completed successfully.\n",
+                   kind == JOB_BUILD ? "Build" : "Deploy", id);
+        } else {
+            printf("%s job %d failed with exit code %d.\n",
+                   kind == JOB_BUILD ? "Build" : "Deploy", id, rc);
+        }
+
+        mutex_lock(&job_lock);
+        job_t *j = job_find_locked(id);
+        if (j) {
+            j->exit_code = rc;
+            j->state = rc == 0 ? JOB_SUCCEEDED : JOB_FAILED;
+            j->finished_at = time(NULL);
+        }
+        if (kind == JOB_BUILD && rc == 0) live_generation++;
+        cond_broadcast(&job_changed);
+    }
+    mutex_unlock(&job_lock);
+    THREAD_RETURN;
+}
+
+/* Wake the job thread and any event streams so they notice running == 0 */
+static void job_shutdown(void) {
+    mutex_lock(&job_lock);
+    cond_broadcast(&job_changed);
+    mutex_unlock(&job_lock);
+}
+
+/* Describe a job as a JSON object. Caller holds job_lock. */
+static void job_json_locked(const job_t *j, char *out, size_t out_len) {
+    char exit_code[16] = "null";
+    char error[96] = "";
+    if (j->state >= JOB_SUCCEEDED) snprintf(exit_code, sizeof(exit_code), "%d", j->exit_code);
+    if (j->state == JOB_FAILED && j->exit_code < 0) {
+        snprintf(error, sizeof(error), ",\"error\":\"%s tool could not be started\"",
+                 j->kind == JOB_BUILD ? "Build" : "Deploy");
+    } else if (j->state == JOB_FAILED) {
+        snprintf(error, sizeof(error), ",\"error\":\"%s failed with exit code %d\"",
+                 j->kind == JOB_BUILD ? "Build" : "Deploy", j->exit_code);
+    }
+    snprintf(out, out_len,
+        "{\"id\":%d,\"kind\":\"%s\",\"status\":\"%s\",\"exitCode\":%s,\"requests\":%d,"
+        "\"queuedAt\":%ld,\"startedAt\":%ld,\"finishedAt\":%ld,\"outputBytes\":%ld,"
+        "\"truncated\":%s%s}",
+        j->id, job_kind_names[j->kind], job_state_names[j->state], exit_code, j->requests,
+        (long)j->queued_at, (long)j->started_at, (long)j->finished_at, j->log_len,
+        j->log_truncated ? "true" : "false", error);
+}
+
+/* Send one SSE event; data may span lines, each becomes a "data:" field */
+static int sse_send_event(conn_t *conn, const char *event, long id,
+                          const char *data, long len) {
+    json_buf ev = JSON_BUF_INIT;
+    char line[64];
+    int ok = 0;
+    if (id >= 0) {
+        snprintf(line, sizeof(line), "id: %ld\n", id);
+        json_buf_append(&ev, line, strlen(line));
+    }
+    snprintf(line, sizeof(line), "event: %s\n", event);
+    json_buf_append(&ev, line, strlen(line));
+    long start = 0;
+    for (long i = 0; i <= len; i++) {
+        if (i == len || data[i] == '\n') {
+            long end = i;
+            if (end > start && data[end - 1] == '\r') end--;
+            json_buf_append(&ev, "data: ", 6);
+            json_buf_append(&ev, data + start, (size_t)(end - start));
+            json_buf_append(&ev, "\n", 1);
+            start = i + 1;
+        }
+    }
+    json_buf_append(&ev, "\n", 1);
+    if (!ev.data || send_all(conn, ev.data, (long)ev.len) != 0) ok = -1;
+    free(ev.data);
+    return ok;
+}
+
+/* ---- Request Bodies ---- */
+
+/*
+ * Request bodies are pulled through body_read() in pieces, so a handler
+ * can stream an upload to disk instead of holding all of it in memory.
+ * Both Content-Length and chunked transfer coding are understood. Bytes
+ * that arrived with the headers are used first; when the buffer runs dry
+ * the area after the headers is reused for the next recv(). Clients that
+ * sent "Expect: 100-continue" get their interim response the first time
+ * a handler actually asks for body bytes, so a rejected upload (413) is
+ * never transmitted.
+ */
+
+#define DEFAULT_MAX_BODY_MB 10
+
+static long cfg_max_body = (long)DEFAULT_MAX_BODY_MB * 1024 * 1024;
+
+enum { CHUNK_SIZE_LINE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_DONE };
+
+static void body_send_continue(conn_t *conn) {
+    if (conn->expect_continue) {
+        conn->expect_continue = 0;
+        send_all(conn, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    }
+}
+
+/* Make sure unread body bytes are buffered; returns how many, 0 on EOF or error */
+static int body_fill(conn_t *conn) {
+    if (conn->consumed < conn->len) return conn->len - conn->consumed;
+    body_send_continue(conn);
+    conn->len = conn->consumed = conn->head_len;
+    int n = recv(conn->sock, conn->buf + conn->len, CONN_BUF_SIZE - 1 - conn->len, 0);
+    if (n <= 0) {
+        conn->keep_alive = 0;
+        return 0;
+    }
+    conn->bytes_in += n;
+    conn->len += n;
+    conn->buf[conn->len] = '\0';
+    return n;
+}
+
+/* Read one CRLF-terminated line of chunked framing (without the CRLF) */
+static int body_read_line(conn_t *conn, char *out, int out_len) {
+    int n = 0;
+    for (;;) {
+        if (!body_fill(conn)) return -1;
+        char c = conn->buf[conn->consumed++];
+        if (c == '\n') break;
+        if (c != '\r' && n < out_len - 1) out[n++] = c;
+    }
+    out[n] = '\0';
+    return 0;
+}
+
+/*
+ * Copy up to cap body bytes into out. Returns the number copied, 0 at the
+ * end of the body, or -1 if the client went away or sent bad framing
+ * (keep_alive is cleared then, since the stream is out of sync).
+ */
+static long body_read(conn_t *conn, char *out, long cap) {
+    if (conn->body_chunked) {
+        while (conn->chunk_state != CHUNK_DATA) {
+            char line[256];
+            if (conn->chunk_state == CHUNK_DONE) return 0;
+            if (body_read_line(conn, line, sizeof(line)) != 0) return -1;
+            if (conn->chunk_state == CHUNK_DATA_END) {
+                if (line[0] != '\0') goto bad_framing;
+                conn->chunk_state = CHUNK_SIZE_LINE;
+                continue;
+            }
+            char *end;
+            long size = strtol(line, &end, 16);
+            if (end == line || size < 0) goto bad_framing;
+            if (size == 0) {
+                /* Skip trailer fields up to the blank line */
+                do {
+                    if (body_read_line(conn, line, sizeof(line)) != 0) return -1;
+                } while (line[0] != '\0');
+                conn->chunk_state = CHUNK_DONE;
+                return 0;
+            }
+            conn->body_remaining = size;
+            conn->chunk_state = CHUNK_DATA;
+        }
+    } else if (conn->body_remaining <= 0) {
+        return 0;
+    }
+
+    long avail = body_fill(conn);
+    if (avail == 0) return -1;
+    long n = conn->body_remaining;
+    if (n > avail) n = avail;
+    if (n > cap) n = cap;
+    memcpy(out, conn->buf + conn->consumed, n);
+    conn->consumed += (int)n;
+    conn->body_remaining -= n;
+    if (conn->body_chunked && conn->body_remaining == 0) conn->chunk_state = CHUNK_DATA_END;
+    return n;
+
+bad_framing:
+    conn->keep_alive = 0;
+    conn->chunk_state = CHUNK_DONE;
+    return -1;
+}
+
+/* True when the request declares more body than --max-body-mb allows */
+static int body_too_large(conn_t *conn) {
+    return !conn->body_chunked && conn->body_remaining > cfg_max_body;
+}
+
+/*
+ * Read the whole request body into memory, for the small JSON bodies of
+ * the config endpoints. Returns NULL when there is no body, it exceeds
+ * the size limit, or the client disconnected midway.
+ */
+static char *read_request_body(conn_t *conn, long *out_len) {
+    *out_len = 0;
+    if (body_too_large(conn) || (!conn->body_chunked && conn->body_remaining <= 0)) {
+        return NULL;
+    }
+
+    json_buf body = JSON_BUF_INIT;
+    char piece[8192];
+    long n;
+    while ((n = body_read(conn, piece, sizeof(piece))) > 0) {
+        if ((long)body.len + n > cfg_max_body || json_buf_append(&body, piece, (size_t)n) != 0) {
+            conn->keep_alive = 0;
+            n = -1;
+            break;
+        }
+    }
+    if (n < 0 || !body.data) {
+        free(body.data);
+        return NULL;
+    }
+    *out_len = (long)body.len;
+    return body.data;
+}
+
+/* Flush, fsync and close f; returns 0 only if all of it succeeded */
+static int file_sync_close(FILE *f) {
+    int rc = fflush(f) != 0 ? -1 : 0;
+    #ifdef _WIN32
+    if (rc == 0 && _commit(_fileno(f)) != 0) rc = -1;
+    #else
+    if (rc == 0 && fsync(fileno(f)) != 0) rc = -1;
+    #endif
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+/* Rename tmp over target and persist the directory entry; removes tmp on failure */
+static int file_replace(const char *tmp, const char *target) {
+    #ifdef _WIN32
+    if (!MoveFileExA(tmp, target, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        remove(tmp);
+        return -1;
+    }
+    #else
+    if (rename(tmp, target) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    int dfd = open(".", O_RDONLY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+    #endif
+    return 0;
+}
+
+/*
+ * Stream the request body into a temp file next to target (named in tmp)
+ * and fsync it. save_body_commit() then renames it over target, so
+ * readers see either the old or the new file and a crash mid-upload
+ * leaves the original intact. The upload needs no lock; only the
+ * rename does. Returns 0 on success, or the HTTP status to answer with.
+ */
+static int save_body_temp(conn_t *conn, const char *target, char *tmp, size_t tmp_len,
+                          long *out_len) {
+    *out_len = 0;
+    if (body_too_large(conn)) return 413;
+    if (!conn->body_chunked && conn->body_remaining <= 0) return 400;
+
+    snprintf(tmp, tmp_len, "%s.%lu.tmp", target, (unsigned long)conn->sock);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return 500;
+
+    char *piece = (char *)malloc(65536);
+    if (!piece) {
+        fclose(f);
+        remove(tmp);
+        return 500;
+    }
+    int status = 0;
+    long total = 0;
+    long n;
+    while ((n = body_read(conn, piece, 65536)) > 0) {
+        total += n;
+        if (total > cfg_max_body) {
+            status = 413;
+            conn->keep_alive = 0;
+            break;
+        }
+        if (fwrite(piece, 1, (size_t)n, f) != (size_t)n) {
+            status = 500;
+            break;
+        }
+    }
+    free(piece);
+    if (n < 0 && status == 0) status = 400;
+    if (status == 0 && total == 0) status = 400;
+
+    if (file_sync_close(f) != 0 && status == 0) status = 500;
+    if (status != 0) {
+        remove(tmp);
+        return status;
+    }
+    *out_len = total;
+    return 0;
+}
+
+static int save_body_commit(const char *tmp, const char *target) {
+    return file_replace(tmp, target) != 0 ? 500 : 0;
+}
+
+/* ---- JSON Documents ---- */
+
+/*
+ * A small JSON DOM for the data model (see Data Model). The nodes of a
+ * document live in one arena, and string and number nodes point at their
+ * raw bytes in the source text instead of decoding them. So loading the
+ * 1.8 MB data file costs one read plus a few thousand nodes, and writing
+ * it back is mostly memcpy. Edits allocate new nodes into the same arena
+ * and unlink the old ones. The garbage is dropped when the document is
+ * compacted and re-parsed into a fresh arena.
+ */
+
+#define ARENA_BLOCK     (256 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+    size_t pad;                    /* keeps the payload 16-byte aligned */
+} arena_block;
+
+typedef struct {
+    arena_block *head;
+    size_t bytes;
+} arena;
+
+static void *arena_alloc(arena *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    arena_block *b = a->head;
+    if (!b || b->cap - b->used < n) {
+        size_t cap = n > ARENA_BLOCK / 4 ? n : ARENA_BLOCK;
+        b = (arena_block *)malloc(sizeof(arena_block) + cap);
+        if (!b) return NULL;
+        b->used = 0;
+        b->cap = cap;
+        if (a->head && cap != ARENA_BLOCK) {
+            /* Oversized one-off: keep allocating from the current block */
+            b->next = a->head->next;
+            a->head->next = b;
+        } else {
+            b->next = a->head;
+            a->head = b;
+        }
+        a->bytes += cap;
+    }
+    void *p = (char *)(b + 1) + b->used;
+    b->used += n;
+    return p;
+}
+
+static void arena_free(arena *a) {
+    arena_block *b = a->head;
+    while (b) {
+        arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->bytes = 0;
+}
+
+/* A point to roll an arena back to, e.g. when a parse fails half way */
+typedef struct {
+    arena_block *head;
+    arena_block *rest;             /* head->next at the time */
+    size_t used;
+    size_t bytes;
+} arena_mark;
+
+static arena_mark arena_save(const arena *a) {
+    arena_mark m;
+    m.head = a->head;
+    m.rest = a->head ? a->head->next : NULL;
+    m.used = a->head ? a->head->used : 0;
+    m.bytes = a->bytes;
+    return m;
+}
+
+/* Free everything allocated since m. New blocks all sit in front of m.rest */
+static void arena_rewind(arena *a, const arena_mark *m) {
+    arena_block *b = a->head;
+    while (b && b != m->rest) {
+        arena_block *next = b->next;
+        if (b != m->head) free(b);
+        b = next;
+    }
+    a->head = m->head;
+    if (m->head) {
+        m->head->next = m->rest;
+        m->head->used = m->used;
+    }
+    a->bytes = m->bytes;
+}
+
+enum { JSON_NULL, JSON_FALSE, JSON_TRUE, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+typedef struct json_node json_node;
+struct json_node {
+    int type;
+    const char *text;     /* number literal, or string contents still escaped */
+    size_t len;
+    const char *key;      /* member name inside an object, still escaped */
+    size_t key_len;
+    json_node *child;     /* first element or member */
+    json_node *next;      /* next sibling */
+    size_t count;         /* number of children */
+};
+
+static json_node *json_new(arena *a, int type) {
+    json_node *n = (json_node *)arena_alloc(a, sizeof(json_node));
+    if (n) {
+        memset(n, 0, sizeof(*n));
+        n->type = type;
+    }
+    return n;
+}
+
+static const int node_types[] = {
+    [JSON_TOK_OBJECT] = JSON_OBJECT, [JSON_TOK_ARRAY] = JSON_ARRAY,
+    [JSON_TOK_STRING] = JSON_STRING, [JSON_TOK_NUMBER] = JSON_NUMBER,
+    [JSON_TOK_TRUE] = JSON_TRUE, [JSON_TOK_FALSE] = JSON_FALSE, [JSON_TOK_NULL] = JSON_NULL
+};
+
+/*
+ * Parse text[0..len) into nodes allocated from a, using the shared
+ * tokenizer (lib/json.h). The text must outlive the nodes (normally it is
+ * itself allocated from a). On failure returns NULL and points *err at a
+ * message and *err_at at the offending offset.
+ */
+static json_node *json_parse(arena *a, const char *text, size_t len,
+                             const char **err, size_t *err_at) {
+    json_lexer lx;
+    json_token t, key = { 0, NULL, 0 };
+    json_node *open[JSON_MAX_DEPTH];
+    json_node **tail[JSON_MAX_DEPTH];
+    json_node *root = NULL;
+    int depth = 0;
+    json_lexer_init(&lx, text, len);
+    for (;;) {
+        int type = json_next(&lx, &t);
+        if (type == JSON_TOK_END) return root;
+        if (type == JSON_TOK_ERROR) break;
+        if (type == JSON_TOK_KEY) {
+            key = t;
+            continue;
+        }
+        if (type == JSON_TOK_OBJECT_END || type == JSON_TOK_ARRAY_END) {
+            depth--;
+            continue;
+        }
+        json_node *n = json_new(a, node_types[type]);
+        if (!n) {
+            lx.err = "out of memory";
+            break;
+        }
+        if (type == JSON_TOK_STRING || type == JSON_TOK_NUMBER) {
+            n->text = t.text;
+            n->len = t.len;
+        }
+        if (depth > 0) {
+            json_node *parent = open[depth - 1];
+            if (parent->type == JSON_OBJECT) {
+                n->key = key.text;
+                n->key_len = key.len;
+            }
+            *tail[depth - 1] = n;
+            tail[depth - 1] = &n->next;
+            parent->count++;
+        } else {
+            root = n;
+        }
+        if (type == JSON_TOK_OBJECT || type == JSON_TOK_ARRAY) {
+            open[depth] = n;
+            tail[depth] = &n->child;
+            depth++;
+        }
+    }
+    if (err) *err = lx.err ? lx.err : "invalid JSON";
+    if (err_at) *err_at = json_lexer_offset(&lx);
+    return NULL;
+}
+
+/* Escape s[0..n) into arena memory, the inverse of json_unescape */
+static const char *json_escape_arena(arena *a, const char *s, size_t n, size_t *out_len) {
+    char *out = (char *)arena_alloc(a, n * 6 + 1);
+    if (!out) return NULL;
+    size_t o = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out[o++] = '\\';
+            out[o++] = (char)c;
+        } else if (c < 0x20) {
+            o += (size_t)snprintf(out + o, 7, "\\u%04x", c);
+        } else {
+            out[o++] = (char)c;
+        }
+    }
+    *out_len = o;
+    return out;
+}
+
+static json_node *json_member(const json_node *obj, const char *name, size_t name_len) {
+    for (json_node *m = obj->child; m; m = m->next) {
+        if (json_raw_equals(m->key, m->key_len, name, name_len)) return m;
+    }
+    return NULL;
+}
+
+/* Deep copy; the raw text stays shared, since it is never modified */
+static json_node *json_copy(arena *a, const json_node *src) {
+    json_node *n = json_new(a, src->type);
+    if (!n) return NULL;
+    n->text = src->text;
+    n->len = src->len;
+    n->key = src->key;
+    n->key_len = src->key_len;
+    n->count = src->count;
+    json_node **tail = &n->child;
+    for (const json_node *c = src->child; c; c = c->next) {
+        json_node *cc = json_copy(a, c);
+        if (!cc) return NULL;
+        *tail = cc;
+        tail = &cc->next;
+    }
+    return n;
+}
+
+static int json_equal(const json_node *x, const json_node *y);
+
+static int json_string_equal(const json_node *x, const json_node *y) {
+    if (x->len == y->len && memcmp(x->text, y->text, x->len) == 0) return 1;
+    char *buf = (char *)malloc(y->len + 1);
+    if (!buf) return 0;
+    size_t n = json_unescape(y->text, y->len, buf);
+    int eq = json_raw_equals(x->text, x->len, buf, n);
+    free(buf);
+    return eq;
+}
+
+/* Value equality as RFC 6902 "test" defines it */
+static int json_equal(const json_node *x, const json_node *y) {
+    if (x->type != y->type) return 0;
+    switch (x->type) {
+        case JSON_NUMBER: {
+            char a[64], b[64];
+            if (x->len >= sizeof(a) || y->len >= sizeof(b)) {
+                return x->len == y->len && memcmp(x->text, y->text, x->len) == 0;
+            }
+            memcpy(a, x->text, x->len);
+            a[x->len] = '\0';
+            memcpy(b, y->text, y->len);
+            b[y->len] = '\0';
+            return strtod(a, NULL) == strtod(b, NULL);
+        }
+        case JSON_STRING:
+            return json_string_equal(x, y);
+        case JSON_ARRAY: {
+            if (x->count != y->count) return 0;
+            const json_node *b = y->child;
+            for (const json_node *a2 = x->child; a2; a2 = a2->next, b = b->next) {
+                if (!json_equal(a2, b)) return 0;
+            }
+            return 1;
+        }
+        case JSON_OBJECT: {
+            if (x->count != y->count) return 0;
+            for (const json_node *m = x->child; m; m = m->next) {
+                char small[256];
+                char *name = m->key_len <= sizeof(small) ? small : (char *)malloc(m->key_len + 1);
+                if (!name) return 0;
+                size_t n = json_unescape(m->key, m->key_len, name);
+                const json_node *o = json_member(y, name, n);
+                if (name != small) free(name);
+                if (!o || !json_equal(m, o)) return 0;
+            }
+            return 1;
+        }
+        default:
+            return 1;
+    }
+}
+
+static void json_indent(json_buf *b, int depth) {
+    static const char spaces[] = "                                ";
+    size_t n = (size_t)depth * 2;
+    while (n > 0) {
+        size_t k = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        json_buf_append(b, spaces, k);
+        n -= k;
+    }
+}
+
+/* Serialize the way JSON.stringify(value, null, 2) lays it out */
+static void json_write(json_buf *b, const json_node *n, int depth) {
+    switch (n->type) {
+        case JSON_NULL:   json_buf_append(b, "null", 4); return;
+        case JSON_TRUE:   json_buf_append(b, "true", 4); return;
+        case JSON_FALSE:  json_buf_append(b, "false", 5); return;
+        case JSON_NUMBER: json_buf_append(b, n->text, n->len); return;
+        case JSON_STRING:
+            json_buf_append(b, "\"", 1);
+            json_buf_append(b, n->text, n->len);
+            json_buf_append(b, "\"", 1);
+            return;
+        default:
+            break;
+    }
+    int obj = n->type == JSON_OBJECT;
+    if (!n->child) {
+        json_buf_append(b, obj ? "{}" : "[]", 2);
+        return;
+    }
+    json_buf_append(b, obj ? "{\n" : "[\n", 2);
+    for (const json_node *c = n->child; c; c = c->next) {
+        json_indent(b, depth + 1);
+        if (obj) {
+            json_buf_append(b, "\"", 1);
+            json_buf_append(b, c->key, c->key_len);
+            json_buf_append(b, "\": ", 3);
+        }
+        json_write(b, c, depth + 1);
+        json_buf_append(b, c->next ? ",\n" : "\n", c->next ? 2 : 1);
+    }
+    json_indent(b, depth);
+    json_buf_append(b, obj ? "}" : "]", 1);
+}
+
+/* ---- JSON Patch ---- */
+
+/*
+ * RFC 6902 (JSON Patch) and RFC 7396 (JSON Merge Patch) applied to a
+ * document in place. A JSON Patch is all or nothing: every change to an
+ * existing node's links goes through the undo log, so when op 5 of 8
+ * fails the first four are rolled back before the caller sees an error.
+ * Nodes added along the way simply become arena garbage.
+ */
+
+typedef struct {
+    void **slot;          /* NULL for a count record */
+    void *old_ptr;
+    size_t *count_slot;
+    size_t old_count;
+} undo_rec;
+
+typedef struct {
+    arena *a;
+    json_node **root;
+    undo_rec *log;
+    size_t log_len;
+    size_t log_cap;
+    const char *err;      /* why the patch failed */
+    int status;           /* HTTP status for the failure: 400 malformed, 409 not applicable */
+} patch_ctx;
+
+static int undo_push(patch_ctx *pc, undo_rec r) {
+    if (pc->log_len == pc->log_cap) {
+        size_t cap = pc->log_cap ? pc->log_cap * 2 : 64;
+        undo_rec *grown = (undo_rec *)realloc(pc->log, cap * sizeof(undo_rec));
+        if (!grown) return -1;
+        pc->log = grown;
+        pc->log_cap = cap;
+    }
+    pc->log[pc->log_len++] = r;
+    return 0;
+}
+
+static int set_link(patch_ctx *pc, json_node **slot, json_node *v) {
+    undo_rec r = { (void **)slot, *slot, NULL, 0 };
+    if (undo_push(pc, r) != 0) return -1;
+    *slot = v;
+    return 0;
+}
+
+static int set_count(patch_ctx *pc, size_t *slot, size_t v) {
+    undo_rec r = { NULL, NULL, slot, *slot };
+    if (undo_push(pc, r) != 0) return -1;
+    *slot = v;
+    return 0;
+}
+
+static void undo_all(patch_ctx *pc) {
+    while (pc->log_len > 0) {
+        undo_rec *r = &pc->log[--pc->log_len];
+        if (r->slot) *r->slot = r->old_ptr;
+        else *r->count_slot = r->old_count;
+    }
+}
+
+/* Where a JSON Pointer lands: the link that points at it and its parent */
+typedef struct {
+    json_node *parent;    /* NULL for the root */
+    json_node **slot;     /* link to the target, or to where it would go */
+    json_node *node;      /* the target, NULL if it does not exist */
+    const char *name;     /* last reference token, decoded */
+    size_t name_len;
+} json_loc;
+
+static int patch_fail(patch_ctx *pc, int status, const char *err) {
+    if (!pc->err) {
+        pc->err = err;
+        pc->status = status;
+    }
+    return -1;
+}
+
+/*
+ * Resolve a decoded JSON Pointer. With for_add the final token may name a
+ * missing member, an index equal to the array length, or "-" (append).
+ * tok must have room for the pointer's length; it receives the decoded
+ * last token that loc->name points at.
+ */
+static int json_locate(patch_ctx *pc, const char *ptr, size_t len, int for_add,
+                       json_loc *loc, char *tok) {
+    loc->parent = NULL;
+    loc->slot = pc->root;
+    loc->node = *pc->root;
+    loc->name = "";
+    loc->name_len = 0;
+    if (len == 0) return 0;
+    if (ptr[0] != '/') return patch_fail(pc, 400, "JSON Pointer must start with '/'");
+
+    size_t i = 1;
+    for (;;) {
+        /* Decode one reference token: ~1 is '/', ~0 is '~' */
+        size_t n = 0;
+        while (i < len && ptr[i] != '/') {
+            if (ptr[i] == '~') {
+                if (i + 1 >= len || (ptr[i + 1] != '0' && ptr[i + 1] != '1')) {
+                    return patch_fail(pc, 400, "bad '~' escape in JSON Pointer");
+                }
+                tok[n++] = ptr[i + 1] == '0' ? '~' : '/';
+                i += 2;
+            } else {
+                tok[n++] = ptr[i++];
+            }
+        }
+        int last = i >= len;
+        json_node *cur = loc->node;
+        if (!cur || (cur->type != JSON_OBJECT && cur->type != JSON_ARRAY)) {
+            return patch_fail(pc, 409, "path does not exist");
+        }
+        loc->parent = cur;
+        loc->name = tok;
+        loc->name_len = n;
+        if (cur->type == JSON_OBJECT) {
+            json_node **slot = &cur->child;
+            while (*slot && !json_raw_equals((*slot)->key, (*slot)->key_len, tok, n)) {
+                slot = &(*slot)->next;
+            }
+            loc->slot = slot;
+            loc->node = *slot;
+        } else {
+            size_t index = 0;
+            int append = n == 1 && tok[0] == '-';
+            if (!append) {
+                if (n == 0 || (n > 1 && tok[0] == '0')) return patch_fail(pc, 409, "bad array index");
+                for (size_t k = 0; k < n; k++) {
+                    if (tok[k] < '0' || tok[k] > '9' || index > cur->count) {
+                        return patch_fail(pc, 409, "bad array index");
+                    }
+                    index = index * 10 + (size_t)(tok[k] - '0');
+                }
+            } else {
+                index = cur->count;
+            }
+            if (index > cur->count || (index == cur->count && !(for_add && last))) {
+                return patch_fail(pc, 409, "array index out of range");
+            }
+            json_node **slot = &cur->child;
+            for (size_t k = 0; k < index; k++) slot = &(*slot)->next;
+            loc->slot = slot;
+            loc->node = *slot;
+        }
+        if (last) break;
+        if (!loc->node) return patch_fail(pc, 409, "path does not exist");
+        i++;  /* past '/' */
+    }
+    if (!loc->node && !for_add) return patch_fail(pc, 409, "path does not exist");
+    return 0;
+}
+
+/* Give a fresh node the key it needs at loc */
+static int loc_key(patch_ctx *pc, const json_loc *loc, json_node *v) {
+    v->key = NULL;
+    v->key_len = 0;
+    if (loc->parent && loc->parent->type == JSON_OBJECT) {
+        v->key = json_escape_arena(pc->a, loc->name, loc->name_len, &v->key_len);
+        if (!v->key) return patch_fail(pc, 500, "out of memory");
+    }
+    return 0;
+}
+
+/*
+ * Put fresh node v at loc: replaces an existing member or element, or
+ * inserts a new one (array inserts shift the rest right).
+ */
+static int loc_put(patch_ctx *pc, const json_loc *loc, json_node *v, int insert) {
+    if (loc_key(pc, loc, v) != 0) return -1;
+    if (!loc->parent) return set_link(pc, loc->slot, v);
+    if (loc->node && !insert) {
+        v->next = loc->node->next;
+        return set_link(pc, loc->slot, v);
+    }
+    v->next = *loc->slot;
+    if (set_link(pc, loc->slot, v) != 0) return -1;
+    return set_count(pc, &loc->parent->count, loc->parent->count + 1);
+}
+
+static int loc_remove(patch_ctx *pc, const json_loc *loc) {
+    if (!loc->parent) return patch_fail(pc, 409, "cannot remove the whole document");
+    if (set_link(pc, loc->slot, loc->node->next) != 0) return -1;
+    return set_count(pc, &loc->parent->count, loc->parent->count - 1);
+}
+
+/* A decoded copy of a string member of a patch operation, in arena memory */
+static char *op_string(patch_ctx *pc, const json_node *op, const char *name, size_t *out_len) {
+    json_node *m = json_member(op, name, strlen(name));
+    if (!m || m->type != JSON_STRING) return NULL;
+    char *s = (char *)arena_alloc(pc->a, m->len + 1);
+    if (!s) return NULL;
+    *out_len = json_unescape(m->text, m->len, s);
+    s[*out_len] = '\0';
+    return s;
+}
+
+static int patch_op(patch_ctx *pc, const json_node *op) {
+    if (op->type != JSON_OBJECT) return patch_fail(pc, 400, "operation is not an object");
+    size_t op_len = 0, path_len = 0, from_len = 0;
+    char *name = op_string(pc, op, "op", &op_len);
+    char *path = op_string(pc, op, "path", &path_len);
+    if (!name) return patch_fail(pc, 400, "operation has no \"op\"");
+    if (!path) return patch_fail(pc, 400, "operation has no \"path\"");
+
+    char *tok = (char *)arena_alloc(pc->a, path_len + 1);
+    if (!tok) return patch_fail(pc, 500, "out of memory");
+    json_node *value = json_member(op, "value", 5);
+    json_loc loc;
+
+    if (strcmp(name, "add") == 0 || strcmp(name, "replace") == 0 || strcmp(name, "test") == 0) {
+        if (!value) return patch_fail(pc, 400, "operation has no \"value\"");
+        int add = name[0] == 'a';
+        if (json_locate(pc, path, path_len, add, &loc, tok) != 0) return -1;
+        if (name[0] == 't') {
+            return json_equal(loc.node, value) ? 0 : patch_fail(pc, 409, "test failed");
+        }
+        json_node *v = json_copy(pc->a, value);
+        if (!v) return patch_fail(pc, 500, "out of memory");
+        int insert = add && loc.parent && loc.parent->type == JSON_ARRAY;
+        return loc_put(pc, &loc, v, insert);
+    }
+    if (strcmp(name, "remove") == 0) {
+        if (json_locate(pc, path, path_len, 0, &loc, tok) != 0) return -1;
+        return loc_remove(pc, &loc);
+    }
+    if (strcmp(name, "move") == 0 || strcmp(name, "copy") == 0) {
+        char *from = op_string(pc, op, "from", &from_len);
+        if (!from) return patch_fail(pc, 400, "operation has no \"from\"");
+        char *from_tok = (char *)arena_alloc(pc->a, from_len + 1);
+        if (!from_tok) return patch_fail(pc, 500, "out of memory");
+        json_loc src;
+        if (json_locate(pc, from, from_len, 0, &src, from_tok) != 0) return -1;
+        int move = name[0] == 'm';
+        if (move) {
+            if (path_len > from_len && memcmp(path, from, from_len) == 0 && path[from_len] == '/') {
+                return patch_fail(pc, 409, "cannot move a value into itself");
+            }
+            if (path_len == from_len && memcmp(path, from, from_len) == 0) return 0;
+        }
+        json_node *v = move ? json_new(pc->a, src.node->type) : json_copy(pc->a, src.node);
+        if (!v) return patch_fail(pc, 500, "out of memory");
+        if (move) {
+            /* A moved node keeps its children; only the wrapper is new */
+            v->text = src.node->text;
+            v->len = src.node->len;
+            v->child = src.node->child;
+            v->count = src.node->count;
+            if (loc_remove(pc, &src) != 0) return -1;
+        }
+        if (json_locate(pc, path, path_len, 1, &loc, tok) != 0) return -1;
+        int insert = loc.parent && loc.parent->type == JSON_ARRAY;
+        return loc_put(pc, &loc, v, insert);
+    }
+    return patch_fail(pc, 400, "unknown \"op\"");
+}
+
+/* RFC 7396: merge patch into the value at loc (which may not exist yet) */
+static int merge_at(patch_ctx *pc, json_loc *loc, const json_node *patch, int depth) {
+    if (patch->type != JSON_OBJECT) {
+        json_node *v = json_copy(pc->a, patch);
+        if (!v) return patch_fail(pc, 500, "out of memory");
+        return loc_put(pc, loc, v, 0);
+    }
+    if (depth > JSON_MAX_DEPTH) return patch_fail(pc, 400, "patch nested too deeply");
+    json_node *target = loc->node;
+    if (!target || target->type != JSON_OBJECT) {
+        target = json_new(pc->a, JSON_OBJECT);
+        if (!target) return patch_fail(pc, 500, "out of memory");
+        if (loc_put(pc, loc, target, 0) != 0) return -1;
+    }
+    for (const json_node *m = patch->child; m; m = m->next) {
+        char *name = (char *)arena_alloc(pc->a, m->key_len + 1);
+        if (!name) return patch_fail(pc, 500, "out of memory");
+        json_loc sub;
+        sub.parent = target;
+        sub.name = name;
+        sub.name_len = json_unescape(m->key, m->key_len, name);
+        sub.slot = &target->child;
+        while (*sub.slot && !json_raw_equals((*sub.slot)->key, (*sub.slot)->key_len,
+                                              name, sub.name_len)) {
+            sub.slot = &(*sub.slot)->next;
+        }
+        sub.node = *sub.slot;
+        if (m->type == JSON_NULL) {
+            if (sub.node && loc_remove(pc, &sub) != 0) return -1;
+            continue;
+        }
+        if (merge_at(pc, &sub, m, depth + 1) != 0) return -1;
+    }
+    return 0;
+}
+
+enum { PATCH_JSON, PATCH_MERGE };
+
+/*
+ * Apply a patch document (already parsed into the document's arena).
+ * Returns the number of operations applied, or -1 with pc->err set and
+ * the document unchanged. On success the changes can still be taken
+ * back with patch_rollback() until patch_release() drops the undo log.
+ */
+static int json_apply_patch(patch_ctx *pc, int kind, const json_node *patch) {
+    int ops = 0;
+    if (kind == PATCH_MERGE) {
+        json_loc loc = { NULL, pc->root, *pc->root, "", 0 };
+        ops = merge_at(pc, &loc, patch, 0) == 0 ? 1 : -1;
+    } else if (patch->type != JSON_ARRAY) {
+        patch_fail(pc, 400, "a JSON Patch must be an array of operations");
+        ops = -1;
+    } else {
+        for (const json_node *op = patch->child; op; op = op->next) {
+            if (patch_op(pc, op) != 0) {
+                ops = -1;
+                break;
+            }
+            ops++;
+        }
+    }
+    if (ops < 0) undo_all(pc);
+    return ops;
+}
+
+static void patch_rollback(patch_ctx *pc) {
+    undo_all(pc);
+}
+
+static void patch_release(patch_ctx *pc) {
+    free(pc->log);
+    pc->log = NULL;
+    pc->log_len = pc->log_cap = 0;
+}
+
+/* ---- Data Model ---- */
+
+/*
+ * crissy-data.json is kept parsed in memory (see JSON Documents) so the
+ * manager can send just its edits: PATCH /api/data takes an RFC 6902
+ * JSON Patch or an RFC 7396 merge patch and applies it to the in-memory
+ * tree. Before the reply goes out, the patch body is appended to
+ * crissy-data.json.wal and fsynced. A small edit costs a small upload and
+ * one append, no matter how big the document is.
+ *
+ * A background thread folds the log back into the file once edits have
+ * gone quiet for DATA_COMPACT_IDLE_MS, or after DATA_COMPACT_MAX_MS under
+ * a steady stream of edits, or when the log passes DATA_WAL_MAX. It
+ * serializes the tree the way the manager does (JSON.stringify with a
+ * two-space indent), renames it over the file, deletes the log and
+ * re-parses into a fresh arena so the garbage left by edits goes away.
+ * Builds and deploys flush pending edits first, so build.go always reads
+ * a current file. While edits are pending, GET /crissy-data.json is
+ * answered from memory as well.
+ *
+ * The log header records the size and FNV-1a hash of the file it applies
+ * to. At startup a log whose base matches is replayed and compacted. A
+ * log that does not match was either already compacted (the server
+ * stopped between the rename and the delete) or belongs to a file that
+ * was replaced since. Either way it is moved aside as .wal.stale and not
+ * applied.
+ *
+ * POST /api/save still replaces the whole file. Any pending edits are
+ * dropped along with the log, since the upload is the newer document.
+ */
+
+#define DATA_FILE            "crissy-data.json"
+#define DATA_WAL             "crissy-data.json.wal"
+#define DATA_WAL_STALE       "crissy-data.json.wal.stale"
+#define DATA_WAL_MAGIC       "crissy-data-wal 1"
+#define DATA_COMPACT_IDLE_MS 1000
+#define DATA_COMPACT_MAX_MS  10000
+#define DATA_WAL_MAX         (4L * 1024 * 1024)
+
+typedef struct {
+    int loaded;
+    arena mem;                 /* the file text and every node */
+    json_node *root;
+    long version;              /* bumped by every load and applied patch */
+    long pending;              /* patches in the log but not yet in the file */
+    long wal_bytes;
+    long long wal_end;         /* log size after the last complete record */
+    int wal_broken;            /* a failed append could not be cut off the log */
+    long long first_pending_ms;
+    long long last_patch_ms;
+    FILE *wal;
+    long disk_size;            /* the file as last read or written */
+    time_t disk_mtime;
+    unsigned long long disk_hash;
+    int warned_external;       /* reported an outside edit during pending patches */
+    json_buf text;             /* serialization of version text_version */
+    long text_version;
+    char *gz;                  /* gzip of text, for version gz_version */
+    long gz_len;
+    long gz_version;
+} data_model;
+
+static data_model data;
+static mutex_t data_lock;
+static cond_t data_changed;
+static time_t data_epoch;      /* start time, so ETags differ across restarts */
+
+static unsigned long long fnv1a64(const char *p, size_t n) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void data_etag_locked(char *out, size_t out_len) {
+    snprintf(out, out_len, "\"d%lx-%ld\"", (unsigned long)data_epoch, data.version);
+}
+
+/* Adopt a freshly parsed tree, dropping the old arena */
+static void data_adopt_locked(arena *mem, json_node *root) {
+    arena_free(&data.mem);
+    data.mem = *mem;
+    data.root = root;
+    data.loaded = 1;
+}
+
+/*
+ * Make sure the model reflects the file. It is (re)read when it was never
+ * loaded, or when the file changed on disk and no patches are pending;
+ * pending patches win over an outside edit. Returns 0, or -1 with a
+ * message in err.
+ */
+static int data_load_locked(char *err, size_t err_len) {
+    struct stat st;
+    if (stat(DATA_FILE, &st) != 0) {
+        snprintf(err, err_len, "%s not found", DATA_FILE);
+        return data.loaded ? 0 : -1;
+    }
+    if (data.loaded && (long)st.st_size == data.disk_size && st.st_mtime == data.disk_mtime) {
+        return 0;
+    }
+    if (data.loaded && data.pending) {
+        if (!data.warned_external) {
+            printf("Warning: %s changed on disk while edits are pending; "
+                   "the pending edits will overwrite it.\n", DATA_FILE);
+            data.warned_external = 1;
+        }
+        return 0;
+    }
+
+    arena mem = { NULL, 0 };
+    char *text = (char *)arena_alloc(&mem, (size_t)st.st_size + 1);
+    FILE *f = text ? fopen(DATA_FILE, "rb") : NULL;
+    size_t n = f ? fread(text, 1, (size_t)st.st_size, f) : 0;
+    if (f) fclose(f);
+    if (!f || n != (size_t)st.st_size) {
+        arena_free(&mem);
+        snprintf(err, err_len, "Failed to read %s", DATA_FILE);
+        return -1;
+    }
+    const char *perr = NULL;
+    size_t at = 0;
+    json_node *root = json_parse(&mem, text, n, &perr, &at);
+    if (!root) {
+        arena_free(&mem);
+        snprintf(err, err_len, "%s is not valid JSON: %s at byte %lu", DATA_FILE, perr,
+                 (unsigned long)at);
+        return -1;
+    }
+    data_adopt_locked(&mem, root);
+    data.version++;
+    data.disk_size = (long)st.st_size;
+    data.disk_mtime = st.st_mtime;
+    data.disk_hash = fnv1a64(text, n);
+    data.warned_external = 0;
+    return 0;
+}
+
+/* Serialize the current version into data.text (reused until the next change) */
+static int data_text_locked(void) {
+    if (data.text.data && data.text_version == data.version) return 0;
+    data.text.len = 0;
+    json_write(&data.text, data.root, 0);
+    if (!data.text.data) return -1;
+    data.text_version = data.version;
+    return 0;
+}
+
+static void data_wal_close_locked(void) {
+    if (data.wal) {
+        fclose(data.wal);
+        data.wal = NULL;
+    }
+    remove(DATA_WAL);
+    data.pending = 0;
+    data.wal_bytes = 0;
+    data.wal_end = 0;
+    data.wal_broken = 0;
+}
+
+/*
+ * Cut the log back to its first at bytes, get that onto the disk and
+ * reopen it for appending. Returns 0, or -1 with the log closed.
+ */
+static int data_wal_truncate_locked(long long at) {
+    if (data.wal) {
+        fclose(data.wal);
+        data.wal = NULL;
+    }
+    #ifdef _WIN32
+    int fd = _open(DATA_WAL, _O_WRONLY | _O_BINARY);
+    int ok = fd >= 0 && _chsize_s(fd, at) == 0 && _commit(fd) == 0;
+    if (fd >= 0) _close(fd);
+    #else
+    int fd = open(DATA_WAL, O_WRONLY);
+    int ok = fd >= 0 && ftruncate(fd, (off_t)at) == 0 && fsync(fd) == 0;
+    if (fd >= 0) close(fd);
+    #endif
+    if (ok) data.wal = fopen(DATA_WAL, "ab");
+    if (!data.wal) return -1;
+    data.wal_end = at;
+    return 0;
+}
+
+/*
+ * Append one patch to the log and get it onto the disk. A failed append
+ * is cut off again, so no torn or unacknowledged record stays in the log
+ * for recovery to stop at or replay. If even that fails, appends are
+ * refused until compaction starts a new log.
+ */
+static int data_wal_append_locked(int kind, const char *body, long len) {
+    if (data.wal_broken) return -1;
+    int fresh = !data.wal;
+    long long at = fresh ? 0 : data.wal_end;
+    if (fresh) {
+        data.wal = fopen(DATA_WAL, "wb");
+        if (!data.wal) return -1;
+    }
+    int head = fresh ? fprintf(data.wal, "%s %ld %016llx\n", DATA_WAL_MAGIC, data.disk_size,
+                               data.disk_hash) : 0;
+    int rec = fprintf(data.wal, "%s %ld\n", kind == PATCH_MERGE ? "merge" : "patch", len);
+    int ok = head >= 0 && rec >= 0 && fwrite(body, 1, (size_t)len, data.wal) == (size_t)len &&
+             fputc('\n', data.wal) != EOF && fflush(data.wal) == 0 && !ferror(data.wal);
+    #ifdef _WIN32
+    if (ok && _commit(_fileno(data.wal)) != 0) ok = 0;
+    #else
+    if (ok && fsync(fileno(data.wal)) != 0) ok = 0;
+    #endif
+    if (!ok) {
+        if (fresh) {
+            fclose(data.wal);
+            data.wal = NULL;
+            remove(DATA_WAL);
+        } else if (data_wal_truncate_locked(at) != 0) {
+            data.wal_broken = 1;
+            fprintf(stderr, "Failed to cut a torn record off %s; edits are refused until "
+                    "it is compacted.\n", DATA_WAL);
+        }
+        return -1;
+    }
+    data.wal_end = at + head + rec + len + 1;
+    data.wal_bytes += len;
+    return 0;
+}
+
+/*
+ * Apply one patch body to the model. The body is copied into the arena
+ * because the new nodes point into it. Returns the number of operations,
+ * or -1 with *status and *err describing the failure; the model is then
+ * unchanged and the arena is rolled back, so rejected patches leave no
+ * garbage for compaction to find. With log_it the patch is also appended
+ * to the WAL.
+ */
+static int data_apply_locked(int kind, const char *body, long len, int log_it,
+                             int *status, const char **err) {
+    arena_mark mark = arena_save(&data.mem);
+    char *copy = (char *)arena_alloc(&data.mem, (size_t)len + 1);
+    if (!copy) {
+        arena_rewind(&data.mem, &mark);
+        *status = 500;
+        *err = "out of memory";
+        return -1;
+    }
+    memcpy(copy, body, (size_t)len);
+    size_t at = 0;
+    json_node *patch = json_parse(&data.mem, copy, (size_t)len, err, &at);
+    if (!patch) {
+        arena_rewind(&data.mem, &mark);
+        *status = 400;
+        return -1;
+    }
+
+    patch_ctx pc;
+    memset(&pc, 0, sizeof(pc));
+    pc.a = &data.mem;
+    pc.root = &data.root;
+    int ops = json_apply_patch(&pc, kind, patch);
+    if (ops < 0) {
+        *status = pc.status ? pc.status : 409;
+        *err = pc.err ? pc.err : "patch failed";
+    } else if (log_it && data_wal_append_locked(kind, body, len) != 0) {
+        patch_rollback(&pc);
+        *status = 500;
+        *err = "Failed to write " DATA_WAL;
+        ops = -1;
+    }
+    patch_release(&pc);
+    if (ops < 0) arena_rewind(&data.mem, &mark);
+    if (ops >= 0) {
+        long long now = now_ms();
+        if (log_it && data.pending++ == 0) data.first_pending_ms = now;
+        data.last_patch_ms = now;
+        data.version++;
+    }
+    return ops;
+}
+
+/*
+ * Write pending edits into the file and start a new log. Returns 0 on
+ * success; on failure the log is kept and compaction is retried later.
+ */
+static int data_compact_locked(void) {
+    if (!data.loaded || !data.pending) return 0;
+    if (data_text_locked() != 0) return -1;
+
+    const char *tmp = DATA_FILE ".compact.tmp";
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    int ok = fwrite(data.text.data, 1, data.text.len, f) == data.text.len;
+    if (file_sync_close(f) != 0 || !ok || file_replace(tmp, DATA_FILE) != 0) {
+        remove(tmp);
+        fprintf(stderr, "Failed to compact edits into %s; will retry.\n", DATA_FILE);
+        return -1;
+    }
+    long edits = data.pending;
+    data_wal_close_locked();
+
+    /* Re-parse from the written text so the arena holds no dead nodes */
+    arena mem = { NULL, 0 };
+    char *text = (char *)arena_alloc(&mem, data.text.len + 1);
+    json_node *root = NULL;
+    if (text) {
+        memcpy(text, data.text.data, data.text.len);
+        root = json_parse(&mem, text, data.text.len, NULL, NULL);
+    }
+    if (root) data_adopt_locked(&mem, root);
+    else arena_free(&mem);
+
+    struct stat st;
+    if (stat(DATA_FILE, &st) == 0) {
+        data.disk_size = (long)st.st_size;
+        data.disk_mtime = st.st_mtime;
+    }
+    data.disk_hash = fnv1a64(data.text.data, data.text.len);
+    data.warned_external = 0;
+    cache_invalidate_prefix(DATA_FILE);
+    printf("Compacted %ld edit%s into %s (%ld bytes).\n", edits, edits == 1 ? "" : "s",
+           DATA_FILE, (long)data.text.len);
+    return 0;
+}
+
+/* Write out pending edits now; builds and deploys call this under api_lock */
+static void data_flush(void) {
+    mutex_lock(&data_lock);
+    data_compact_locked();
+    mutex_unlock(&data_lock);
+}
+
+/*
+ * The file was replaced wholesale (POST /api/save): forget the model and
+ * the log. The next request reloads from disk.
+ */
+static void data_reset_locked(void) {
+    data_wal_close_locked();
+    arena_free(&data.mem);
+    data.root = NULL;
+    data.loaded = 0;
+    data.version++;
+}
+
+/* Startup: replay a log left by a previous run, then fold it into the file */
+static void data_recover(void) {
+    data_epoch = time(NULL);
+    FILE *f = fopen(DATA_WAL, "rb");
+    if (!f) return;
+
+    json_buf log = JSON_BUF_INIT;
+    char piece[8192];
+    size_t n;
+    while ((n = fread(piece, 1, sizeof(piece), f)) > 0) json_buf_append(&log, piece, n);
+    fclose(f);
+
+    char err[256];
+    long base_size = -1;
+    unsigned long long base_hash = 0;
+    size_t magic_len = strlen(DATA_WAL_MAGIC);
+    const char *p = log.data, *end = log.data + log.len;
+    const char *nl = p ? (const char *)memchr(p, '\n', log.len) : NULL;
+    int header_ok = nl && log.len > magic_len && memcmp(p, DATA_WAL_MAGIC, magic_len) == 0 &&
+                    sscanf(p + magic_len, " %ld %llx", &base_size, &base_hash) == 2;
+
+    mutex_lock(&data_lock);
+    if (!header_ok || data_load_locked(err, sizeof(err)) != 0 ||
+        base_size != data.disk_size || base_hash != data.disk_hash) {
+        mutex_unlock(&data_lock);
+        free(log.data);
+        remove(DATA_WAL_STALE);
+        rename(DATA_WAL, DATA_WAL_STALE);
+        printf("Warning: %s does not match %s (already applied, or the file was replaced); "
+               "moved it to %s.\n", DATA_WAL, DATA_FILE, DATA_WAL_STALE);
+        return;
+    }
+
+    long replayed = 0, skipped = 0;
+    p = nl + 1;
+    size_t log_end = (size_t)(p - log.data);       /* end of the last whole record */
+    while (p < end) {
+        char kind[16];
+        long len = -1;
+        nl = (const char *)memchr(p, '\n', (size_t)(end - p));
+        if (!nl || sscanf(p, "%15s %ld", kind, &len) != 2 || len < 0 ||
+            len > (long)(end - nl - 1) - 1) {
+            break;  /* torn tail from a crash mid-append: that edit was never acknowledged */
+        }
+        int status;
+        const char *perr;
+        if (data_apply_locked(strcmp(kind, "merge") == 0 ? PATCH_MERGE : PATCH_JSON,
+                              nl + 1, len, 0, &status, &perr) >= 0) {
+            replayed++;
+        } else {
+            skipped++;
+        }
+        p = nl + 1 + len + 1;
+        log_end = (size_t)(p - log.data);
+    }
+    size_t log_len = log.len;
+    free(log.data);
+    printf("Replayed %ld edit%s from %s", replayed, replayed == 1 ? "" : "s", DATA_WAL);
+    if (skipped) printf(" (%ld could not be applied)", skipped);
+    printf(".\n");
+
+    data.pending = replayed;
+    data.first_pending_ms = data.last_patch_ms = now_ms();
+    if (replayed == 0) {
+        data_wal_close_locked();
+    } else if (data_compact_locked() != 0) {
+        /* Keep the log: new edits go after the replayed ones, not after a torn tail */
+        if (data_wal_truncate_locked((long long)log_end) != 0) data.wal_broken = 1;
+        data.wal_bytes = (long)log_len;
+    }
+    mutex_unlock(&data_lock);
+}
+
+/* Compaction thread: fold the log into the file once edits go quiet */
+static THREAD_FUNC data_main(void *arg) {
+    (void)arg;
+    mutex_lock(&data_lock);
+    while (running) {
+        cond_timedwait(&data_changed, &data_lock, 250);
+        if (!data.pending) continue;
+        long long now = now_ms();
+        if (now - data.last_patch_ms < DATA_COMPACT_IDLE_MS &&
+            now - data.first_pending_ms < DATA_COMPACT_MAX_MS && data.wal_bytes < DATA_WAL_MAX) {
+            continue;
+        }
+        /* api_lock first, as everywhere: a running build must finish reading the file */
+        mutex_unlock(&data_lock);
+        mutex_lock(&api_lock);
+        mutex_lock(&data_lock);
+        data_compact_locked();
+        mutex_unlock(&api_lock);
+    }
+    mutex_unlock(&data_lock);
+    THREAD_RETURN;
+}
+
+static void data_shutdown(void) {
+    mutex_lock(&data_lock);
+    cond_broadcast(&data_changed);
+    mutex_unlock(&data_lock);
+}
+
+static void send_data_error(conn_t *conn, int status, const char *status_text, const char *err) {
+    json_buf b = JSON_BUF_INIT;
+    json_buf_append(&b, "{\"error\":", 9);
+    json_buf_cstring(&b, err);
+    json_buf_append(&b, "}", 1);
+    send_response(conn, status, status_text, "application/json; charset=utf-8",
+                  b.data, (long)b.len);
+    free(b.data);
+}
+
+/*
+ * Send the in-memory document. With pending_only it is only sent while
+ * edits are waiting in the log (GET /crissy-data.json); otherwise the
+ * file on disk is current and the static path serves it. Returns 1 if a
+ * response was sent.
+ */
+static int data_send(conn_t *conn, int pending_only) {
+    char err[256], etag[64], extra[256];
+    mutex_lock(&data_lock);
+    if (pending_only && !data.pending) {
+        mutex_unlock(&data_lock);
+        return 0;
+    }
+    if (data_load_locked(err, sizeof(err)) != 0 || data_text_locked() != 0) {
+        mutex_unlock(&data_lock);
+        send_data_error(conn, 500, "Internal Server Error", err);
+        return 1;
+    }
+    data_etag_locked(etag, sizeof(etag));
+    int gzip = cfg_compress && accept_encoding_q(conn, "gzip") > 0;
+    snprintf(extra, sizeof(extra),
+             "ETag: %s\r\nCache-Control: no-cache\r\n%s%s"
+             "Accept-Patch: application/json-patch+json, application/merge-patch+json\r\n",
+             etag, cfg_compress ? "Vary: Accept-Encoding\r\n" : "",
+             gzip ? "Content-Encoding: gzip\r\n" : "");
+    /* ETag only: the document has no Last-Modified, and can change twice in a second */
+    char inm[1024];
+    if (find_header(conn->buf, conn->head_len, "If-None-Match", inm, sizeof(inm)) &&
+        etag_matches(inm, etag)) {
+        mutex_unlock(&data_lock);
+        send_head(conn, 304, "Not Modified", NULL, -1, extra);
+        return 1;
+    }
+    if (gzip && (!data.gz || data.gz_version != data.version)) {
+        free(data.gz);
+        data.gz = gzip_buffer(data.text.data, (long)data.text.len, &data.gz_len);
+        data.gz_version = data.version;
+    }
+    if (gzip && !data.gz) {
+        gzip = 0;
+        snprintf(extra, sizeof(extra), "ETag: %s\r\nCache-Control: no-cache\r\n"
+                 "Vary: Accept-Encoding\r\n", etag);
+    }
+    /* Send a copy, so a slow client does not hold up edits */
+    const char *src = gzip ? data.gz : data.text.data;
+    long len = gzip ? data.gz_len : (long)data.text.len;
+    char *copy = conn->head_only ? NULL : (char *)malloc((size_t)len);
+    if (copy) memcpy(copy, src, (size_t)len);
+    mutex_unlock(&data_lock);
+
+    if (!conn->head_only && !copy) {
+        send_error(conn, 500, "Internal Server Error");
+        return 1;
+    }
+    send_head(conn, 200, "OK", "application/json; charset=utf-8", len, extra);
+    if (copy) send_all(conn, copy, len);
+    free(copy);
+    return 1;
+}
+
+/* Handle PATCH /api/data - apply a JSON Patch or merge patch */
+static void handle_api_data_patch(conn_t *conn) {
+    char type[128] = "";
+    find_header(conn->buf, conn->head_len, "Content-Type", type, sizeof(type));
+    char *semi = strchr(type, ';');
+    if (semi) *semi = '\0';
+    int kind;
+    if (header_has_token(type, "application/json-patch+json")) {
+        kind = PATCH_JSON;
+    } else if (header_has_token(type, "application/merge-patch+json")) {
+        kind = PATCH_MERGE;
+    } else {
+        const char *msg = "{\"error\":\"Use Content-Type application/json-patch+json "
+                          "or application/merge-patch+json\"}";
+        send_head(conn, 415, "Unsupported Media Type", "application/json; charset=utf-8",
+                  (long)strlen(msg),
+                  "Accept-Patch: application/json-patch+json, application/merge-patch+json\r\n");
+        if (!conn->head_only) send_all(conn, msg, (long)strlen(msg));
+        return;
+    }
+    if (body_too_large(conn)) {
+        send_data_error(conn, 413, "Payload Too Large", "Request body exceeds --max-body-mb");
+        conn->keep_alive = 0;
+        return;
+    }
+    long len = 0;
+    char *body = read_request_body(conn, &len);
+    if (!body) {
+        send_data_error(conn, 400, "Bad Request", "Missing or truncated patch body");
+        return;
+    }
+
+    char err[256], if_match[256], etag[64];
+    int has_if_match = find_header(conn->buf, conn->head_len, "If-Match", if_match,
+                                   sizeof(if_match));
+    mutex_lock(&data_lock);
+    if (data_load_locked(err, sizeof(err)) != 0) {
+        mutex_unlock(&data_lock);
+        free(body);
+        send_data_error(conn, 500, "Internal Server Error", err);
+        return;
+    }
+    data_etag_locked(etag, sizeof(etag));
+    if (has_if_match && strcmp(if_match, "*") != 0 && !etag_matches(if_match, etag)) {
+        mutex_unlock(&data_lock);
+        free(body);
+        send_data_error(conn, 412, "Precondition Failed",
+                        "The document changed since it was read (If-Match)");
+        return;
+    }
+    int status = 0;
+    const char *perr = NULL;
+    int ops = data_apply_locked(kind, body, len, 1, &status, &perr);
+    if (ops >= 0) {
+        data_etag_locked(etag, sizeof(etag));
+        cond_signal(&data_changed);
+    }
+    mutex_unlock(&data_lock);
+    free(body);
+
+    if (ops < 0) {
+        snprintf(err, sizeof(err), "%s", perr);
+        send_data_error(conn, status,
+                        status == 400 ? "Bad Request" :
+                        status == 409 ? "Conflict" : "Internal Server Error", err);
+        return;
+    }
+    printf("Patched %s (%d op%s, %ld bytes).\n", DATA_FILE, ops, ops == 1 ? "" : "s", len);
+
+    char msg[160], extra[96];
+    int n = snprintf(msg, sizeof(msg), "{\"ok\":true,\"ops\":%d,\"etag\":", ops);
+    json_buf b = JSON_BUF_INIT;
+    json_buf_append(&b, msg, (size_t)n);
+    json_buf_cstring(&b, etag);
+    json_buf_append(&b, "}", 1);
+    snprintf(extra, sizeof(extra), "ETag: %s\r\n", etag);
+    send_head(conn, 200, "OK", "application/json; charset=utf-8", (long)b.len, extra);
+    if (b.data) send_all(conn, b.data, (long)b.len);
+    free(b.data);
+}
+
+/* ---- File Watcher ---- */
+
+/*
+ * With --watch, a thread keeps an eye on the four build inputs. A change
+ * is debounced for WATCH_DEBOUNCE_MS, because editors often write a file
+ * in several steps and a save from the manager renames a temp file over
+ * the JSON. A build job is then queued through the normal job queue, so
+ * it coalesces with builds started from the manager, and build.go's
+ * manifest keeps the rebuild incremental.
+ *
+ * Linux waits on inotify and Windows on a change notification handle for
+ * the project directory. Other systems poll every WATCH_POLL_MS: FSEvents
+ * would need CoreServices, which the one-line cc build does not link. In
+ * every case the files' size and mtime decide whether anything changed,
+ * so unrelated activity in the directory only costs a few stat calls.
+ *
+ * HTML pages other than the manager are served with a small script that
+ * listens on GET /api/live-reload (Server-Sent Events) and reloads the
+ * page when a build succeeds, so an open preview refreshes itself.
+ */
+
+#define WATCH_POLL_MS      250
+#define WATCH_DEBOUNCE_MS  150
+#define WATCH_IDLE_MS      1000
+#define WATCH_COUNT        4
+
+static int cfg_watch = 0;
+static int live_clients = 0;   /* open /api/live-reload streams, under job_lock */
+
+static const char *const watch_files[WATCH_COUNT] = {
+    "index.html", "styles.css", "scripts.js", "crissy-data.json"
+};
+
+typedef struct {
+    long long size;
+    long mtime;
+    long nsec;
+    int exists;
+} watch_sig;
+
+static void watch_scan(watch_sig *sigs) {
+    for (int i = 0; i < WATCH_COUNT; i++) {
+        struct stat st;
+        memset(&sigs[i], 0, sizeof(sigs[i]));
+        if (stat(watch_files[i], &st) == 0) {
+            sigs[i].exists = 1;
+            sigs[i].size = (long long)st.st_size;
+            sigs[i].mtime = (long)st.st_mtime;
+            sigs[i].nsec = ST_MTIME_NSEC(&st);
+        }
+    }
+}
+
+/* Native change notification, or nothing when we only poll */
+#if defined(_WIN32)
+static HANDLE watch_handle = INVALID_HANDLE_VALUE;
+static int watch_open(void) {
+    watch_handle = FindFirstChangeNotificationA(".", FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    return watch_handle != INVALID_HANDLE_VALUE;
+}
+static void watch_wait(int ms) {
+    if (watch_handle == INVALID_HANDLE_VALUE) {
+        Sleep(ms);
+    } else if (WaitForSingleObject(watch_handle, ms) == WAIT_OBJECT_0) {
+        FindNextChangeNotification(watch_handle);
+    }
+}
+static void watch_close(void) {
+    if (watch_handle != INVALID_HANDLE_VALUE) FindCloseChangeNotification(watch_handle);
+}
+#elif defined(__linux__)
+static int watch_fd = -1;
+static int watch_open(void) {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) return 0;
+    if (inotify_add_watch(watch_fd, ".", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO |
+                                          IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        close(watch_fd);
+        watch_fd = -1;
+        return 0;
+    }
+    return 1;
+}
+static void watch_wait(int ms) {
+    if (watch_fd < 0) {
+        usleep((useconds_t)ms * 1000);
+        return;
+    }
+    struct pollfd pfd = { watch_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, ms) > 0) {
+        char events[4096];
+        while (read(watch_fd, events, sizeof(events)) > 0) { /* drain */ }
+    }
+}
+static void watch_close(void) {
+    if (watch_fd >= 0) close(watch_fd);
+}
+#else
+static int watch_open(void) { return 0; }
+static void watch_wait(int ms) { usleep((useconds_t)ms * 1000); }
+static void watch_close(void) {}
+#endif
+
+static void live_reload_bump(void) {
+    mutex_lock(&job_lock);
+    live_generation++;
+    cond_broadcast(&job_changed);
+    mutex_unlock(&job_lock);
+}
+
+/* Queue a build for the settled change, or just reload if there is no build tool */
+static void watch_trigger(void) {
+    const char *err = NULL;
+    if (job_command(JOB_BUILD, &err)) {
+        int coalesced = 0;
+        int id = job_submit(JOB_BUILD, &coalesced);
+        printf("Change detected, %s build job %d.\n", coalesced ? "joined" : "queued", id);
+    } else {
+        printf("Change detected (no build tool, reloading previews only).\n");
+        live_reload_bump();
+    }
+}
+
+static THREAD_FUNC watch_main(void *arg) {
+    (void)arg;
+    int native = watch_open();
+    watch_sig sigs[WATCH_COUNT], now[WATCH_COUNT];
+    watch_scan(sigs);
+    long long changed_at = -1;  /* time of the last change still settling */
+    printf("Watching index.html, styles.css, scripts.js and crissy-data.json (%s).\n\n",
+           native ? "change notifications" : "polling");
+
+    while (running) {
+        int timeout = native ? WATCH_IDLE_MS : WATCH_POLL_MS;
+        if (changed_at >= 0) {
+            long long left = WATCH_DEBOUNCE_MS - (now_ms() - changed_at);
+            timeout = left > 0 ? (int)left : 0;
+        }
+        if (timeout > 0) watch_wait(timeout);
+
+        watch_scan(now);
+        if (memcmp(now, sigs, sizeof(sigs)) != 0) {
+            memcpy(sigs, now, sizeof(sigs));
+            changed_at = now_ms();
+            continue;
+        }
+        if (changed_at >= 0 && now_ms() - changed_at >= WATCH_DEBOUNCE_MS) {
+            changed_at = -1;
+            watch_trigger();
+        }
+    }
+    watch_close();
+    THREAD_RETURN;
+}
+
+static const char live_reload_script[] =
+    "<script>(function(){if(!window.EventSource)return;"
+    "var es=new EventSource(\"/api/live-reload\");"
+    "es.addEventListener(\"reload\",function(){es.close();location.reload();});"
+    "})();</script>\n";
+
+/* HTML pages other than the manager, which would lose unsaved edits */
+static int live_reload_page(const char *filepath) {
+    const char *mime = get_mime(filepath);
+    if (strncmp(mime, "text/html", 9) != 0) return 0;
+    const char *base = filepath + strlen(filepath);
+    while (base > filepath && base[-1] != '/' && base[-1] != '\\') base--;
+    return strcmp(base, "manage.html") != 0;
+}
+
+/* Serve an HTML page with live_reload_script inserted before </body> */
+static void send_live_html(conn_t *conn, const char *filepath, const struct stat *st) {
+    char etag[64], lrtag[80], extra[384];
+    make_etag(st, etag, sizeof(etag));
+    etag_with_suffix(etag, "lr", lrtag, sizeof(lrtag));
+    file_headers(extra, sizeof(extra), filepath, lrtag, st->st_mtime, NULL, 0);
+    if (request_not_modified(conn, lrtag, st->st_mtime)) {
+        send_head(conn, 304, "Not Modified", NULL, -1, extra);
+        return;
+    }
+
+    const char *data = NULL;
+    long size = 0;
+    char *owned = NULL;
+    cache_entry *e = cache_get(filepath, st);
+    if (e) {
+        data = e->data;
+        size = e->size;
+    } else {
+        FILE *f = fopen(filepath, "rb");
+        owned = f ? (char *)malloc((size_t)st->st_size + 1) : NULL;
+        if (owned) size = (long)fread(owned, 1, (size_t)st->st_size, f);
+        if (f) fclose(f);
+        if (!owned) {
+            send_error(conn, 404, "Not Found");
+            return;
+        }
+        data = owned;
+    }
+
+    /* Insert before the last </body>, or append if there is none */
+    long at = size;
+    for (long i = size - 6; i >= 0 && at == size; i--) {
+        int k = 0;
+        while (k < 6 && tolower((unsigned char)data[i + k]) == "</body"[k]) k++;
+        if (k == 6) at = i;
+    }
+    long script_len = (long)sizeof(live_reload_script) - 1;
+    send_head(conn, 200, "OK", get_mime(filepath), size + script_len, extra);
+    if (!conn->head_only && send_all(conn, data, at) == 0 &&
+        send_all(conn, live_reload_script, script_len) == 0) {
+        send_all(conn, data + at, size - at);
+    }
+    if (e) cache_release(e);
+    free(owned);
+}
+
+/* Static file response, with the live-reload hook when --watch is on */
+static void send_static(conn_t *conn, const char *filepath, const struct stat *st) {
+    if (cfg_watch && live_reload_page(filepath)) {
+        send_live_html(conn, filepath, st);
+    } else {
+        send_file(conn, filepath, st);
+    }
+}
+
+/*
+ * GET /api/live-reload: an event stream that sends "reload" after each
+ * successful build. The event id is the build generation, so a client that
+ * reconnects after missing a build (or after a server restart) reloads at
+ * once. Each stream holds a worker, so at most half the pool is given to
+ * them and the rest get 503.
+ */
+static void handle_api_live_reload(conn_t *conn) {
+    char value[32];
+    long seen = -1;
+    if (find_header(conn->buf, conn->head_len, "Last-Event-ID", value, sizeof(value))) {
+        seen = atol(value);
+    }
+
+    mutex_lock(&job_lock);
+    int admitted = cfg_watch && live_clients < cfg_workers / 2;
+    if (admitted) live_clients++;
+    long gen = live_generation;
+    mutex_unlock(&job_lock);
+    if (!cfg_watch) {
+        send_error(conn, 404, "Not Found");
+        return;
+    }
+    if (!admitted) {
+        const char *msg = "{\"error\":\"Too many live-reload connections\"}";
+        send_response(conn, 503, "Service Unavailable", "application/json; charset=utf-8",
+                      msg, (long)strlen(msg));
+        return;
+    }
+
+    conn->keep_alive = 0;
+    send_head(conn, 200, "OK", "text/event-stream; charset=utf-8", -1,
+              "Cache-Control: no-cache\r\nX-Accel-Buffering: no\r\n");
+    if (!conn->head_only) {
+        int ok = seen >= 0 && seen != gen
+            ? sse_send_event(conn, "reload", gen, "missed", 6)
+            : sse_send_event(conn, "hello", gen, "watching", 8);
+        int idle_seconds = 0;
+        while (ok == 0 && running) {
+            mutex_lock(&job_lock);
+            if (running && live_generation == gen) cond_timedwait(&job_changed, &job_lock, 1000);
+            long next = live_generation;
+            mutex_unlock(&job_lock);
+
+            if (next != gen) {
+                gen = next;
+                ok = sse_send_event(conn, "reload", gen, "build", 5);
+                idle_seconds = 0;
+            } else if (++idle_seconds >= SSE_HEARTBEAT_SECONDS) {
+                ok = send_all(conn, ": ping\n\n", 8);
+                idle_seconds = 0;
+            }
+        }
+    }
+
+    mutex_lock(&job_lock);
+    live_clients--;
+    mutex_unlock(&job_lock);
+}
+
+/* ---- Metrics Endpoint ---- */
+
+/*
+ * GET /api/metrics answers in the Prometheus text format, or as JSON
+ * for ?format=json or an Accept header asking for application/json.
+ * Prometheus gets one histogram bucket per power of two from 64 us up;
+ * the JSON view reads percentiles off the full-resolution buckets.
+ */
+
+static void prom_histogram(json_buf *b, const char *name, const char *labels, const histogram *h) {
+    long long cum = 0;
+    int next = 0;
+    for (int g = 0; g < HIST_GROUPS; g++) {
+        for (; next < (g + 1) * HIST_SUB; next++) cum += counter_get(&h->buckets[next]);
+        long long limit = hist_bucket_limit(next - 1);
+        if (limit < 64) continue;
+        json_buf_printf(b, "%s_bucket{%s,le=\"%g\"} %lld\n", name, labels, (double)limit / 1e6, cum);
+    }
+    json_buf_printf(b, "%s_bucket{%s,le=\"+Inf\"} %lld\n", name, labels, counter_get(&h->count));
+    json_buf_printf(b, "%s_sum{%s} %.6f\n", name, labels, (double)counter_get(&h->sum_us) / 1e6);
+    json_buf_printf(b, "%s_count{%s} %lld\n", name, labels, counter_get(&h->count));
+}
+
+static void json_histogram(json_buf *b, const histogram *h) {
+    long long count = counter_get(&h->count);
+    json_buf_printf(b, "{\"count\":%lld,\"meanMs\":%.3f,\"p50Ms\":%.3f,\"p90Ms\":%.3f,"
+                    "\"p99Ms\":%.3f,\"maxMs\":%.3f}",
+                    count, count ? (double)counter_get(&h->sum_us) / (double)count / 1000.0 : 0.0,
+                    (double)hist_quantile(h, 0.50) / 1000.0, (double)hist_quantile(h, 0.90) / 1000.0,
+                    (double)hist_quantile(h, 0.99) / 1000.0, (double)counter_get(&h->max_us) / 1000.0);
+}
+
+static void status_label(int slot, char *out, size_t out_len) {
+    if (slot < STATUS_COUNT - 1) snprintf(out, out_len, "%d", metric_statuses[slot]);
+    else snprintf(out, out_len, "other");
+}
+
+static void metrics_prometheus(body_stream *out, long hits, long misses, long evictions,
+                               long entries, long used) {
+    json_buf *b = &out->buf;
+    char labels[128], status[16];
+
+    json_buf_printf(b, "# HELP portfolio_http_requests_total Requests served, by route and status.\n"
+                       "# TYPE portfolio_http_requests_total counter\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (int s = 0; s < STATUS_COUNT; s++) {
+            long long n = counter_get(&route_stats[r].status[s]);
+            if (n == 0) continue;
+            status_label(s, status, sizeof(status));
+            json_buf_printf(b, "portfolio_http_requests_total{route=\"%s\",status=\"%s\"} %lld\n",
+                            route_names[r], status, n);
+        }
+    }
+    stream_check(out);
+
+    json_buf_printf(b, "# HELP portfolio_http_request_duration_seconds Time from the first byte "
+                       "of a request to the end of its response.\n"
+                       "# TYPE portfolio_http_request_duration_seconds histogram\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        if (counter_get(&route_stats[r].latency.count) == 0) continue;
+        snprintf(labels, sizeof(labels), "route=\"%s\"", route_names[r]);
+        prom_histogram(b, "portfolio_http_request_duration_seconds", labels,
+                       &route_stats[r].latency);
+    }
+    stream_check(out);
+
+    json_buf_printf(b, "# HELP portfolio_http_received_bytes_total Bytes read from clients.\n"
+                       "# TYPE portfolio_http_received_bytes_total counter\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        if (counter_get(&route_stats[r].latency.count) == 0) continue;
+        json_buf_printf(b, "portfolio_http_received_bytes_total{route=\"%s\"} %lld\n",
+                        route_names[r], counter_get(&route_stats[r].bytes_in));
+    }
+    stream_check(out);
+    json_buf_printf(b, "# HELP portfolio_http_sent_bytes_total Bytes sent to clients, "
+                       "headers included.\n"
+                       "# TYPE portfolio_http_sent_bytes_total counter\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        if (counter_get(&route_stats[r].latency.count) == 0) continue;
+        json_buf_printf(b, "portfolio_http_sent_bytes_total{route=\"%s\"} %lld\n",
+                        route_names[r], counter_get(&route_stats[r].bytes_out));
+    }
+    stream_check(out);
+
+    json_buf_printf(b, "# HELP portfolio_http_connections_total Connections accepted.\n"
+                       "# TYPE portfolio_http_connections_total counter\n"
+                       "portfolio_http_connections_total %lld\n",
+                    counter_get(&connections_accepted));
+
+    json_buf_printf(b, "# HELP portfolio_file_cache_lookups_total Static file cache lookups.\n"
+                       "# TYPE portfolio_file_cache_lookups_total counter\n"
+                       "portfolio_file_cache_lookups_total{result=\"hit\"} %ld\n"
+                       "portfolio_file_cache_lookups_total{result=\"miss\"} %ld\n"
+                       "# TYPE portfolio_file_cache_evictions_total counter\n"
+                       "portfolio_file_cache_evictions_total %ld\n"
+                       "# TYPE portfolio_file_cache_entries gauge\n"
+                       "portfolio_file_cache_entries %ld\n"
+                       "# TYPE portfolio_file_cache_bytes gauge\n"
+                       "portfolio_file_cache_bytes %ld\n",
+                    hits, misses, evictions, entries, used);
+
+    json_buf_printf(b, "# HELP portfolio_deploy_check_total deploy-check requests by how they "
+                       "were answered.\n"
+                       "# TYPE portfolio_deploy_check_total counter\n");
+    for (int c = 0; c < CHECK_COUNT; c++) {
+        json_buf_printf(b, "portfolio_deploy_check_total{result=\"%s\"} %lld\n",
+                        check_names[c], counter_get(&check_stats[c]));
+    }
+    stream_check(out);
+
+    json_buf_printf(b, "# HELP portfolio_child_duration_seconds Wall time of child processes "
+                       "the server waits on.\n"
+                       "# TYPE portfolio_child_duration_seconds histogram\n");
+    for (int k = 0; k < CHILD_COUNT; k++) {
+        if (counter_get(&child_stats[k].duration.count) == 0) continue;
+        snprintf(labels, sizeof(labels), "kind=\"%s\"", child_names[k]);
+        prom_histogram(b, "portfolio_child_duration_seconds", labels, &child_stats[k].duration);
+    }
+    stream_check(out);
+    json_buf_printf(b, "# HELP portfolio_child_failures_total Child processes that exited "
+                       "non-zero or did not start.\n"
+                       "# TYPE portfolio_child_failures_total counter\n");
+    for (int k = 0; k < CHILD_COUNT; k++) {
+        json_buf_printf(b, "portfolio_child_failures_total{kind=\"%s\"} %lld\n",
+                        child_names[k], counter_get(&child_stats[k].failures));
+    }
+    stream_check(out);
+
+    json_buf_printf(b, "# TYPE portfolio_uptime_seconds gauge\n"
+                       "portfolio_uptime_seconds %ld\n", (long)(time(NULL) - metrics_started));
+}
+
+static void metrics_json(body_stream *out, long hits, long misses, long evictions,
+                         long entries, long used) {
+    json_buf *b = &out->buf;
+    char status[16];
+    json_buf_printf(b, "{\"uptimeSeconds\":%ld,\"connections\":%lld,\"routes\":{",
+                    (long)(time(NULL) - metrics_started), counter_get(&connections_accepted));
+    int first = 1;
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        const route_metrics *m = &route_stats[r];
+        if (counter_get(&m->latency.count) == 0) continue;
+        json_buf_printf(b, "%s\"%s\":{\"status\":{", first ? "" : ",", route_names[r]);
+        first = 0;
+        int sfirst = 1;
+        for (int s = 0; s < STATUS_COUNT; s++) {
+            long long n = counter_get(&m->status[s]);
+            if (n == 0) continue;
+            status_label(s, status, sizeof(status));
+            json_buf_printf(b, "%s\"%s\":%lld", sfirst ? "" : ",", status, n);
+            sfirst = 0;
+        }
+        json_buf_printf(b, "},\"bytesIn\":%lld,\"bytesOut\":%lld,\"latency\":",
+                        counter_get(&m->bytes_in), counter_get(&m->bytes_out));
+        json_histogram(b, &m->latency);
+        json_buf_append(b, "}", 1);
+    }
+    stream_check(out);
+    long lookups = hits + misses;
+    json_buf_printf(b, "},\"fileCache\":{\"hits\":%ld,\"misses\":%ld,\"hitRate\":%.3f,"
+                    "\"evictions\":%ld,\"entries\":%ld,\"bytes\":%ld},\"deployCheck\":{",
+                    hits, misses, lookups ? (double)hits / (double)lookups : 0.0,
+                    evictions, entries, used);
+    long long checks = 0;
+    for (int c = 0; c < CHECK_COUNT; c++) {
+        long long n = counter_get(&check_stats[c]);
+        checks += n;
+        json_buf_printf(b, "\"%s\":%lld,", check_names[c], n);
+    }
+    stream_check(out);
+    /* Answered without a fetch: from the memo or after an ls-remote showed no change */
+    json_buf_printf(b, "\"hitRate\":%.3f},\"children\":{",
+                    checks ? (double)(counter_get(&check_stats[CHECK_MEMO]) +
+                                      counter_get(&check_stats[CHECK_UNCHANGED])) / (double)checks
+                           : 0.0);
+    for (int k = 0; k < CHILD_COUNT; k++) {
+        json_buf_printf(b, "%s\"%s\":{\"failures\":%lld,\"duration\":", k ? "," : "",
+                        child_names[k], counter_get(&child_stats[k].failures));
+        json_histogram(b, &child_stats[k].duration);
+        json_buf_append(b, "}", 1);
+    }
+    stream_check(out);
+    json_buf_append(b, "}}", 2);
+}
+
+/* Handle GET /api/metrics */
+static void handle_api_metrics(conn_t *conn, const char *query) {
+    char accept[256] = "";
+    find_header(conn->buf, conn->head_len, "Accept", accept, sizeof(accept));
+    int json = strstr(query, "format=json") != NULL ||
+               (strstr(query, "format=") == NULL && strstr(accept, "application/json") != NULL);
+
+    mutex_lock(&cache_lock);
+    long hits = cache_hits, misses = cache_misses, evictions = cache_evictions;
+    long entries = cache_entries, used = cache_used;
+    mutex_unlock(&cache_lock);
+
+    body_stream out;
+    stream_begin(&out, conn, json ? "application/json; charset=utf-8"
+                                  : "text/plain; version=0.0.4; charset=utf-8");
+    if (json) metrics_json(&out, hits, misses, evictions, entries, used);
+    else metrics_prometheus(&out, hits, misses, evictions, entries, used);
+    stream_end(&out);
+}
+
+/*
+ * --access-log writes one JSON object per request. The phases add up to
+ * total_us: recv (first byte to end of headers), parse (header parsing),
+ * handler (the route's own work, minus time spent sending) and send.
+ */
+static void access_log_write(conn_t *conn, long long recv_us, long long parse_us,
+                             long long handler_us, long long total_us) {
+    char method[16] = {0};
+    char target[1024] = {0};
+    sscanf(conn->buf, "%15s %1023s", method, target);
+
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tmv;
+    #ifdef _WIN32
+    gmtime_s(&tmv, &now);
+    #else
+    gmtime_r(&now, &tmv);
+    #endif
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tmv);
+
+    json_buf line = JSON_BUF_INIT;
+    json_buf_printf(&line, "{\"time\":\"%s\",\"method\":", stamp);
+    json_buf_cstring(&line, method);
+    json_buf_append(&line, ",\"path\":", 8);
+    json_buf_cstring(&line, target);
+    json_buf_printf(&line, ",\"route\":\"%s\",\"status\":%d,\"bytesIn\":%lld,\"bytesOut\":%lld,"
+                    "\"recvUs\":%lld,\"parseUs\":%lld,\"handlerUs\":%lld,\"sendUs\":%lld,"
+                    "\"totalUs\":%lld,\"connRequest\":%d}\n",
+                    route_names[conn->route], conn->status, conn->bytes_in, conn->bytes_out,
+                    recv_us, parse_us, handler_us, conn->send_us, total_us, conn->requests);
+    if (!line.data) return;
+
+    mutex_lock(&access_log_lock);
+    fwrite(line.data, 1, line.len, access_log);
+    fflush(access_log);
+    mutex_unlock(&access_log_lock);
+    free(line.data);
+}
+
+/* Record a finished request; head_done and handler_start are now_us() stamps */
+static void request_finish(conn_t *conn, long long head_done, long long handler_start) {
+    long long end = now_us();
+    long long total = end - conn->recv_start;
+    metrics_request(conn->route, conn->status, conn->bytes_in, conn->bytes_out, total);
+    if (access_log) {
+        long long handler = end - handler_start - conn->send_us;
+        access_log_write(conn, head_done - conn->recv_start, handler_start - head_done,
+                         handler < 0 ? 0 : handler, total);
+    }
+}
+
+/* ---- Request Handler ---- */
+
+/* Handle POST /api/save - stream the JSON body over crissy-data.json */
+static void handle_api_save(conn_t *conn) {
+    char tmp[1024];
+    long body_len = 0;
+    int status = save_body_temp(conn, DATA_FILE, tmp, sizeof(tmp), &body_len);
+    if (status == 0) {
+        /*
+         * The upload runs unlocked; only the swap waits, for a running
+         * build or deploy (api_lock) and for PATCH and compaction (data_lock).
+         */
+        mutex_lock(&api_lock);
+        mutex_lock(&data_lock);
+        status = save_body_commit(tmp, DATA_FILE);
+        if (status == 0) data_reset_locked();
+        mutex_unlock(&data_lock);
+        if (status == 0) cache_invalidate_prefix("crissy-data.json");
+        mutex_unlock(&api_lock);
+    }
+    if (status == 413) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "{\"error\":\"Request body exceeds the %ld MB limit (--max-body-mb)\"}",
+                 cfg_max_body / (1024 * 1024));
+        send_response(conn, 413, "Payload Too Large",
+                      "application/json; charset=utf-8", msg, (long)strlen(msg));
+        return;
+    }
+    if (status == 400) {
+        send_error(conn, 400, "Bad Request");
+        return;
+    }
+    if (status != 0) {
+        const char *msg = "{\"error\":\"Failed to write crissy-data.json\"}";
+        send_response(conn, 500, "Internal Server Error",
+                      "application/json; charset=utf-8", msg, (long)strlen(msg));
+        return;
+    }
+
+    printf("Saved crissy-data.json (%ld bytes)\n", body_len);
+
+    const char *ok = "{\"ok\":true,\"message\":\"Saved crissy-data.json\"}";
+    send_response(conn, 200, "OK", "application/json; charset=utf-8", ok, (long)strlen(ok));
+}
+
+/* Handle POST /api/build and POST /api/deploy - queue a job, reply with its id */
+static void handle_api_job_start(conn_t *conn, int kind) {
+    const char *err = NULL;
+    if (!job_command(kind, &err)) {
+        send_response(conn, 500, "Internal Server Error",
+                      "application/json; charset=utf-8", err, (long)strlen(err));
+        return;
     }
-    fread(buf, 1, fsize, f);
-    fclose(f);
 
-    const char *mime = get_mime(filepath);
-    send_response(client, 200, "OK", mime, buf, fsize);
-    free(buf);
+    int coalesced = 0;
+    int id = job_submit(kind, &coalesced);
+    char json[512];
+    mutex_lock(&job_lock);
+    job_t *j = job_find_locked(id);
+    snprintf(json, sizeof(json),
+        "{\"ok\":true,\"job\":%d,\"kind\":\"%s\",\"status\":\"%s\",\"coalesced\":%s,"
+        "\"events\":\"/api/jobs/%d/events\"}",
+        id, job_kind_names[kind], j ? job_state_names[j->state] : "queued",
+        coalesced ? "true" : "false", id);
+    mutex_unlock(&job_lock);
+    send_response(conn, 202, "Accepted", "application/json; charset=utf-8",
+                  json, (long)strlen(json));
 }
 
-/* ---- Request Handler ---- */
-
-/* Read the full request body of a given Content-Length */
-static char *read_request_body(sock_t client, const char *headers, int already_read, long *out_len) {
-    /* Find Content-Length */
-    const char *cl = strstr(headers, "Content-Length:");
-    if (!cl) cl = strstr(headers, "content-length:");
-    if (!cl) { *out_len = 0; return NULL; }
-    long content_length = atol(cl + 15);
-    if (content_length <= 0 || content_length > 10 * 1024 * 1024) { /* max 10MB */
-        *out_len = 0;
-        return NULL;
+/*
+ * Stream a job's output as Server-Sent Events. "status" is sent first,
+ * then "output" events whose id is the log offset (so an EventSource
+ * that reconnects with Last-Event-ID resumes where it left off), and a
+ * final "done" event carrying the job JSON.
+ */
+static void handle_api_job_events(conn_t *conn, int id) {
+    char value[32];
+    long offset = 0;
+    if (find_header(conn->buf, conn->head_len, "Last-Event-ID", value, sizeof(value))) {
+        offset = atol(value);
+        if (offset < 0) offset = 0;
     }
 
-    /* Find end of headers */
-    const char *body_start = strstr(headers, "\r\n\r\n");
-    if (!body_start) { *out_len = 0; return NULL; }
-    body_start += 4;
-    long header_len = (long)(body_start - headers);
-    long body_already = already_read - header_len;
-    if (body_already < 0) body_already = 0;
+    char json[512];
+    mutex_lock(&job_lock);
+    job_t *j = job_find_locked(id);
+    if (j) job_json_locked(j, json, sizeof(json));
+    mutex_unlock(&job_lock);
+    if (!j) {
+        send_error(conn, 404, "Not Found");
+        return;
+    }
 
-    char *body = (char *)malloc(content_length + 1);
-    if (!body) { *out_len = 0; return NULL; }
+    /* No length and no chunking: the stream ends when the connection does */
+    conn->keep_alive = 0;
+    send_head(conn, 200, "OK", "text/event-stream; charset=utf-8", -1,
+              "Cache-Control: no-cache\r\nX-Accel-Buffering: no\r\n");
+    if (conn->head_only) return;
+    if (sse_send_event(conn, "status", -1, json, (long)strlen(json)) != 0) return;
 
-    /* Copy what we already have */
-    if (body_already > 0) {
-        if (body_already > content_length) body_already = content_length;
-        memcpy(body, body_start, body_already);
-    }
+    char *chunk = (char *)malloc(SSE_CHUNK);
+    if (!chunk) return;
+    int idle_seconds = 0;
+    for (;;) {
+        mutex_lock(&job_lock);
+        j = job_find_locked(id);
+        if (j && running && offset >= j->log_len && j->state <= JOB_RUNNING) {
+            cond_timedwait(&job_changed, &job_lock, 1000);
+            j = job_find_locked(id);
+        }
+        if (!j) {
+            mutex_unlock(&job_lock);
+            break;
+        }
+        long n = 0;
+        if (offset < j->log_len) {
+            n = j->log_len - offset;
+            if (n > SSE_CHUNK) {
+                n = SSE_CHUNK;
+                /* Do not split a UTF-8 sequence across two events */
+                while (n > 1 && ((unsigned char)j->log[offset + n] & 0xC0) == 0x80) n--;
+            }
+            memcpy(chunk, j->log + offset, n);
+        }
+        int finished = j->state >= JOB_SUCCEEDED;
+        if (finished) job_json_locked(j, json, sizeof(json));
+        mutex_unlock(&job_lock);
 
-    /* Read the rest */
-    long remaining = content_length - body_already;
-    long offset = body_already;
-    while (remaining > 0) {
-        int chunk = recv(client, body + offset, (int)remaining, 0);
-        if (chunk <= 0) break;
-        offset += chunk;
-        remaining -= chunk;
+        if (n > 0) {
+            offset += n;
+            if (sse_send_event(conn, "output", offset, chunk, n) != 0) break;
+            idle_seconds = 0;
+            continue;
+        }
+        if (finished) {
+            sse_send_event(conn, "done", offset, json, (long)strlen(json));
+            break;
+        }
+        if (!running) break;
+        if (++idle_seconds >= SSE_HEARTBEAT_SECONDS) {
+            if (send_all(conn, ": ping\n\n", 8) != 0) break;
+            idle_seconds = 0;
+        }
     }
-    body[offset] = '\0';
-    *out_len = offset;
-    return body;
+    free(chunk);
 }
 
-/* Handle POST /api/save - write JSON to crissy-data.json */
-static void handle_api_save(sock_t client, const char *headers, int headers_len) {
-    long body_len = 0;
-    char *body = read_request_body(client, headers, headers_len, &body_len);
-    if (!body || body_len == 0) {
-        send_error(client, 400, "Bad Request");
-        if (body) free(body);
+/* Handle GET /api/jobs, /api/jobs/<id>, /api/jobs/<id>/log and /api/jobs/<id>/events */
+static void handle_api_jobs(conn_t *conn, const char *path) {
+    const char *rest = path + strlen("/api/jobs");
+    if (*rest == '\0' || strcmp(rest, "/") == 0) {
+        json_buf out = JSON_BUF_INIT;
+        char json[512];
+        json_buf_append(&out, "{\"jobs\":[", 9);
+        mutex_lock(&job_lock);
+        int first = 1;
+        for (int id = job_next_id - 1; id > 0 && id >= job_next_id - JOB_HISTORY; id--) {
+            job_t *j = job_find_locked(id);
+            if (!j) continue;
+            job_json_locked(j, json, sizeof(json));
+            if (!first) json_buf_append(&out, ",", 1);
+            json_buf_append(&out, json, strlen(json));
+            first = 0;
+        }
+        mutex_unlock(&job_lock);
+        json_buf_append(&out, "]}", 2);
+        if (out.data) {
+            send_response(conn, 200, "OK", "application/json; charset=utf-8",
+                          out.data, (long)out.len);
+        } else {
+            send_error(conn, 500, "Internal Server Error");
+        }
+        free(out.data);
         return;
     }
 
-    FILE *f = fopen("crissy-data.json", "wb");
-    if (!f) {
-        const char *msg = "{\"error\":\"Failed to write crissy-data.json\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
-        free(body);
+    int id = 0;
+    int used = 0;
+    if (sscanf(rest, "/%d%n", &id, &used) != 1) {
+        send_error(conn, 404, "Not Found");
+        return;
+    }
+    const char *tail = rest + used;
+    if (strcmp(tail, "/events") == 0) {
+        handle_api_job_events(conn, id);
+        return;
+    }
+    if (*tail != '\0' && strcmp(tail, "/log") != 0) {
+        send_error(conn, 404, "Not Found");
         return;
     }
-    fwrite(body, 1, body_len, f);
-    fclose(f);
-    free(body);
-
-    printf("Saved crissy-data.json (%ld bytes)\n", body_len);
-
-    const char *ok = "{\"ok\":true,\"message\":\"Saved crissy-data.json\"}";
-    send_response(client, 200, "OK", "application/json; charset=utf-8", ok, (long)strlen(ok));
-}
 
-/* Handle POST /api/build - run the Go build tool */
-static void handle_api_build(sock_t client) {
-    int rc;
-    #ifdef _WIN32
-    /* Try portfolio-build.exe first, then go run */
-    struct stat st;
-    if (stat("portfolio-build.exe", &st) == 0) {
-        rc = system("portfolio-build.exe .");
-    } else if (stat("build.go", &st) == 0) {
-        rc = system("go run build.go .");
-    } else {
-        const char *msg = "{\"error\":\"No build tool found (portfolio-build.exe or build.go)\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
+    mutex_lock(&job_lock);
+    job_t *j = job_find_locked(id);
+    if (!j) {
+        mutex_unlock(&job_lock);
+        send_error(conn, 404, "Not Found");
         return;
     }
-    #else
-    struct stat st;
-    if (stat("portfolio-build", &st) == 0) {
-        rc = system("./portfolio-build .");
-    } else if (stat("build.go", &st) == 0) {
-        rc = system("go run build.go .");
-    } else {
-        const char *msg = "{\"error\":\"No build tool found (portfolio-build or build.go)\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
+    if (*tail == '\0') {
+        char json[512];
+        job_json_locked(j, json, sizeof(json));
+        mutex_unlock(&job_lock);
+        send_response(conn, 200, "OK", "application/json; charset=utf-8",
+                      json, (long)strlen(json));
         return;
     }
-    #endif
 
-    if (rc == 0) {
-        printf("Build completed successfully.\n");
-        const char *ok = "{\"ok\":true,\"message\":\"Build completed successfully\"}";
-        send_response(client, 200, "OK", "application/json; charset=utf-8", ok, (long)strlen(ok));
-    } else {
-        printf("Build failed with exit code %d.\n", rc);
-        const char *msg = "{\"error\":\"Build failed. Check terminal for details.\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
+    /*
+     * The log is streamed as it stood when the request arrived. It only
+     * ever grows, so it is copied out a piece at a time and the job lock
+     * is never held while sending.
+     */
+    long log_len = j->log_len;
+    mutex_unlock(&job_lock);
+    body_stream out;
+    stream_begin(&out, conn, "text/plain; charset=utf-8");
+    char *piece = (char *)malloc(STREAM_CHUNK_BYTES);
+    if (!piece) out.failed = 1;
+    for (long off = 0; off < log_len && !out.failed && !conn->head_only; ) {
+        long n = log_len - off < STREAM_CHUNK_BYTES ? log_len - off : STREAM_CHUNK_BYTES;
+        mutex_lock(&job_lock);
+        j = job_find_locked(id);
+        if (j) memcpy(piece, j->log + off, (size_t)n);
+        mutex_unlock(&job_lock);
+        if (!j) {
+            out.failed = 1;     /* dropped from the history mid-stream */
+            break;
+        }
+        stream_write(&out, piece, (size_t)n);
+        off += n;
     }
+    free(piece);
+    stream_end(&out);
 }
 
 /* Handle GET /api/deploy-config - read deploy.conf */
-static void handle_api_deploy_config_get(sock_t client) {
+static void handle_api_deploy_config_get(conn_t *conn) {
     FILE *f = fopen("deploy.conf", "r");
     if (!f) {
         const char *empty = "{\"repo\":\"\",\"domain\":\"\"}";
-        send_response(client, 200, "OK", "application/json; charset=utf-8",
+        send_response(conn, 200, "OK", "application/json; charset=utf-8",
                       empty, (long)strlen(empty));
         return;
     }
@@ -334,61 +5014,75 @@ static void handle_api_deploy_config_get(sock_t client) {
     }
     fclose(f);
 
-    char json[2048];
-    snprintf(json, sizeof(json), "{\"repo\":\"%s\",\"domain\":\"%s\"}", repo, domain);
-    send_response(client, 200, "OK", "application/json; charset=utf-8",
-                  json, (long)strlen(json));
+    json_buf json = JSON_BUF_INIT;
+    json_buf_append(&json, "{\"repo\":", 8);
+    json_buf_cstring(&json, repo);
+    json_buf_append(&json, ",\"domain\":", 10);
+    json_buf_cstring(&json, domain);
+    json_buf_append(&json, "}", 1);
+    if (json.failed) {
+        json_buf_free(&json);
+        send_error(conn, 500, "Internal Server Error");
+        return;
+    }
+    send_response(conn, 200, "OK", "application/json; charset=utf-8",
+                  json.data, (long)json.len);
+    json_buf_free(&json);
+}
+
+/*
+ * Copy the string member name of a JSON object into out. A missing member
+ * leaves out empty; a value that is not a string, does not fit, or holds
+ * control characters (which would split a deploy.conf line) is an error.
+ */
+static int config_string_member(const char *body, long body_len, const char *name,
+                                char *out, size_t size) {
+    json_lexer lx;
+    json_token val;
+    out[0] = '\0';
+    int found = json_find_member(&lx, body, (size_t)body_len, name, &val);
+    if (found <= 0) return found;
+    if (val.type != JSON_TOK_STRING) return -1;
+    size_t len;
+    char *s = json_strdup(&val, &len);
+    if (!s) return -1;
+    int ok = len < size;
+    for (size_t i = 0; ok && i < len; i++) {
+        if ((unsigned char)s[i] < 0x20 || s[i] == 0x7F) ok = 0;
+    }
+    if (ok) memcpy(out, s, len + 1);
+    free(s);
+    return ok ? 0 : -1;
 }
 
 /* Handle POST /api/deploy-config - write deploy.conf */
-static void handle_api_deploy_config_post(sock_t client, const char *headers, int headers_len) {
+static void handle_api_deploy_config_post(conn_t *conn) {
     long body_len = 0;
-    char *body = read_request_body(client, headers, headers_len, &body_len);
+    char *body = read_request_body(conn, &body_len);
     if (!body || body_len == 0) {
-        send_error(client, 400, "Bad Request");
+        send_error(conn, 400, "Bad Request");
         if (body) free(body);
         return;
     }
 
-    /* Simple JSON parse for {"repo":"...","domain":"..."} */
-    char repo[1024] = {0};
-    char domain[256] = {0};
-    char *rk = strstr(body, "\"repo\"");
-    if (rk) {
-        char *colon = strchr(rk + 6, ':');
-        if (colon) {
-            char *q1 = strchr(colon, '"');
-            if (q1) {
-                q1++;
-                char *q2 = strchr(q1, '"');
-                if (q2 && (q2 - q1) < (int)sizeof(repo)) {
-                    memcpy(repo, q1, q2 - q1);
-                    repo[q2 - q1] = '\0';
-                }
-            }
-        }
-    }
-    char *dk = strstr(body, "\"domain\"");
-    if (dk) {
-        char *colon = strchr(dk + 8, ':');
-        if (colon) {
-            char *q1 = strchr(colon, '"');
-            if (q1) {
-                q1++;
-                char *q2 = strchr(q1, '"');
-                if (q2 && (q2 - q1) < (int)sizeof(domain)) {
-                    memcpy(domain, q1, q2 - q1);
-                    domain[q2 - q1] = '\0';
-                }
-            }
-        }
+    char repo[1024];
+    char domain[256];
+    if (config_string_member(body, body_len, "repo", repo, sizeof(repo)) != 0 ||
+        config_string_member(body, body_len, "domain", domain, sizeof(domain)) != 0) {
+        free(body);
+        const char *msg = "{\"error\":\"repo and domain must be single-line strings\"}";
+        send_response(conn, 400, "Bad Request",
+                      "application/json; charset=utf-8", msg, (long)strlen(msg));
+        return;
     }
     free(body);
 
+    mutex_lock(&api_lock);
     FILE *f = fopen("deploy.conf", "w");
     if (!f) {
+        mutex_unlock(&api_lock);
         const char *msg = "{\"error\":\"Failed to write deploy.conf\"}";
-        send_response(client, 500, "Internal Server Error",
+        send_response(conn, 500, "Internal Server Error",
                       "application/json; charset=utf-8", msg, (long)strlen(msg));
         return;
     }
@@ -398,49 +5092,29 @@ static void handle_api_deploy_config_post(sock_t client, const char *headers, in
         fprintf(f, "domain=%s\n", domain);
     }
     fclose(f);
+    mutex_unlock(&api_lock);
 
     printf("Saved deploy.conf: repo=%s domain=%s\n", repo, domain);
     const char *ok = "{\"ok\":true,\"message\":\"Deploy config saved\"}";
-    send_response(client, 200, "OK", "application/json; charset=utf-8",
+    send_response(conn, 200, "OK", "application/json; charset=utf-8",
                   ok, (long)strlen(ok));
 }
 
 /* Handle GET /api/deploy-check - inspect repo and list build files */
-static void handle_api_deploy_check(sock_t client) {
-    /* Build JSON with: build files, remote repo files, remote CNAME */
-    char json[32768];
-    int pos = 0;
-    pos += snprintf(json + pos, sizeof(json) - pos, "{\"build\":[");
+static void handle_api_deploy_check(conn_t *conn) {
+    /*
+     * JSON with: build files, remote repo files, remote CNAME. The local
+     * listing is sent while the remote state is still being refreshed.
+     */
+    body_stream out;
+    json_buf *json = &out.buf;
+    stream_begin(&out, conn, "application/json; charset=utf-8");
+    json_buf_append(json, "{\"build\":[", 10);
 
     /* List build/ directory files */
-    struct stat st;
-    int has_build = (stat("build", &st) == 0);
-    if (has_build) {
-        #ifdef _WIN32
-        FILE *p = _popen("dir /B build\\ 2>nul", "r");
-        #else
-        FILE *p = popen("ls -1 build/ 2>/dev/null", "r");
-        #endif
-        if (p) {
-            char fname[512];
-            int first = 1;
-            while (fgets(fname, sizeof(fname), p)) {
-                int len = (int)strlen(fname);
-                while (len > 0 && (fname[len-1] == '\n' || fname[len-1] == '\r'))
-                    fname[--len] = '\0';
-                if (len == 0) continue;
-                if (!first) pos += snprintf(json + pos, sizeof(json) - pos, ",");
-                pos += snprintf(json + pos, sizeof(json) - pos, "\"%s\"", fname);
-                first = 0;
-            }
-            #ifdef _WIN32
-            _pclose(p);
-            #else
-            pclose(p);
-            #endif
-        }
-    }
-    pos += snprintf(json + pos, sizeof(json) - pos, "],");
+    int has_build = list_dir_json("build", json) == 0;
+    json_buf_append(json, "],", 2);
+    stream_flush(&out);
 
     /* Read deploy.conf for repo URL */
     char repo[1024] = {0};
@@ -461,209 +5135,133 @@ static void handle_api_deploy_check(sock_t client) {
         fclose(cf);
     }
 
-    /* Check remote repo */
-    pos += snprintf(json + pos, sizeof(json) - pos, "\"remote\":[");
+    /* Check remote repo (memoized, see Remote Deploy State) */
+    json_buf_append(json, "\"remote\":[", 10);
     char remote_cname[256] = {0};
+    char remote_head[64] = {0};
     int repo_exists = 0;
 
-    if (repo[0]) {
-        /* Use git ls-remote to check if repo exists, then ls-tree for file list */
-        char cmd[2048];
-        snprintf(cmd, sizeof(cmd),
-            "git ls-tree --name-only HEAD -r 2>/dev/null"
-            " || true");
-        /* Actually clone shallow to tmp to list files */
-        char tmpdir[1024];
-        #ifdef _WIN32
-        const char *tmp = getenv("TEMP");
-        if (!tmp) tmp = "C:\\Temp";
-        snprintf(tmpdir, sizeof(tmpdir), "%s\\deploy-check", tmp);
-        snprintf(cmd, sizeof(cmd), "rmdir /S /Q \"%s\" 2>nul", tmpdir);
-        #else
-        const char *tmp = getenv("TMPDIR");
-        if (!tmp) tmp = "/tmp";
-        snprintf(tmpdir, sizeof(tmpdir), "%s/deploy-check", tmp);
-        snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", tmpdir);
-        #endif
-        system(cmd);
-
-        snprintf(cmd, sizeof(cmd),
-            "git clone --depth 1 \"%s\" \"%s\" 2>/dev/null", repo, tmpdir);
-        int clone_rc = system(cmd);
-
-        if (clone_rc == 0) {
-            repo_exists = 1;
-            /* List files */
-            #ifdef _WIN32
-            snprintf(cmd, sizeof(cmd), "dir /B \"%s\\\" 2>nul", tmpdir);
-            FILE *p = _popen(cmd, "r");
-            #else
-            snprintf(cmd, sizeof(cmd),
-                "ls -1A \"%s\" 2>/dev/null | grep -v '^.git$'", tmpdir);
-            FILE *p = popen(cmd, "r");
-            #endif
-            if (p) {
-                char fname[512];
-                int first = 1;
-                while (fgets(fname, sizeof(fname), p)) {
-                    int len = (int)strlen(fname);
-                    while (len > 0 && (fname[len-1] == '\n' || fname[len-1] == '\r'))
-                        fname[--len] = '\0';
-                    if (len == 0 || strcmp(fname, ".git") == 0) continue;
-                    if (!first) pos += snprintf(json + pos, sizeof(json) - pos, ",");
-                    pos += snprintf(json + pos, sizeof(json) - pos, "\"%s\"", fname);
-                    first = 0;
-                    /* Check for CNAME */
-                    if (strcmp(fname, "CNAME") == 0) {
-                        char cpath[1024];
-                        snprintf(cpath, sizeof(cpath), "%s%cCNAME", tmpdir,
-                            #ifdef _WIN32
-                            '\\'
-                            #else
-                            '/'
-                            #endif
-                        );
-                        FILE *cnf = fopen(cpath, "r");
-                        if (cnf) {
-                            if (fgets(remote_cname, sizeof(remote_cname), cnf)) {
-                                int cl = (int)strlen(remote_cname);
-                                while (cl > 0 && (remote_cname[cl-1] == '\n' ||
-                                       remote_cname[cl-1] == '\r'))
-                                    remote_cname[--cl] = '\0';
-                            }
-                            fclose(cnf);
-                        }
-                    }
-                }
-                #ifdef _WIN32
-                _pclose(p);
-                #else
-                pclose(p);
-                #endif
-            }
-            /* Cleanup */
-            #ifdef _WIN32
-            snprintf(cmd, sizeof(cmd), "rmdir /S /Q \"%s\" 2>nul", tmpdir);
-            #else
-            snprintf(cmd, sizeof(cmd), "rm -rf \"%s\"", tmpdir);
-            #endif
-            system(cmd);
+    if (repo[0] && repo_url_is_safe(repo)) {
+        mutex_lock(&check_lock);
+        remote_state_refresh(repo);
+        repo_exists = remote_memo.exists;
+        if (remote_memo.files.len > 0) {
+            json_buf_append(json, remote_memo.files.data, remote_memo.files.len);
         }
+        snprintf(remote_cname, sizeof(remote_cname), "%s", remote_memo.cname);
+        snprintf(remote_head, sizeof(remote_head), "%s", remote_memo.head);
+        mutex_unlock(&check_lock);
     }
 
-    pos += snprintf(json + pos, sizeof(json) - pos, "],");
-    pos += snprintf(json + pos, sizeof(json) - pos,
-        "\"repoExists\":%s,", repo_exists ? "true" : "false");
-    pos += snprintf(json + pos, sizeof(json) - pos,
-        "\"remoteCname\":\"%s\",", remote_cname);
-    pos += snprintf(json + pos, sizeof(json) - pos,
-        "\"hasBuild\":%s}", has_build ? "true" : "false");
-
-    send_response(client, 200, "OK", "application/json; charset=utf-8",
-                  json, (long)strlen(json));
-}
-
-/* Handle POST /api/deploy - run the deploy tool */
-static void handle_api_deploy(sock_t client) {
-    int rc;
-    #ifdef _WIN32
-    struct stat st;
-    if (stat("deploy\\deploy.exe", &st) == 0) {
-        rc = system("deploy\\deploy.exe");
-    } else if (stat("deploy\\deploy.c", &st) == 0) {
-        const char *msg = "{\"error\":\"deploy.exe not compiled. Run: cd deploy && cl deploy.c /Fe:deploy.exe\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
-        return;
-    } else {
-        const char *msg = "{\"error\":\"No deploy tool found in deploy/ directory\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
-        return;
-    }
-    #else
-    struct stat st;
-    if (stat("deploy/deploy", &st) == 0) {
-        rc = system("./deploy/deploy");
-    } else if (stat("deploy/deploy.c", &st) == 0) {
-        const char *msg = "{\"error\":\"deploy binary not compiled. Run: cd deploy && cc -O2 -o deploy deploy.c\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
-        return;
-    } else {
-        const char *msg = "{\"error\":\"No deploy tool found in deploy/ directory\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
-        return;
-    }
-    #endif
+    json_buf_append(json, "],\"repoExists\":", 15);
+    json_buf_append(json, repo_exists ? "true" : "false", repo_exists ? 4 : 5);
+    json_buf_append(json, ",\"remoteCname\":", 15);
+    json_buf_cstring(json, remote_cname);
+    json_buf_append(json, ",\"remoteHead\":", 14);
+    json_buf_cstring(json, remote_head);
+    json_buf_append(json, ",\"hasBuild\":", 12);
+    json_buf_append(json, has_build ? "true}" : "false}", has_build ? 5 : 6);
 
-    if (rc == 0) {
-        printf("Deploy completed successfully.\n");
-        const char *ok = "{\"ok\":true,\"message\":\"Deploy completed successfully\"}";
-        send_response(client, 200, "OK", "application/json; charset=utf-8",
-                      ok, (long)strlen(ok));
-    } else {
-        printf("Deploy failed with exit code %d.\n", rc);
-        const char *msg = "{\"error\":\"Deploy failed. Check terminal for details.\"}";
-        send_response(client, 500, "Internal Server Error",
-                      "application/json; charset=utf-8", msg, (long)strlen(msg));
-    }
+    stream_end(&out);
 }
 
-static void handle_request(sock_t client) {
-    /* Use a larger buffer for POST bodies */
-    char buf[65536];
-    int n = recv(client, buf, sizeof(buf) - 1, 0);
-    if (n <= 0) return;
-    buf[n] = '\0';
-
+/* Dispatch the request whose headers occupy the first conn->head_len bytes of conn->buf */
+static void handle_request(conn_t *conn) {
     /* Parse request line */
     char method[16] = {0};
     char raw_path[1024] = {0};
-    sscanf(buf, "%15s %1023s", method, raw_path);
+    sscanf(conn->buf, "%15s %1023s", method, raw_path);
 
     /* Strip query string */
     char *qmark = strchr(raw_path, '?');
+    const char *query = qmark ? qmark + 1 : "";
     if (qmark) *qmark = '\0';
 
+    conn->route = ROUTE_OTHER;
+
     /* Handle POST endpoints */
     if (strcmp(method, "POST") == 0) {
         if (strcmp(raw_path, "/api/save") == 0) {
-            handle_api_save(client, buf, n);
+            conn->route = ROUTE_SAVE;
+            handle_api_save(conn);
             return;
         }
         if (strcmp(raw_path, "/api/build") == 0) {
-            handle_api_build(client);
+            conn->route = ROUTE_BUILD;
+            handle_api_job_start(conn, JOB_BUILD);
             return;
         }
         if (strcmp(raw_path, "/api/deploy") == 0) {
-            handle_api_deploy(client);
+            conn->route = ROUTE_DEPLOY;
+            handle_api_job_start(conn, JOB_DEPLOY);
             return;
         }
         if (strcmp(raw_path, "/api/deploy-config") == 0) {
-            handle_api_deploy_config_post(client, buf, n);
+            conn->route = ROUTE_DEPLOY_CONFIG;
+            handle_api_deploy_config_post(conn);
             return;
         }
-        send_error(client, 404, "Not Found");
+        send_error(conn, 404, "Not Found");
+        return;
+    }
+    if (strcmp(raw_path, "/api/data") == 0) {
+        conn->route = ROUTE_DATA;
+        if (strcmp(method, "PATCH") == 0) {
+            handle_api_data_patch(conn);
+        } else if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
+            if (method[0] == 'H') conn->head_only = 1;
+            data_send(conn, 0);
+        } else {
+            send_error(conn, 405, "Method Not Allowed");
+        }
         return;
     }
 
     /* Handle GET endpoints */
     if (strcmp(method, "GET") == 0 && strcmp(raw_path, "/api/deploy-config") == 0) {
-        handle_api_deploy_config_get(client);
+        conn->route = ROUTE_DEPLOY_CONFIG;
+        handle_api_deploy_config_get(conn);
         return;
     }
     if (strcmp(method, "GET") == 0 && strcmp(raw_path, "/api/deploy-check") == 0) {
-        handle_api_deploy_check(client);
+        conn->route = ROUTE_DEPLOY_CHECK;
+        handle_api_deploy_check(conn);
+        return;
+    }
+    if ((strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) &&
+        strcmp(raw_path, "/api/live-reload") == 0) {
+        conn->route = ROUTE_LIVE_RELOAD;
+        handle_api_live_reload(conn);
+        return;
+    }
+    if (strcmp(method, "GET") == 0 && strcmp(raw_path, "/api/cache-stats") == 0) {
+        conn->route = ROUTE_CACHE_STATS;
+        handle_api_cache_stats(conn);
+        return;
+    }
+    if ((strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) &&
+        strcmp(raw_path, "/api/metrics") == 0 && cfg_metrics) {
+        if (method[0] == 'H') conn->head_only = 1;
+        conn->route = ROUTE_METRICS;
+        handle_api_metrics(conn, query);
+        return;
+    }
+    if ((strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) &&
+        strncmp(raw_path, "/api/jobs", 9) == 0 && (raw_path[9] == '\0' || raw_path[9] == '/')) {
+        if (method[0] == 'H') conn->head_only = 1;
+        conn->route = ROUTE_JOBS;
+        handle_api_jobs(conn, raw_path);
         return;
     }
 
-    /* Only handle GET beyond this point */
-    if (strcmp(method, "GET") != 0) {
-        send_error(client, 405, "Method Not Allowed");
+    /* Only handle GET and HEAD beyond this point */
+    if (strcmp(method, "HEAD") == 0) {
+        conn->head_only = 1;
+    } else if (strcmp(method, "GET") != 0) {
+        send_error(conn, 405, "Method Not Allowed");
         return;
     }
+    conn->route = ROUTE_STATIC;
 
     /* URL decode (basic: handle %XX) */
     char path[1024];
@@ -683,7 +5281,7 @@ static void handle_request(sock_t client) {
 
     /* Safety check */
     if (!path_is_safe(path)) {
-        send_error(client, 403, "Forbidden");
+        send_error(conn, 403, "Forbidden");
         return;
     }
 
@@ -706,35 +5304,400 @@ static void handle_request(sock_t client) {
     }
     #endif
 
+    /* Edits not yet compacted into the file are served from memory */
+    if (strcmp(filepath, DATA_FILE) == 0 && data_send(conn, 1)) return;
+
     /* Check if path is a directory, try index.html */
     struct stat st;
     if (stat(filepath, &st) == 0 && S_ISDIR(st.st_mode)) {
         char idx[2048];
         snprintf(idx, sizeof(idx), "%s%cindex.html", filepath, PATH_SEP);
         if (stat(idx, &st) == 0 && S_ISREG(st.st_mode)) {
-            send_file(client, idx);
+            send_static(conn, idx, &st);
         } else {
-            send_error(client, 403, "Forbidden");
+            send_error(conn, 403, "Forbidden");
         }
         return;
     }
 
     if (stat(filepath, &st) == 0 && S_ISREG(st.st_mode)) {
-        send_file(client, filepath);
+        send_static(conn, filepath, &st);
     } else {
-        send_error(client, 404, "Not Found");
+        send_error(conn, 404, "Not Found");
+    }
+}
+
+/* ---- Request Loop ---- */
+
+/*
+ * Persistent connections: after each response the worker waits up to
+ * --keepalive-timeout seconds for the next request on the same socket,
+ * serving at most --keepalive-max requests before closing. Requests that
+ * arrive together in one recv() are handled back to back (pipelining).
+ * An idle connection gives up its worker early when others are queued.
+ */
+
+#define DEFAULT_KEEPALIVE_TIMEOUT 5
+#define DEFAULT_KEEPALIVE_MAX     100
+
+static int cfg_keepalive_timeout = DEFAULT_KEEPALIVE_TIMEOUT;
+static int cfg_keepalive_max = DEFAULT_KEEPALIVE_MAX;
+
+static int conn_queue_waiting(void);
+
+/* Wait until the socket is readable. Returns 1 readable, 0 timeout, -1 error. */
+static int wait_readable(sock_t sock, int timeout_ms) {
+    #ifdef _WIN32
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(sock, &rfds);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    int rc = select(0, &rfds, NULL, NULL, &tv);
+    #else
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int rc = poll(&pfd, 1, timeout_ms);
+    if (rc < 0 && errno == EINTR) return 0;
+    #endif
+    if (rc == SOCKERR) return -1;
+    return rc > 0 ? 1 : 0;
+}
+
+/* Return the offset just past "\r\n\r\n" in buf, or 0 if not yet complete */
+static int find_head_end(const char *buf, int len) {
+    for (int i = 3; i < len; i++) {
+        if (buf[i] == '\n' && buf[i-1] == '\r' && buf[i-2] == '\n' && buf[i-3] == '\r') {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Fill conn->buf until a complete header block is present.
+ * While waiting between requests the wait is sliced so an idle connection
+ * can be dropped as soon as another client is queued for a worker.
+ * Returns the header length, or 0 if the connection should be closed.
+ */
+static int read_request_head(conn_t *conn, int idle_ms) {
+    int waited = 0;
+    conn->recv_start = conn->len > 0 && METRICS_TIMING ? now_us() : 0;
+    for (;;) {
+        int head = find_head_end(conn->buf, conn->len);
+        if (head > 0) return head;
+        if (conn->len >= CONN_BUF_SIZE - 1) {
+            conn->keep_alive = 0;
+            send_error(conn, 431, "Request Header Fields Too Large");
+            return 0;
+        }
+        int slice = 100;
+        int ready = wait_readable(conn->sock, slice);
+        if (ready < 0 || !running) return 0;
+        if (ready == 0) {
+            waited += slice;
+            /* Mid-request stalls and idle waits share the same deadline */
+            if (waited >= idle_ms) return 0;
+            if (conn->len == 0 && conn->requests > 0 && conn_queue_waiting()) return 0;
+            continue;
+        }
+        int n = recv(conn->sock, conn->buf + conn->len, CONN_BUF_SIZE - 1 - conn->len, 0);
+        if (n <= 0) return 0;
+        if (conn->len == 0 && METRICS_TIMING) conn->recv_start = now_us();
+        conn->len += n;
+        conn->bytes_in += n;
+        conn->buf[conn->len] = '\0';
+    }
+}
+
+/* Skip any request body the handler did not read */
+static void discard_request_body(conn_t *conn) {
+    if (conn->body_chunked) {
+        /* An unread chunked body has no known end in the buffer */
+        if (conn->chunk_state != CHUNK_DONE) conn->keep_alive = 0;
+        return;
+    }
+    long avail = conn->len - conn->consumed;
+    long take = conn->body_remaining < avail ? conn->body_remaining : avail;
+    conn->consumed += (int)take;
+    conn->body_remaining -= take;
+    if (conn->body_remaining > 0) {
+        /* Not worth draining a large unread upload; just close */
+        conn->keep_alive = 0;
+    }
+}
+
+static void serve_connection(conn_t *conn, sock_t client) {
+    conn->sock = client;
+    conn->len = 0;
+    conn->requests = 0;
+    conn->bytes_in = 0;
+    conn->buf[0] = '\0';
+    counter_add(&connections_accepted, 1);
+
+    int keepalive_allowed = cfg_keepalive_timeout > 0 && cfg_keepalive_max > 0 && cfg_workers > 0;
+    int idle_ms = (cfg_keepalive_timeout > 0 ? cfg_keepalive_timeout : DEFAULT_KEEPALIVE_TIMEOUT) * 1000;
+
+    while (running) {
+        conn->keep_alive = 0;
+        int head = read_request_head(conn, idle_ms);
+        if (head == 0) break;
+        long long head_done = conn->recv_start ? now_us() : 0;
+
+        conn->head_len = head;
+        conn->consumed = head;
+        conn->body_remaining = 0;
+        conn->body_chunked = 0;
+        conn->chunk_state = 0;
+        conn->expect_continue = 0;
+        conn->head_only = 0;
+        conn->requests++;
+        conn->route = ROUTE_OTHER;
+        conn->status = 0;
+        conn->bytes_out = 0;
+        conn->send_us = 0;
+
+        char value[256];
+        if (find_header(conn->buf, head, "Content-Length", value, sizeof(value))) {
+            conn->body_remaining = atol(value);
+            if (conn->body_remaining < 0) conn->body_remaining = 0;
+        }
+        if (find_header(conn->buf, head, "Transfer-Encoding", value, sizeof(value)) &&
+            header_has_token(value, "chunked")) {
+            conn->body_chunked = 1;
+            conn->body_remaining = 0;
+        }
+        if (find_header(conn->buf, head, "Expect", value, sizeof(value)) &&
+            header_has_token(value, "100-continue")) {
+            conn->expect_continue = 1;
+        }
+
+        /* HTTP/1.1 defaults to persistent, HTTP/1.0 must opt in */
+        char version[16] = {0};
+        sscanf(conn->buf, "%*s %*s %15s", version);
+        conn->http11 = strcmp(version, "HTTP/1.1") == 0;
+        int persistent = conn->http11;
+        if (find_header(conn->buf, head, "Connection", value, sizeof(value))) {
+            if (header_has_token(value, "close")) persistent = 0;
+            else if (header_has_token(value, "keep-alive")) persistent = 1;
+        }
+        conn->keep_alive = keepalive_allowed && persistent &&
+                           conn->requests < cfg_keepalive_max;
+
+        long long handler_start = head_done ? now_us() : 0;
+        handle_request(conn);
+        if (head_done) request_finish(conn, head_done, handler_start);
+        conn->bytes_in = 0;
+
+        if (!conn->keep_alive) break;
+        if (conn->consumed < head) conn->consumed = head;
+        discard_request_body(conn);
+        if (!conn->keep_alive) break;
+
+        /* Shift any pipelined bytes down for the next request */
+        if (conn->consumed < conn->len) {
+            memmove(conn->buf, conn->buf + conn->consumed, conn->len - conn->consumed);
+        }
+        conn->len -= conn->consumed;
+        conn->buf[conn->len] = '\0';
+    }
+}
+
+/* ---- Worker Pool ---- */
+
+#define SEND_TIMEOUT_SECONDS 30
+
+/*
+ * Headers and bodies go out in separate send()/sendfile() calls, so turn
+ * off Nagle to avoid a delayed-ACK stall on the last segment. A send
+ * timeout keeps a stalled client from holding a worker forever.
+ */
+static void configure_client_socket(sock_t client) {
+    int one = 1;
+    #ifdef _WIN32
+    DWORD tv = SEND_TIMEOUT_SECONDS * 1000;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof(tv));
+    #else
+    struct timeval tv;
+    tv.tv_sec = SEND_TIMEOUT_SECONDS;
+    tv.tv_usec = 0;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    #endif
+}
+
+/*
+ * The accept loop hands each client socket to a fixed pool of worker
+ * threads through a bounded queue, so a long /api/build or deploy-check
+ * only ties up one worker while the rest keep serving static files.
+ * When the queue is full the accept loop blocks and new connections wait
+ * in the kernel listen backlog (--backlog).
+ */
+
+#define CONN_QUEUE_MAX 256
+
+static sock_t conn_queue[CONN_QUEUE_MAX];
+static int conn_head = 0;
+static int conn_count = 0;
+static mutex_t conn_lock;
+static cond_t conn_ready;
+static cond_t conn_space;
+
+static void conn_queue_push(sock_t client) {
+    mutex_lock(&conn_lock);
+    while (conn_count == CONN_QUEUE_MAX && running) {
+        cond_wait(&conn_space, &conn_lock);
+    }
+    if (!running) {
+        mutex_unlock(&conn_lock);
+        CLOSESOCKET(client);
+        return;
+    }
+    conn_queue[(conn_head + conn_count) % CONN_QUEUE_MAX] = client;
+    conn_count++;
+    cond_signal(&conn_ready);
+    mutex_unlock(&conn_lock);
+}
+
+/* Returns INVALID_SOCK once the server is shutting down and the queue is drained */
+static sock_t conn_queue_pop(void) {
+    mutex_lock(&conn_lock);
+    while (conn_count == 0 && running) {
+        cond_wait(&conn_ready, &conn_lock);
+    }
+    sock_t client = INVALID_SOCK;
+    if (conn_count > 0) {
+        client = conn_queue[conn_head];
+        conn_head = (conn_head + 1) % CONN_QUEUE_MAX;
+        conn_count--;
+        cond_signal(&conn_space);
+    }
+    mutex_unlock(&conn_lock);
+    return client;
+}
+
+static int conn_queue_waiting(void) {
+    mutex_lock(&conn_lock);
+    int waiting = conn_count;
+    mutex_unlock(&conn_lock);
+    return waiting;
+}
+
+static THREAD_FUNC worker_main(void *arg) {
+    (void)arg;
+    conn_t *conn = (conn_t *)malloc(sizeof(conn_t));
+    for (;;) {
+        sock_t client = conn_queue_pop();
+        if (client == INVALID_SOCK) break;
+        if (conn) serve_connection(conn, client);
+        CLOSESOCKET(client);
     }
+    free(conn);
+    THREAD_RETURN;
+}
+
+/* Wake every worker so it can observe running == 0 and exit */
+static void conn_queue_shutdown(void) {
+    mutex_lock(&conn_lock);
+    cond_broadcast(&conn_ready);
+    cond_broadcast(&conn_space);
+    mutex_unlock(&conn_lock);
 }
 
 /* ---- Main ---- */
 
+static void print_usage(void) {
+    printf("Usage: serve [PORT] [OPTIONS]\n\n");
+    printf("Serves the current directory on http://localhost:PORT/ (default 9090).\n\n");
+    printf("Options:\n");
+    printf("  --workers N   Worker threads handling connections (default %d,\n", DEFAULT_WORKERS);
+    printf("                0 = handle each connection inline on the accept loop)\n");
+    printf("  --backlog N   Listen backlog for pending connections (default %d)\n", DEFAULT_BACKLOG);
+    printf("  --cache-mb N  Memory for the static file cache in MB (default %d, 0 = off)\n",
+           DEFAULT_CACHE_MB);
+    printf("  --cache-file-mb N\n");
+    printf("                Largest single file kept in the cache in MB (default %d)\n",
+           DEFAULT_CACHE_FILE_MB);
+    printf("  --no-compress Do not gzip text responses on the fly (.br/.gz sidecars\n");
+    printf("                are still served)\n");
+    printf("  --check-ttl S Seconds a deploy-check result is reused before asking\n");
+    printf("                the remote again (default %d)\n", DEFAULT_CHECK_TTL);
+    printf("  --max-body-mb N\n");
+    printf("                Largest request body accepted, e.g. by /api/save (default %d)\n",
+           DEFAULT_MAX_BODY_MB);
+    printf("  --watch       Rebuild when index.html, styles.css, scripts.js or\n");
+    printf("                crissy-data.json change, and live-reload open pages\n");
+    printf("  --keepalive-timeout S\n");
+    printf("                Seconds an idle persistent connection stays open\n");
+    printf("                (default %d, 0 = close after every response)\n", DEFAULT_KEEPALIVE_TIMEOUT);
+    printf("  --keepalive-max N\n");
+    printf("                Requests served per connection before closing (default %d)\n",
+           DEFAULT_KEEPALIVE_MAX);
+    printf("  --no-metrics  Do not count requests or serve /api/metrics\n");
+    printf("  --access-log FILE\n");
+    printf("                Append one JSON line per request with phase timings\n");
+    printf("                to FILE (- = stdout)\n");
+    printf("  --help        Show this message\n");
+}
+
 int main(int argc, char *argv[]) {
     int port = 9090;
 
-    if (argc > 1) {
-        port = atoi(argv[1]);
-        if (port <= 0 || port > 65535) {
-            fprintf(stderr, "Invalid port: %s\n", argv[1]);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            cfg_workers = atoi(argv[++i]);
+            if (cfg_workers < 0) cfg_workers = 0;
+            if (cfg_workers > MAX_WORKERS) cfg_workers = MAX_WORKERS;
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            cfg_backlog = atoi(argv[++i]);
+            if (cfg_backlog <= 0) cfg_backlog = DEFAULT_BACKLOG;
+            if (cfg_backlog > SOMAXCONN) cfg_backlog = SOMAXCONN;
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            long mb = atol(argv[++i]);
+            cfg_cache_bytes = mb > 0 ? mb * 1024 * 1024 : 0;
+        } else if (strcmp(argv[i], "--cache-file-mb") == 0 && i + 1 < argc) {
+            long mb = atol(argv[++i]);
+            cfg_cache_max_file = (mb > 0 ? mb : 1) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--max-body-mb") == 0 && i + 1 < argc) {
+            long mb = atol(argv[++i]);
+            cfg_max_body = (mb > 0 ? mb : 1) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--check-ttl") == 0 && i + 1 < argc) {
+            cfg_check_ttl = atoi(argv[++i]);
+            if (cfg_check_ttl < 0) cfg_check_ttl = 0;
+        } else if (strcmp(argv[i], "--no-compress") == 0) {
+            cfg_compress = 0;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            cfg_watch = 1;
+        } else if (strcmp(argv[i], "--keepalive-timeout") == 0 && i + 1 < argc) {
+            cfg_keepalive_timeout = atoi(argv[++i]);
+            if (cfg_keepalive_timeout < 0) cfg_keepalive_timeout = 0;
+        } else if (strcmp(argv[i], "--keepalive-max") == 0 && i + 1 < argc) {
+            cfg_keepalive_max = atoi(argv[++i]);
+            if (cfg_keepalive_max < 1) cfg_keepalive_max = 1;
+        } else if (strcmp(argv[i], "--no-metrics") == 0) {
+            cfg_metrics = 0;
+        } else if (strcmp(argv[i], "--access-log") == 0 && i + 1 < argc) {
+            const char *file = argv[++i];
+            access_log = strcmp(file, "-") == 0 ? stdout : fopen(file, "a");
+            if (!access_log) {
+                fprintf(stderr, "Cannot open access log %s\n", file);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage();
+            return 0;
+        } else if (argv[i][0] != '-') {
+            port = atoi(argv[i]);
+            if (port <= 0 || port > 65535) {
+                fprintf(stderr, "Invalid port: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
             return 1;
         }
     }
@@ -861,7 +5824,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (listen(server_sock, 16) == SOCKERR) {
+    if (listen(server_sock, cfg_backlog) == SOCKERR) {
         fprintf(stderr, "Failed to listen.\n");
         CLOSESOCKET(server_sock);
         platform_cleanup();
@@ -875,6 +5838,75 @@ int main(int argc, char *argv[]) {
 
     open_browser(port);
 
+    mutex_init(&api_lock);
+    mutex_init(&check_lock);
+    mutex_init(&access_log_lock);
+    metrics_started = time(NULL);
+    mutex_init(&cache_lock);
+    crc32_init();
+    mutex_init(&conn_lock);
+    cond_init(&conn_ready);
+    cond_init(&conn_space);
+    mutex_init(&job_lock);
+    cond_init(&job_changed);
+    mutex_init(&data_lock);
+    cond_init(&data_changed);
+    data_recover();
+
+    /* Start workers with SIGINT blocked so Ctrl+C lands on the accept loop */
+    thread_t workers[MAX_WORKERS];
+    int nworkers = 0;
+    thread_t job_thread, watch_thread, data_thread;
+    int job_thread_started = 0, watch_thread_started = 0, data_thread_started = 0;
+    conn_t *inline_conn = NULL;
+    {
+        #ifndef _WIN32
+        sigset_t block, prev;
+        sigemptyset(&block);
+        sigaddset(&block, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &block, &prev);
+        #endif
+        for (int i = 0; i < cfg_workers; i++) {
+            if (thread_start(&workers[nworkers], worker_main, NULL) != 0) {
+                fprintf(stderr, "Failed to start worker thread %d.\n", i);
+                break;
+            }
+            nworkers++;
+        }
+        if (thread_start(&job_thread, job_main, NULL) == 0) {
+            job_thread_started = 1;
+        } else {
+            fprintf(stderr, "Failed to start the build/deploy job thread.\n");
+        }
+        if (thread_start(&data_thread, data_main, NULL) == 0) {
+            data_thread_started = 1;
+        } else {
+            fprintf(stderr, "Failed to start the data compaction thread.\n");
+        }
+        if (cfg_watch) {
+            if (thread_start(&watch_thread, watch_main, NULL) == 0) {
+                watch_thread_started = 1;
+            } else {
+                fprintf(stderr, "Failed to start the file watcher thread.\n");
+            }
+        }
+        #ifndef _WIN32
+        pthread_sigmask(SIG_SETMASK, &prev, NULL);
+        #endif
+    }
+    if (nworkers > 0) {
+        printf("Serving with %d worker threads (backlog %d).\n\n", nworkers, cfg_backlog);
+    } else {
+        cfg_workers = 0;  /* no pool: serve_connection closes after each response */
+        inline_conn = (conn_t *)malloc(sizeof(conn_t));
+        if (!inline_conn) {
+            fprintf(stderr, "Out of memory.\n");
+            CLOSESOCKET(server_sock);
+            platform_cleanup();
+            return 1;
+        }
+    }
+
     while (running) {
         struct sockaddr_in client_addr;
         #ifdef _WIN32
@@ -888,11 +5920,35 @@ int main(int argc, char *argv[]) {
             if (!running) break;
             continue;
         }
+        configure_client_socket(client);
 
-        handle_request(client);
-        CLOSESOCKET(client);
+        if (nworkers > 0) {
+            conn_queue_push(client);
+        } else {
+            serve_connection(inline_conn, client);
+            CLOSESOCKET(client);
+        }
+    }
+
+    running = 0;
+    conn_queue_shutdown();
+    job_shutdown();
+    data_shutdown();
+    for (int i = 0; i < nworkers; i++) {
+        thread_join(workers[i]);
+    }
+    if (job_thread_started) thread_join(job_thread);
+    if (watch_thread_started) thread_join(watch_thread);
+    if (data_thread_started) thread_join(data_thread);
+    data_flush();
+    free(inline_conn);
+
+    if (cache_hits + cache_misses > 0) {
+        printf("\nFile cache: %ld hits, %ld misses, %ld evictions, %ld entries (%ld bytes).\n",
+               cache_hits, cache_misses, cache_evictions, cache_entries, cache_used);
     }
 
+    if (access_log && access_log != stdout) fclose(access_log);
     printf("\nServer stopped.\n");
     if (server_sock != INVALID_SOCK) {
         CLOSESOCKET(server_sock);